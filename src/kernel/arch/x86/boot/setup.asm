@@ -33,11 +33,11 @@ _setup:
     or eax, 0x003
     mov [boot_page_directory + 1022 * 4], eax
 
-    ; enable paging
+    ; enable paging, with write protection so read only pages are read only for the kernel too
     mov eax, boot_page_directory
     mov cr3, eax
     mov eax, cr0
-    or eax, 0x80000000
+    or eax, 0x80010000
     mov cr0, eax
 
     ; restore multiboot data
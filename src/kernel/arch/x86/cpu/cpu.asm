@@ -3,6 +3,12 @@
 section .text
 global cpu_hlt
 global cpu_pause
+global cpu_sti_hlt
+global cpu_irq_save
+global cpu_irq_restore
+global cpu_rdtsc
+global cpu_sti
+global cpu_read_cr2
 
 cpu_hlt:
     hlt
@@ -10,4 +16,36 @@ cpu_hlt:
 
 cpu_pause:
     pause
-    ret
\ No newline at end of file
+    ret
+
+; sti only takes effect after the next instruction, so an interrupt that is
+; already pending wakes the hlt instead of being handled before it
+cpu_sti_hlt:
+    sti
+    hlt
+    ret
+
+cpu_irq_save:
+    pushfd
+    pop eax
+    cli
+    ret
+
+cpu_irq_restore:
+    mov eax, [esp + 4]
+    push eax
+    popfd
+    ret
+; returns the time stamp counter in edx:eax
+cpu_rdtsc:
+    rdtsc
+    ret
+
+cpu_sti:
+    sti
+    ret
+
+; returns the address that caused the last page fault
+cpu_read_cr2:
+    mov eax, cr2
+    ret
@@ -8,21 +8,34 @@
 #include <io.h>
 #include <panic.h>
 
-static irq_handler_t irq_handlers[16];
+static irq_handler_t irq_handlers[16][IRQ_MAX_SHARED];
 static isr_handler_t isr_handlers[32];
 
 /**
  * @brief Installs a custom handler for a specific IRQ.
  * 
+ * PCI devices may share a line, so every line keeps a chain of handlers and
+ * each of them must check whether its own device raised the interrupt.
+ * Installing a handler that is already on the line does nothing.
  * @param irq The IRQ number (0-15).
  * @param handler The function to call when the IRQ occurs.
+ * @return 0 on success, 1 for an invalid IRQ, 2 if the line has no free slot.
  */
-void irq_install_handler(int irq, irq_handler_t handler) {
-    if (irq >= 0 && irq < 16) {
-        irq_handlers[irq] = handler;
-    } else {
+uint8_t irq_install_handler(int irq, irq_handler_t handler) {
+    if (irq < 0 || irq >= 16) {
         serial_printf("Error: Invalid IRQ number %d! Must be between 0 and 15.\n", irq);
+        return 1;
+    }
+
+    for (int i = 0; i < IRQ_MAX_SHARED; i++) {
+        if (irq_handlers[irq][i] == handler) return 0;
+        if (!irq_handlers[irq][i]) {
+            irq_handlers[irq][i] = handler;
+            return 0;
+        }
     }
+    serial_printf("Error: IRQ %d is shared by too many handlers!\n", irq);
+    return 2;
 }
 
 /**
@@ -42,15 +55,15 @@ void isr_install_handler(int isr, isr_handler_t handler) {
 /**
  * @brief The common IRQ handler called from assembly stubs.
  * 
- * Sends EOI to the PICs and dispatches to the registered handler.
+ * Sends EOI to the PICs and dispatches to the handlers registered for the line.
  * @param regs The CPU register state at the time of the interrupt.
  */
 void irq_handler(struct registers *regs) {
     if (regs->int_no >= 40) outb(0xA0, 0x20);
     outb(0x20, 0x20);
 
-    irq_handler_t handler = irq_handlers[regs->int_no - 32];
-    if (handler) handler(regs);
+    irq_handler_t* chain = irq_handlers[regs->int_no - 32];
+    for (int i = 0; i < IRQ_MAX_SHARED && chain[i]; i++) chain[i](regs);
 }
 
 /**
@@ -60,12 +73,11 @@ void irq_handler(struct registers *regs) {
  * @param regs The CPU register state at the time of the exception.
  */
 void isr_handler(struct registers *regs) {
-    if (regs->int_no < 32) serial_printf("Exception: %d, Error Code: %d\n", regs->int_no, regs->err_code);
-
     isr_handler_t handler = isr_handlers[regs->int_no];
     if (handler) {
-        handler(regs);
+        handler(regs); // page faults are routine with swap, the handler reports what it cannot resolve
     } else {
+        if (regs->int_no < 32) serial_printf("Exception: %d, Error Code: %d\n", regs->int_no, regs->err_code);
         serial_printf("DS: %x, EDI: %x, ESI: %x, EBP: %x, ESP: %x, EBX: %x, EDX: %x, ECX: %x, EAX: %x\n",
                       regs->ds, regs->edi, regs->esi, regs->ebp, regs->esp,
                       regs->ebx, regs->edx, regs->ecx, regs->eax);
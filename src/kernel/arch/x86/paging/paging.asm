@@ -24,7 +24,7 @@ flush_tlb:
 
 enable_paging:
     mov eax, cr0
-    or eax, 0x80000000  ; set the paging bit (bit 31)
+    or eax, 0x80010000  ; set the paging bit (bit 31) and write protect (bit 16)
     mov cr0, eax
     jmp .flush
 .flush:
@@ -28,20 +28,51 @@
 #include <storage.h>
 #include <ata.h>
 #include <partman.h>
+#include <bcache.h>
+#include <ramdisk.h>
+#include <zram.h>
+#include <swap.h>
+#include <vfs.h>
+#include <fat32.h>
+#include <tmpfs.h>
+#include <initramfs.h>
 
 init_state_t init_state = INIT_START;
 mmap_t kernel_mmap;
+boot_modules_t kernel_modules;
 fb_info_t kernel_fb_info;
 multiboot_info_t* kernel_multiboot_info;
 char kernel_cmdline[256];
 char kernel_bootloader_name[64];
 static rsdp_t rsdp_stable_copy;
 
+/**
+ * @brief Tells archives from disk images.
+ *
+ * The header is checked when it lies in the identity mapped first 4 MB, where
+ * GRUB puts small modules right behind the kernel. Modules further up are
+ * recognized by the extension of their name.
+ */
+static uint8_t multiboot_module_kind(const boot_module_t* module) {
+    if (module->phys_start + 512 <= BOOT_IDENTITY_MAP_END && module->phys_end - module->phys_start >= 512) {
+        const char* header = (const char*)(uintptr_t)module->phys_start;
+        if (strncmp(header, "070701", 6) == 0 || strncmp(header, "070702", 6) == 0) return BOOT_MODULE_CPIO;
+        if (strncmp(header + 257, "ustar", 5) == 0) return BOOT_MODULE_TAR;
+        return BOOT_MODULE_IMAGE;
+    }
+
+    size_t len = 0;
+    while (module->cmdline[len] && module->cmdline[len] != ' ') len++;
+    if (len >= 5 && strncmp(module->cmdline + len - 5, ".cpio", 5) == 0) return BOOT_MODULE_CPIO;
+    if (len >= 4 && strncmp(module->cmdline + len - 4, ".tar", 4) == 0) return BOOT_MODULE_TAR;
+    return BOOT_MODULE_IMAGE;
+}
+
 /**
  * @brief Parses the Multiboot2 information structure.
  *
  * Iterates through the Multiboot2 tags to extract command line, bootloader name,
- * memory map, and framebuffer information.
+ * boot modules, memory map, and framebuffer information.
  * @param multiboot_magic The magic value passed by the bootloader.
  * @param multiboot_info The physical address of the Multiboot2 information structure.
  */
@@ -77,6 +108,21 @@ void multiboot_parse(uint32_t multiboot_magic, uint32_t multiboot_info) {
 
                 serial_printf("Multiboot: Boot loader name: %s\n", boot_loader_tag->string);
                 break;
+            case MULTIBOOT_TAG_TYPE_MODULE:
+                multiboot_tag_module_t* module_tag = (multiboot_tag_module_t*)tag;
+                serial_printf("Multiboot: Module at %x-%x: '%s'\n", module_tag->mod_start, module_tag->mod_end, module_tag->string);
+                if (kernel_modules.count < BOOT_MODULES_MAX && module_tag->mod_end > module_tag->mod_start) {
+                    boot_module_t* module = &kernel_modules.entries[kernel_modules.count++];
+                    module->phys_start = module_tag->mod_start;
+                    module->phys_end = module_tag->mod_end;
+                    size_t mod_len = module_tag->size - 16;
+                    if (mod_len > sizeof(module->cmdline) - 1) mod_len = sizeof(module->cmdline) - 1;
+                    for (size_t i = 0; i < mod_len; i++) module->cmdline[i] = module_tag->string[i];
+                    module->cmdline[mod_len] = '\0';
+                    module->kind = multiboot_module_kind(module);
+                    if (module->kind != BOOT_MODULE_IMAGE) serial_printf("Multiboot: Module '%s' is a %s archive\n", module->cmdline, module->kind == BOOT_MODULE_CPIO ? "cpio" : "tar");
+                }
+                break;
             case MULTIBOOT_TAG_TYPE_MMAP:
                 multiboot_tag_mmap_t* mmap_tag = (multiboot_tag_mmap_t*)tag;
                 kernel_mmap.entry_count = 0;
@@ -121,6 +167,22 @@ void multiboot_parse(uint32_t multiboot_magic, uint32_t multiboot_info) {
     init_state = INIT_MULTIBOOT;
 }
 
+/**
+ * @brief Looks up a "key=value" option on the kernel command line.
+ * @param key The option name including the '=', e.g. "ramdisk=".
+ * @return The value, terminated by a space or the end of the line, or NULL if the option is not given.
+ */
+const char* kernel_cmdline_get(const char* key) {
+    size_t key_len = strlen(key);
+    const char* p = kernel_cmdline;
+    while (*p) {
+        while (*p == ' ') p++;
+        if (strncmp(p, key, key_len) == 0) return p + key_len;
+        while (*p && *p != ' ') p++;
+    }
+    return NULL;
+}
+
 /**
  * @brief Executes kernel-level tests and demonstrations.
  * 
@@ -158,11 +220,20 @@ void kernel_main(uint32_t multiboot_magic, uint32_t multiboot_info) {
     timer_init();
     rtc_init();
 
+    // archives from the bootloader are readable before any disk driver runs
+    vfs_init();
+    initramfs_init();
+
     storage_init();
     pci_init();
     ata_init();
+    ramdisk_init();
+    zram_init();
 
     partman_init();
+    swap_init();
+    fat32_init();
+    tmpfs_init();
 
     // We have an emulated PS/2 controller so the initialization does not work
     // i8042_init();
@@ -176,6 +247,8 @@ void kernel_main(uint32_t multiboot_magic, uint32_t multiboot_info) {
     while (1) {
         uint32_t unicode = keyboard_get_unicode();
         shell_handle_input(unicode);
+        vfs_sync_task();
+        bcache_writeback_task();
         console_update();
         fb_update();
         cpu_hlt();
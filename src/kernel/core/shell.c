@@ -16,6 +16,16 @@
 #include <acpi.h>
 #include <storage.h>
 #include <partman.h>
+#include <diskbench.h>
+#include <fsbench.h>
+#include <ramdisk.h>
+#include <zram.h>
+#include <swap.h>
+#include <md.h>
+#include <iostat.h>
+#include <vfs.h>
+#include <pcache.h>
+#include <tmpfs.h>
 
 uint32_t command_buffer[MAX_COMMAND_LENGTH];
 size_t command_buffer_pos = 0;
@@ -57,6 +67,22 @@ void shell_command_help(int argc, uint32_t** argv) {
     console_puts(U"storage         - Displays information about connected storage devices\n");
     console_puts(U"storage_read    - Usage: storage_read <disk_index> <sector>\n");
     console_puts(U"storage_write   - Usage: storage_write <disk_index> <sector> <hex_data>\n");
+    console_puts(U"sync            - Writes all cached disk writes back to the disks\n");
+    console_puts(U"ramdisk         - Usage: ramdisk <size_mb> (creates an empty RAM disk)\n");
+    console_puts(U"zram            - Usage: zram <size_mb> (creates a compressed RAM disk)\n");
+    console_puts(U"md              - Usage: md <raid0|raid1> <chunk_kb> <disk_index> <disk_index> [...]\n");
+    console_puts(U"iostat          - Usage: iostat [interval_s] [count] | iostat hist <disk_index>\n");
+    console_puts(U"swap            - Usage: swap [on <disk_index> | test <size_mb>]\n");
+    console_puts(U"ls              - Usage: ls [path] (lists a directory)\n");
+    console_puts(U"cat             - Usage: cat <path> (prints a file)\n");
+    console_puts(U"write           - Usage: write <path> <text> (replaces a file's contents)\n");
+    console_puts(U"mkdir           - Usage: mkdir <path>\n");
+    console_puts(U"rm              - Usage: rm <path> (removes a file or empty directory)\n");
+    console_puts(U"mount           - Usage: mount [<disk_index> <path> [fs] | tmpfs <path> [KB]]\n");
+    console_puts(U"umount          - Usage: umount <path>\n");
+    console_puts(U"vfs             - Usage: vfs [cache <dentries> <vnodes> | pages <n> | drop]\n");
+    console_puts(U"diskbench       - Usage: diskbench <disk_index> [bs=<bytes>] [qd=<n>] [ops=<n>] [start=<lba>] [span=<sectors>] [seq|rand] [write]\n");
+    console_puts(U"fsbench         - Usage: fsbench <path> [files=<n>] [size=<bytes>] [large=<KB>] [bs=<bytes>] [ops=<n>] [qd=<n>] [meta] [list] [seq] [rand]\n");
     console_puts(U"partman         - Dumps partition table information\n");
     console_puts(U"acpiinfo        - Dumps general ACPI table information\n");
     console_puts(U"fadtinfo        - Dumps FADT (Fixed ACPI Description Table) details\n");
@@ -190,6 +216,455 @@ void shell_command_storage_write(int argc, uint32_t** argv) {
     kfree((virt_addr_t)buffer);
 }
 
+void shell_command_sync(int argc, uint32_t** argv) {
+    (void)argc;
+    (void)argv;
+    // filesystem metadata first, it lands in the block cache
+    if (vfs_sync() == 0 && storage_sync() == 0) {
+        console_puts(U"All cached writes flushed to disk.\n");
+    } else {
+        console_puts(U"Error: Failed to flush cached writes.\n");
+    }
+}
+
+void shell_command_ramdisk(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        console_puts(U"Usage: ramdisk <size_mb>\n");
+        return;
+    }
+
+    uint64_t size_mb = str_to_u64(argv[1]);
+    if (size_mb == 0 || size_mb > (VMM_RAMDISK_END + 1 - VMM_RAMDISK_BASE) / (1024 * 1024)) {
+        console_puts(U"Error: Invalid RAM disk size.\n");
+        return;
+    }
+
+    disk_t* disk = ramdisk_create((uint32_t)size_mb * 1024 * 1024);
+    if (!disk) {
+        console_puts(U"Error: Failed to create the RAM disk.\n");
+        return;
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "Created %s as disk %u.\n", disk->name, storage_get_disk_count() - 1);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+}
+
+void shell_command_zram(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        console_puts(U"Usage: zram <size_mb>\n");
+        return;
+    }
+
+    uint64_t size_mb = str_to_u64(argv[1]);
+    if (size_mb == 0 || size_mb > ZRAM_MAX_SIZE_MB) {
+        console_puts(U"Error: Invalid zram disk size.\n");
+        return;
+    }
+
+    disk_t* disk = zram_create((uint32_t)size_mb * 1024 * 1024);
+    if (!disk) {
+        console_puts(U"Error: Failed to create the zram disk.\n");
+        return;
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "Created %s as disk %u.\n", disk->name, storage_get_disk_count() - 1);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+}
+
+void shell_command_md(int argc, uint32_t** argv) {
+    if (argc < 5) {
+        console_puts(U"Usage: md <raid0|raid1> <chunk_kb> <disk_index> <disk_index> [...]\n");
+        return;
+    }
+
+    md_level_t level;
+    if (u32_strcmp(argv[1], U"raid0") == 0) {
+        level = MD_RAID0;
+    } else if (u32_strcmp(argv[1], U"raid1") == 0) {
+        level = MD_RAID1;
+    } else {
+        console_puts(U"Error: Unknown RAID level.\n");
+        return;
+    }
+
+    uint32_t chunk_kb = (uint32_t)str_to_u64(argv[2]);
+
+    disk_t* members[MD_MAX_MEMBERS];
+    uint8_t member_count = 0;
+    for (int i = 3; i < argc; i++) {
+        if (member_count >= MD_MAX_MEMBERS) {
+            console_puts(U"Error: Too many member disks.\n");
+            return;
+        }
+        members[member_count] = storage_get_disk((uint8_t)str_to_u64(argv[i]));
+        if (!members[member_count]) {
+            console_puts(U"Error: Disk not found.\n");
+            return;
+        }
+        member_count++;
+    }
+
+    disk_t* disk = md_create(level, chunk_kb * 1024 / members[0]->sector_size, members, member_count);
+    if (!disk) {
+        console_puts(U"Error: Failed to create the md disk.\n");
+        return;
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "Created %s as disk %u.\n", disk->name, storage_get_disk_count() - 1);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+}
+
+void shell_command_iostat(int argc, uint32_t** argv) {
+    if (argc >= 2 && u32_strcmp(argv[1], U"hist") == 0) {
+        if (argc < 3) {
+            console_puts(U"Usage: iostat hist <disk_index>\n");
+            return;
+        }
+        disk_t* disk = storage_get_disk((uint8_t)str_to_u64(argv[2]));
+        if (!disk) {
+            console_puts(U"Error: Disk not found.\n");
+            return;
+        }
+        iostat_dump_histogram(disk);
+        return;
+    }
+
+    uint32_t interval_ms = argc >= 2 ? (uint32_t)str_to_u64(argv[1]) * 1000 : IOSTAT_DEFAULT_INTERVAL_MS;
+    uint32_t count = argc >= 3 ? (uint32_t)str_to_u64(argv[2]) : 1;
+    if (interval_ms == 0 || count == 0) {
+        console_puts(U"Error: Interval and count must be at least 1.\n");
+        return;
+    }
+    iostat_report(interval_ms, count);
+}
+
+void shell_command_swap(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        swap_dump_info();
+        return;
+    }
+
+    if (u32_strcmp(argv[1], U"on") == 0 && argc >= 3) {
+        disk_t* disk = storage_get_disk((uint8_t)str_to_u64(argv[2]));
+        if (!disk) {
+            console_puts(U"Error: Disk not found.\n");
+            return;
+        }
+        if (swap_on(disk) != 0) console_puts(U"Error: Failed to enable swap.\n");
+        return;
+    }
+
+    if (u32_strcmp(argv[1], U"test") == 0 && argc >= 3) {
+        uint64_t size_mb = str_to_u64(argv[2]);
+        if (size_mb == 0 || size_mb > (VMM_ANON_END + 1 - VMM_ANON_BASE) / (1024 * 1024)) {
+            console_puts(U"Error: Invalid test size.\n");
+            return;
+        }
+
+        uint32_t words = (uint32_t)size_mb * 1024 * 1024 / sizeof(uint32_t);
+        uint32_t* data = (uint32_t*)swap_alloc_anon(words * sizeof(uint32_t));
+        if (!data) {
+            console_puts(U"Error: Failed to allocate anonymous memory.\n");
+            return;
+        }
+
+        // one pass to write, one to verify, so every page is touched twice
+        for (uint32_t i = 0; i < words; i++) data[i] = i * 2654435761u;
+        uint32_t errors = 0;
+        for (uint32_t i = 0; i < words; i++) {
+            if (data[i] != i * 2654435761u) errors++;
+        }
+        swap_free_anon((virt_addr_t)data);
+
+        char buf[64];
+        snprintf(buf, sizeof(buf), "Tested %u MB of anonymous memory, %u errors.\n", (uint32_t)size_mb, errors);
+        for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+        swap_dump_info();
+        return;
+    }
+
+    console_puts(U"Usage: swap [on <disk_index> | test <size_mb>]\n");
+}
+
+void shell_command_ls(int argc, uint32_t** argv) {
+    char path[VFS_MAX_PATH];
+    ustr_to_str(argc >= 2 ? argv[1] : U"/", path, sizeof(path));
+
+    vfs_file_t* dir = vfs_open(path, 0);
+    if (!dir || dir->vnode->type != VFS_TYPE_DIR) {
+        console_puts(U"Error: Directory not found.\n");
+        vfs_close(dir);
+        return;
+    }
+
+    char buf[VFS_MAX_NAME + 32];
+    vfs_dirent_t entry;
+    uint32_t cursor = 0;
+    while (vfs_readdir(dir, &cursor, &entry) == 0) {
+        if (entry.type == VFS_TYPE_DIR) snprintf(buf, sizeof(buf), "  <DIR>      %s\n", entry.name);
+        else snprintf(buf, sizeof(buf), "  %10llu %s\n", entry.size, entry.name);
+        for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    }
+    vfs_close(dir);
+}
+
+void shell_command_cat(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        console_puts(U"Usage: cat <path>\n");
+        return;
+    }
+    char path[VFS_MAX_PATH];
+    ustr_to_str(argv[1], path, sizeof(path));
+
+    vfs_file_t* file = vfs_open(path, 0);
+    if (!file || file->vnode->type != VFS_TYPE_FILE) {
+        console_puts(U"Error: File not found.\n");
+        vfs_close(file);
+        return;
+    }
+
+    uint8_t data[256];
+    uint64_t offset = 0;
+    int32_t n;
+    while ((n = vfs_read(file, offset, data, sizeof(data))) > 0) {
+        for (int32_t i = 0; i < n; i++) console_putc((uint32_t)data[i]);
+        offset += (uint32_t)n;
+    }
+    if (n < 0) console_puts(U"\nError: Read failed.");
+    console_putc(U'\n');
+    vfs_close(file);
+}
+
+void shell_command_write(int argc, uint32_t** argv) {
+    if (argc < 3) {
+        console_puts(U"Usage: write <path> <text>\n");
+        return;
+    }
+    char path[VFS_MAX_PATH];
+    ustr_to_str(argv[1], path, sizeof(path));
+
+    vfs_file_t* file = vfs_open(path, VFS_OPEN_CREATE | VFS_OPEN_TRUNCATE);
+    if (!file || file->vnode->type != VFS_TYPE_FILE) {
+        console_puts(U"Error: Failed to create the file.\n");
+        vfs_close(file);
+        return;
+    }
+
+    // the remaining arguments are written separated by single spaces
+    char buf[MAX_COMMAND_LENGTH];
+    uint64_t offset = 0;
+    for (int a = 2; a < argc; a++) {
+        ustr_to_str(argv[a], buf, sizeof(buf) - 1);
+        uint32_t len = (uint32_t)strlen(buf);
+        if (a + 1 < argc) buf[len++] = ' ';
+        if (vfs_write(file, offset, buf, len) != (int32_t)len) {
+            console_puts(U"Error: Write failed.\n");
+            break;
+        }
+        offset += len;
+    }
+    vfs_close(file);
+    if (vfs_sync() != 0) console_puts(U"Error: Sync failed.\n");
+}
+
+void shell_command_mkdir(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        console_puts(U"Usage: mkdir <path>\n");
+        return;
+    }
+    char path[VFS_MAX_PATH];
+    ustr_to_str(argv[1], path, sizeof(path));
+
+    if (vfs_mkdir(path) != 0) console_puts(U"Error: Failed to create the directory.\n");
+    else if (vfs_sync() != 0) console_puts(U"Error: Sync failed.\n");
+}
+
+void shell_command_rm(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        console_puts(U"Usage: rm <path>\n");
+        return;
+    }
+    char path[VFS_MAX_PATH];
+    ustr_to_str(argv[1], path, sizeof(path));
+
+    if (vfs_unlink(path) != 0) console_puts(U"Error: Failed to remove (directories must be empty).\n");
+    else if (vfs_sync() != 0) console_puts(U"Error: Sync failed.\n");
+}
+
+void shell_command_mount(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        vfs_dump_info();
+        return;
+    }
+    if (argc < 3) {
+        console_puts(U"Usage: mount [<disk_index> <path> [fs] | tmpfs <path> [KB]]\n");
+        return;
+    }
+
+    if (u32_strcmp(argv[1], U"tmpfs") == 0) {
+        char path[VFS_MAX_PATH];
+        ustr_to_str(argv[2], path, sizeof(path));
+        uint32_t limit_kb = argc >= 4 ? (uint32_t)str_to_u64(argv[3]) : TMPFS_DEFAULT_KB;
+        if (tmpfs_mount(path, limit_kb) != 0) console_puts(U"Error: Failed to mount the tmpfs.\n");
+        return;
+    }
+
+    disk_t* disk = storage_get_disk((uint8_t)str_to_u64(argv[1]));
+    if (!disk) {
+        console_puts(U"Error: Disk not found.\n");
+        return;
+    }
+    char path[VFS_MAX_PATH];
+    char fs_name[16];
+    ustr_to_str(argv[2], path, sizeof(path));
+    ustr_to_str(argc >= 4 ? argv[3] : U"fat32", fs_name, sizeof(fs_name));
+
+    if (vfs_mount(path, fs_name, disk) != 0) console_puts(U"Error: Failed to mount the disk.\n");
+}
+
+void shell_command_umount(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        console_puts(U"Usage: umount <path>\n");
+        return;
+    }
+    char path[VFS_MAX_PATH];
+    ustr_to_str(argv[1], path, sizeof(path));
+
+    if (vfs_umount(path) != 0) console_puts(U"Error: Failed to unmount (is a file open?).\n");
+}
+
+void shell_command_vfs(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        vfs_dump_info();
+        return;
+    }
+
+    if (u32_strcmp(argv[1], U"cache") == 0 && argc >= 4) {
+        vfs_set_cache_limits((uint32_t)str_to_u64(argv[2]), (uint32_t)str_to_u64(argv[3]));
+        vfs_dump_info();
+        return;
+    }
+    if (u32_strcmp(argv[1], U"pages") == 0 && argc >= 3) {
+        pcache_set_limit((uint32_t)str_to_u64(argv[2]));
+        vfs_dump_info();
+        return;
+    }
+    if (u32_strcmp(argv[1], U"drop") == 0) {
+        vfs_drop_caches();
+        console_puts(U"Dropped the dentry cache, unused vnodes and unmapped cached pages.\n");
+        return;
+    }
+
+    console_puts(U"Usage: vfs [cache <dentries> <vnodes> | pages <n> | drop]\n");
+}
+
+void shell_command_diskbench(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        console_puts(U"Usage: diskbench <disk_index> [bs=<bytes>] [qd=<n>] [ops=<n>] [start=<lba>] [span=<sectors>] [seq|rand] [write]\n");
+        return;
+    }
+
+    disk_t* disk = storage_get_disk((uint8_t)str_to_u64(argv[1]));
+    if (!disk) {
+        console_puts(U"Error: Disk not found.\n");
+        return;
+    }
+
+    diskbench_config_t config;
+    diskbench_default_config(disk, &config);
+
+    bool start_set = false;
+    for (int i = 2; i < argc; i++) {
+        if (u32_strncmp(argv[i], U"bs=", 3) == 0) {
+            config.block_size = (uint32_t)str_to_u64(argv[i] + 3);
+        } else if (u32_strncmp(argv[i], U"qd=", 3) == 0) {
+            config.queue_depth = (uint32_t)str_to_u64(argv[i] + 3);
+        } else if (u32_strncmp(argv[i], U"ops=", 4) == 0) {
+            config.ops = (uint32_t)str_to_u64(argv[i] + 4);
+        } else if (u32_strncmp(argv[i], U"start=", 6) == 0) {
+            config.start_lba = str_to_u64(argv[i] + 6);
+            start_set = true;
+        } else if (u32_strncmp(argv[i], U"span=", 5) == 0) {
+            config.span = str_to_u64(argv[i] + 5);
+        } else if (u32_strcmp(argv[i], U"seq") == 0) {
+            config.patterns = DISKBENCH_SEQ;
+        } else if (u32_strcmp(argv[i], U"rand") == 0) {
+            config.patterns = DISKBENCH_RAND;
+        } else if (u32_strcmp(argv[i], U"write") == 0) {
+            config.write = true;
+        } else {
+            console_puts(U"Error: Unknown diskbench option.\n");
+            return;
+        }
+    }
+
+    // a span given without a start is still placed at the end of the disk
+    if (!start_set && config.span <= disk->total_sectors) {
+        config.start_lba = disk->total_sectors - config.span;
+    }
+
+    if (config.write) {
+        console_puts(U"Warning: write tests overwrite the scratch range.\n");
+    }
+
+    uint8_t res = diskbench_run(disk, &config);
+    if (res == 1) {
+        console_puts(U"Error: Invalid benchmark parameters.\n");
+    } else if (res != 0) {
+        console_puts(U"Error: Memory allocation failed.\n");
+    }
+}
+
+void shell_command_fsbench(int argc, uint32_t** argv) {
+    if (argc < 2) {
+        console_puts(U"Usage: fsbench <path> [files=<n>] [size=<bytes>] [large=<KB>] [bs=<bytes>] [ops=<n>] [qd=<n>] [meta] [list] [seq] [rand]\n");
+        return;
+    }
+
+    char path[VFS_MAX_PATH];
+    ustr_to_str(argv[1], path, sizeof(path));
+
+    fsbench_config_t config;
+    fsbench_default_config(&config);
+
+    // naming tests runs only those, otherwise all of them
+    uint32_t tests = 0;
+    for (int i = 2; i < argc; i++) {
+        if (u32_strncmp(argv[i], U"files=", 6) == 0) {
+            config.files = (uint32_t)str_to_u64(argv[i] + 6);
+        } else if (u32_strncmp(argv[i], U"size=", 5) == 0) {
+            config.file_size = (uint32_t)str_to_u64(argv[i] + 5);
+        } else if (u32_strncmp(argv[i], U"large=", 6) == 0) {
+            config.large_kb = (uint32_t)str_to_u64(argv[i] + 6);
+        } else if (u32_strncmp(argv[i], U"bs=", 3) == 0) {
+            config.block_size = (uint32_t)str_to_u64(argv[i] + 3);
+        } else if (u32_strncmp(argv[i], U"ops=", 4) == 0) {
+            config.ops = (uint32_t)str_to_u64(argv[i] + 4);
+        } else if (u32_strncmp(argv[i], U"qd=", 3) == 0) {
+            config.queue_depth = (uint32_t)str_to_u64(argv[i] + 3);
+        } else if (u32_strcmp(argv[i], U"meta") == 0) {
+            tests |= FSBENCH_META;
+        } else if (u32_strcmp(argv[i], U"list") == 0) {
+            tests |= FSBENCH_LIST;
+        } else if (u32_strcmp(argv[i], U"seq") == 0) {
+            tests |= FSBENCH_SEQ;
+        } else if (u32_strcmp(argv[i], U"rand") == 0) {
+            tests |= FSBENCH_RAND;
+        } else {
+            console_puts(U"Error: Unknown fsbench option.\n");
+            return;
+        }
+    }
+    if (tests) config.tests = tests;
+
+    if (fsbench_run(path, &config) != 0) {
+        console_puts(U"Error: Invalid benchmark parameters or path.\n");
+    }
+}
+
 void shell_command_partman(int argc, uint32_t** argv) {
     (void)argc;
     (void)argv;
@@ -304,6 +779,118 @@ void shell_init(void) {
     };
     shell_register_command(&storage_write_command);
 
+    shell_command_t sync_command = {
+        .name = U"sync",
+        .handler = shell_command_sync,
+        .description = U"Flushes cached writes to the storage devices"
+    };
+    shell_register_command(&sync_command);
+
+    shell_command_t ramdisk_command = {
+        .name = U"ramdisk",
+        .handler = shell_command_ramdisk,
+        .description = U"Creates an empty RAM disk (usage: ramdisk <size_mb>)"
+    };
+    shell_register_command(&ramdisk_command);
+
+    shell_command_t zram_command = {
+        .name = U"zram",
+        .handler = shell_command_zram,
+        .description = U"Creates a compressed RAM disk (usage: zram <size_mb>)"
+    };
+    shell_register_command(&zram_command);
+
+    shell_command_t md_command = {
+        .name = U"md",
+        .handler = shell_command_md,
+        .description = U"Creates a RAID-0/RAID-1 disk (usage: md <raid0|raid1> <chunk_kb> <disk_index> <disk_index> [...])"
+    };
+    shell_register_command(&md_command);
+
+    shell_command_t iostat_command = {
+        .name = U"iostat",
+        .handler = shell_command_iostat,
+        .description = U"Displays per-disk I/O statistics (usage: iostat [interval_s] [count] | iostat hist <disk_index>)"
+    };
+    shell_register_command(&iostat_command);
+
+    shell_command_t swap_command = {
+        .name = U"swap",
+        .handler = shell_command_swap,
+        .description = U"Displays swap usage or enables swap (usage: swap [on <disk_index> | test <size_mb>])"
+    };
+    shell_register_command(&swap_command);
+
+    shell_command_t ls_command = {
+        .name = U"ls",
+        .handler = shell_command_ls,
+        .description = U"Lists a directory (usage: ls [path])"
+    };
+    shell_register_command(&ls_command);
+
+    shell_command_t cat_command = {
+        .name = U"cat",
+        .handler = shell_command_cat,
+        .description = U"Prints a file (usage: cat <path>)"
+    };
+    shell_register_command(&cat_command);
+
+    shell_command_t write_command = {
+        .name = U"write",
+        .handler = shell_command_write,
+        .description = U"Replaces the contents of a file (usage: write <path> <text>)"
+    };
+    shell_register_command(&write_command);
+
+    shell_command_t mkdir_command = {
+        .name = U"mkdir",
+        .handler = shell_command_mkdir,
+        .description = U"Creates a directory (usage: mkdir <path>)"
+    };
+    shell_register_command(&mkdir_command);
+
+    shell_command_t rm_command = {
+        .name = U"rm",
+        .handler = shell_command_rm,
+        .description = U"Removes a file or an empty directory (usage: rm <path>)"
+    };
+    shell_register_command(&rm_command);
+
+    shell_command_t mount_command = {
+        .name = U"mount",
+        .handler = shell_command_mount,
+        .description = U"Lists mounts or mounts a disk or a tmpfs (usage: mount [<disk_index> <path> [fs] | tmpfs <path> [KB]])"
+    };
+    shell_register_command(&mount_command);
+
+    shell_command_t umount_command = {
+        .name = U"umount",
+        .handler = shell_command_umount,
+        .description = U"Unmounts a filesystem (usage: umount <path>)"
+    };
+    shell_register_command(&umount_command);
+
+    shell_command_t vfs_command = {
+        .name = U"vfs",
+        .handler = shell_command_vfs,
+        .description = U"Shows VFS cache statistics or changes the cache sizes (usage: vfs [cache <dentries> <vnodes> | pages <n> | drop])"
+    };
+    shell_register_command(&vfs_command);
+
+    shell_command_t diskbench_command = {
+        .name = U"diskbench",
+        .handler = shell_command_diskbench,
+        .description = U"Benchmarks a storage device (usage: diskbench <disk_index> [options])"
+    };
+    shell_register_command(&diskbench_command);
+
+    shell_command_t fsbench_command = {
+        .name = U"fsbench",
+        .handler = shell_command_fsbench,
+        .description = U"Benchmarks a filesystem (usage: fsbench <path> [options])"
+    };
+    shell_register_command(&fsbench_command);
+
     shell_command_t partman_command = {
         .name = U"partman",
         .handler = shell_command_partman,
@@ -11,6 +11,8 @@
 #include <console.h>
 #include <io.h>
 #include <cpu.h>
+#include <storage.h>
+#include <vfs.h>
 
 rsdp_t* rsdp;
 rsdt_t* rsdt;
@@ -437,6 +439,11 @@ void acpi_dump_madt() {
  * @brief Attempts to power off the system using ACPI.
  */
 void acpi_power_off() {
+    serial_printf("ACPI: Flushing storage before power off\n");
+    // filesystem metadata and delayed data first, it lands in the block cache
+    vfs_sync();
+    storage_sync();
+
     if (!fadt || !dsdt) {
         serial_printf("ACPI: Cannot power off, FADT or DSDT not mapped!\n");
         return;
@@ -0,0 +1,328 @@
+/**
+ * @file aio.c
+ * @brief Asynchronous file I/O with submission and completion rings
+ * @author friedrichOsDev
+ *
+ * A batch of file operations is taken from the submission queue at once.
+ * Reads of file data that lies on the disk are turned into device requests
+ * straight into the caller's buffer, through the filesystem's bmap callback,
+ * and all requests of the batch are queued with storage_submit() before any
+ * is waited for, so independent reads overlap on queued devices. The device
+ * notification is delayed to the last request of each disk.
+ *
+ * Everything else is done right away and completes during aio_submit():
+ * reads the page cache holds entirely, files in memory, data not on the disk
+ * yet and the unaligned ends of a read. Writes also go through vfs_write()
+ * right away, they land in the delayed pages of the filesystem or the
+ * write-back block cache and have nothing to wait for.
+ *
+ * Queued reads bypass the page cache and the block cache, like direct I/O;
+ * on a partition they go to the queue of the parent disk. Ranges with dirty
+ * blocks in the cache of the disk that holds them are read through the
+ * caches instead.
+ * Completions are posted from interrupt context and handed to the caller,
+ * together with its callbacks, by aio_reap().
+ */
+
+#include <aio.h>
+#include <pcache.h>
+#include <bcache.h>
+#include <partman.h>
+#include <memory.h>
+#include <string.h>
+#include <console.h>
+#include <print.h>
+#include <cpu.h>
+
+static aio_stats_t stats;
+
+/**
+ * @brief Moves a finished operation to the completion queue.
+ */
+static void aio_post(aio_op_t* op) {
+    aio_ring_t* ring = op->ring;
+    uint32_t irq_flags = cpu_irq_save();
+    ring->cq[ring->cq_tail & (ring->entries - 1)] = op;
+    ring->cq_tail++;
+    cpu_irq_restore(irq_flags);
+}
+
+/**
+ * @brief Completion callback of the device requests, runs in interrupt context.
+ */
+static void aio_request_done(storage_request_t* req) {
+    aio_op_t* op = (aio_op_t*)req->private;
+    uint32_t irq_flags = cpu_irq_save();
+    if (req->status != 0) op->failed = true;
+    bool last = --op->pending == 0;
+    cpu_irq_restore(irq_flags);
+    if (last) aio_post(op);
+}
+
+static uint8_t aio_add_request(aio_op_t* op, disk_t* disk, uint64_t lba, uint32_t count, void* buffer) {
+    if (op->request_count % 8 == 0) {
+        storage_request_t* requests = (storage_request_t*)krealloc((virt_addr_t)op->requests, (op->request_count + 8) * sizeof(storage_request_t));
+        if (!requests) return 1;
+        op->requests = requests;
+    }
+
+    storage_request_t* req = &op->requests[op->request_count++];
+    memset(req, 0, sizeof(storage_request_t));
+    req->disk = disk;
+    req->op = STORAGE_OP_READ;
+    req->lba = lba;
+    req->count = count;
+    req->buffer = buffer;
+    req->complete = aio_request_done;
+    req->private = op;
+    return 0;
+}
+
+/**
+ * @brief Builds the device requests of a read, the parts that cannot be queued are read right away.
+ */
+static void aio_prepare_read(aio_op_t* op, const aio_sqe_t* sqe) {
+    vfs_vnode_t* node = sqe->file->vnode;
+    const vfs_fs_type_t* type = node->mount->type;
+    if (sqe->offset >= node->size) return;
+
+    uint32_t length = sqe->length;
+    if (length > node->size - sqe->offset) length = (uint32_t)(node->size - sqe->offset);
+    if (length > INT32_MAX) length = INT32_MAX;
+    op->result = (int32_t)length;
+
+    uint8_t* out = (uint8_t*)sqe->buffer;
+    disk_t* disk = node->mount->disk;
+    uint32_t done = 0;
+    uint32_t queued = 0;
+    if (type->ops->bmap && disk && !(type->flags & VFS_FS_NO_PAGE_CACHE) && !pcache_contains(node, sqe->offset, length)) {
+        uint32_t sector = disk->sector_size;
+
+        // the unaligned head goes through the caches, whole sectors to the device queue
+        uint32_t head = (uint32_t)sqe->offset & (sector - 1);
+        if (head != 0) {
+            head = sector - head < length ? sector - head : length;
+            if (vfs_read(sqe->file, sqe->offset, out, head) != (int32_t)head) op->failed = true;
+            done = head;
+        }
+
+        while (!op->failed && length - done >= sector) {
+            uint64_t lba;
+            uint32_t run;
+            if (type->ops->bmap(node, sqe->offset + done, &lba, &run) != 0) break;
+            if (run > length - done) run = length - done;
+
+            uint32_t count = run / sector;
+            if (count == 0) break;
+            if (count > AIO_REQUEST_SECTORS) count = AIO_REQUEST_SECTORS;
+            // partitions are not cached themselves, their blocks are cached for the parent
+            uint64_t backing_lba = lba;
+            disk_t* backing = partman_resolve(disk, &backing_lba);
+            if (bcache_range_dirty(backing, backing_lba, count)) break;
+            if (aio_add_request(op, disk, lba, count, out + done) != 0) break;
+            done += count * sector;
+            queued += count * sector;
+        }
+    }
+
+    if (!op->failed && done < length && vfs_read(sqe->file, sqe->offset + done, out + done, length - done) != (int32_t)(length - done)) {
+        op->failed = true;
+    }
+    stats.queued_bytes += queued;
+    stats.sync_bytes += length - queued;
+}
+
+/**
+ * @brief Submits one device request of a batch.
+ *
+ * A rejected request fails its operation. The requests of its disk queued
+ * before it with STORAGE_REQ_MORE still wait for the notification it would
+ * have sent, so the device is kicked.
+ */
+static void aio_issue(storage_request_t* req) {
+    disk_t* disk = req->disk;
+    if (storage_submit(disk, req) == 0) return;
+    storage_kick(disk);
+    storage_complete(req, 1);
+}
+
+static aio_op_t* aio_alloc_op(aio_ring_t* ring) {
+    for (uint32_t i = 0; i < ring->entries; i++) {
+        aio_op_t* op = &ring->ops[i];
+        if (op->busy) continue;
+        memset(op, 0, sizeof(aio_op_t));
+        op->ring = ring;
+        op->busy = true;
+        return op;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Creates a ring with room for entries operations, rounded up to a power of two.
+ * @return The ring, or NULL when out of memory.
+ */
+aio_ring_t* aio_create(uint32_t entries) {
+    if (entries > AIO_MAX_ENTRIES) entries = AIO_MAX_ENTRIES;
+    uint32_t size = 1;
+    while (size < entries) size <<= 1;
+
+    aio_ring_t* ring = (aio_ring_t*)kzalloc(sizeof(aio_ring_t));
+    if (!ring) return NULL;
+    ring->entries = size;
+    ring->sq = (aio_sqe_t*)kzalloc(size * sizeof(aio_sqe_t));
+    ring->ops = (aio_op_t*)kzalloc(size * sizeof(aio_op_t));
+    ring->cq = (aio_op_t**)kzalloc(size * sizeof(aio_op_t*));
+    if (!ring->sq || !ring->ops || !ring->cq) {
+        if (ring->sq) kfree((virt_addr_t)ring->sq);
+        if (ring->ops) kfree((virt_addr_t)ring->ops);
+        if (ring->cq) kfree((virt_addr_t)ring->cq);
+        kfree((virt_addr_t)ring);
+        return NULL;
+    }
+    return ring;
+}
+
+/**
+ * @brief Waits for the operations in flight, reaps them and frees the ring.
+ *
+ * Entries that were never submitted are dropped.
+ */
+void aio_destroy(aio_ring_t* ring) {
+    aio_wait(ring, ring->outstanding);
+    aio_reap(ring, NULL, ring->entries);
+    kfree((virt_addr_t)ring->sq);
+    kfree((virt_addr_t)ring->ops);
+    kfree((virt_addr_t)ring->cq);
+    kfree((virt_addr_t)ring);
+}
+
+/**
+ * @brief Returns the next free submission queue entry, cleared.
+ * @return The entry, or NULL if the queue is full.
+ */
+aio_sqe_t* aio_get_sqe(aio_ring_t* ring) {
+    if (ring->sq_tail - ring->sq_head == ring->entries) return NULL;
+    aio_sqe_t* sqe = &ring->sq[ring->sq_tail & (ring->entries - 1)];
+    memset(sqe, 0, sizeof(aio_sqe_t));
+    ring->sq_tail++;
+    return sqe;
+}
+
+/**
+ * @brief Starts the queued entries, as many as there is room for in the completion queue.
+ *
+ * The device requests of all entries are submitted together at the end.
+ * @return The number of entries taken from the submission queue.
+ */
+uint32_t aio_submit(aio_ring_t* ring) {
+    aio_op_t* batch = NULL;
+    aio_op_t** batch_tail = &batch;
+    uint32_t taken = 0;
+
+    while (ring->sq_head != ring->sq_tail && ring->outstanding < ring->entries) {
+        const aio_sqe_t* sqe = &ring->sq[ring->sq_head & (ring->entries - 1)];
+        aio_op_t* op = aio_alloc_op(ring);
+        if (!op) break;
+        ring->sq_head++;
+        ring->outstanding++;
+        taken++;
+        stats.ops++;
+
+        op->callback = sqe->callback;
+        op->user_data = sqe->user_data;
+        if (!sqe->file || !sqe->buffer || sqe->file->vnode->type != VFS_TYPE_FILE) {
+            op->failed = true;
+        } else if (sqe->op == AIO_OP_READ) {
+            aio_prepare_read(op, sqe);
+        } else if (sqe->op == AIO_OP_WRITE) {
+            op->result = vfs_write(sqe->file, sqe->offset, sqe->buffer, sqe->length);
+            if (op->result < 0) op->failed = true;
+            else stats.sync_bytes += (uint32_t)op->result;
+        } else {
+            op->failed = true;
+        }
+
+        if (op->request_count == 0) {
+            aio_post(op);
+            continue;
+        }
+        op->pending = op->request_count;
+        *batch_tail = op;
+        batch_tail = &op->batch_next;
+        stats.queued_ops++;
+        stats.requests += op->request_count;
+    }
+
+    // a request is sent on once the next one is known, only the last one of each disk notifies the device
+    storage_request_t* prev = NULL;
+    for (aio_op_t* op = batch; op; op = op->batch_next) {
+        for (uint32_t i = 0; i < op->request_count; i++) {
+            storage_request_t* req = &op->requests[i];
+            if (prev) {
+                prev->flags = prev->disk == req->disk ? STORAGE_REQ_MORE : 0;
+                aio_issue(prev);
+            }
+            prev = req;
+        }
+    }
+    if (prev) aio_issue(prev);
+    return taken;
+}
+
+/**
+ * @brief Takes up to max completions and runs their callbacks.
+ * @param out Receives the completions, may be NULL.
+ * @return The number of completions taken.
+ */
+uint32_t aio_reap(aio_ring_t* ring, aio_cqe_t* out, uint32_t max) {
+    uint32_t count = 0;
+    while (count < max) {
+        uint32_t irq_flags = cpu_irq_save();
+        aio_op_t* op = ring->cq_head != ring->cq_tail ? ring->cq[ring->cq_head++ & (ring->entries - 1)] : NULL;
+        cpu_irq_restore(irq_flags);
+        if (!op) break;
+
+        aio_cqe_t cqe = { .user_data = op->user_data, .result = op->failed ? -1 : op->result };
+        aio_callback_t callback = op->callback;
+        if (op->failed) stats.errors++;
+        if (op->requests) kfree((virt_addr_t)op->requests);
+        op->busy = false;
+        ring->outstanding--;
+
+        if (out) out[count] = cqe;
+        count++;
+        if (callback) callback(&cqe);
+    }
+    return count;
+}
+
+/**
+ * @brief Sleeps until min_complete completions can be reaped, or all submitted ones.
+ * @note Must be called with interrupts enabled.
+ */
+void aio_wait(aio_ring_t* ring, uint32_t min_complete) {
+    if (min_complete > ring->outstanding) min_complete = ring->outstanding;
+    while (1) {
+        // the same check-then-halt pattern as storage_wait()
+        uint32_t irq_flags = cpu_irq_save();
+        if (ring->cq_tail - ring->cq_head >= min_complete) {
+            cpu_irq_restore(irq_flags);
+            break;
+        }
+        cpu_sti_hlt();
+    }
+}
+
+aio_stats_t* aio_get_stats(void) {
+    return &stats;
+}
+
+void aio_dump_info(void) {
+    char buf[128];
+    console_puts(U"Async I/O:\n");
+    snprintf(buf, sizeof(buf), "  Operations:     %llu (%llu queued on the device, %llu requests), %llu errors\n", stats.ops, stats.queued_ops, stats.requests, stats.errors);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Data:           %llu KB queued, %llu KB served right away\n", stats.queued_bytes >> 10, stats.sync_bytes >> 10);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+}
@@ -1,4 +1,1943 @@
 /**
  * @file fat32.c
+ * @brief FAT32 filesystem driver
  * @author friedrichOsDev
- */
\ No newline at end of file
+ *
+ * The first FAT is cached in memory in chunks of FAT32_FAT_CHUNK_SECTORS
+ * sectors, loaded on first use and written back to every FAT copy on sync.
+ * A bitmap of used clusters, built at mount time, serves all allocations.
+ * Opening a file converts its cluster chain into a sorted list of extents, so
+ * mapping a file offset to a sector is a binary search and contiguous runs are
+ * transferred with one multi-sector request.
+ * Appended data is held in per-file pages and only gets clusters at writeback,
+ * so a file written in small pieces is allocated as one extent and its
+ * directory entry is written once per flush rather than once per write.
+ * Directories get a hash index of their names on first use, so lookups,
+ * short name checks and finding room for a new entry do not scan them.
+ */
+
+#include <fat32.h>
+#include <memory.h>
+#include <string.h>
+#include <serial.h>
+#include <console.h>
+#include <print.h>
+#include <rtc.h>
+#include <vfs.h>
+#include <kernel.h>
+#include <convert.h>
+
+#define FAT32_ENTRIES_PER_CHUNK (FAT32_FAT_CHUNK_SECTORS * FAT32_SECTOR_SIZE / sizeof(uint32_t))
+#define FAT32_ENTRIES_PER_SECTOR (FAT32_SECTOR_SIZE / sizeof(fat32_dirent_t))
+
+// byte offsets of the 13 UCS-2 characters within a long name entry
+static const uint8_t lfn_char_offsets[FAT32_LFN_CHARS] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+static fat32_volume_t* volumes[FAT32_MAX_VOLUMES];
+static uint32_t volume_count = 0;
+
+/**
+ * @brief Walks the entries of a directory, one sector is kept loaded at a time.
+ */
+typedef struct {
+    fat32_volume_t* vol;
+    uint32_t cluster;      /**< Cluster holding entry index. */
+    uint32_t index;        /**< Index of the next entry. */
+    uint64_t lba;          /**< Sector in buffer, 0 if none. */
+    uint32_t deleted;      /**< Deleted entries passed by fat32_iter_next_node(). */
+    bool at_end;           /**< fat32_iter_next_node() stopped at the end marker. */
+    uint8_t buffer[FAT32_SECTOR_SIZE];
+} fat32_dir_iter_t;
+
+#define FAT32_SLOT_EMPTY   0
+#define FAT32_SLOT_DELETED 1
+#define FAT32_SLOT_NAME    2 // the name a file is shown with
+#define FAT32_SLOT_SHORT   3 // the raw 11 byte 8.3 name
+
+static fat32_dir_index_t* index_lru_head = NULL; // most recently used
+static fat32_dir_index_t* index_lru_tail = NULL; // least recently used
+static uint32_t index_bytes = 0;
+static uint32_t index_limit = FAT32_INDEX_DEFAULT_KB * 1024;
+
+static inline bool fat32_valid_cluster(fat32_volume_t* vol, uint32_t cluster) {
+    return cluster >= 2 && cluster < vol->cluster_count + 2;
+}
+
+static inline uint64_t fat32_cluster_lba(fat32_volume_t* vol, uint32_t cluster) {
+    return vol->data_lba + (uint64_t)(cluster - 2) * vol->sectors_per_cluster;
+}
+
+static inline uint32_t fat32_entry_cluster(const fat32_dirent_t* entry) {
+    return ((uint32_t)entry->first_cluster_high << 16) | entry->first_cluster_low;
+}
+
+static inline char fat32_upper(char c) {
+    return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+}
+
+static inline char fat32_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+/**
+ * @brief Returns the loaded FAT chunk, reading it on first use.
+ */
+static uint32_t* fat32_fat_chunk(fat32_volume_t* vol, uint32_t chunk) {
+    fat32_fat_chunk_t* entry = &vol->fat_cache[chunk];
+    if (entry->entries) {
+        vol->fat_hits++;
+        return entry->entries;
+    }
+
+    uint32_t first = chunk * FAT32_FAT_CHUNK_SECTORS;
+    uint32_t count = vol->fat_sectors - first;
+    if (count > FAT32_FAT_CHUNK_SECTORS) count = FAT32_FAT_CHUNK_SECTORS;
+
+    uint32_t* entries = (uint32_t*)kzalloc(FAT32_FAT_CHUNK_SECTORS * FAT32_SECTOR_SIZE);
+    if (!entries) return NULL;
+    if (storage_read(vol->disk, vol->fat_lba + first, count, entries) != 0) {
+        serial_printf("FAT32: Error: Reading FAT sectors %u-%u on %s failed\n", first, first + count - 1, vol->disk->name);
+        kfree((virt_addr_t)entries);
+        return NULL;
+    }
+
+    entry->entries = entries;
+    vol->fat_misses++;
+    return entries;
+}
+
+static uint8_t fat32_get_next(fat32_volume_t* vol, uint32_t cluster, uint32_t* next) {
+    if (!fat32_valid_cluster(vol, cluster)) return 1;
+
+    uint32_t* entries = fat32_fat_chunk(vol, cluster / FAT32_ENTRIES_PER_CHUNK);
+    if (!entries) return 1;
+    *next = entries[cluster % FAT32_ENTRIES_PER_CHUNK] & FAT32_CLUSTER_MASK;
+    return 0;
+}
+
+static uint8_t fat32_set_next(fat32_volume_t* vol, uint32_t cluster, uint32_t value) {
+    if (!fat32_valid_cluster(vol, cluster)) return 1;
+
+    uint32_t chunk = cluster / FAT32_ENTRIES_PER_CHUNK;
+    uint32_t* entries = fat32_fat_chunk(vol, chunk);
+    if (!entries) return 1;
+
+    // the upper 4 bits are reserved and must be preserved
+    uint32_t* entry = &entries[cluster % FAT32_ENTRIES_PER_CHUNK];
+    *entry = (*entry & ~FAT32_CLUSTER_MASK) | (value & FAT32_CLUSTER_MASK);
+    vol->fat_cache[chunk].dirty = true;
+    return 0;
+}
+
+/**
+ * @brief Writes the dirty FAT chunks to every FAT copy.
+ */
+static uint8_t fat32_flush_fat(fat32_volume_t* vol) {
+    for (uint32_t chunk = 0; chunk < vol->fat_chunk_count; chunk++) {
+        fat32_fat_chunk_t* entry = &vol->fat_cache[chunk];
+        if (!entry->dirty) continue;
+
+        uint32_t first = chunk * FAT32_FAT_CHUNK_SECTORS;
+        uint32_t count = vol->fat_sectors - first;
+        if (count > FAT32_FAT_CHUNK_SECTORS) count = FAT32_FAT_CHUNK_SECTORS;
+
+        for (uint32_t fat = 0; fat < vol->fat_count; fat++) {
+            uint64_t lba = vol->fat_lba + (uint64_t)fat * vol->fat_sectors + first;
+            if (storage_write(vol->disk, lba, count, entry->entries) != 0) {
+                serial_printf("FAT32: Error: Writing FAT %u sectors %u-%u on %s failed\n", fat, first, first + count - 1, vol->disk->name);
+                return 1;
+            }
+        }
+        entry->dirty = false;
+    }
+    return 0;
+}
+
+static inline bool fat32_bitmap_test(fat32_volume_t* vol, uint32_t cluster) {
+    uint32_t bit = cluster - 2;
+    return vol->used_bitmap[bit / 32] & (1u << (bit % 32));
+}
+
+static inline void fat32_bitmap_set(fat32_volume_t* vol, uint32_t cluster) {
+    uint32_t bit = cluster - 2;
+    vol->used_bitmap[bit / 32] |= 1u << (bit % 32);
+}
+
+static inline void fat32_bitmap_clear(fat32_volume_t* vol, uint32_t cluster) {
+    uint32_t bit = cluster - 2;
+    vol->used_bitmap[bit / 32] &= ~(1u << (bit % 32));
+}
+
+/**
+ * @brief Builds the bitmap of used clusters by streaming the whole FAT.
+ * @return The number of free clusters, or UINT32_MAX on a read error.
+ */
+static uint32_t fat32_build_bitmap(fat32_volume_t* vol) {
+    uint32_t words = (vol->cluster_count + 31) / 32;
+    memset32(vol->used_bitmap, 0, words);
+    // bits past the last cluster count as used so no run ever reaches them
+    for (uint32_t bit = vol->cluster_count; bit < words * 32; bit++) vol->used_bitmap[bit / 32] |= 1u << (bit % 32);
+
+    uint32_t* buffer = (uint32_t*)kmalloc(FAT32_MAX_IO_SECTORS * FAT32_SECTOR_SIZE);
+    if (!buffer) return UINT32_MAX;
+
+    const uint32_t per_sector = FAT32_SECTOR_SIZE / sizeof(uint32_t);
+    uint32_t last_cluster = vol->cluster_count + 1;
+    uint32_t free_count = 0;
+    for (uint32_t sector = 0; sector * per_sector <= last_cluster; sector += FAT32_MAX_IO_SECTORS) {
+        uint32_t count = vol->fat_sectors - sector;
+        if (count > FAT32_MAX_IO_SECTORS) count = FAT32_MAX_IO_SECTORS;
+        if (storage_read(vol->disk, vol->fat_lba + sector, count, buffer) != 0) {
+            kfree((virt_addr_t)buffer);
+            return UINT32_MAX;
+        }
+
+        uint32_t first = sector * per_sector;
+        for (uint32_t i = 0; i < count * per_sector; i++) {
+            uint32_t cluster = first + i;
+            if (cluster < 2) continue;
+            if (cluster > last_cluster) break;
+            if ((buffer[i] & FAT32_CLUSTER_MASK) == FAT32_CLUSTER_FREE) free_count++;
+            else fat32_bitmap_set(vol, cluster);
+        }
+    }
+
+    kfree((virt_addr_t)buffer);
+    return free_count;
+}
+
+/**
+ * @brief Best-fit state of fat32_find_run().
+ */
+typedef struct {
+    uint32_t want;
+    uint32_t start;
+    uint32_t length;
+    bool fits;
+} fat32_run_search_t;
+
+/**
+ * @brief Considers a free run for the best fit.
+ * @return true if the run fits exactly, so the search can stop.
+ */
+static bool fat32_consider_run(fat32_run_search_t* search, uint32_t start, uint32_t length) {
+    if (length >= search->want) {
+        if (!search->fits || length < search->length) {
+            search->start = start;
+            search->length = length;
+            search->fits = true;
+        }
+        return length == search->want;
+    }
+    if (!search->fits && length > search->length) {
+        search->start = start;
+        search->length = length;
+    }
+    return false;
+}
+
+/**
+ * @brief Finds the smallest free run of at least want clusters, or the largest run if none is that long.
+ * @param length Set to the length of the run, 0 if no cluster is free.
+ * @return The first cluster of the run.
+ */
+static uint32_t fat32_find_run(fat32_volume_t* vol, uint32_t want, uint32_t* length) {
+    fat32_run_search_t search = { .want = want };
+    uint32_t run_start = 0;
+    uint32_t run_length = 0;
+
+    for (uint32_t bit = 0; bit < vol->cluster_count; ) {
+        uint32_t word = vol->used_bitmap[bit / 32];
+
+        // whole words that are all used or all free are taken in one step
+        if (bit % 32 == 0 && word == 0xFFFFFFFF && run_length == 0) {
+            bit += 32;
+            continue;
+        }
+        if (bit % 32 == 0 && word == 0 && bit + 32 <= vol->cluster_count) {
+            if (run_length == 0) run_start = bit;
+            run_length += 32;
+            bit += 32;
+            continue;
+        }
+
+        if (!(word & (1u << (bit % 32)))) {
+            if (run_length == 0) run_start = bit;
+            run_length++;
+        } else if (run_length > 0) {
+            if (fat32_consider_run(&search, run_start, run_length)) break;
+            run_length = 0;
+        }
+        bit++;
+    }
+    if (run_length > 0) fat32_consider_run(&search, run_start, run_length);
+
+    *length = search.length;
+    return search.start + 2;
+}
+
+/**
+ * @brief Allocates up to want contiguous clusters and appends them to a chain.
+ *
+ * A chain grows in place while the clusters behind it are free. Otherwise the
+ * smallest free run that holds room clusters is used, so large runs stay
+ * available for large files, or the largest run if none is long enough.
+ * @param prev Last cluster of the chain, 0 to start a new chain.
+ * @param room Run length to look for, at least want. Larger values leave room to grow in place later.
+ * @param length Set to the number of clusters allocated, between 1 and want.
+ */
+static uint8_t fat32_alloc_extent(fat32_volume_t* vol, uint32_t prev, uint32_t want, uint32_t room, uint32_t* start, uint32_t* length) {
+    uint32_t first = prev + 1;
+    uint32_t count = 0;
+    if (prev) {
+        while (count < want && fat32_valid_cluster(vol, first + count) && !fat32_bitmap_test(vol, first + count)) count++;
+    }
+    if (count == 0) {
+        first = fat32_find_run(vol, room > want ? room : want, &count);
+        if (count == 0) {
+            serial_printf("FAT32: Error: No free clusters left on %s\n", vol->disk->name);
+            return 1;
+        }
+        if (count > want) count = want;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t cluster = first + i;
+        if (fat32_set_next(vol, cluster, i + 1 < count ? cluster + 1 : FAT32_CLUSTER_LAST) != 0) return 1;
+        fat32_bitmap_set(vol, cluster);
+    }
+    if (prev && fat32_set_next(vol, prev, first) != 0) return 1;
+
+    vol->free_count -= count;
+    vol->next_free = first + count;
+    vol->fsinfo_dirty = true;
+    *start = first;
+    *length = count;
+    return 0;
+}
+
+/**
+ * @brief Allocates a single cluster and appends it to a chain.
+ * @param prev Last cluster of the chain, 0 to start a new chain.
+ */
+static uint8_t fat32_alloc_cluster(fat32_volume_t* vol, uint32_t prev, uint32_t* out) {
+    uint32_t length;
+    return fat32_alloc_extent(vol, prev, 1, 1, out, &length);
+}
+
+/**
+ * @brief Releases every cluster of a chain.
+ */
+static uint8_t fat32_free_chain(fat32_volume_t* vol, uint32_t cluster) {
+    for (uint32_t steps = 0; fat32_valid_cluster(vol, cluster) && steps < vol->cluster_count; steps++) {
+        uint32_t next;
+        if (fat32_get_next(vol, cluster, &next) != 0) return 1;
+        if (fat32_set_next(vol, cluster, FAT32_CLUSTER_FREE) != 0) return 1;
+        if (fat32_bitmap_test(vol, cluster)) {
+            fat32_bitmap_clear(vol, cluster);
+            vol->free_count++;
+        }
+        vol->fsinfo_dirty = true;
+        cluster = next;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes zeros over a whole cluster.
+ */
+static uint8_t fat32_zero_cluster(fat32_volume_t* vol, uint32_t cluster) {
+    memset(vol->sector_buffer, 0, FAT32_SECTOR_SIZE);
+    uint64_t lba = fat32_cluster_lba(vol, cluster);
+    for (uint32_t i = 0; i < vol->sectors_per_cluster; i++) {
+        if (storage_write(vol->disk, lba + i, 1, vol->sector_buffer) != 0) return 1;
+    }
+    return 0;
+}
+
+static void fat32_iter_init(fat32_dir_iter_t* it, fat32_volume_t* vol, uint32_t dir_cluster, uint32_t index) {
+    it->vol = vol;
+    it->cluster = dir_cluster;
+    it->index = index;
+    it->lba = 0;
+    it->deleted = 0;
+    it->at_end = false;
+
+    uint32_t skip = (index * sizeof(fat32_dirent_t)) >> vol->cluster_shift;
+    for (uint32_t i = 0; i < skip && fat32_valid_cluster(vol, it->cluster); i++) {
+        if (fat32_get_next(vol, it->cluster, &it->cluster) != 0) it->cluster = 0;
+    }
+}
+
+/**
+ * @brief Returns the next entry of a directory, pointing into the iterator's buffer.
+ * @return The entry, or NULL at the end of the cluster chain or on a read error.
+ */
+static fat32_dirent_t* fat32_iter_next(fat32_dir_iter_t* it) {
+    fat32_volume_t* vol = it->vol;
+    if (!fat32_valid_cluster(vol, it->cluster)) return NULL;
+
+    uint32_t within = (it->index * sizeof(fat32_dirent_t)) & (vol->cluster_size - 1);
+    uint64_t lba = fat32_cluster_lba(vol, it->cluster) + within / FAT32_SECTOR_SIZE;
+    if (lba != it->lba) {
+        if (storage_read(vol->disk, lba, 1, it->buffer) != 0) return NULL;
+        it->lba = lba;
+    }
+    fat32_dirent_t* entry = (fat32_dirent_t*)(it->buffer + within % FAT32_SECTOR_SIZE);
+
+    it->index++;
+    if (((it->index * sizeof(fat32_dirent_t)) & (vol->cluster_size - 1)) == 0) {
+        uint32_t next;
+        it->cluster = fat32_get_next(vol, it->cluster, &next) == 0 ? next : 0;
+    }
+    return entry;
+}
+
+/**
+ * @brief Writes the sector holding the entry last returned by fat32_iter_next() back.
+ */
+static uint8_t fat32_iter_write(fat32_dir_iter_t* it) {
+    return storage_write(it->vol->disk, it->lba, 1, it->buffer);
+}
+
+static uint8_t fat32_checksum(const char* short_name) {
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < 11; i++) sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + (uint8_t)short_name[i]);
+    return sum;
+}
+
+/**
+ * @brief Formats an 8.3 entry name as "NAME.EXT", honouring the lower case flags.
+ */
+static void fat32_format_short_name(const fat32_dirent_t* entry, char* out) {
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < 8 && entry->name[i] != ' '; i++) {
+        char c = (i == 0 && (uint8_t)entry->name[0] == 0x05) ? (char)0xE5 : entry->name[i];
+        out[len++] = (entry->ntres & FAT32_NTRES_LOWER_BASE) ? fat32_lower(c) : c;
+    }
+    if (entry->name[8] != ' ') {
+        out[len++] = '.';
+        for (uint32_t i = 8; i < 11 && entry->name[i] != ' '; i++) {
+            out[len++] = (entry->ntres & FAT32_NTRES_LOWER_EXT) ? fat32_lower(entry->name[i]) : entry->name[i];
+        }
+    }
+    out[len] = '\0';
+}
+
+/**
+ * @brief Reads the next file or directory of a directory, assembling its long name.
+ * @return 0 if an entry was found, 1 at the end of the directory.
+ */
+static uint8_t fat32_iter_next_node(fat32_dir_iter_t* it, uint32_t dir_cluster, fat32_node_t* out) {
+    uint8_t lfn_count = 0;
+    uint8_t lfn_expected = 0;
+    uint8_t lfn_checksum = 0;
+    bool lfn_valid = false;
+
+    fat32_dirent_t* entry;
+    while ((entry = fat32_iter_next(it)) != NULL) {
+        uint8_t first = (uint8_t)entry->name[0];
+        if (first == FAT32_DIRENT_END) {
+            it->at_end = true;
+            return 1;
+        }
+        if (first == FAT32_DIRENT_DELETED) {
+            it->deleted++;
+            lfn_valid = false;
+            continue;
+        }
+
+        if ((entry->attr & 0x3F) == FAT32_ATTR_LFN) {
+            fat32_lfn_entry_t* lfn = (fat32_lfn_entry_t*)entry;
+            uint8_t order = lfn->order & 0x3F;
+
+            if (lfn->order & FAT32_LFN_LAST) {
+                lfn_valid = order >= 1 && order * FAT32_LFN_CHARS <= FAT32_MAX_NAME + FAT32_LFN_CHARS;
+                lfn_count = order;
+                lfn_checksum = lfn->checksum;
+                memset(out->name, 0, sizeof(out->name));
+            } else if (!lfn_valid || order != lfn_expected || lfn->checksum != lfn_checksum) {
+                lfn_valid = false;
+            }
+            if (!lfn_valid) continue;
+            lfn_expected = order - 1;
+
+            // long names are UCS-2, everything outside ASCII is shown as '?'
+            const uint8_t* raw = (const uint8_t*)lfn;
+            uint32_t pos = (order - 1) * FAT32_LFN_CHARS;
+            for (uint32_t i = 0; i < FAT32_LFN_CHARS; i++, pos++) {
+                uint16_t c = (uint16_t)(raw[lfn_char_offsets[i]] | (raw[lfn_char_offsets[i] + 1] << 8));
+                if (c == 0x0000 || c == 0xFFFF || pos >= FAT32_MAX_NAME) continue;
+                out->name[pos] = c < 0x80 ? (char)c : '?';
+            }
+            continue;
+        }
+
+        if (entry->attr & FAT32_ATTR_VOLUME_ID) {
+            lfn_valid = false;
+            continue;
+        }
+
+        bool use_lfn = lfn_valid && lfn_expected == 0 && lfn_checksum == fat32_checksum(entry->name) && out->name[0] != '\0';
+        if (!use_lfn) fat32_format_short_name(entry, out->name);
+
+        out->attr = entry->attr;
+        out->first_cluster = fat32_entry_cluster(entry);
+        out->size = entry->file_size;
+        out->dir_cluster = dir_cluster;
+        out->entry_index = it->index - 1;
+        out->lfn_count = use_lfn ? lfn_count : 0;
+        return 0;
+    }
+    return 1;
+}
+
+static bool fat32_name_equal(const char* a, const char* b) {
+    while (*a && *b) {
+        if (fat32_upper(*a) != fat32_upper(*b)) return false;
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static uint32_t fat32_name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) hash = (hash ^ (uint8_t)fat32_upper(*name)) * 16777619u;
+    return hash;
+}
+
+static uint32_t fat32_short_hash(const char* short_name) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < 11; i++) hash = (hash ^ (uint8_t)short_name[i]) * 16777619u;
+    return hash;
+}
+
+static void fat32_index_lru_unlink(fat32_dir_index_t* index) {
+    if (index->lru_prev) index->lru_prev->lru_next = index->lru_next;
+    else index_lru_head = index->lru_next;
+    if (index->lru_next) index->lru_next->lru_prev = index->lru_prev;
+    else index_lru_tail = index->lru_prev;
+    index->lru_prev = NULL;
+    index->lru_next = NULL;
+}
+
+static void fat32_index_lru_push_front(fat32_dir_index_t* index) {
+    index->lru_prev = NULL;
+    index->lru_next = index_lru_head;
+    if (index_lru_head) index_lru_head->lru_prev = index;
+    index_lru_head = index;
+    if (!index_lru_tail) index_lru_tail = index;
+}
+
+static void fat32_index_free(fat32_dir_index_t* index) {
+    fat32_dir_index_t** link = &index->volume->index_table[index->dir_cluster % FAT32_INDEX_BUCKETS];
+    while (*link && *link != index) link = &(*link)->hash_next;
+    if (*link) *link = index->hash_next;
+    fat32_index_lru_unlink(index);
+
+    index_bytes -= sizeof(fat32_dir_index_t) + index->capacity * sizeof(fat32_index_slot_t);
+    if (index->slots) kfree((virt_addr_t)index->slots);
+    kfree((virt_addr_t)index);
+}
+
+/**
+ * @brief Frees least recently used indexes until at most target bytes are in use.
+ * @param keep An index that stays, even if that leaves more than target bytes.
+ */
+static void fat32_index_evict(uint32_t target, fat32_dir_index_t* keep) {
+    while (index_bytes > target && index_lru_tail && index_lru_tail != keep) {
+        index_lru_tail->volume->index_evictions++;
+        fat32_index_free(index_lru_tail);
+    }
+}
+
+/**
+ * @brief Allocates zeroed memory for an index, evicting the others while the heap is exhausted.
+ */
+static void* fat32_index_alloc(size_t size, fat32_dir_index_t* keep) {
+    void* data = (void*)kzalloc(size);
+    while (!data && index_lru_tail && index_lru_tail != keep) {
+        index_lru_tail->volume->index_evictions++;
+        fat32_index_free(index_lru_tail);
+        data = (void*)kzalloc(size);
+    }
+    return data;
+}
+
+static bool fat32_index_rehash(fat32_dir_index_t* index, uint32_t capacity) {
+    fat32_index_slot_t* slots = (fat32_index_slot_t*)fat32_index_alloc(capacity * sizeof(fat32_index_slot_t), index);
+    if (!slots) return false;
+
+    for (uint32_t i = 0; i < index->capacity; i++) {
+        fat32_index_slot_t* old = &index->slots[i];
+        if (old->kind < FAT32_SLOT_NAME) continue;
+        uint32_t pos = old->hash & (capacity - 1);
+        while (slots[pos].kind != FAT32_SLOT_EMPTY) pos = (pos + 1) & (capacity - 1);
+        slots[pos] = *old;
+    }
+
+    index_bytes += (capacity - index->capacity) * sizeof(fat32_index_slot_t);
+    if (index->slots) kfree((virt_addr_t)index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    index->tombstones = 0;
+    return true;
+}
+
+/**
+ * @brief Adds a name to an index, growing it to stay at most three quarters full.
+ * @return false when out of memory, the index is then incomplete and must be freed.
+ */
+static bool fat32_index_insert(fat32_dir_index_t* index, uint8_t kind, uint32_t hash, uint32_t entry_index, uint8_t lfn_count) {
+    if (entry_index >= FAT32_INDEX_MAX_ENTRIES) return false;
+    if ((index->used + index->tombstones + 1) * 4 > index->capacity * 3) {
+        uint32_t capacity = 16;
+        while (capacity < (index->used + 1) * 2) capacity *= 2;
+        if (!fat32_index_rehash(index, capacity)) return false;
+    }
+
+    uint32_t pos = hash & (index->capacity - 1);
+    while (index->slots[pos].kind >= FAT32_SLOT_NAME) pos = (pos + 1) & (index->capacity - 1);
+    if (index->slots[pos].kind == FAT32_SLOT_DELETED) index->tombstones--;
+    index->slots[pos] = (fat32_index_slot_t){ .hash = hash, .entry_index = (uint16_t)entry_index, .lfn_count = lfn_count, .kind = kind };
+    index->used++;
+    return true;
+}
+
+/**
+ * @brief Removes the name of the entry at entry_index from an index.
+ * @return false if the index did not hold it.
+ */
+static bool fat32_index_erase(fat32_dir_index_t* index, uint8_t kind, uint32_t hash, uint32_t entry_index) {
+    uint32_t pos = hash & (index->capacity - 1);
+    for (uint32_t probes = 0; probes < index->capacity && index->slots[pos].kind != FAT32_SLOT_EMPTY; probes++) {
+        fat32_index_slot_t* slot = &index->slots[pos];
+        if (slot->kind == kind && slot->hash == hash && slot->entry_index == entry_index) {
+            slot->kind = FAT32_SLOT_DELETED;
+            index->used--;
+            index->tombstones++;
+            return true;
+        }
+        pos = (pos + 1) & (index->capacity - 1);
+    }
+    return false;
+}
+
+/**
+ * @brief Returns the index of a directory if it is cached.
+ */
+static fat32_dir_index_t* fat32_index_cached(fat32_volume_t* vol, uint32_t dir_cluster) {
+    for (fat32_dir_index_t* index = vol->index_table[dir_cluster % FAT32_INDEX_BUCKETS]; index; index = index->hash_next) {
+        if (index->dir_cluster == dir_cluster) return index;
+    }
+    return NULL;
+}
+
+static uint32_t fat32_chain_length(fat32_volume_t* vol, uint32_t cluster) {
+    uint32_t count = 0;
+    while (fat32_valid_cluster(vol, cluster) && count < vol->cluster_count) {
+        count++;
+        if (fat32_get_next(vol, cluster, &cluster) != 0) break;
+    }
+    return count;
+}
+
+/**
+ * @brief Returns the index of a directory, reading the whole directory once to build it.
+ * @return The index, or NULL if indexes are disabled, memory is short or the directory cannot be read.
+ */
+static fat32_dir_index_t* fat32_index_get(fat32_volume_t* vol, uint32_t dir_cluster) {
+    if (index_limit == 0) return NULL;
+
+    fat32_dir_index_t* index = fat32_index_cached(vol, dir_cluster);
+    if (index) {
+        vol->index_hits++;
+        fat32_index_lru_unlink(index);
+        fat32_index_lru_push_front(index);
+        return index;
+    }
+
+    index = (fat32_dir_index_t*)fat32_index_alloc(sizeof(fat32_dir_index_t), NULL);
+    if (!index) return NULL;
+    index->volume = vol;
+    index->dir_cluster = dir_cluster;
+    index->hash_next = vol->index_table[dir_cluster % FAT32_INDEX_BUCKETS];
+    vol->index_table[dir_cluster % FAT32_INDEX_BUCKETS] = index;
+    fat32_index_lru_push_front(index);
+    index_bytes += sizeof(fat32_dir_index_t);
+
+    fat32_dir_iter_t it;
+    fat32_node_t node;
+    fat32_iter_init(&it, vol, dir_cluster, 0);
+    while (fat32_iter_next_node(&it, dir_cluster, &node) == 0) {
+        // the iterator buffer still holds the sector of the 8.3 entry
+        const fat32_dirent_t* entry = (const fat32_dirent_t*)(it.buffer + (node.entry_index * sizeof(fat32_dirent_t)) % FAT32_SECTOR_SIZE);
+        if (!fat32_index_insert(index, FAT32_SLOT_NAME, fat32_name_hash(node.name), node.entry_index, node.lfn_count) ||
+            !fat32_index_insert(index, FAT32_SLOT_SHORT, fat32_short_hash(entry->name), node.entry_index, node.lfn_count)) {
+            fat32_index_free(index);
+            return NULL;
+        }
+    }
+    if (!it.at_end && fat32_valid_cluster(vol, it.cluster)) {
+        fat32_index_free(index); // read error, the index would miss names
+        return NULL;
+    }
+
+    index->end = it.at_end ? it.index - 1 : it.index;
+    index->entry_capacity = fat32_chain_length(vol, dir_cluster) * (vol->cluster_size / sizeof(fat32_dirent_t));
+    index->holes = it.deleted;
+    vol->index_builds++;
+    fat32_index_evict(index_limit, index);
+    return index;
+}
+
+/**
+ * @brief Adds a created node to the index of its directory, if there is one.
+ */
+static void fat32_index_add(fat32_volume_t* vol, const fat32_node_t* node, const char* short_name) {
+    fat32_dir_index_t* index = fat32_index_cached(vol, node->dir_cluster);
+    if (!index) return;
+
+    if (!fat32_index_insert(index, FAT32_SLOT_NAME, fat32_name_hash(node->name), node->entry_index, node->lfn_count) ||
+        !fat32_index_insert(index, FAT32_SLOT_SHORT, fat32_short_hash(short_name), node->entry_index, node->lfn_count)) {
+        fat32_index_free(index);
+        return;
+    }
+
+    // entries in front of end were deleted ones, the run may also reach past it
+    uint32_t first = node->entry_index - node->lfn_count;
+    if (first < index->end) {
+        uint32_t reused = (node->entry_index < index->end ? node->entry_index + 1 : index->end) - first;
+        index->holes = index->holes > reused ? index->holes - reused : 0;
+    }
+    if (node->entry_index >= index->end) index->end = node->entry_index + 1;
+    fat32_index_evict(index_limit, index);
+}
+
+/**
+ * @brief Looks a name up through a directory index, reading only the entries whose hash matches.
+ */
+static bool fat32_index_find(fat32_dir_index_t* index, const char* name, fat32_node_t* out) {
+    fat32_volume_t* vol = index->volume;
+    uint32_t hash = fat32_name_hash(name);
+    uint32_t pos = hash & (index->capacity - 1);
+
+    for (uint32_t probes = 0; probes < index->capacity && index->slots[pos].kind != FAT32_SLOT_EMPTY; probes++) {
+        fat32_index_slot_t* slot = &index->slots[pos];
+        pos = (pos + 1) & (index->capacity - 1);
+        if (slot->kind != FAT32_SLOT_NAME || slot->hash != hash) continue;
+
+        fat32_dir_iter_t it;
+        fat32_iter_init(&it, vol, index->dir_cluster, slot->entry_index - slot->lfn_count);
+        if (fat32_iter_next_node(&it, index->dir_cluster, out) == 0 && out->entry_index == slot->entry_index && fat32_name_equal(out->name, name)) return true;
+    }
+    return false;
+}
+
+void fat32_root_node(fat32_volume_t* vol, fat32_node_t* out) {
+    memset(out, 0, sizeof(fat32_node_t));
+    out->name[0] = '/';
+    out->attr = FAT32_ATTR_DIRECTORY;
+    out->first_cluster = vol->root_cluster;
+}
+
+/**
+ * @brief Looks up a name in a directory, case-insensitively.
+ * @return 0 if found, 1 otherwise.
+ */
+uint8_t fat32_find(fat32_volume_t* vol, const fat32_node_t* dir, const char* name, fat32_node_t* out) {
+    if (!(dir->attr & FAT32_ATTR_DIRECTORY)) return 1;
+
+    bool found = false;
+    fat32_dir_index_t* index = fat32_index_get(vol, dir->first_cluster);
+    if (index) {
+        found = fat32_index_find(index, name, out);
+    } else {
+        fat32_dir_iter_t it;
+        fat32_iter_init(&it, vol, dir->first_cluster, 0);
+        while (!found && fat32_iter_next_node(&it, dir->first_cluster, out) == 0) found = fat32_name_equal(out->name, name);
+    }
+    if (!found) return 1;
+
+    // ".." of a directory in the root points at cluster 0
+    if ((out->attr & FAT32_ATTR_DIRECTORY) && out->first_cluster == 0) out->first_cluster = vol->root_cluster;
+    return 0;
+}
+
+/**
+ * @brief Resolves an absolute or root-relative path, separated by '/'.
+ */
+uint8_t fat32_lookup(fat32_volume_t* vol, const char* path, fat32_node_t* out) {
+    fat32_root_node(vol, out);
+
+    char component[FAT32_MAX_NAME + 1];
+    while (*path) {
+        while (*path == '/') path++;
+        if (!*path) break;
+
+        uint32_t len = 0;
+        while (path[len] && path[len] != '/') len++;
+        if (len > FAT32_MAX_NAME) return 1;
+        memcpy(component, path, len);
+        component[len] = '\0';
+        path += len;
+
+        if (strcmp(component, ".") == 0) continue;
+
+        fat32_node_t dir = *out;
+        if (fat32_find(vol, &dir, component, out) != 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the entry at or after *cursor, skipping "." and "..".
+ * @param cursor Start with 0, advanced past the returned entry.
+ * @return 0 if an entry was returned, 1 at the end of the directory.
+ */
+uint8_t fat32_readdir(fat32_volume_t* vol, const fat32_node_t* dir, uint32_t* cursor, fat32_node_t* out) {
+    if (!(dir->attr & FAT32_ATTR_DIRECTORY)) return 1;
+
+    fat32_dir_iter_t it;
+    fat32_iter_init(&it, vol, dir->first_cluster, *cursor);
+    while (fat32_iter_next_node(&it, dir->first_cluster, out) == 0) {
+        *cursor = it.index;
+        if (strcmp(out->name, ".") == 0 || strcmp(out->name, "..") == 0) continue;
+        return 0;
+    }
+    *cursor = it.index;
+    return 1;
+}
+
+/**
+ * @brief Returns the current time as FAT date (high half) and time (low half).
+ */
+static uint32_t fat32_timestamp(void) {
+    rtc_time_t now = rtc_get_time();
+    uint32_t year = now.year >= 1980 ? now.year - 1980u : 0;
+    uint32_t date = (year << 9) | ((uint32_t)now.month << 5) | now.day;
+    uint32_t time = ((uint32_t)now.hours << 11) | ((uint32_t)now.minutes << 5) | (now.seconds / 2u);
+    return (date << 16) | time;
+}
+
+/**
+ * @brief Writes the first cluster and size of a node back to its directory entry.
+ */
+static uint8_t fat32_update_entry(fat32_volume_t* vol, const fat32_node_t* node) {
+    if (node->dir_cluster == 0) return 0; // the root has no entry
+
+    fat32_dir_iter_t it;
+    fat32_iter_init(&it, vol, node->dir_cluster, node->entry_index);
+    fat32_dirent_t* entry = fat32_iter_next(&it);
+    if (!entry) return 1;
+
+    entry->first_cluster_high = (uint16_t)(node->first_cluster >> 16);
+    entry->first_cluster_low = (uint16_t)node->first_cluster;
+    entry->file_size = (node->attr & FAT32_ATTR_DIRECTORY) ? 0 : node->size;
+    if (!(node->attr & FAT32_ATTR_DIRECTORY)) entry->attr |= FAT32_ATTR_ARCHIVE;
+    uint32_t stamp = fat32_timestamp();
+    entry->write_date = (uint16_t)(stamp >> 16);
+    entry->write_time = (uint16_t)stamp;
+    entry->access_date = entry->write_date;
+    return fat32_iter_write(&it);
+}
+
+static bool fat32_valid_name(const char* name) {
+    size_t len = strlen(name);
+    if (len == 0 || len > FAT32_MAX_NAME) return false;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return false;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if ((uint8_t)c < 0x20 || (uint8_t)c >= 0x80) return false;
+        if (c == '"' || c == '*' || c == '/' || c == ':' || c == '<' || c == '>' || c == '?' || c == '\\' || c == '|') return false;
+    }
+    return true;
+}
+
+static bool fat32_short_char(char c) {
+    if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) return true;
+    const char* specials = "!#$%&'()-@^_`{}~";
+    for (uint32_t i = 0; specials[i]; i++) {
+        if (c == specials[i]) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Converts a name that already is a valid upper case 8.3 name.
+ * @return false if the name needs a long name entry.
+ */
+static bool fat32_make_short_name(const char* name, char* out) {
+    memset(out, ' ', 11);
+    const char* dot = NULL;
+    for (const char* p = name; *p; p++) {
+        if (*p == '.') {
+            if (dot) return false;
+            dot = p;
+        }
+    }
+
+    size_t base_len = dot ? (size_t)(dot - name) : strlen(name);
+    size_t ext_len = dot ? strlen(dot + 1) : 0;
+    if (base_len == 0 || base_len > 8 || ext_len > 3 || (dot && ext_len == 0)) return false;
+
+    for (size_t i = 0; i < base_len; i++) {
+        if (!fat32_short_char(name[i])) return false;
+        out[i] = name[i];
+    }
+    for (size_t i = 0; i < ext_len; i++) {
+        if (!fat32_short_char(dot[1 + i])) return false;
+        out[8 + i] = dot[1 + i];
+    }
+    if ((uint8_t)out[0] == 0xE5) out[0] = 0x05;
+    return true;
+}
+
+static bool fat32_short_name_exists(fat32_volume_t* vol, uint32_t dir_cluster, const char* short_name) {
+    fat32_dir_iter_t it;
+    fat32_dirent_t* entry;
+
+    fat32_dir_index_t* index = fat32_index_get(vol, dir_cluster);
+    if (index) {
+        uint32_t hash = fat32_short_hash(short_name);
+        uint32_t pos = hash & (index->capacity - 1);
+        for (uint32_t probes = 0; probes < index->capacity && index->slots[pos].kind != FAT32_SLOT_EMPTY; probes++) {
+            fat32_index_slot_t* slot = &index->slots[pos];
+            pos = (pos + 1) & (index->capacity - 1);
+            if (slot->kind != FAT32_SLOT_SHORT || slot->hash != hash) continue;
+
+            fat32_iter_init(&it, vol, dir_cluster, slot->entry_index);
+            entry = fat32_iter_next(&it);
+            if (entry && memcmp(entry->name, short_name, 11) == 0) return true;
+        }
+        return false;
+    }
+
+    fat32_iter_init(&it, vol, dir_cluster, 0);
+    while ((entry = fat32_iter_next(&it)) != NULL) {
+        if ((uint8_t)entry->name[0] == FAT32_DIRENT_END) break;
+        if ((uint8_t)entry->name[0] == FAT32_DIRENT_DELETED || (entry->attr & 0x3F) == FAT32_ATTR_LFN) continue;
+        if (memcmp(entry->name, short_name, 11) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Derives a unique "BASIS~N.EXT" short name for a long name.
+ *
+ * After four tries the basis is cut to two characters followed by four hex
+ * digits of a hash of the long name, as Windows does, so many names sharing
+ * a basis do not have to try every number in turn.
+ */
+static uint8_t fat32_generate_short_name(fat32_volume_t* vol, uint32_t dir_cluster, const char* name, char* out) {
+    char basis[8];
+    char ext[3];
+    uint32_t basis_len = 0;
+    uint32_t ext_len = 0;
+
+    const char* dot = NULL;
+    for (const char* p = name; *p; p++) {
+        if (*p == '.') dot = p;
+    }
+    if (dot == name) dot = NULL; // ".profile" has no extension
+
+    for (const char* p = name; *p && p != dot && basis_len < 8; p++) {
+        if (*p == ' ' || *p == '.') continue;
+        char c = fat32_upper(*p);
+        basis[basis_len++] = fat32_short_char(c) ? c : '_';
+    }
+    if (dot) {
+        for (const char* p = dot + 1; *p && ext_len < 3; p++) {
+            if (*p == ' ' || *p == '.') continue;
+            char c = fat32_upper(*p);
+            ext[ext_len++] = fat32_short_char(c) ? c : '_';
+        }
+    }
+    if (basis_len == 0) basis[basis_len++] = '_';
+
+    uint32_t hash = fat32_name_hash(name);
+    for (uint32_t n = 1; n < 1000000; n++) {
+        char suffix[8];
+        uint32_t keep = basis_len;
+        if (n <= 4) {
+            snprintf(suffix, sizeof(suffix), "~%u", n);
+        } else {
+            const char* digits = "0123456789ABCDEF";
+            uint32_t value = (hash + n) & 0xFFFF;
+            for (uint32_t i = 0; i < 4; i++) suffix[i] = digits[(value >> (12 - 4 * i)) & 0xF];
+            memcpy(suffix + 4, "~1", 3);
+            if (keep > 2) keep = 2;
+        }
+        uint32_t suffix_len = (uint32_t)strlen(suffix);
+        if (keep > 8 - suffix_len) keep = 8 - suffix_len;
+
+        memset(out, ' ', 11);
+        memcpy(out, basis, keep);
+        memcpy(out + keep, suffix, suffix_len);
+        memcpy(out + 8, ext, ext_len);
+
+        if (!fat32_short_name_exists(vol, dir_cluster, out)) return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Appends a zeroed cluster to a directory.
+ */
+static uint8_t fat32_extend_dir(fat32_volume_t* vol, uint32_t dir_cluster) {
+    uint32_t last = dir_cluster;
+    for (uint32_t steps = 0; steps < vol->cluster_count; steps++) {
+        uint32_t next;
+        if (fat32_get_next(vol, last, &next) != 0) return 1;
+        if (!fat32_valid_cluster(vol, next)) break;
+        last = next;
+    }
+
+    uint32_t cluster;
+    if (fat32_alloc_cluster(vol, last, &cluster) != 0) return 1;
+    if (fat32_zero_cluster(vol, cluster) != 0) return 1;
+
+    fat32_dir_index_t* index = fat32_index_cached(vol, dir_cluster);
+    if (index) index->entry_capacity += vol->cluster_size / sizeof(fat32_dirent_t);
+    return 0;
+}
+
+/**
+ * @brief Finds count consecutive free entries in a directory, growing it if needed.
+ * @return The index of the first one, or -1 on failure.
+ */
+static int32_t fat32_find_free_entries(fat32_volume_t* vol, uint32_t dir_cluster, uint32_t count) {
+    // without deleted entries to reuse, new entries go behind the last one
+    fat32_dir_index_t* index = fat32_index_get(vol, dir_cluster);
+    if (index && index->holes == 0) {
+        while (index->end + count > index->entry_capacity) {
+            if (fat32_extend_dir(vol, dir_cluster) != 0) return -1;
+        }
+        return (int32_t)index->end;
+    }
+
+    // a long name takes up to 21 entries, more than a cluster of 512 bytes holds
+    uint32_t per_cluster = vol->cluster_size / sizeof(fat32_dirent_t);
+    uint32_t max_extensions = (count + per_cluster - 1) / per_cluster;
+
+    for (uint32_t attempt = 0; attempt <= max_extensions; attempt++) {
+        fat32_dir_iter_t it;
+        fat32_iter_init(&it, vol, dir_cluster, 0);
+
+        uint32_t run_start = 0;
+        uint32_t run = 0;
+        fat32_dirent_t* entry;
+        while ((entry = fat32_iter_next(&it)) != NULL) {
+            uint8_t first = (uint8_t)entry->name[0];
+            if (first == FAT32_DIRENT_END || first == FAT32_DIRENT_DELETED) {
+                if (run == 0) run_start = it.index - 1;
+                if (++run == count) return (int32_t)run_start;
+            } else {
+                run = 0;
+            }
+        }
+
+        // free entries at the end carry over into the new cluster
+        if (attempt == max_extensions || fat32_extend_dir(vol, dir_cluster) != 0) break;
+    }
+    return -1;
+}
+
+/**
+ * @brief Creates a file or directory.
+ * @param attr FAT32_ATTR_DIRECTORY for a directory, 0 for a file.
+ * @return 0 on success, 1 if the name is invalid or taken or the volume is full.
+ */
+uint8_t fat32_create(fat32_volume_t* vol, const fat32_node_t* dir, const char* name, uint8_t attr, fat32_node_t* out) {
+    if (!(dir->attr & FAT32_ATTR_DIRECTORY) || !fat32_valid_name(name)) return 1;
+    if (fat32_find(vol, dir, name, out) == 0) return 1;
+
+    uint32_t dir_cluster = dir->first_cluster;
+    char short_name[11];
+    bool needs_lfn = !fat32_make_short_name(name, short_name);
+    if (needs_lfn && fat32_generate_short_name(vol, dir_cluster, name, short_name) != 0) return 1;
+
+    size_t name_len = strlen(name);
+    uint32_t lfn_count = needs_lfn ? (uint32_t)((name_len + FAT32_LFN_CHARS - 1) / FAT32_LFN_CHARS) : 0;
+    int32_t index = fat32_find_free_entries(vol, dir_cluster, lfn_count + 1);
+    if (index < 0) return 1;
+
+    // a directory gets its first cluster with "." and ".." right away
+    uint32_t first_cluster = 0;
+    if (attr & FAT32_ATTR_DIRECTORY) {
+        if (fat32_alloc_cluster(vol, 0, &first_cluster) != 0) return 1;
+        if (fat32_zero_cluster(vol, first_cluster) != 0) {
+            fat32_free_chain(vol, first_cluster);
+            return 1;
+        }
+    }
+
+    fat32_dirent_t entry;
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.name, short_name, 11);
+    entry.attr = (attr & FAT32_ATTR_DIRECTORY) ? FAT32_ATTR_DIRECTORY : FAT32_ATTR_ARCHIVE;
+    entry.first_cluster_high = (uint16_t)(first_cluster >> 16);
+    entry.first_cluster_low = (uint16_t)first_cluster;
+    uint32_t stamp = fat32_timestamp();
+    entry.create_date = (uint16_t)(stamp >> 16);
+    entry.create_time = (uint16_t)stamp;
+    entry.write_date = entry.create_date;
+    entry.write_time = entry.create_time;
+    entry.access_date = entry.create_date;
+
+    if (first_cluster) {
+        fat32_dirent_t* dots = (fat32_dirent_t*)vol->sector_buffer;
+        memset(vol->sector_buffer, 0, FAT32_SECTOR_SIZE);
+        dots[0] = entry;
+        memcpy(dots[0].name, ".          ", 11);
+        dots[1] = entry;
+        memcpy(dots[1].name, "..         ", 11);
+        uint32_t parent = dir_cluster == vol->root_cluster ? 0 : dir_cluster;
+        dots[1].first_cluster_high = (uint16_t)(parent >> 16);
+        dots[1].first_cluster_low = (uint16_t)parent;
+        if (storage_write(vol->disk, fat32_cluster_lba(vol, first_cluster), 1, vol->sector_buffer) != 0) {
+            fat32_free_chain(vol, first_cluster);
+            return 1;
+        }
+    }
+
+    uint8_t checksum = fat32_checksum(short_name);
+    fat32_dir_iter_t it;
+    fat32_iter_init(&it, vol, dir_cluster, (uint32_t)index);
+    for (uint32_t i = 0; i <= lfn_count; i++) {
+        fat32_dirent_t* slot = fat32_iter_next(&it);
+        if (!slot) return 1;
+
+        if (i < lfn_count) {
+            // long name parts are stored last part first
+            uint32_t order = lfn_count - i;
+            fat32_lfn_entry_t* lfn = (fat32_lfn_entry_t*)slot;
+            memset(lfn, 0, sizeof(fat32_lfn_entry_t));
+            lfn->order = (uint8_t)(order | (i == 0 ? FAT32_LFN_LAST : 0));
+            lfn->attr = FAT32_ATTR_LFN;
+            lfn->checksum = checksum;
+
+            uint8_t* raw = (uint8_t*)lfn;
+            uint32_t pos = (order - 1) * FAT32_LFN_CHARS;
+            for (uint32_t c = 0; c < FAT32_LFN_CHARS; c++, pos++) {
+                // the name is terminated by one NUL if it does not fill the entry, then padded with 0xFFFF
+                uint16_t value = pos < name_len ? (uint16_t)(uint8_t)name[pos] : (pos == name_len ? 0x0000 : 0xFFFF);
+                raw[lfn_char_offsets[c]] = (uint8_t)value;
+                raw[lfn_char_offsets[c] + 1] = (uint8_t)(value >> 8);
+            }
+        } else {
+            *slot = entry;
+        }
+
+        // flush when the next entry lies in another sector or this was the last one
+        if (i == lfn_count || (it.index % FAT32_ENTRIES_PER_SECTOR) == 0) {
+            if (fat32_iter_write(&it) != 0) return 1;
+        }
+    }
+
+    memset(out, 0, sizeof(fat32_node_t));
+    strncpy(out->name, name, FAT32_MAX_NAME);
+    out->attr = entry.attr;
+    out->first_cluster = first_cluster;
+    out->size = 0;
+    out->dir_cluster = dir_cluster;
+    out->entry_index = (uint32_t)index + lfn_count;
+    out->lfn_count = (uint8_t)lfn_count;
+    fat32_index_add(vol, out, short_name);
+    return 0;
+}
+
+/**
+ * @brief Deletes a file or an empty directory and frees its clusters.
+ */
+uint8_t fat32_remove(fat32_volume_t* vol, const fat32_node_t* node) {
+    if (node->dir_cluster == 0) return 1;
+
+    if (node->attr & FAT32_ATTR_DIRECTORY) {
+        fat32_node_t child;
+        uint32_t cursor = 0;
+        if (fat32_readdir(vol, node, &cursor, &child) == 0) return 1;
+    }
+
+    char short_name[11] = { 0 };
+    uint8_t res = 0;
+    fat32_dir_iter_t it;
+    fat32_iter_init(&it, vol, node->dir_cluster, node->entry_index - node->lfn_count);
+    for (uint32_t i = 0; i <= node->lfn_count && res == 0; i++) {
+        fat32_dirent_t* entry = fat32_iter_next(&it);
+        if (!entry) {
+            res = 1;
+            break;
+        }
+        if (i == node->lfn_count) memcpy(short_name, entry->name, 11);
+        entry->name[0] = (char)FAT32_DIRENT_DELETED;
+        if (i == node->lfn_count || (it.index % FAT32_ENTRIES_PER_SECTOR) == 0) res = fat32_iter_write(&it);
+    }
+
+    // a failed removal leaves the directory in an unknown state, its index is rebuilt
+    fat32_dir_index_t* index = fat32_index_cached(vol, node->dir_cluster);
+    if (index) {
+        if (res == 0 && fat32_index_erase(index, FAT32_SLOT_NAME, fat32_name_hash(node->name), node->entry_index) &&
+            fat32_index_erase(index, FAT32_SLOT_SHORT, fat32_short_hash(short_name), node->entry_index)) {
+            index->holes += (uint32_t)node->lfn_count + 1;
+        } else {
+            fat32_index_free(index);
+        }
+    }
+    if (res != 0) return res;
+
+    if (node->attr & FAT32_ATTR_DIRECTORY) {
+        // the clusters may hold another directory soon
+        fat32_dir_index_t* own = fat32_index_cached(vol, node->first_cluster);
+        if (own) fat32_index_free(own);
+    }
+    if (node->first_cluster) return fat32_free_chain(vol, node->first_cluster);
+    return 0;
+}
+
+/**
+ * @brief Adds the next clusters of a file to its extents, merging them into the last run if they follow on the disk.
+ */
+static uint8_t fat32_extent_append(fat32_file_t* file, uint32_t disk_cluster, uint32_t length) {
+    if (file->extent_count > 0) {
+        fat32_extent_t* last = &file->extents[file->extent_count - 1];
+        if (last->disk_cluster + last->length == disk_cluster) {
+            last->length += length;
+            file->cluster_count += length;
+            return 0;
+        }
+    }
+
+    if (file->extent_count == file->extent_capacity) {
+        uint32_t capacity = file->extent_capacity ? file->extent_capacity * 2 : 4;
+        fat32_extent_t* extents = (fat32_extent_t*)krealloc((virt_addr_t)file->extents, capacity * sizeof(fat32_extent_t));
+        if (!extents) return 1;
+        file->extents = extents;
+        file->extent_capacity = capacity;
+    }
+
+    file->extents[file->extent_count++] = (fat32_extent_t){ .file_cluster = file->cluster_count, .disk_cluster = disk_cluster, .length = length };
+    file->cluster_count += length;
+    return 0;
+}
+
+/**
+ * @brief Returns the extent holding a cluster of the file, NULL past the end.
+ */
+static fat32_extent_t* fat32_find_extent(fat32_file_t* file, uint32_t file_cluster) {
+    uint32_t low = 0;
+    uint32_t high = file->extent_count;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        fat32_extent_t* extent = &file->extents[mid];
+        if (file_cluster < extent->file_cluster) high = mid;
+        else if (file_cluster >= extent->file_cluster + extent->length) low = mid + 1;
+        else return extent;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Allocates clusters until the file has count of them, in as few extents as possible.
+ */
+static uint8_t fat32_grow(fat32_file_t* file, uint32_t count) {
+    fat32_volume_t* vol = file->volume;
+    while (file->cluster_count < count) {
+        uint32_t prev = 0;
+        if (file->extent_count > 0) {
+            fat32_extent_t* last = &file->extents[file->extent_count - 1];
+            prev = last->disk_cluster + last->length - 1;
+        }
+
+        uint32_t cluster;
+        uint32_t length;
+        if (fat32_alloc_extent(vol, prev, count - file->cluster_count, FAT32_FILE_MIN_RUN, &cluster, &length) != 0) return 1;
+        if (!prev) file->node.first_cluster = cluster;
+        if (fat32_extent_append(file, cluster, length) != 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Moves data between a buffer and the allocated clusters of a file.
+ * @param buffer NULL writes zeros.
+ */
+static uint8_t fat32_transfer(fat32_file_t* file, uint32_t offset, uint8_t* buffer, uint32_t length, bool write) {
+    fat32_volume_t* vol = file->volume;
+
+    while (length > 0) {
+        fat32_extent_t* extent = fat32_find_extent(file, offset >> vol->cluster_shift);
+        if (!extent) return 1;
+
+        uint32_t run_offset = offset - (extent->file_cluster << vol->cluster_shift);
+        uint64_t run_left = ((uint64_t)extent->length << vol->cluster_shift) - run_offset;
+        uint64_t lba = fat32_cluster_lba(vol, extent->disk_cluster) + run_offset / FAT32_SECTOR_SIZE;
+        uint32_t sector_offset = offset % FAT32_SECTOR_SIZE;
+        uint32_t bytes;
+
+        if (buffer && sector_offset == 0 && length >= FAT32_SECTOR_SIZE) {
+            // whole sectors of the run go straight between the device and the buffer
+            uint64_t span = run_left < length ? run_left : length;
+            uint32_t sectors = (uint32_t)(span / FAT32_SECTOR_SIZE);
+            if (sectors > FAT32_MAX_IO_SECTORS) sectors = FAT32_MAX_IO_SECTORS;
+
+            uint8_t res = write ? storage_write(vol->disk, lba, sectors, buffer) : storage_read(vol->disk, lba, sectors, buffer);
+            if (res != 0) return res;
+            bytes = sectors * FAT32_SECTOR_SIZE;
+        } else {
+            bytes = FAT32_SECTOR_SIZE - sector_offset;
+            if (bytes > length) bytes = length;
+
+            if (!write || bytes < FAT32_SECTOR_SIZE) {
+                if (storage_read(vol->disk, lba, 1, vol->sector_buffer) != 0) return 1;
+            }
+            if (write) {
+                if (buffer) memcpy(vol->sector_buffer + sector_offset, buffer, bytes);
+                else memset(vol->sector_buffer + sector_offset, 0, bytes);
+                if (storage_write(vol->disk, lba, 1, vol->sector_buffer) != 0) return 1;
+            } else {
+                memcpy(buffer, vol->sector_buffer + sector_offset, bytes);
+            }
+        }
+
+        offset += bytes;
+        length -= bytes;
+        if (buffer) buffer += bytes;
+    }
+    return 0;
+}
+
+/**
+ * @brief Opens a file found by fat32_find(), fat32_lookup() or fat32_readdir().
+ * @return The file, or NULL for directories, broken chains or when out of memory.
+ */
+fat32_file_t* fat32_open_node(fat32_volume_t* vol, const fat32_node_t* node) {
+    if (node->attr & FAT32_ATTR_DIRECTORY) return NULL;
+
+    fat32_file_t* file = (fat32_file_t*)kzalloc(sizeof(fat32_file_t));
+    if (!file) return NULL;
+    file->volume = vol;
+    file->node = *node;
+
+    uint32_t cluster = node->first_cluster;
+    for (uint32_t steps = 0; fat32_valid_cluster(vol, cluster); steps++) {
+        if (steps >= vol->cluster_count || fat32_extent_append(file, cluster, 1) != 0 || fat32_get_next(vol, cluster, &cluster) != 0) {
+            serial_printf("FAT32: Error: Broken cluster chain of '%s' on %s\n", node->name, vol->disk->name);
+            fat32_close(file);
+            return NULL;
+        }
+    }
+
+    // a size beyond the chain would read clusters the file does not own
+    if (((uint64_t)file->cluster_count << vol->cluster_shift) < node->size) {
+        serial_printf("FAT32: Warning: '%s' is larger than its %u clusters, size clamped\n", node->name, file->cluster_count);
+        file->node.size = file->cluster_count << vol->cluster_shift;
+    }
+
+    file->next_open = vol->open_files;
+    vol->open_files = file;
+    return file;
+}
+
+/**
+ * @brief Opens a file by path.
+ * @param flags FAT32_OPEN_CREATE creates a missing file, FAT32_OPEN_TRUNCATE empties it.
+ */
+fat32_file_t* fat32_open(fat32_volume_t* vol, const char* path, uint32_t flags) {
+    fat32_node_t node;
+    if (fat32_lookup(vol, path, &node) != 0) {
+        if (!(flags & FAT32_OPEN_CREATE)) return NULL;
+
+        const char* slash = NULL;
+        for (const char* p = path; *p; p++) {
+            if (*p == '/') slash = p;
+        }
+        const char* name = slash ? slash + 1 : path;
+
+        char parent_path[FAT32_MAX_NAME + 1];
+        size_t parent_len = slash ? (size_t)(slash - path) : 0;
+        if (parent_len > FAT32_MAX_NAME) return NULL;
+        memcpy(parent_path, path, parent_len);
+        parent_path[parent_len] = '\0';
+
+        fat32_node_t parent;
+        if (fat32_lookup(vol, parent_path, &parent) != 0) return NULL;
+        if (fat32_create(vol, &parent, name, 0, &node) != 0) return NULL;
+    }
+
+    fat32_file_t* file = fat32_open_node(vol, &node);
+    if (file && (flags & FAT32_OPEN_TRUNCATE) && fat32_truncate(file, 0) != 0) {
+        fat32_close(file);
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * @brief Returns the offset from which on the data of a file is held in delayed pages.
+ */
+static uint64_t fat32_delay_start(fat32_file_t* file) {
+    if (file->page_count > 0) return file->page_base;
+    return (uint64_t)file->cluster_count << file->volume->cluster_shift;
+}
+
+/**
+ * @brief Reads up to length bytes at offset.
+ * @return The number of bytes read (0 at the end of the file), or -1 on error.
+ */
+int32_t fat32_read(fat32_file_t* file, uint32_t offset, void* buffer, uint32_t length) {
+    if (offset >= file->node.size) return 0;
+    if (length > file->node.size - offset) length = file->node.size - offset;
+    if (length > INT32_MAX) length = INT32_MAX;
+
+    uint64_t delay_start = fat32_delay_start(file);
+    uint8_t* out = (uint8_t*)buffer;
+    uint32_t done = 0;
+    if (offset < delay_start) {
+        done = delay_start - offset < length ? (uint32_t)(delay_start - offset) : length;
+        if (fat32_transfer(file, offset, out, done, false) != 0) return -1;
+    }
+
+    // the rest lies in delayed pages
+    while (done < length) {
+        uint32_t pos = (uint32_t)(offset + done - delay_start);
+        uint32_t page_offset = pos % FAT32_PAGE_SIZE;
+        uint32_t bytes = FAT32_PAGE_SIZE - page_offset;
+        if (bytes > length - done) bytes = length - done;
+        memcpy(out + done, file->pages[pos / FAT32_PAGE_SIZE] + page_offset, bytes);
+        done += bytes;
+    }
+    return (int32_t)length;
+}
+
+static void fat32_drop_pages(fat32_file_t* file) {
+    for (uint32_t i = 0; i < file->page_count; i++) kfree((virt_addr_t)file->pages[i]);
+    file->page_count = 0;
+}
+
+/**
+ * @brief Allocates clusters for the delayed pages, writes them out and updates the directory entry.
+ *
+ * All delayed data is allocated with a single request, which places it in one
+ * extent whenever a free run is long enough.
+ */
+uint8_t fat32_flush(fat32_file_t* file) {
+    fat32_volume_t* vol = file->volume;
+
+    if (file->page_count > 0) {
+        uint32_t clusters = (uint32_t)(((uint64_t)file->node.size + vol->cluster_size - 1) >> vol->cluster_shift);
+        if (fat32_grow(file, clusters) != 0) {
+            file->entry_dirty = true;
+            return 1;
+        }
+
+        for (uint32_t i = 0; i < file->page_count; i++) {
+            uint64_t offset = file->page_base + (uint64_t)i * FAT32_PAGE_SIZE;
+            // whole sectors avoid reading back the new clusters, the page is zero past the end
+            uint64_t bytes = ((uint64_t)file->node.size - offset + FAT32_SECTOR_SIZE - 1) & ~(uint64_t)(FAT32_SECTOR_SIZE - 1);
+            if (bytes > FAT32_PAGE_SIZE) bytes = FAT32_PAGE_SIZE;
+            if (fat32_transfer(file, (uint32_t)offset, file->pages[i], (uint32_t)bytes, true) != 0) return 1;
+        }
+        fat32_drop_pages(file);
+        vol->writebacks++;
+        file->entry_dirty = true;
+    }
+
+    if (file->entry_dirty) {
+        if (fat32_update_entry(vol, &file->node) != 0) return 1;
+        file->entry_dirty = false;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes length bytes at offset, growing the file as needed.
+ *
+ * Bytes within the allocated clusters are written right away, bytes past them
+ * go to delayed pages. A write that would need more than FAT32_DELAY_MAX_PAGES
+ * pages flushes them and allocates its own clusters at once. A gap between the
+ * old end of the file and offset is filled with zeros.
+ * @return The number of bytes written, or -1 on error.
+ */
+int32_t fat32_write(fat32_file_t* file, uint32_t offset, const void* buffer, uint32_t length) {
+    fat32_volume_t* vol = file->volume;
+    if (length > UINT32_MAX - offset) length = UINT32_MAX - offset;
+    if (length > INT32_MAX) length = INT32_MAX;
+    if (length == 0) return 0;
+
+    uint32_t end = offset + length;
+    uint64_t delay_start = fat32_delay_start(file);
+    if (end > delay_start && end - delay_start > (uint64_t)FAT32_DELAY_MAX_PAGES * FAT32_PAGE_SIZE) {
+        if (fat32_flush(file) != 0) return -1;
+        uint32_t clusters = (uint32_t)(((uint64_t)end + vol->cluster_size - 1) >> vol->cluster_shift);
+        file->entry_dirty = true;
+        if (fat32_grow(file, clusters) != 0) return -1;
+        delay_start = fat32_delay_start(file);
+    }
+
+    const uint8_t* in = (const uint8_t*)buffer;
+    uint32_t direct = 0;
+    if (offset < delay_start) {
+        direct = delay_start - offset < length ? (uint32_t)(delay_start - offset) : length;
+        if (offset > file->node.size && fat32_transfer(file, file->node.size, NULL, offset - file->node.size, true) != 0) return -1;
+        if (fat32_transfer(file, offset, (uint8_t*)in, direct, true) != 0) return -1;
+    } else if (file->node.size < delay_start) {
+        if (fat32_transfer(file, file->node.size, NULL, (uint32_t)(delay_start - file->node.size), true) != 0) return -1;
+    }
+
+    // new pages are zeroed, which also fills any gap in front of the data
+    if (direct < length && file->page_count == 0) file->page_base = (uint32_t)delay_start;
+    uint32_t done = direct;
+    while (done < length) {
+        uint32_t pos = (uint32_t)(offset + done - delay_start);
+        uint32_t page = pos / FAT32_PAGE_SIZE;
+        while (file->page_count <= page) {
+            uint8_t* data = (uint8_t*)kzalloc(FAT32_PAGE_SIZE);
+            if (!data) return -1;
+            file->pages[file->page_count++] = data;
+        }
+        uint32_t page_offset = pos % FAT32_PAGE_SIZE;
+        uint32_t bytes = FAT32_PAGE_SIZE - page_offset;
+        if (bytes > length - done) bytes = length - done;
+        memcpy(file->pages[page] + page_offset, in + done, bytes);
+        done += bytes;
+    }
+    if (direct < length) vol->delayed_writes++;
+
+    if (end > file->node.size) file->node.size = end;
+    file->entry_dirty = true;
+    return (int32_t)length;
+}
+
+/**
+ * @brief Sets the size of a file, freeing clusters past a new, smaller size.
+ */
+uint8_t fat32_truncate(fat32_file_t* file, uint32_t size) {
+    fat32_volume_t* vol = file->volume;
+
+    if (size > file->node.size) {
+        uint8_t zero = 0;
+        // writing the last byte zero fills the gap in front of it
+        return fat32_write(file, size - 1, &zero, 1) == 1 ? 0 : 1;
+    }
+
+    // delayed pages past the new size are dropped, the rest of the last one kept is zeroed
+    if (file->page_count > 0) {
+        if (size <= file->page_base) {
+            fat32_drop_pages(file);
+        } else {
+            uint32_t keep_bytes = size - file->page_base;
+            uint32_t keep_pages = (keep_bytes + FAT32_PAGE_SIZE - 1) / FAT32_PAGE_SIZE;
+            while (file->page_count > keep_pages) kfree((virt_addr_t)file->pages[--file->page_count]);
+            uint32_t tail = keep_bytes % FAT32_PAGE_SIZE;
+            if (tail) memset(file->pages[keep_pages - 1] + tail, 0, FAT32_PAGE_SIZE - tail);
+        }
+    }
+
+    uint32_t keep = (uint32_t)(((uint64_t)size + vol->cluster_size - 1) >> vol->cluster_shift);
+    if (keep < file->cluster_count) {
+        uint32_t first_freed;
+        if (keep == 0) {
+            first_freed = file->node.first_cluster;
+            file->node.first_cluster = 0;
+        } else {
+            fat32_extent_t* extent = fat32_find_extent(file, keep - 1);
+            uint32_t last = extent->disk_cluster + (keep - 1 - extent->file_cluster);
+            if (fat32_get_next(vol, last, &first_freed) != 0) return 1;
+            if (fat32_set_next(vol, last, FAT32_CLUSTER_LAST) != 0) return 1;
+        }
+        if (fat32_free_chain(vol, first_freed) != 0) return 1;
+
+        // drop the extents past the new end and shorten the one it falls into
+        while (file->extent_count > 0 && file->extents[file->extent_count - 1].file_cluster >= keep) file->extent_count--;
+        if (file->extent_count > 0) {
+            fat32_extent_t* last = &file->extents[file->extent_count - 1];
+            last->length = keep - last->file_cluster;
+        }
+        file->cluster_count = keep;
+    }
+
+    file->node.size = size;
+    file->entry_dirty = true;
+    return fat32_flush(file);
+}
+
+/**
+ * @brief Writes back and closes a file.
+ */
+void fat32_close(fat32_file_t* file) {
+    if (!file) return;
+    fat32_volume_t* vol = file->volume;
+    if (fat32_flush(file) != 0) {
+        serial_printf("FAT32: Error: Delayed data of '%s' on %s is lost\n", file->node.name, vol->disk->name);
+    }
+
+    for (fat32_file_t** link = &vol->open_files; *link; link = &(*link)->next_open) {
+        if (*link != file) continue;
+        *link = file->next_open;
+        break;
+    }
+    fat32_drop_pages(file);
+    if (file->extents) kfree((virt_addr_t)file->extents);
+    kfree((virt_addr_t)file);
+}
+
+/**
+ * @brief Writes back open files, the cached FAT and the FSInfo hints and flushes the disk.
+ */
+uint8_t fat32_sync(fat32_volume_t* vol) {
+    uint8_t res = 0;
+    for (fat32_file_t* file = vol->open_files; file; file = file->next_open) {
+        if (fat32_flush(file) != 0) res = 1;
+    }
+    if (fat32_flush_fat(vol) != 0) return 1;
+
+    if (vol->fsinfo_dirty && vol->fsinfo_sector) {
+        fat32_fsinfo_t* fsinfo = (fat32_fsinfo_t*)vol->sector_buffer;
+        if (storage_read(vol->disk, vol->fsinfo_sector, 1, fsinfo) != 0) return 1;
+        if (fsinfo->lead_signature == FAT32_FSINFO_LEAD_SIG && fsinfo->struct_signature == FAT32_FSINFO_STRUCT_SIG) {
+            fsinfo->free_count = vol->free_count;
+            fsinfo->next_free = vol->next_free;
+            if (storage_write(vol->disk, vol->fsinfo_sector, 1, fsinfo) != 0) return 1;
+        }
+        vol->fsinfo_dirty = false;
+    }
+
+    if (storage_flush(vol->disk) != 0) return 1;
+    return res;
+}
+
+/**
+ * @brief Mounts the FAT32 volume on a disk or partition.
+ * @return The volume, or NULL if the disk holds no FAT32 filesystem.
+ */
+fat32_volume_t* fat32_mount(disk_t* disk) {
+    if (!disk || volume_count >= FAT32_MAX_VOLUMES || disk->sector_size != FAT32_SECTOR_SIZE) return NULL;
+
+    fat32_bpb_t bpb;
+    if (storage_read(disk, 0, 1, &bpb) != 0) return NULL;
+
+    // FAT32 is told apart from FAT12/16 by its layout, not by the type string
+    uint8_t spc = bpb.sectors_per_cluster;
+    if (bpb.signature != 0xAA55 || bpb.bytes_per_sector != FAT32_SECTOR_SIZE || spc == 0 || (spc & (spc - 1)) != 0 ||
+        bpb.reserved_sectors == 0 || bpb.fat_count == 0 || bpb.root_entry_count != 0 || bpb.fat_size_16 != 0 || bpb.fat_size_32 == 0) {
+        return NULL;
+    }
+
+    uint32_t total_sectors = bpb.total_sectors_16 ? bpb.total_sectors_16 : bpb.total_sectors_32;
+    uint32_t meta_sectors = bpb.reserved_sectors + bpb.fat_count * bpb.fat_size_32;
+    if (total_sectors > disk->total_sectors || total_sectors <= meta_sectors) return NULL;
+
+    uint32_t cluster_count = (total_sectors - meta_sectors) / spc;
+    uint32_t fat_capacity = bpb.fat_size_32 * (FAT32_SECTOR_SIZE / sizeof(uint32_t)) - 2;
+    if (cluster_count > fat_capacity) cluster_count = fat_capacity;
+    if (cluster_count < 65525) {
+        serial_printf("FAT32: %s has %u clusters, too few for FAT32\n", disk->name, cluster_count);
+        return NULL;
+    }
+
+    fat32_volume_t* vol = (fat32_volume_t*)kzalloc(sizeof(fat32_volume_t));
+    if (!vol) return NULL;
+
+    vol->disk = disk;
+    vol->sectors_per_cluster = spc;
+    vol->cluster_size = spc * FAT32_SECTOR_SIZE;
+    while ((1u << vol->cluster_shift) < vol->cluster_size) vol->cluster_shift++;
+    vol->fat_count = bpb.fat_count;
+    vol->fat_sectors = bpb.fat_size_32;
+    vol->fat_lba = bpb.reserved_sectors;
+    vol->data_lba = meta_sectors;
+    vol->root_cluster = bpb.root_cluster;
+    vol->cluster_count = cluster_count;
+    vol->next_free = 2;
+
+    vol->fat_chunk_count = (vol->fat_sectors + FAT32_FAT_CHUNK_SECTORS - 1) / FAT32_FAT_CHUNK_SECTORS;
+    vol->fat_cache = (fat32_fat_chunk_t*)kzalloc(vol->fat_chunk_count * sizeof(fat32_fat_chunk_t));
+    vol->used_bitmap = (uint32_t*)kmalloc((cluster_count + 31) / 32 * sizeof(uint32_t));
+    if (vol->fat_cache && vol->used_bitmap && fat32_valid_cluster(vol, vol->root_cluster)) vol->free_count = fat32_build_bitmap(vol);
+    if (!vol->fat_cache || !vol->used_bitmap || !fat32_valid_cluster(vol, vol->root_cluster) || vol->free_count == UINT32_MAX) {
+        serial_printf("FAT32: Error: Failed to set up %s\n", disk->name);
+        if (vol->fat_cache) kfree((virt_addr_t)vol->fat_cache);
+        if (vol->used_bitmap) kfree((virt_addr_t)vol->used_bitmap);
+        kfree((virt_addr_t)vol);
+        return NULL;
+    }
+
+    // the counted free clusters replace a stale FSInfo hint at the next sync
+    if (bpb.fsinfo_sector != 0 && bpb.fsinfo_sector != 0xFFFF && bpb.fsinfo_sector < bpb.reserved_sectors) {
+        fat32_fsinfo_t* fsinfo = (fat32_fsinfo_t*)vol->sector_buffer;
+        if (storage_read(disk, bpb.fsinfo_sector, 1, fsinfo) == 0 &&
+            fsinfo->lead_signature == FAT32_FSINFO_LEAD_SIG && fsinfo->struct_signature == FAT32_FSINFO_STRUCT_SIG) {
+            vol->fsinfo_sector = bpb.fsinfo_sector;
+            if (fat32_valid_cluster(vol, fsinfo->next_free)) vol->next_free = fsinfo->next_free;
+            if (fsinfo->free_count != vol->free_count) {
+                serial_printf("FAT32: FSInfo of %s claims %u free clusters, counted %u\n", disk->name, fsinfo->free_count, vol->free_count);
+                vol->fsinfo_dirty = true;
+            }
+        }
+    }
+
+    volumes[volume_count++] = vol;
+    serial_printf("FAT32: Mounted %s: %u clusters of %u bytes, %u FATs of %u sectors\n",
+                  disk->name, cluster_count, vol->cluster_size, vol->fat_count, vol->fat_sectors);
+    return vol;
+}
+
+/**
+ * @brief Writes everything back and releases a volume.
+ */
+void fat32_unmount(fat32_volume_t* vol) {
+    fat32_sync(vol);
+
+    for (uint32_t i = 0; i < volume_count; i++) {
+        if (volumes[i] != vol) continue;
+        volumes[i] = volumes[--volume_count];
+        break;
+    }
+    for (uint32_t i = 0; i < FAT32_INDEX_BUCKETS; i++) {
+        while (vol->index_table[i]) fat32_index_free(vol->index_table[i]);
+    }
+    for (uint32_t chunk = 0; chunk < vol->fat_chunk_count; chunk++) {
+        if (vol->fat_cache[chunk].entries) kfree((virt_addr_t)vol->fat_cache[chunk].entries);
+    }
+    kfree((virt_addr_t)vol->fat_cache);
+    kfree((virt_addr_t)vol->used_bitmap);
+    kfree((virt_addr_t)vol);
+}
+
+uint32_t fat32_get_volume_count(void) {
+    return volume_count;
+}
+
+fat32_volume_t* fat32_get_volume(uint32_t index) {
+    return index < volume_count ? volumes[index] : NULL;
+}
+
+/**
+ * @brief Returns the directory entry behind a vnode, directories keep a node and files an open file.
+ */
+static fat32_node_t* fat32_vnode_node(vfs_vnode_t* vnode) {
+    if (vnode->type == VFS_TYPE_DIR) return (fat32_node_t*)vnode->private;
+    return &((fat32_file_t*)vnode->private)->node;
+}
+
+/**
+ * @brief Fills in a vnode for a directory entry.
+ *
+ * The position of the 8.3 entry identifies the node, the root directory has none and gets 0.
+ */
+static uint8_t fat32_vfs_fill(fat32_volume_t* vol, const fat32_node_t* node, vfs_vnode_t* out) {
+    out->ino = node->dir_cluster ? ((uint64_t)node->dir_cluster << 32) | node->entry_index : 0;
+    out->size = node->size;
+
+    if (node->attr & FAT32_ATTR_DIRECTORY) {
+        fat32_node_t* copy = (fat32_node_t*)kmalloc(sizeof(fat32_node_t));
+        if (!copy) return 1;
+        *copy = *node;
+        out->type = VFS_TYPE_DIR;
+        out->size = 0;
+        out->private = copy;
+        return 0;
+    }
+
+    fat32_file_t* file = fat32_open_node(vol, node);
+    if (!file) return 1;
+    out->type = VFS_TYPE_FILE;
+    out->size = file->node.size;
+    out->private = file;
+    return 0;
+}
+
+static uint8_t fat32_vfs_lookup(vfs_vnode_t* dir, const char* name, vfs_vnode_t* out) {
+    fat32_volume_t* vol = (fat32_volume_t*)dir->mount->private;
+    fat32_node_t node;
+    if (fat32_find(vol, fat32_vnode_node(dir), name, &node) != 0) return 1;
+    return fat32_vfs_fill(vol, &node, out);
+}
+
+static uint8_t fat32_vfs_create(vfs_vnode_t* dir, const char* name, uint8_t type, vfs_vnode_t* out) {
+    fat32_volume_t* vol = (fat32_volume_t*)dir->mount->private;
+    fat32_node_t node;
+    if (fat32_create(vol, fat32_vnode_node(dir), name, type == VFS_TYPE_DIR ? FAT32_ATTR_DIRECTORY : 0, &node) != 0) return 1;
+    return fat32_vfs_fill(vol, &node, out);
+}
+
+static uint8_t fat32_vfs_remove(vfs_vnode_t* dir, vfs_vnode_t* node) {
+    if (node->type == VFS_TYPE_FILE) {
+        // the released vnode must not write delayed data over a freed entry
+        fat32_file_t* file = (fat32_file_t*)node->private;
+        fat32_drop_pages(file);
+        file->entry_dirty = false;
+    }
+    return fat32_remove((fat32_volume_t*)dir->mount->private, fat32_vnode_node(node));
+}
+
+static uint8_t fat32_vfs_readdir(vfs_vnode_t* dir, uint32_t* cursor, vfs_dirent_t* out) {
+    fat32_node_t node;
+    if (fat32_readdir((fat32_volume_t*)dir->mount->private, fat32_vnode_node(dir), cursor, &node) != 0) return 1;
+    strcpy(out->name, node.name);
+    out->type = (node.attr & FAT32_ATTR_DIRECTORY) ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+    out->size = (node.attr & FAT32_ATTR_DIRECTORY) ? 0 : node.size;
+    return 0;
+}
+
+static int32_t fat32_vfs_read(vfs_vnode_t* node, uint64_t offset, void* buffer, uint32_t length) {
+    if (offset >= node->size) return 0;
+    return fat32_read((fat32_file_t*)node->private, (uint32_t)offset, buffer, length);
+}
+
+static int32_t fat32_vfs_write(vfs_vnode_t* node, uint64_t offset, const void* buffer, uint32_t length) {
+    if (offset > UINT32_MAX) return -1;
+    fat32_file_t* file = (fat32_file_t*)node->private;
+    int32_t res = fat32_write(file, (uint32_t)offset, buffer, length);
+    node->size = file->node.size;
+    return res;
+}
+
+static uint8_t fat32_vfs_truncate(vfs_vnode_t* node, uint64_t size) {
+    if (size > UINT32_MAX) return 1;
+    fat32_file_t* file = (fat32_file_t*)node->private;
+    uint8_t res = fat32_truncate(file, (uint32_t)size);
+    node->size = file->node.size;
+    return res;
+}
+
+/**
+ * @brief Maps a file offset to its sector, for reads that go straight to the disk.
+ *
+ * Delayed data has no clusters yet and cannot be mapped.
+ */
+static uint8_t fat32_vfs_bmap(vfs_vnode_t* node, uint64_t offset, uint64_t* lba, uint32_t* length) {
+    fat32_file_t* file = (fat32_file_t*)node->private;
+    fat32_volume_t* vol = file->volume;
+    uint64_t delay_start = fat32_delay_start(file);
+    if (offset >= delay_start) return 1;
+
+    fat32_extent_t* extent = fat32_find_extent(file, (uint32_t)offset >> vol->cluster_shift);
+    if (!extent) return 1;
+
+    uint32_t run_offset = (uint32_t)offset - (extent->file_cluster << vol->cluster_shift);
+    uint64_t run_end = (uint64_t)(extent->file_cluster + extent->length) << vol->cluster_shift;
+    if (run_end > delay_start) run_end = delay_start;
+
+    *lba = fat32_cluster_lba(vol, extent->disk_cluster) + run_offset / FAT32_SECTOR_SIZE;
+    *length = run_end - offset > UINT32_MAX ? UINT32_MAX : (uint32_t)(run_end - offset);
+    return 0;
+}
+
+static uint8_t fat32_vfs_sync(vfs_mount_t* mount) {
+    return fat32_sync((fat32_volume_t*)mount->private);
+}
+
+static void fat32_vfs_release(vfs_vnode_t* node) {
+    if (node->type == VFS_TYPE_DIR) kfree((virt_addr_t)node->private);
+    else fat32_close((fat32_file_t*)node->private);
+}
+
+static uint8_t fat32_vfs_mount(vfs_mount_t* mount, disk_t* disk, vfs_vnode_t* root) {
+    fat32_volume_t* vol = fat32_mount(disk);
+    if (!vol) return 1;
+
+    fat32_node_t node;
+    fat32_root_node(vol, &node);
+    if (fat32_vfs_fill(vol, &node, root) != 0) {
+        fat32_unmount(vol);
+        return 1;
+    }
+    mount->private = vol;
+    return 0;
+}
+
+static void fat32_vfs_unmount(vfs_mount_t* mount) {
+    fat32_unmount((fat32_volume_t*)mount->private);
+}
+
+static void fat32_vfs_dump(vfs_mount_t* mount) {
+    fat32_volume_t* vol = (fat32_volume_t*)mount->private;
+    char buf[128];
+
+    uint32_t loaded = 0;
+    for (uint32_t c = 0; c < vol->fat_chunk_count; c++) {
+        if (vol->fat_cache[c].entries) loaded++;
+    }
+
+    snprintf(buf, sizeof(buf), "  Clusters:  %u of %u bytes\n", vol->cluster_count, vol->cluster_size);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+    uint32_t largest;
+    fat32_find_run(vol, UINT32_MAX, &largest);
+    snprintf(buf, sizeof(buf), "  Free:      %u clusters (%llu MB), largest run %u clusters\n",
+             vol->free_count, ((uint64_t)vol->free_count * vol->cluster_size) >> 20, largest);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+    snprintf(buf, sizeof(buf), "  FAT cache: %u of %u chunks loaded, %llu hits, %llu misses\n", loaded, vol->fat_chunk_count, vol->fat_hits, vol->fat_misses);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+
+    uint32_t pages = 0;
+    for (fat32_file_t* file = vol->open_files; file; file = file->next_open) pages += file->page_count;
+    uint32_t indexes = 0;
+    uint32_t bytes = 0;
+    for (uint32_t i = 0; i < FAT32_INDEX_BUCKETS; i++) {
+        for (fat32_dir_index_t* index = vol->index_table[i]; index; index = index->hash_next) {
+            indexes++;
+            bytes += sizeof(fat32_dir_index_t) + index->capacity * sizeof(fat32_index_slot_t);
+        }
+    }
+    snprintf(buf, sizeof(buf), "  Dir index: %u directories in %u KB (%u KB limit), %llu hits, %llu builds, %llu evictions\n",
+             indexes, bytes / 1024, index_limit / 1024, vol->index_hits, vol->index_builds, vol->index_evictions);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+
+    snprintf(buf, sizeof(buf), "  Delayed:   %u pages pending, %llu writes delayed, %llu writebacks\n", pages, vol->delayed_writes, vol->writebacks);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+}
+
+static const vfs_ops_t fat32_vfs_ops = {
+    .lookup = fat32_vfs_lookup,
+    .create = fat32_vfs_create,
+    .remove = fat32_vfs_remove,
+    .readdir = fat32_vfs_readdir,
+    .read = fat32_vfs_read,
+    .write = fat32_vfs_write,
+    .truncate = fat32_vfs_truncate,
+    .bmap = fat32_vfs_bmap,
+    .sync = fat32_vfs_sync,
+    .release = fat32_vfs_release
+};
+
+static const vfs_fs_type_t fat32_fs_type = {
+    .name = "fat32",
+    .flags = VFS_FS_CASE_INSENSITIVE,
+    .mount = fat32_vfs_mount,
+    .unmount = fat32_vfs_unmount,
+    .dump = fat32_vfs_dump,
+    .ops = &fat32_vfs_ops
+};
+
+/**
+ * @brief Registers FAT32 with the VFS and mounts every FAT32 volume found.
+ *
+ * Volumes are mounted at /<disk name>, the one named by root=<disk name> on
+ * the kernel command line at /. dirindex=<KB> sets the memory kept for
+ * directory indexes.
+ */
+void fat32_init(void) {
+    vfs_register_fs(&fat32_fs_type);
+
+    const char* limit = kernel_cmdline_get("dirindex=");
+    if (limit) index_limit = (uint32_t)str_to_u64_legacy(limit) * 1024;
+
+    const char* root = kernel_cmdline_get("root=");
+    size_t root_len = 0;
+    while (root && root[root_len] && root[root_len] != ' ') root_len++;
+
+    uint8_t disk_count = storage_get_disk_count();
+    for (uint8_t i = 0; i < disk_count; i++) {
+        disk_t* disk = storage_get_disk(i);
+        char path[sizeof(disk->name) + 1];
+        if (root && strlen(disk->name) == root_len && strncmp(disk->name, root, root_len) == 0) {
+            strcpy(path, "/");
+        } else {
+            snprintf(path, sizeof(path), "/%s", disk->name);
+        }
+        vfs_mount(path, "fat32", disk);
+    }
+}
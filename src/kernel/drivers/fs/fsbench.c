@@ -0,0 +1,378 @@
+/**
+ * @file fsbench.c
+ * @brief In-kernel filesystem benchmark
+ * @author friedrichOsDev
+ *
+ * Runs metadata and data tests through the VFS in a scratch directory below
+ * the benchmarked path: creating, stating, listing and unlinking many small
+ * files, sequential reads and writes of a large file, and random 4 KB reads
+ * of it, one at a time and through the async I/O rings. Read tests run twice,
+ * cold after the VFS, page and block caches were emptied and warm right
+ * after. Each test prints a human readable line to the console and a machine
+ * readable "FSBENCH key=value ..." line to the serial port.
+ */
+
+#include <fsbench.h>
+#include <aio.h>
+#include <bcache.h>
+#include <partman.h>
+#include <timer.h>
+#include <console.h>
+#include <serial.h>
+#include <print.h>
+#include <string.h>
+#include <convert.h>
+
+typedef struct {
+    const char* test;
+    const char* cache;       /**< "cold", "warm" or "-" for tests that write. */
+    uint32_t queue_depth;    /**< 0 for tests that do one operation at a time. */
+    uint32_t ops;
+    uint64_t bytes;
+    uint64_t elapsed_ns;
+    uint32_t errors;
+} fsbench_result_t;
+
+// kernel image memory is physically contiguous, which drivers with a single DMA segment rely on
+static uint8_t bench_buffer[FSBENCH_MAX_BLOCK] __attribute__((aligned(4096)));
+static char bench_dir[VFS_MAX_PATH];
+static char bench_path[VFS_MAX_PATH];
+static vfs_mount_t* bench_mount;
+static uint32_t rng_state;
+
+/**
+ * @brief xorshift32, seeded the same way for every test so runs are comparable.
+ */
+static uint32_t fsbench_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void fsbench_print(const char* str) {
+    for (int i = 0; str[i]; i++) console_putc((uint32_t)str[i]);
+}
+
+static const char* fsbench_file(uint32_t index) {
+    snprintf(bench_path, sizeof(bench_path), "%s/f%05u", bench_dir, index);
+    return bench_path;
+}
+
+static const char* fsbench_large(void) {
+    snprintf(bench_path, sizeof(bench_path), "%s/large.bin", bench_dir);
+    return bench_path;
+}
+
+/**
+ * @brief Writes everything back and empties the VFS, page and block caches for a cold test.
+ *
+ * The blocks of a partition are cached for its parent disk, so the whole
+ * parent is dropped from the block cache.
+ */
+static void fsbench_drop_caches(void) {
+    vfs_sync();
+    vfs_drop_caches();
+    disk_t* backing = partman_resolve(bench_mount->disk, NULL);
+    if (backing) bcache_invalidate_disk(backing);
+}
+
+static void fsbench_start(fsbench_result_t* result, const char* test, const char* cache, uint32_t queue_depth) {
+    memset(result, 0, sizeof(fsbench_result_t));
+    result->test = test;
+    result->cache = cache;
+    result->queue_depth = queue_depth;
+    rng_state = 0x2545F491;
+    result->elapsed_ns = timer_get_ns();
+}
+
+/**
+ * @brief Stops the clock and prints the result to the console and the summary line to serial.
+ */
+static void fsbench_report(fsbench_result_t* result) {
+    result->elapsed_ns = timer_get_ns() - result->elapsed_ns;
+
+    uint64_t elapsed_us = result->elapsed_ns;
+    div64_32(&elapsed_us, 1000);
+    if (elapsed_us == 0) elapsed_us = 1;
+    uint32_t divisor = elapsed_us > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed_us;
+
+    // MB/s with two decimals, scaled in steps that cannot overflow
+    uint64_t rate = (((result->bytes * 100) >> 10) * 1000000) >> 10;
+    div64_32(&rate, divisor);
+    uint64_t ops_per_sec = (uint64_t)result->ops * 1000000;
+    div64_32(&ops_per_sec, divisor);
+    uint64_t rate_whole = rate;
+    uint32_t rate_frac = div64_32(&rate_whole, 100);
+
+    char qd[8] = "";
+    if (result->queue_depth) snprintf(qd, sizeof(qd), "qd %u", result->queue_depth);
+
+    char buf[160];
+    snprintf(buf, sizeof(buf), "%-8s %-5s %-5s %7u ops %8llu ops/s %5llu.%02u MB/s%s\n",
+        result->test, result->cache, qd, result->ops, ops_per_sec, rate_whole, rate_frac, result->errors ? "  ERRORS" : "");
+    fsbench_print(buf);
+
+    serial_printf("FSBENCH fs=%s disk=%s test=%s cache=%s qd=%u ops=%u bytes=%llu usec=%llu ops_per_sec=%llu mbps_x100=%llu errors=%u\n",
+        bench_mount->type->name, bench_mount->disk ? bench_mount->disk->name : "none", result->test, result->cache,
+        result->queue_depth, result->ops, result->bytes, elapsed_us, ops_per_sec, rate, result->errors);
+}
+
+static void fsbench_create(const fsbench_config_t* config, fsbench_result_t* result) {
+    for (uint32_t i = 0; i < config->files; i++) {
+        vfs_file_t* file = vfs_open(fsbench_file(i), VFS_OPEN_CREATE | VFS_OPEN_TRUNCATE);
+        if (!file) {
+            result->errors++;
+            continue;
+        }
+        if (config->file_size && vfs_write(file, 0, bench_buffer, config->file_size) != (int32_t)config->file_size) result->errors++;
+        vfs_close(file);
+        result->ops++;
+        result->bytes += config->file_size;
+    }
+    // the time to get the files to the disk is part of creating them
+    if (vfs_sync() != 0) result->errors++;
+}
+
+static void fsbench_stat(const fsbench_config_t* config, fsbench_result_t* result) {
+    vfs_stat_t stat;
+    for (uint32_t i = 0; i < config->files; i++) {
+        if (vfs_stat(fsbench_file(i), &stat) != 0 || stat.size != config->file_size) result->errors++;
+        result->ops++;
+    }
+}
+
+static void fsbench_list(const fsbench_config_t* config, fsbench_result_t* result) {
+    vfs_file_t* dir = vfs_open(bench_dir, 0);
+    if (!dir) {
+        result->errors++;
+        return;
+    }
+    uint32_t cursor = 0;
+    vfs_dirent_t entry;
+    while (vfs_readdir(dir, &cursor, &entry) == 0) result->ops++;
+    vfs_close(dir);
+
+    // the large file may be there as well
+    if (result->ops < config->files) result->errors++;
+}
+
+static void fsbench_unlink(const fsbench_config_t* config, fsbench_result_t* result) {
+    for (uint32_t i = 0; i < config->files; i++) {
+        if (vfs_unlink(fsbench_file(i)) != 0) result->errors++;
+        result->ops++;
+    }
+    if (vfs_sync() != 0) result->errors++;
+}
+
+static void fsbench_seq(const fsbench_config_t* config, bool write, fsbench_result_t* result) {
+    uint64_t size = (uint64_t)config->large_kb * 1024;
+    vfs_file_t* file = vfs_open(fsbench_large(), write ? VFS_OPEN_CREATE | VFS_OPEN_TRUNCATE : 0);
+    if (!file) {
+        result->errors++;
+        return;
+    }
+
+    for (uint64_t offset = 0; offset < size; offset += config->block_size) {
+        uint32_t length = size - offset < config->block_size ? (uint32_t)(size - offset) : config->block_size;
+        int32_t done = write ? vfs_write(file, offset, bench_buffer, length) : vfs_read(file, offset, bench_buffer, length);
+        if (done != (int32_t)length) {
+            result->errors++;
+            break;
+        }
+        result->ops++;
+        result->bytes += length;
+    }
+    vfs_close(file);
+    if (write && vfs_sync() != 0) result->errors++;
+}
+
+static uint64_t fsbench_random_offset(const fsbench_config_t* config) {
+    uint32_t blocks = config->large_kb / (FSBENCH_RANDOM_BLOCK / 1024);
+    return (uint64_t)(fsbench_random() % blocks) * FSBENCH_RANDOM_BLOCK;
+}
+
+static void fsbench_rand(const fsbench_config_t* config, fsbench_result_t* result) {
+    vfs_file_t* file = vfs_open(fsbench_large(), 0);
+    if (!file) {
+        result->errors++;
+        return;
+    }
+    for (uint32_t i = 0; i < config->ops; i++) {
+        if (vfs_read(file, fsbench_random_offset(config), bench_buffer, FSBENCH_RANDOM_BLOCK) != FSBENCH_RANDOM_BLOCK) result->errors++;
+        result->ops++;
+        result->bytes += FSBENCH_RANDOM_BLOCK;
+    }
+    vfs_close(file);
+}
+
+/**
+ * @brief Random reads with queue_depth of them in flight, each in its own slot of the buffer.
+ */
+static void fsbench_rand_async(const fsbench_config_t* config, fsbench_result_t* result) {
+    vfs_file_t* file = vfs_open(fsbench_large(), 0);
+    aio_ring_t* ring = aio_create(config->queue_depth);
+    if (!file || !ring) {
+        result->errors++;
+        if (file) vfs_close(file);
+        if (ring) aio_destroy(ring);
+        return;
+    }
+
+    uint32_t busy = 0; // one bit per buffer slot
+    uint32_t submitted = 0;
+    aio_cqe_t completions[FSBENCH_MAX_QD];
+    while (result->ops < config->ops) {
+        for (uint32_t slot = 0; slot < config->queue_depth && submitted < config->ops; slot++) {
+            if (busy & (1u << slot)) continue;
+            aio_sqe_t* sqe = aio_get_sqe(ring);
+            if (!sqe) break;
+            sqe->op = AIO_OP_READ;
+            sqe->file = file;
+            sqe->offset = fsbench_random_offset(config);
+            sqe->buffer = bench_buffer + slot * FSBENCH_RANDOM_BLOCK;
+            sqe->length = FSBENCH_RANDOM_BLOCK;
+            sqe->user_data = (void*)(uintptr_t)slot;
+            busy |= 1u << slot;
+            submitted++;
+        }
+        aio_submit(ring);
+        aio_wait(ring, 1);
+
+        uint32_t count = aio_reap(ring, completions, FSBENCH_MAX_QD);
+        for (uint32_t i = 0; i < count; i++) {
+            busy &= ~(1u << (uint32_t)(uintptr_t)completions[i].user_data);
+            if (completions[i].result != FSBENCH_RANDOM_BLOCK) result->errors++;
+            result->ops++;
+            result->bytes += FSBENCH_RANDOM_BLOCK;
+        }
+    }
+    aio_destroy(ring);
+    vfs_close(file);
+}
+
+/**
+ * @brief Fills in the default run: all tests with 1000 files of 1 KB and a 4 MB file.
+ */
+void fsbench_default_config(fsbench_config_t* config) {
+    memset(config, 0, sizeof(fsbench_config_t));
+    config->files = FSBENCH_DEFAULT_FILES;
+    config->file_size = FSBENCH_DEFAULT_FILE_SIZE;
+    config->large_kb = FSBENCH_DEFAULT_LARGE_KB;
+    config->block_size = FSBENCH_DEFAULT_BLOCK;
+    config->ops = FSBENCH_DEFAULT_OPS;
+    config->queue_depth = FSBENCH_DEFAULT_QD;
+    config->tests = FSBENCH_ALL;
+}
+
+/**
+ * @brief Runs the configured tests in a scratch directory below path, which is removed afterwards.
+ * @return 0 on success, 1 for an invalid configuration or path.
+ */
+uint8_t fsbench_run(const char* path, const fsbench_config_t* config) {
+    if (!path || !config || config->tests == 0) return 1;
+    if (config->files == 0 || config->files > FSBENCH_MAX_FILES || config->file_size > FSBENCH_MAX_BLOCK) {
+        serial_printf("FSBench: Error: Use 1 to %u files of up to %u bytes\n", FSBENCH_MAX_FILES, FSBENCH_MAX_BLOCK);
+        return 1;
+    }
+    if (config->block_size == 0 || config->block_size > FSBENCH_MAX_BLOCK || config->large_kb < FSBENCH_RANDOM_BLOCK / 1024 || config->large_kb > 1024 * 1024) {
+        serial_printf("FSBench: Error: Invalid block size or large file size\n");
+        return 1;
+    }
+    if (config->ops == 0 || config->queue_depth == 0 || config->queue_depth > FSBENCH_MAX_QD) {
+        serial_printf("FSBench: Error: Invalid random read count or queue depth\n");
+        return 1;
+    }
+
+    char base[VFS_MAX_PATH];
+    vfs_stat_t stat;
+    if (vfs_normalize_path(path, base) != 0 || vfs_stat(base, &stat) != 0 || stat.type != VFS_TYPE_DIR) {
+        serial_printf("FSBench: Error: '%s' is no directory\n", path);
+        return 1;
+    }
+    snprintf(bench_dir, sizeof(bench_dir), "%s/%s", strcmp(base, "/") == 0 ? "" : base, FSBENCH_DIR_NAME);
+    if (vfs_stat(bench_dir, &stat) != 0 && vfs_mkdir(bench_dir) != 0) {
+        serial_printf("FSBench: Error: Cannot create '%s'\n", bench_dir);
+        return 1;
+    }
+
+    vfs_file_t* dir = vfs_open(bench_dir, 0);
+    if (!dir) return 1;
+    bench_mount = dir->vnode->mount;
+    vfs_close(dir);
+
+    char buf[160];
+    snprintf(buf, sizeof(buf), "fsbench %s (%s): %u files of %u bytes, %u KB file read in %u byte blocks, %u random reads\n",
+        bench_dir, bench_mount->type->name, config->files, config->file_size, config->large_kb, config->block_size, config->ops);
+    fsbench_print(buf);
+    memset(bench_buffer, 0x5A, sizeof(bench_buffer));
+
+    fsbench_result_t result;
+    if (config->tests & (FSBENCH_META | FSBENCH_LIST)) {
+        fsbench_start(&result, "create", "-", 0);
+        fsbench_create(config, &result);
+        if (config->tests & FSBENCH_META) fsbench_report(&result);
+    }
+    if (config->tests & FSBENCH_META) {
+        fsbench_drop_caches();
+        fsbench_start(&result, "stat", "cold", 0);
+        fsbench_stat(config, &result);
+        fsbench_report(&result);
+        fsbench_start(&result, "stat", "warm", 0);
+        fsbench_stat(config, &result);
+        fsbench_report(&result);
+    }
+    if (config->tests & FSBENCH_LIST) {
+        fsbench_drop_caches();
+        fsbench_start(&result, "list", "cold", 0);
+        fsbench_list(config, &result);
+        fsbench_report(&result);
+        fsbench_start(&result, "list", "warm", 0);
+        fsbench_list(config, &result);
+        fsbench_report(&result);
+    }
+
+    if (config->tests & (FSBENCH_SEQ | FSBENCH_RAND)) {
+        fsbench_start(&result, "seqwrite", "-", 0);
+        fsbench_seq(config, true, &result);
+        if (config->tests & FSBENCH_SEQ) fsbench_report(&result);
+    }
+    if (config->tests & FSBENCH_SEQ) {
+        fsbench_drop_caches();
+        fsbench_start(&result, "seqread", "cold", 0);
+        fsbench_seq(config, false, &result);
+        fsbench_report(&result);
+        fsbench_start(&result, "seqread", "warm", 0);
+        fsbench_seq(config, false, &result);
+        fsbench_report(&result);
+    }
+    if (config->tests & FSBENCH_RAND) {
+        // every run reads the same offsets; queued reads skip the block cache and use the page cache only
+        // when it holds the whole block, without filling it, so the warm queued run follows the single ones
+        fsbench_drop_caches();
+        fsbench_start(&result, "rand4k", "cold", 0);
+        fsbench_rand(config, &result);
+        fsbench_report(&result);
+        fsbench_start(&result, "rand4k", "warm", 0);
+        fsbench_rand(config, &result);
+        fsbench_report(&result);
+        fsbench_start(&result, "rand4k", "warm", config->queue_depth);
+        fsbench_rand_async(config, &result);
+        fsbench_report(&result);
+
+        fsbench_drop_caches();
+        fsbench_start(&result, "rand4k", "cold", config->queue_depth);
+        fsbench_rand_async(config, &result);
+        fsbench_report(&result);
+    }
+
+    if (config->tests & (FSBENCH_META | FSBENCH_LIST)) {
+        fsbench_start(&result, "unlink", "-", 0);
+        fsbench_unlink(config, &result);
+        if (config->tests & FSBENCH_META) fsbench_report(&result);
+    }
+    if (config->tests & (FSBENCH_SEQ | FSBENCH_RAND)) vfs_unlink(fsbench_large());
+    if (vfs_unlink(bench_dir) != 0) serial_printf("FSBench: Warning: Could not remove '%s'\n", bench_dir);
+    vfs_sync();
+    return 0;
+}
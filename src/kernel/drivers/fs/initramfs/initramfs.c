@@ -0,0 +1,423 @@
+/**
+ * @file initramfs.c
+ * @brief Read-only filesystem on a cpio or tar archive loaded as a boot module
+ * @author friedrichOsDev
+ *
+ * GRUB loads the archive with module2 and multiboot_parse() recognizes it.
+ * It is mounted before any disk driver runs, so its files are there right
+ * after the heap. The module is mapped read only and indexed once at mount
+ * time: every entry becomes a node whose data points into the module, so
+ * nothing is unpacked or copied. Directories missing from the archive are
+ * implied by the paths below them. Names are found through one hash table of
+ * (parent, name) for the whole archive.
+ *
+ * Both the cpio newc format (as written by `cpio -H newc`) and tar are read,
+ * tar with long paths from GNU and pax headers. Links and device nodes are
+ * left out.
+ */
+
+#include <initramfs.h>
+#include <ramdisk.h>
+#include <memory.h>
+#include <string.h>
+#include <serial.h>
+#include <console.h>
+#include <print.h>
+
+#define CPIO_MODE_TYPE 0170000
+#define CPIO_MODE_DIR  0040000
+#define CPIO_MODE_FILE 0100000
+
+static const boot_module_t* pending_module = NULL; // archive of the next mount
+static uint8_t* module_maps[BOOT_MODULES_MAX];     // modules stay mapped across remounts
+
+static uint32_t initramfs_hash(uint32_t parent, const char* name, uint32_t len) {
+    uint32_t hash = 2166136261u ^ parent;
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t initramfs_find(initramfs_volume_t* vol, uint32_t parent, const char* name, uint32_t len) {
+    uint32_t index = vol->buckets[initramfs_hash(parent, name, len) % INITRAMFS_BUCKETS];
+    while (index != INITRAMFS_NONE) {
+        initramfs_node_t* node = &vol->nodes[index];
+        if (node->parent == parent && strncmp(node->name, name, len) == 0 && node->name[len] == '\0') return index;
+        index = node->hash_next;
+    }
+    return INITRAMFS_NONE;
+}
+
+static uint32_t initramfs_add(initramfs_volume_t* vol, uint32_t parent, const char* name, uint32_t len, uint8_t type) {
+    if (vol->node_count == vol->node_capacity) {
+        uint32_t capacity = vol->node_capacity ? vol->node_capacity * 2 : 64;
+        initramfs_node_t* nodes = (initramfs_node_t*)krealloc((virt_addr_t)vol->nodes, capacity * sizeof(initramfs_node_t));
+        if (!nodes) return INITRAMFS_NONE;
+        vol->nodes = nodes;
+        vol->node_capacity = capacity;
+    }
+
+    char* copy = (char*)kmalloc(len + 1);
+    if (!copy) return INITRAMFS_NONE;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+
+    uint32_t index = vol->node_count++;
+    initramfs_node_t* node = &vol->nodes[index];
+    memset(node, 0, sizeof(initramfs_node_t));
+    node->name = copy;
+    node->parent = parent;
+    node->type = type;
+    if (index > 0) {
+        uint32_t bucket = initramfs_hash(parent, name, len) % INITRAMFS_BUCKETS;
+        node->hash_next = vol->buckets[bucket];
+        vol->buckets[bucket] = index;
+    }
+    if (type == VFS_TYPE_DIR) vol->dir_count++;
+    else vol->file_count++;
+    return index;
+}
+
+/**
+ * @brief Adds an archive entry, creating the directories on its path.
+ * @return 0 on success (also for entries that are skipped), 1 if memory ran out.
+ */
+static uint8_t initramfs_add_path(initramfs_volume_t* vol, const char* path, uint32_t len, uint8_t type, const uint8_t* data, uint32_t size) {
+    uint32_t current = 0;
+    uint32_t pos = 0;
+    while (pos < len) {
+        while (pos < len && path[pos] == '/') pos++;
+        uint32_t start = pos;
+        while (pos < len && path[pos] != '/') pos++;
+        uint32_t part = pos - start;
+        while (pos < len && path[pos] == '/') pos++;
+        bool last = pos >= len;
+
+        if (part == 0 || (part == 1 && path[start] == '.')) continue;
+        if (part == 2 && path[start] == '.' && path[start + 1] == '.') {
+            vol->skipped++;
+            return 0;
+        }
+
+        uint8_t part_type = last ? type : VFS_TYPE_DIR;
+        uint32_t child = initramfs_find(vol, current, path + start, part);
+        if (child == INITRAMFS_NONE) {
+            child = initramfs_add(vol, current, path + start, part, part_type);
+            if (child == INITRAMFS_NONE) return 1;
+        } else if (vol->nodes[child].type != part_type) {
+            serial_printf("Initramfs: Skipping '%s', a part of its path is a %s\n", path, part_type == VFS_TYPE_DIR ? "file" : "directory");
+            vol->skipped++;
+            return 0;
+        }
+        if (last && type == VFS_TYPE_FILE) {
+            vol->nodes[child].data = data;
+            vol->nodes[child].size = size;
+        }
+        current = child;
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses a fixed width number of an archive header.
+ * @return false if a character is no digit of the base.
+ */
+static bool initramfs_parse_number(const char* text, uint32_t width, uint32_t base, uint64_t* out) {
+    uint64_t value = 0;
+    uint32_t i = 0;
+    while (i < width && text[i] == ' ') i++;
+    for (; i < width && text[i] != '\0' && text[i] != ' '; i++) {
+        char c = text[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') digit = (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') digit = (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') digit = (uint32_t)(c - 'A' + 10);
+        else return false;
+        if (digit >= base) return false;
+        value = value * base + digit;
+    }
+    *out = value;
+    return true;
+}
+
+static inline uint32_t initramfs_align(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static uint8_t initramfs_parse_cpio(initramfs_volume_t* vol) {
+    const uint8_t* archive = vol->archive;
+    uint32_t pos = 0;
+    while (pos + CPIO_NEWC_HEADER_SIZE <= vol->archive_size) {
+        const char* header = (const char*)archive + pos;
+        uint64_t mode, file_size, name_size;
+        if (strncmp(header, "07070", 5) != 0 || (header[5] != '1' && header[5] != '2') ||
+            !initramfs_parse_number(header + 14, 8, 16, &mode) ||
+            !initramfs_parse_number(header + 54, 8, 16, &file_size) ||
+            !initramfs_parse_number(header + 94, 8, 16, &name_size) || name_size == 0) {
+            serial_printf("Initramfs: Error: Bad cpio header at offset %u\n", pos);
+            return 1;
+        }
+
+        uint32_t name_start = pos + CPIO_NEWC_HEADER_SIZE;
+        if (name_size > vol->archive_size - name_start) break;
+        uint32_t data_start = initramfs_align(name_start + (uint32_t)name_size, 4);
+        if (data_start > vol->archive_size || file_size > vol->archive_size - data_start) {
+            serial_printf("Initramfs: Error: cpio entry at offset %u runs past the archive\n", pos);
+            return 1;
+        }
+
+        const char* name = (const char*)archive + name_start;
+        uint32_t name_len = (uint32_t)name_size - 1;
+        if (name_len == 10 && strncmp(name, "TRAILER!!!", 10) == 0) return 0;
+
+        uint32_t type = (uint32_t)mode & CPIO_MODE_TYPE;
+        if (type == CPIO_MODE_DIR || type == CPIO_MODE_FILE) {
+            uint8_t vfs_type = type == CPIO_MODE_DIR ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+            if (initramfs_add_path(vol, name, name_len, vfs_type, archive + data_start, (uint32_t)file_size) != 0) return 1;
+        } else {
+            vol->skipped++;
+        }
+        pos = initramfs_align(data_start + (uint32_t)file_size, 4);
+    }
+    serial_printf("Initramfs: Warning: cpio archive has no trailer\n");
+    return 0;
+}
+
+static uint8_t initramfs_parse_tar(initramfs_volume_t* vol) {
+    const uint8_t* archive = vol->archive;
+    const char* long_name = NULL;
+    uint32_t long_name_len = 0;
+    char path[VFS_MAX_PATH];
+
+    uint32_t pos = 0;
+    while (pos + TAR_BLOCK_SIZE <= vol->archive_size) {
+        const char* header = (const char*)archive + pos;
+        if (header[0] == '\0') return 0; // the first of the zero blocks that end the archive
+
+        uint64_t size;
+        if (strncmp(header + 257, "ustar", 5) != 0 || !initramfs_parse_number(header + 124, 12, 8, &size)) {
+            serial_printf("Initramfs: Error: Bad tar header at offset %u\n", pos);
+            return 1;
+        }
+        uint32_t data_start = pos + TAR_BLOCK_SIZE;
+        if (size > vol->archive_size - data_start) {
+            serial_printf("Initramfs: Error: tar entry at offset %u runs past the archive\n", pos);
+            return 1;
+        }
+        pos = data_start + initramfs_align((uint32_t)size, TAR_BLOCK_SIZE);
+
+        char flag = header[156];
+        if (flag == 'L') {
+            // GNU long name of the next entry
+            long_name = (const char*)archive + data_start;
+            long_name_len = 0;
+            while (long_name_len < size && long_name[long_name_len] != '\0') long_name_len++;
+            continue;
+        }
+        if (flag == 'x') {
+            // pax attributes of the next entry, only a long path is needed
+            const char* record = (const char*)archive + data_start;
+            const char* end = record + size;
+            while (record < end) {
+                uint32_t record_len = 0;
+                const char* key = record;
+                while (key < end && *key >= '0' && *key <= '9') record_len = record_len * 10 + (uint32_t)(*key++ - '0');
+                if (record_len == 0 || record_len > (uint32_t)(end - record)) break;
+                if (key + 6 <= record + record_len && strncmp(key, " path=", 6) == 0) {
+                    long_name = key + 6;
+                    long_name_len = (uint32_t)(record + record_len - 1 - long_name); // without the newline
+                }
+                record += record_len;
+            }
+            continue;
+        }
+        if (flag == 'g') continue;
+
+        uint32_t len = 0;
+        if (long_name) {
+            if (long_name_len < sizeof(path)) {
+                memcpy(path, long_name, long_name_len);
+                len = long_name_len;
+            }
+            long_name = NULL;
+        } else {
+            // POSIX ustar splits long paths into prefix and name, GNU tar uses the prefix field otherwise
+            uint32_t prefix_len = 0;
+            if (header[263] == '0') {
+                while (prefix_len < 155 && header[345 + prefix_len] != '\0') prefix_len++;
+            }
+            uint32_t name_len = 0;
+            while (name_len < 100 && header[name_len] != '\0') name_len++;
+            if (prefix_len + 1 + name_len < sizeof(path)) {
+                memcpy(path, header + 345, prefix_len);
+                len = prefix_len;
+                if (prefix_len > 0) path[len++] = '/';
+                memcpy(path + len, header, name_len);
+                len += name_len;
+            }
+        }
+        path[len] = '\0';
+
+        if (len == 0 || (flag != '0' && flag != '\0' && flag != '7' && flag != '5')) {
+            vol->skipped++;
+            continue;
+        }
+        uint8_t type = flag == '5' ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+        if (initramfs_add_path(vol, path, len, type, archive + data_start, (uint32_t)size) != 0) return 1;
+    }
+    return 0;
+}
+
+static void initramfs_free(initramfs_volume_t* vol) {
+    for (uint32_t i = 0; i < vol->node_count; i++) kfree((virt_addr_t)vol->nodes[i].name);
+    if (vol->nodes) kfree((virt_addr_t)vol->nodes);
+    kfree((virt_addr_t)vol);
+}
+
+static void initramfs_vfs_fill(initramfs_volume_t* vol, uint32_t index, vfs_vnode_t* out) {
+    initramfs_node_t* node = &vol->nodes[index];
+    out->ino = index;
+    out->type = node->type;
+    out->size = node->type == VFS_TYPE_FILE ? node->size : 0;
+    out->private = node;
+}
+
+static uint8_t initramfs_vfs_lookup(vfs_vnode_t* dir, const char* name, vfs_vnode_t* out) {
+    initramfs_volume_t* vol = (initramfs_volume_t*)dir->mount->private;
+    uint32_t index = initramfs_find(vol, (uint32_t)dir->ino, name, (uint32_t)strlen(name));
+    if (index == INITRAMFS_NONE) return 1;
+    initramfs_vfs_fill(vol, index, out);
+    return 0;
+}
+
+/**
+ * @brief Lists a directory in archive order, the cursor is the index of the next node to check.
+ */
+static uint8_t initramfs_vfs_readdir(vfs_vnode_t* dir, uint32_t* cursor, vfs_dirent_t* out) {
+    initramfs_volume_t* vol = (initramfs_volume_t*)dir->mount->private;
+    for (uint32_t i = *cursor > 0 ? *cursor : 1; i < vol->node_count; i++) {
+        initramfs_node_t* node = &vol->nodes[i];
+        if (node->parent != (uint32_t)dir->ino) continue;
+        strcpy(out->name, node->name);
+        out->type = node->type;
+        out->size = node->type == VFS_TYPE_FILE ? node->size : 0;
+        *cursor = i + 1;
+        return 0;
+    }
+    *cursor = vol->node_count;
+    return 1;
+}
+
+static int32_t initramfs_vfs_read(vfs_vnode_t* vnode, uint64_t offset, void* buffer, uint32_t length) {
+    initramfs_volume_t* vol = (initramfs_volume_t*)vnode->mount->private;
+    initramfs_node_t* node = (initramfs_node_t*)vnode->private;
+    if (offset >= node->size) return 0;
+    if (length > node->size - offset) length = node->size - (uint32_t)offset;
+    if (length > INT32_MAX) length = INT32_MAX;
+
+    memcpy(buffer, node->data + (uint32_t)offset, length);
+    vol->bytes_read += length;
+    return (int32_t)length;
+}
+
+static uint8_t initramfs_vfs_mount(vfs_mount_t* mount, disk_t* disk, vfs_vnode_t* root) {
+    (void)disk;
+    const boot_module_t* module = pending_module;
+    if (!module || module->kind == BOOT_MODULE_IMAGE) return 1;
+
+    uint32_t slot = (uint32_t)(module - kernel_modules.entries);
+    if (!module_maps[slot]) module_maps[slot] = ramdisk_map_module(module, false);
+    if (!module_maps[slot]) return 1;
+
+    initramfs_volume_t* vol = (initramfs_volume_t*)kzalloc(sizeof(initramfs_volume_t));
+    if (!vol) return 1;
+    vol->module = module;
+    vol->archive = module_maps[slot];
+    vol->archive_size = module->phys_end - module->phys_start;
+    memset(vol->buckets, 0xFF, sizeof(vol->buckets));
+
+    uint8_t res = initramfs_add(vol, 0, "", 0, VFS_TYPE_DIR) == INITRAMFS_NONE;
+    if (res == 0) res = module->kind == BOOT_MODULE_CPIO ? initramfs_parse_cpio(vol) : initramfs_parse_tar(vol);
+    if (res != 0) {
+        serial_printf("Initramfs: Error: Failed to index '%s'\n", module->cmdline);
+        initramfs_free(vol);
+        return 1;
+    }
+
+    initramfs_vfs_fill(vol, 0, root);
+    mount->private = vol;
+    serial_printf("Initramfs: '%s' holds %u files and %u directories (%u entries skipped)\n", module->cmdline, vol->file_count, vol->dir_count - 1, vol->skipped);
+    return 0;
+}
+
+static void initramfs_vfs_unmount(vfs_mount_t* mount) {
+    initramfs_free((initramfs_volume_t*)mount->private);
+}
+
+static void initramfs_vfs_dump(vfs_mount_t* mount) {
+    initramfs_volume_t* vol = (initramfs_volume_t*)mount->private;
+    char buf[128];
+
+    snprintf(buf, sizeof(buf), "  Archive:   %s '%s', %u KB, read only\n", vol->module->kind == BOOT_MODULE_CPIO ? "cpio" : "tar", vol->module->cmdline, vol->archive_size / 1024);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+    snprintf(buf, sizeof(buf), "  Nodes:     %u files, %u directories, %u entries skipped\n", vol->file_count, vol->dir_count - 1, vol->skipped);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+    snprintf(buf, sizeof(buf), "  Traffic:   %llu KB read\n", vol->bytes_read >> 10);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+}
+
+static const vfs_ops_t initramfs_vfs_ops = {
+    .lookup = initramfs_vfs_lookup,
+    .create = NULL,
+    .remove = NULL,
+    .readdir = initramfs_vfs_readdir,
+    .read = initramfs_vfs_read,
+    .write = NULL,
+    .truncate = NULL,
+    .bmap = NULL,
+    .sync = NULL,
+    .release = NULL
+};
+
+static const vfs_fs_type_t initramfs_fs_type = {
+    .name = "initramfs",
+    .flags = VFS_FS_NO_PAGE_CACHE,
+    .mount = initramfs_vfs_mount,
+    .unmount = initramfs_vfs_unmount,
+    .dump = initramfs_vfs_dump,
+    .ops = &initramfs_vfs_ops
+};
+
+/**
+ * @brief Mounts an archive module.
+ * @return 0 on success, 1 on failure.
+ */
+uint8_t initramfs_mount(const char* path, const boot_module_t* module) {
+    pending_module = module;
+    uint8_t res = vfs_mount(path, "initramfs", NULL);
+    pending_module = NULL;
+    return res;
+}
+
+/**
+ * @brief Registers initramfs with the VFS and mounts every archive module.
+ *
+ * The first archive is mounted at /, or at /initrd when root=<disk name>
+ * puts a disk there. Further archives go to /initrd<n>.
+ */
+void initramfs_init(void) {
+    vfs_register_fs(&initramfs_fs_type);
+
+    uint32_t mounted = 0;
+    for (uint32_t i = 0; i < kernel_modules.count; i++) {
+        const boot_module_t* module = &kernel_modules.entries[i];
+        if (module->kind == BOOT_MODULE_IMAGE) continue;
+
+        char path[16];
+        if (mounted > 0) snprintf(path, sizeof(path), "/initrd%u", mounted);
+        else strcpy(path, kernel_cmdline_get("root=") ? "/initrd" : "/");
+        if (initramfs_mount(path, module) == 0) mounted++;
+    }
+}
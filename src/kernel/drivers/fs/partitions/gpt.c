@@ -48,14 +48,14 @@ bool gpt_parse(uint8_t disk_index) {
         return false;
     }
     
-    uint32_t current_lba = (uint32_t)header.partition_entry_lba;
+    uint64_t current_lba = header.partition_entry_lba;
 
     for (uint32_t i = 0; i < header.num_partition_entries; i++) {
         uint32_t sub_index = i % entries_per_sector;
 
         if (sub_index == 0) {
             if (storage_read(disk, current_lba, 1, sector_buffer) != 0) {
-                serial_printf("GPT: Error reading partition entry sector %u\n", current_lba);
+                serial_printf("GPT: Error reading partition entry sector %llu\n", current_lba);
                 return false;
             }
             current_lba++;
@@ -76,13 +76,13 @@ bool gpt_parse(uint8_t disk_index) {
         }
         name_ascii[35] = '\0';
 
-        serial_printf("GPT: Found Partition %d: '%s' (Start LBA: %u, Size: %u sectors)\n", 
-                      i, name_ascii, (uint32_t)entry->starting_lba, (uint32_t)total_sectors);
+        serial_printf("GPT: Found Partition %d: '%s' (Start LBA: %llu, Size: %llu sectors)\n", 
+                      i, name_ascii, entry->starting_lba, total_sectors);
 
         partman_register_partition(
             disk_index, 
-            (uint32_t)entry->starting_lba, 
-            (uint32_t)total_sectors, 
+            entry->starting_lba, 
+            total_sectors, 
             0x00,
             name_ascii
         );
@@ -9,93 +9,226 @@
 #include <serial.h>
 #include <console.h>
 #include <print.h>
+#include <memory.h>
 #include <mbr.h>
+#include <cpu.h>
 
-static partition_t global_partitions[MAX_PARTITIONS];
+static partition_t* partitions_head = NULL;
+static partition_t* partitions_tail = NULL;
 static uint32_t partition_count = 0;
 
+static partman_child_t children[PARTMAN_MAX_CHILDREN];
+static partman_child_t* free_children = NULL;
+static bool children_ready = false;
+
+static uint8_t partman_disk_read(disk_t* self, uint64_t lba, uint32_t count, void* buffer) {
+    partition_t* part = (partition_t*)self;
+    if (lba + count > part->sector_count) return 2;
+    return storage_read(part->parent, part->start_lba + lba, count, buffer);
+}
+
+static uint8_t partman_disk_write(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
+    partition_t* part = (partition_t*)self;
+    if (lba + count > part->sector_count) return 2;
+    return storage_write_flags(part->parent, part->start_lba + lba, count, buffer, flags);
+}
+
+static uint8_t partman_disk_flush(disk_t* self) {
+    partition_t* part = (partition_t*)self;
+    return storage_flush(part->parent);
+}
+
+static partman_child_t* partman_alloc_child(void) {
+    uint32_t irq_flags = cpu_irq_save();
+    if (!children_ready) {
+        for (uint32_t i = 0; i < PARTMAN_MAX_CHILDREN; i++) {
+            children[i].next_free = free_children;
+            free_children = &children[i];
+        }
+        children_ready = true;
+    }
+    partman_child_t* child = free_children;
+    if (child) free_children = child->next_free;
+    cpu_irq_restore(irq_flags);
+    return child;
+}
+
+static void partman_free_child(partman_child_t* child) {
+    uint32_t irq_flags = cpu_irq_save();
+    child->next_free = free_children;
+    free_children = child;
+    cpu_irq_restore(irq_flags);
+}
+
+static void partman_child_complete(storage_request_t* req) {
+    partman_child_t* child = (partman_child_t*)req->private;
+    storage_request_t* parent = child->parent;
+    uint8_t status = req->status;
+
+    partman_free_child(child);
+    storage_complete(parent, status);
+}
+
+/**
+ * @brief Forwards a request to the queue of the parent disk, shifted by the start of the partition.
+ *
+ * When all forwarding slots are taken, the request is carried out on the
+ * parent right away. It is submitted without STORAGE_REQ_MORE, so waiting for
+ * it cannot stall on requests of the batch the parent has not been told about.
+ */
+static uint8_t partman_disk_submit(disk_t* self, storage_request_t* req) {
+    partition_t* part = (partition_t*)self;
+
+    partman_child_t* child = partman_alloc_child();
+    storage_request_t sync_req;
+    storage_request_t* fwd = child ? &child->req : &sync_req;
+
+    memset(fwd, 0, sizeof(storage_request_t));
+    fwd->op = req->op;
+    fwd->lba = req->op == STORAGE_OP_FLUSH ? 0 : part->start_lba + req->lba;
+    fwd->count = req->count;
+    fwd->buffer = req->buffer;
+    fwd->flags = req->flags;
+
+    if (!child) {
+        fwd->flags &= ~STORAGE_REQ_MORE;
+        uint8_t res = storage_submit(part->parent, fwd);
+        if (res != 0) return res;
+        storage_complete(req, storage_wait(fwd));
+        return 0;
+    }
+
+    child->parent = req;
+    fwd->complete = partman_child_complete;
+    fwd->private = child;
+
+    uint8_t res = storage_submit(part->parent, fwd);
+    if (res != 0) partman_free_child(child);
+    return res;
+}
+
+static void partman_disk_kick(disk_t* self) {
+    storage_kick(((partition_t*)self)->parent);
+}
+
 void partman_init() {
-    memset(global_partitions, 0, sizeof(global_partitions));
+    partitions_head = NULL;
+    partitions_tail = NULL;
     partition_count = 0;
 
-    for (uint8_t i = 0; i < storage_get_disk_count(); i++) {
+    // partitions register disks of their own, which must not be scanned again
+    uint8_t disk_count = storage_get_disk_count();
+    for (uint8_t i = 0; i < disk_count; i++) {
+        disk_t* disk = storage_get_disk(i);
+        if (!disk || disk->type == TYPE_PARTITION) continue;
         mbr_parse(i);
-    }   
+    }
+}
+
+/**
+ * @brief Finds the disk that holds the blocks of a disk, and their cache entries.
+ * @param lba Translated to the returned disk, may be NULL.
+ * @return The parent of a partition, any other disk itself.
+ */
+disk_t* partman_resolve(disk_t* disk, uint64_t* lba) {
+    if (!disk || disk->type != TYPE_PARTITION) return disk;
+    partition_t* part = (partition_t*)disk;
+    if (lba) *lba += part->start_lba;
+    return part->parent;
 }
 
 partition_t* partman_get_partition(uint32_t partition_id) {
-    if (partition_id >= MAX_PARTITIONS || !global_partitions[partition_id].used) {
+    partition_t* part = partitions_head;
+    for (uint32_t i = 0; part && i < partition_id; i++) part = part->next;
+
+    if (!part) {
         serial_printf("Partman: Error: Invalid partition ID %u\n", partition_id);
         return NULL;
     }
-    return &global_partitions[partition_id];
+    return part;
 }
 
 uint32_t partman_get_partition_count() {
     return partition_count;
 }
 
-int32_t partman_register_partition(uint8_t disk_index, uint32_t start_lba, uint32_t sector_count, uint8_t type, const char* name) {
-    if (partition_count >= MAX_PARTITIONS) {
-        serial_printf("Partman: Error: Maximum partition count reached\n");
+/**
+ * @brief Registers a partition of a disk and exposes it as a disk of its own.
+ * @return The partition ID, or -1 if the partition does not fit the disk or cannot be registered.
+ */
+int32_t partman_register_partition(uint8_t disk_index, uint64_t start_lba, uint64_t sector_count, uint8_t type, const char* label) {
+    disk_t* parent = storage_get_disk(disk_index);
+    if (!parent) {
+        serial_printf("Partman: Error: No disk found at index %u\n", disk_index);
         return -1;
     }
 
-    uint32_t id = partition_count++;
-    global_partitions[id].disk_index = disk_index;
-    global_partitions[id].start_lba = start_lba;
-    global_partitions[id].sector_count = sector_count;
-    global_partitions[id].partition_type = type;
-    global_partitions[id].used = true;
-
-    if (name) {
-        strncpy(global_partitions[id].name, name, sizeof(global_partitions[id].name) - 1);
-    } else {
-        snprintf(global_partitions[id].name, sizeof(global_partitions[id].name), "disk%d-part%d", disk_index, id);
+    if (sector_count == 0 || start_lba >= parent->total_sectors || sector_count > parent->total_sectors - start_lba) {
+        serial_printf("Partman: Error: Partition at LBA %llu with %llu sectors exceeds disk %s\n", start_lba, sector_count, parent->name);
+        return -1;
     }
 
-    serial_printf("Partman: Registered partition %d: %s (Disk %d, Start %u, Size %u)\n", id, global_partitions[id].name, disk_index, start_lba, sector_count);
-
-    return (int32_t)id;
-}
-
-bool partman_read_partition(uint32_t partition_id, uint32_t relative_lba, uint32_t sector_count, uint8_t* buffer) {
-    if (partition_id >= MAX_PARTITIONS || !global_partitions[partition_id].used) {
-        serial_printf("Partman: Error: Invalid partition ID %u\n", partition_id);
-        return false;
+    partition_t* part = (partition_t*)kzalloc(sizeof(partition_t));
+    if (!part) {
+        serial_printf("Partman: Error: Out of memory\n");
+        return -1;
     }
 
-    partition_t* part = &global_partitions[partition_id];
-    
-    if (relative_lba + sector_count > part->sector_count) {
-        serial_printf("Partman: Error: Read exceeds partition bounds (Partition %s, Relative LBA %u, Sector Count %u)\n", part->name, relative_lba, sector_count);
-        return false;
+    uint32_t number = 1;
+    for (partition_t* p = partitions_head; p; p = p->next) {
+        if (p->parent == parent) number++;
     }
 
-    disk_t* disk = storage_get_disk(part->disk_index);
-    if (!disk) {
-        serial_printf("Partman: Error: No disk found for partition %s\n", part->name);
-        return false;
+    part->parent = parent;
+    part->disk_index = disk_index;
+    part->start_lba = start_lba;
+    part->sector_count = sector_count;
+    part->partition_type = type;
+    if (label) strncpy(part->label, label, sizeof(part->label) - 1);
+
+    // hda -> hda1, nvme0n1 -> nvme0n1p1
+    size_t parent_len = strlen(parent->name);
+    bool ends_in_digit = parent_len > 0 && parent->name[parent_len - 1] >= '0' && parent->name[parent_len - 1] <= '9';
+    snprintf(part->base.name, sizeof(part->base.name), ends_in_digit ? "%sp%u" : "%s%u", parent->name, number);
+    part->base.total_sectors = sector_count;
+    part->base.sector_size = parent->sector_size;
+    part->base.type = TYPE_PARTITION;
+    part->base.flags = DISK_FLAG_NOCACHE; // cached once, by the parent
+    part->base.read = partman_disk_read;
+    part->base.write = parent->write ? partman_disk_write : NULL;
+    part->base.flush = partman_disk_flush;
+    part->base.submit = partman_disk_submit;
+    part->base.kick = partman_disk_kick;
+
+    // a partition that is no disk cannot be used, so it does not go into the table either
+    if (storage_register_disk(&part->base) != 0) {
+        serial_printf("Partman: Error: Dropping partition %s\n", part->base.name);
+        kfree((virt_addr_t)part);
+        return -1;
     }
 
-    uint32_t absolute_lba = part->start_lba + relative_lba;
-    return storage_read(disk, absolute_lba, sector_count, buffer) == 0;
+    if (partitions_tail) partitions_tail->next = part;
+    else partitions_head = part;
+    partitions_tail = part;
+    uint32_t id = partition_count++;
+
+    serial_printf("Partman: Registered partition %u: %s '%s' (Disk %u, Start %llu, Size %llu)\n", id, part->base.name, part->label, disk_index, start_lba, sector_count);
+
+    return (int32_t)id;
 }
 
 void partman_dump_info() {
-    char buf[64];
+    char buf[96];
     console_puts(U"Partition Table:\n");
     snprintf(buf, sizeof(buf), "Total Partitions: %u\n\n", partition_count);
     for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
 
-    for (uint32_t i = 0; i < partition_count; i++) {
-        partition_t* part = &global_partitions[i];
-        if (!part->used) continue;
-
-        snprintf(buf, sizeof(buf), "[Partition %u] %s\n", i, part->name);
+    uint32_t id = 0;
+    for (partition_t* part = partitions_head; part; part = part->next, id++) {
+        snprintf(buf, sizeof(buf), "[Partition %u] %s %s\n", id, part->base.name, part->label);
         for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
-        snprintf(buf, sizeof(buf), "  Disk: %u, Start LBA: %u, Sectors: %u, Type: %02X\n\n",
-                 part->disk_index, part->start_lba, part->sector_count, part->partition_type);
+        snprintf(buf, sizeof(buf), "  Disk: %u (%s), Start LBA: %llu, Sectors: %llu, Type: %02X\n\n",
+                 part->disk_index, part->parent->name, part->start_lba, part->sector_count, part->partition_type);
         for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,509 @@
+/**
+ * @file pcache.c
+ * @brief Page cache of file data and file mappings
+ * @author friedrichOsDev
+ *
+ * Every cached page has a fixed slot in the page cache window, where the
+ * kernel reads and writes it. vfs_read() copies out of these pages, and
+ * vfs_mmap() maps the very same frames read only into the mapping window, so
+ * a mapped file is used in place without a copy. Mapping pages are filled on
+ * their first touch by the page fault handler.
+ *
+ * Writes go through to the filesystem and then update the cached pages, so
+ * the cache never holds data the filesystem does not have. Unreferenced pages
+ * are evicted in LRU order for the page limit and handed back to the PMM when
+ * it runs out of memory.
+ */
+
+#include <pcache.h>
+#include <memory.h>
+#include <string.h>
+#include <serial.h>
+#include <console.h>
+#include <print.h>
+#include <convert.h>
+#include <kernel.h>
+
+#define PCACHE_PAGE_SHIFT 12
+
+static pcache_page_t* pages = NULL; // one per slot of the window
+static pcache_page_t* free_slots = NULL;
+static pcache_page_t* hash_table[PCACHE_BUCKETS];
+static pcache_page_t* lru_head = NULL; // most recently used
+static pcache_page_t* lru_tail = NULL; // least recently used
+static uint32_t page_count = 0;
+static uint32_t page_limit = PCACHE_DEFAULT_PAGES;
+static bool reclaiming = false;
+
+static pcache_mapping_t mappings[PCACHE_MAX_MAPPINGS];
+static uint32_t mmap_bitmap[PCACHE_MMAP_PAGES / 32];
+
+static pcache_stats_t stats;
+
+static inline uint8_t* pcache_data(pcache_page_t* page) {
+    return (uint8_t*)(VMM_PCACHE_BASE + (uint32_t)(page - pages) * PCACHE_PAGE_SIZE);
+}
+
+static inline uint32_t pcache_bucket(vfs_vnode_t* node, uint32_t index) {
+    return ((((uint32_t)(uintptr_t)node >> 4) ^ index) * 2654435761u) % PCACHE_BUCKETS;
+}
+
+static void pcache_lru_unlink(pcache_page_t* page) {
+    if (page->lru_prev) page->lru_prev->lru_next = page->lru_next;
+    else lru_head = page->lru_next;
+    if (page->lru_next) page->lru_next->lru_prev = page->lru_prev;
+    else lru_tail = page->lru_prev;
+    page->lru_prev = NULL;
+    page->lru_next = NULL;
+}
+
+static void pcache_lru_push_front(pcache_page_t* page) {
+    page->lru_prev = NULL;
+    page->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = page;
+    lru_head = page;
+    if (!lru_tail) lru_tail = page;
+}
+
+static pcache_page_t* pcache_lookup(vfs_vnode_t* node, uint32_t index) {
+    for (pcache_page_t* page = hash_table[pcache_bucket(node, index)]; page; page = page->hash_next) {
+        if (page->vnode == node && page->index == index) return page;
+    }
+    return NULL;
+}
+
+static void pcache_get(pcache_page_t* page) {
+    if (page->refs++ == 0) pcache_lru_unlink(page);
+}
+
+static void pcache_put(pcache_page_t* page) {
+    if (--page->refs == 0) pcache_lru_push_front(page);
+}
+
+/**
+ * @brief Removes a page from the cache and frees its frame.
+ */
+static void pcache_free(pcache_page_t* page) {
+    pcache_page_t** link = &hash_table[pcache_bucket(page->vnode, page->index)];
+    while (*link && *link != page) link = &(*link)->hash_next;
+    if (*link) *link = page->hash_next;
+
+    if (page->file_prev) page->file_prev->file_next = page->file_next;
+    else page->vnode->pages = page->file_next;
+    if (page->file_next) page->file_next->file_prev = page->file_prev;
+    if (page->refs == 0) pcache_lru_unlink(page);
+
+    virt_addr_t vaddr = (virt_addr_t)pcache_data(page);
+    uint32_t* pte = vmm_get_page_entry(vaddr, false);
+    if (pte) *pte = 0;
+    flush_tlb(vaddr);
+    pmm_free_page(page->phys);
+
+    page->vnode = NULL;
+    page->refs = 0;
+    page->file_prev = NULL;
+    page->file_next = NULL;
+    page->hash_next = free_slots;
+    free_slots = page;
+    page_count--;
+}
+
+/**
+ * @brief Evicts unreferenced pages until at most target pages remain.
+ * @return The number of pages freed.
+ */
+static uint32_t pcache_shrink(uint32_t target) {
+    uint32_t freed = 0;
+    while (page_count > target && lru_tail) {
+        pcache_free(lru_tail);
+        freed++;
+    }
+    return freed;
+}
+
+/**
+ * @brief Takes a slot for a page of a file and gives it a frame.
+ * @return The page with one reference and undefined content, or NULL if every page is in use or memory is out.
+ */
+static pcache_page_t* pcache_alloc(vfs_vnode_t* node, uint32_t index) {
+    if (page_count >= page_limit) stats.evictions += pcache_shrink(page_limit > 0 ? page_limit - 1 : 0);
+    if (page_count >= page_limit || !free_slots) return NULL;
+
+    pcache_page_t* page = free_slots;
+    free_slots = page->hash_next;
+
+    // both allocations may reclaim other pages, this one is not listed anywhere yet
+    page->phys = pmm_alloc_page();
+    virt_addr_t vaddr = (virt_addr_t)pcache_data(page);
+    uint32_t* pte = page->phys ? vmm_get_page_entry(vaddr, true) : NULL;
+    if (!pte) {
+        if (page->phys) pmm_free_page(page->phys);
+        page->hash_next = free_slots;
+        free_slots = page;
+        return NULL;
+    }
+    *pte = page->phys | VMM_PAGE_PRESENT | VMM_PAGE_READ_WRITE;
+    flush_tlb(vaddr);
+
+    page->vnode = node;
+    page->index = index;
+    page->refs = 1;
+    uint32_t bucket = pcache_bucket(node, index);
+    page->hash_next = hash_table[bucket];
+    hash_table[bucket] = page;
+    page->file_prev = NULL;
+    page->file_next = node->pages;
+    if (node->pages) node->pages->file_prev = page;
+    node->pages = page;
+    page_count++;
+    return page;
+}
+
+/**
+ * @brief Returns a page of a file, reading it from the filesystem on a miss.
+ * @return The page with an added reference, or NULL on a read error or if no page is free.
+ */
+static pcache_page_t* pcache_get_page(vfs_vnode_t* node, uint32_t index) {
+    pcache_page_t* page = pcache_lookup(node, index);
+    if (page) {
+        stats.hits++;
+        pcache_get(page);
+        return page;
+    }
+
+    page = pcache_alloc(node, index);
+    if (!page) return NULL;
+    stats.misses++;
+
+    int32_t read = node->mount->type->ops->read(node, (uint64_t)index << PCACHE_PAGE_SHIFT, pcache_data(page), PCACHE_PAGE_SIZE);
+    if (read < 0) {
+        pcache_free(page);
+        return NULL;
+    }
+    memset(pcache_data(page) + read, 0, PCACHE_PAGE_SIZE - (uint32_t)read);
+    return page;
+}
+
+/**
+ * @brief Reads file data through the cache.
+ *
+ * Cached pages are copied out. A run of missing whole pages is read from the
+ * filesystem straight into the buffer with one request and copied into the
+ * cache afterwards, a missing partial page is read into the cache first.
+ * @return The number of bytes read (0 at the end of the file), or -1 on error.
+ */
+int32_t pcache_read(vfs_vnode_t* node, uint64_t offset, void* buffer, uint32_t length) {
+    const vfs_ops_t* ops = node->mount->type->ops;
+    if (offset >= node->size) return 0;
+    if (length > node->size - offset) length = (uint32_t)(node->size - offset);
+    if (length > INT32_MAX) length = INT32_MAX;
+
+    uint8_t* out = (uint8_t*)buffer;
+    uint32_t done = 0;
+    while (done < length) {
+        uint64_t pos = offset + done;
+        uint32_t index = (uint32_t)(pos >> PCACHE_PAGE_SHIFT);
+        uint32_t page_offset = (uint32_t)pos & (PCACHE_PAGE_SIZE - 1);
+        uint32_t bytes = PCACHE_PAGE_SIZE - page_offset;
+        if (bytes > length - done) bytes = length - done;
+
+        pcache_page_t* page = pcache_lookup(node, index);
+        if (!page && page_offset == 0 && length - done >= PCACHE_PAGE_SIZE) {
+            uint32_t run = 1;
+            while (run < PCACHE_READ_RUN && (length - done) / PCACHE_PAGE_SIZE > run && !pcache_lookup(node, index + run)) run++;
+
+            int32_t read = ops->read(node, pos, out + done, run * PCACHE_PAGE_SIZE);
+            if (read < 0) return -1;
+            if (read == 0) break;
+            for (uint32_t i = 0; i < (uint32_t)read / PCACHE_PAGE_SIZE; i++) {
+                pcache_page_t* fresh = pcache_alloc(node, index + i);
+                if (!fresh) break;
+                memcpy(pcache_data(fresh), out + done + i * PCACHE_PAGE_SIZE, PCACHE_PAGE_SIZE);
+                pcache_put(fresh);
+                stats.misses++;
+            }
+            done += (uint32_t)read;
+            continue;
+        }
+
+        page = pcache_get_page(node, index);
+        if (!page) {
+            // no page to spare, read around the cache
+            int32_t read = ops->read(node, pos, out + done, bytes);
+            if (read < 0) return -1;
+            if (read == 0) break;
+            done += (uint32_t)read;
+            continue;
+        }
+        memcpy(out + done, pcache_data(page) + page_offset, bytes);
+        pcache_put(page);
+        done += bytes;
+    }
+    return (int32_t)done;
+}
+
+/**
+ * @brief Tells whether every page of a range of a file is cached.
+ */
+bool pcache_contains(vfs_vnode_t* node, uint64_t offset, uint32_t length) {
+    if (!node->pages || length == 0) return false;
+    uint32_t first = (uint32_t)(offset >> PCACHE_PAGE_SHIFT);
+    uint32_t last = (uint32_t)((offset + length - 1) >> PCACHE_PAGE_SHIFT);
+    for (uint32_t index = first; index <= last; index++) {
+        if (!pcache_lookup(node, index)) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Copies data just written to the filesystem into the cached pages it covers.
+ */
+void pcache_update(vfs_vnode_t* node, uint64_t offset, const void* buffer, uint32_t length) {
+    if (!node->pages) return;
+
+    const uint8_t* in = (const uint8_t*)buffer;
+    uint32_t done = 0;
+    while (done < length) {
+        uint64_t pos = offset + done;
+        uint32_t page_offset = (uint32_t)pos & (PCACHE_PAGE_SIZE - 1);
+        uint32_t bytes = PCACHE_PAGE_SIZE - page_offset;
+        if (bytes > length - done) bytes = length - done;
+
+        // the source may be a mapping whose fault evicts pages, so hold this one
+        pcache_page_t* page = pcache_lookup(node, (uint32_t)(pos >> PCACHE_PAGE_SHIFT));
+        if (page) {
+            pcache_get(page);
+            memcpy(pcache_data(page) + page_offset, in + done, bytes);
+            pcache_put(page);
+        }
+        done += bytes;
+    }
+}
+
+/**
+ * @brief Drops cached pages past a new file size and zeroes the tail of the last one.
+ *
+ * Mapped pages past the end stay until they are unmapped, but read as zeros.
+ */
+void pcache_truncate(vfs_vnode_t* node, uint64_t size) {
+    pcache_page_t* page = node->pages;
+    while (page) {
+        pcache_page_t* next = page->file_next;
+        uint64_t start = (uint64_t)page->index << PCACHE_PAGE_SHIFT;
+        if (start >= size) {
+            if (page->refs == 0) pcache_free(page);
+            else memset(pcache_data(page), 0, PCACHE_PAGE_SIZE);
+        } else if (size - start < PCACHE_PAGE_SIZE) {
+            uint32_t keep = (uint32_t)(size - start);
+            memset(pcache_data(page) + keep, 0, PCACHE_PAGE_SIZE - keep);
+        }
+        page = next;
+    }
+}
+
+/**
+ * @brief Frees every page of a vnode that is about to be released.
+ */
+void pcache_drop_vnode(vfs_vnode_t* node) {
+    while (node->pages) pcache_free(node->pages);
+}
+
+/**
+ * @brief Frees every page that is not mapped.
+ */
+void pcache_drop_all(void) {
+    pcache_shrink(0);
+}
+
+/**
+ * @brief Frees unreferenced pages for the PMM, which calls this when it runs out.
+ * @return The number of pages freed.
+ */
+uint32_t pcache_reclaim(uint32_t count) {
+    if (reclaiming || page_count == 0) return 0;
+    reclaiming = true;
+    uint32_t target = page_count > count ? page_count - count : 0;
+    uint32_t freed = pcache_shrink(target);
+    stats.reclaims += freed;
+    reclaiming = false;
+    return freed;
+}
+
+/**
+ * @brief Sets how many pages are cached, shrinking the cache right away.
+ */
+void pcache_set_limit(uint32_t limit) {
+    page_limit = limit < PCACHE_MAX_PAGES ? limit : PCACHE_MAX_PAGES;
+    stats.evictions += pcache_shrink(page_limit);
+}
+
+/**
+ * @brief Finds count free pages in a row in the mapping window.
+ * @return The first page, or PCACHE_MMAP_PAGES if there is no such run.
+ */
+static uint32_t pcache_mmap_find(uint32_t count) {
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < PCACHE_MMAP_PAGES; i++) {
+        if (mmap_bitmap[i / 32] & (1u << (i % 32))) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) return i + 1 - count;
+    }
+    return PCACHE_MMAP_PAGES;
+}
+
+static void pcache_mmap_mark(uint32_t first, uint32_t count, bool used) {
+    for (uint32_t i = first; i < first + count; i++) {
+        if (used) mmap_bitmap[i / 32] |= 1u << (i % 32);
+        else mmap_bitmap[i / 32] &= ~(1u << (i % 32));
+    }
+}
+
+/**
+ * @brief Reserves a range of the mapping window for part of a file.
+ *
+ * No page is mapped yet, pcache_fault() maps each one on its first touch.
+ * @param offset Start in the file, a multiple of PCACHE_PAGE_SIZE.
+ * @return The address the file offset appears at, or 0 if offset is invalid or the window is full.
+ */
+virt_addr_t pcache_map(vfs_vnode_t* node, uint64_t offset, uint32_t length) {
+    if (length == 0 || (offset & (PCACHE_PAGE_SIZE - 1)) || offset >= node->size) return 0;
+    uint32_t count = (uint32_t)(((uint64_t)length + PCACHE_PAGE_SIZE - 1) >> PCACHE_PAGE_SHIFT);
+
+    pcache_mapping_t* mapping = NULL;
+    for (uint32_t i = 0; i < PCACHE_MAX_MAPPINGS && !mapping; i++) {
+        if (!mappings[i].vnode) mapping = &mappings[i];
+    }
+    if (!mapping) return 0;
+
+    uint32_t first = pcache_mmap_find(count);
+    if (first == PCACHE_MMAP_PAGES) return 0;
+    pcache_mmap_mark(first, count, true);
+
+    mapping->vnode = node;
+    mapping->base = VMM_MMAP_BASE + first * PCACHE_PAGE_SIZE;
+    mapping->first_page = (uint32_t)(offset >> PCACHE_PAGE_SHIFT);
+    mapping->pages = count;
+    return mapping->base;
+}
+
+/**
+ * @brief Removes a mapping made by pcache_map().
+ * @return The vnode it showed, for the caller to release, or NULL if addr starts no mapping.
+ */
+vfs_vnode_t* pcache_unmap(virt_addr_t addr) {
+    pcache_mapping_t* mapping = NULL;
+    for (uint32_t i = 0; i < PCACHE_MAX_MAPPINGS && !mapping; i++) {
+        if (mappings[i].vnode && mappings[i].base == addr) mapping = &mappings[i];
+    }
+    if (!mapping) return NULL;
+
+    for (uint32_t i = 0; i < mapping->pages; i++) {
+        virt_addr_t vaddr = mapping->base + i * PCACHE_PAGE_SIZE;
+        uint32_t* pte = vmm_get_page_entry(vaddr, false);
+        if (!pte || !(*pte & VMM_PAGE_PRESENT)) continue;
+
+        *pte = 0;
+        flush_tlb(vaddr);
+        pcache_page_t* page = pcache_lookup(mapping->vnode, mapping->first_page + i);
+        if (page) pcache_put(page);
+    }
+
+    pcache_mmap_mark((mapping->base - VMM_MMAP_BASE) / PCACHE_PAGE_SIZE, mapping->pages, false);
+    vfs_vnode_t* node = mapping->vnode;
+    mapping->vnode = NULL;
+    return node;
+}
+
+/**
+ * @brief Maps the cached page behind a not present address of the mapping window.
+ *
+ * Called by the page fault handler with interrupts enabled, as the page may
+ * have to be read. The mapping keeps a reference on the page until it is unmapped.
+ * @return false if no mapping covers addr, addr lies past the end of the file or the page cannot be read.
+ */
+bool pcache_fault(virt_addr_t addr) {
+    if (addr < VMM_MMAP_BASE || addr > VMM_MMAP_END) return false;
+
+    for (uint32_t i = 0; i < PCACHE_MAX_MAPPINGS; i++) {
+        pcache_mapping_t* mapping = &mappings[i];
+        if (!mapping->vnode || addr < mapping->base || addr >= mapping->base + mapping->pages * PCACHE_PAGE_SIZE) continue;
+
+        uint32_t index = mapping->first_page + (addr - mapping->base) / PCACHE_PAGE_SIZE;
+        if (((uint64_t)index << PCACHE_PAGE_SHIFT) >= mapping->vnode->size) return false;
+
+        pcache_page_t* page = pcache_get_page(mapping->vnode, index);
+        if (!page) return false;
+
+        virt_addr_t vaddr = addr & VMM_PAGE_MASK;
+        uint32_t* pte = vmm_get_page_entry(vaddr, true);
+        if (!pte) {
+            pcache_put(page);
+            return false;
+        }
+        *pte = page->phys | VMM_PAGE_PRESENT; // read only, writes go through vfs_write()
+        flush_tlb(vaddr);
+        stats.faults++;
+        return true;
+    }
+    return false;
+}
+
+pcache_stats_t* pcache_get_stats(void) {
+    return &stats;
+}
+
+static uint32_t pcache_permille(uint64_t part, uint64_t total) {
+    if (total == 0) return 0;
+    while (total >> 22) {
+        part >>= 1;
+        total >>= 1;
+    }
+    if (total == 0) return 0;
+    return (uint32_t)part * 1000 / (uint32_t)total;
+}
+
+void pcache_dump_info(void) {
+    char buf[128];
+    uint32_t referenced = 0;
+    for (uint32_t i = 0; pages && i < PCACHE_MAX_PAGES; i++) {
+        if (pages[i].vnode && pages[i].refs > 0) referenced++;
+    }
+    uint32_t mapping_count = 0;
+    for (uint32_t i = 0; i < PCACHE_MAX_MAPPINGS; i++) {
+        if (mappings[i].vnode) mapping_count++;
+    }
+    uint32_t rate = pcache_permille(stats.hits, stats.hits + stats.misses);
+
+    console_puts(U"Page Cache:\n");
+    snprintf(buf, sizeof(buf), "  Pages:          %u of %u (%u KB), %u in use\n", page_count, page_limit, page_count * (PCACHE_PAGE_SIZE / 1024), referenced);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Hits / Misses:  %llu / %llu (hit rate %u.%u%%)\n", stats.hits, stats.misses, rate / 10, rate % 10);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Evictions:      %llu, %llu reclaimed by the PMM\n", stats.evictions, stats.reclaims);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Mappings:       %u, %llu pages faulted in\n", mapping_count, stats.faults);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+}
+
+/**
+ * @brief Sets up the page slots and applies the pcache=<n> boot option.
+ */
+void pcache_init(void) {
+    const char* value = kernel_cmdline_get("pcache=");
+    if (value) page_limit = (uint32_t)str_to_u64_legacy(value);
+    if (page_limit > PCACHE_MAX_PAGES) page_limit = PCACHE_MAX_PAGES;
+
+    pages = (pcache_page_t*)kzalloc(PCACHE_MAX_PAGES * sizeof(pcache_page_t));
+    if (!pages) {
+        serial_printf("PCache: Error: No memory for %u page slots, caching disabled\n", PCACHE_MAX_PAGES);
+        page_limit = 0;
+        return;
+    }
+    for (uint32_t i = PCACHE_MAX_PAGES; i-- > 0;) {
+        pages[i].hash_next = free_slots;
+        free_slots = &pages[i];
+    }
+    serial_printf("PCache: Caching up to %u pages of file data\n", page_limit);
+}
@@ -0,0 +1,537 @@
+/**
+ * @file tmpfs.c
+ * @brief In-memory filesystem backed by physical pages
+ * @author friedrichOsDev
+ *
+ * Files and directories live only in memory and are never serialized. The
+ * data of a file is kept in physical pages taken straight from the PMM and
+ * indexed by a radix tree of 64 slots per level, so finding a page costs at
+ * most four steps and holes take no memory. Pages have no permanent virtual
+ * address, each copy maps them through a zero window slot. Directories hash
+ * their names and keep them in creation order for readdir.
+ *
+ * The data is in memory already, so the VFS reads it without the page cache.
+ * Every mount has a limit on its data pages, writes past it fail.
+ */
+
+#include <tmpfs.h>
+#include <memory.h>
+#include <string.h>
+#include <serial.h>
+#include <console.h>
+#include <print.h>
+#include <convert.h>
+#include <kernel.h>
+
+#define TMPFS_PAGE_SHIFT 12
+
+static uint32_t window_depth = 0;
+static uint32_t pending_limit_kb = TMPFS_DEFAULT_KB; // limit of the next mount
+
+/**
+ * @brief Maps a file page at the next free tmpfs slot of the zero window.
+ * @return Its address, or NULL if every slot is taken.
+ */
+static uint8_t* tmpfs_map(phys_addr_t phys) {
+    if (window_depth == TMPFS_WINDOW_COUNT) {
+        serial_printf("Tmpfs: Error: Page copies nested too deeply\n");
+        return NULL;
+    }
+    uint32_t window = TMPFS_WINDOW + window_depth++;
+    vmm_prepare_zero_window(phys, window);
+    return (uint8_t*)(VMM_ZERO_WINDOW + window * VMM_PAGE_SIZE);
+}
+
+static void tmpfs_unmap(void) {
+    window_depth--;
+}
+
+/**
+ * @brief Returns the number of pages a tree of the given height covers.
+ */
+static inline uint32_t tmpfs_radix_span(uint8_t height) {
+    return 1u << (TMPFS_RADIX_SHIFT * height);
+}
+
+/**
+ * @brief Returns the physical page holding a page of a file, 0 for a hole.
+ */
+static phys_addr_t tmpfs_radix_lookup(tmpfs_node_t* node, uint32_t index) {
+    if (node->height == 0 || index >= tmpfs_radix_span(node->height)) return 0;
+
+    tmpfs_radix_node_t* radix = node->root;
+    for (uint8_t level = node->height; radix && level > 1; level--) {
+        uint32_t slot = (index >> (TMPFS_RADIX_SHIFT * (level - 1))) & (TMPFS_RADIX_SLOTS - 1);
+        radix = (tmpfs_radix_node_t*)radix->slots[slot];
+    }
+    return radix ? (phys_addr_t)radix->slots[index & (TMPFS_RADIX_SLOTS - 1)] : 0;
+}
+
+static tmpfs_radix_node_t* tmpfs_radix_alloc(tmpfs_volume_t* vol) {
+    tmpfs_radix_node_t* radix = (tmpfs_radix_node_t*)kzalloc(sizeof(tmpfs_radix_node_t));
+    if (radix) vol->radix_nodes++;
+    return radix;
+}
+
+/**
+ * @brief Returns the lowest tree node that holds a page of a file, adding levels and nodes on the way.
+ * @return The node, or NULL if no memory is left.
+ */
+static tmpfs_radix_node_t* tmpfs_radix_leaf(tmpfs_volume_t* vol, tmpfs_node_t* node, uint32_t index) {
+    while (node->height == 0 || index >= tmpfs_radix_span(node->height)) {
+        if (node->root) {
+            // the old tree becomes the first slot of a new top level
+            tmpfs_radix_node_t* top = tmpfs_radix_alloc(vol);
+            if (!top) return NULL;
+            top->slots[0] = (uintptr_t)node->root;
+            top->count = 1;
+            node->root = top;
+        }
+        node->height++;
+    }
+    if (!node->root) {
+        node->root = tmpfs_radix_alloc(vol);
+        if (!node->root) return NULL;
+    }
+
+    tmpfs_radix_node_t* radix = node->root;
+    for (uint8_t level = node->height; level > 1; level--) {
+        uint32_t slot = (index >> (TMPFS_RADIX_SHIFT * (level - 1))) & (TMPFS_RADIX_SLOTS - 1);
+        if (!radix->slots[slot]) {
+            tmpfs_radix_node_t* child = tmpfs_radix_alloc(vol);
+            if (!child) return NULL;
+            radix->slots[slot] = (uintptr_t)child;
+            radix->count++;
+        }
+        radix = (tmpfs_radix_node_t*)radix->slots[slot];
+    }
+    return radix;
+}
+
+/**
+ * @brief Frees the pages from page first on below a tree node, and the nodes left empty.
+ * @param base Page index of the first page below the node.
+ * @return true if the node is empty now.
+ */
+static bool tmpfs_radix_trim(tmpfs_volume_t* vol, tmpfs_node_t* node, tmpfs_radix_node_t* radix, uint8_t height, uint32_t base, uint32_t first) {
+    uint32_t span = tmpfs_radix_span(height - 1);
+    for (uint32_t i = 0; i < TMPFS_RADIX_SLOTS && radix->count > 0; i++) {
+        uint32_t start = base + i * span;
+        if (!radix->slots[i] || start + span <= first) continue;
+
+        if (height == 1) {
+            pmm_free_page((phys_addr_t)radix->slots[i]);
+            vol->used_pages--;
+            node->page_count--;
+        } else {
+            tmpfs_radix_node_t* child = (tmpfs_radix_node_t*)radix->slots[i];
+            if (!tmpfs_radix_trim(vol, node, child, height - 1, start, first)) continue;
+            kfree((virt_addr_t)child);
+            vol->radix_nodes--;
+        }
+        radix->slots[i] = 0;
+        radix->count--;
+    }
+    return radix->count == 0;
+}
+
+/**
+ * @brief Frees the pages of a file from page first on, and the tree levels it no longer needs.
+ */
+static void tmpfs_free_pages(tmpfs_volume_t* vol, tmpfs_node_t* node, uint32_t first) {
+    if (!node->root) return;
+    if (tmpfs_radix_trim(vol, node, node->root, node->height, 0, first)) {
+        kfree((virt_addr_t)node->root);
+        vol->radix_nodes--;
+        node->root = NULL;
+        node->height = 0;
+        return;
+    }
+    while (node->height > 1 && node->root->count == 1 && node->root->slots[0]) {
+        tmpfs_radix_node_t* child = (tmpfs_radix_node_t*)node->root->slots[0];
+        kfree((virt_addr_t)node->root);
+        vol->radix_nodes--;
+        node->root = child;
+        node->height--;
+    }
+}
+
+static uint32_t tmpfs_name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static tmpfs_dirent_t* tmpfs_dir_find(tmpfs_node_t* dir, const char* name) {
+    if (!dir->buckets) return NULL;
+    uint32_t hash = tmpfs_name_hash(name);
+    for (tmpfs_dirent_t* entry = dir->buckets[hash & (dir->bucket_count - 1)]; entry; entry = entry->hash_next) {
+        if (entry->hash == hash && strcmp(entry->name, name) == 0) return entry;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Doubles the hash buckets of a directory, or allocates the first ones.
+ */
+static bool tmpfs_dir_grow_buckets(tmpfs_node_t* dir) {
+    uint32_t count = dir->bucket_count ? dir->bucket_count * 2 : TMPFS_DIR_MIN_BUCKETS;
+    tmpfs_dirent_t** buckets = (tmpfs_dirent_t**)kzalloc(count * sizeof(tmpfs_dirent_t*));
+    if (!buckets) return false;
+
+    for (uint32_t i = 0; i < dir->bucket_count; i++) {
+        tmpfs_dirent_t* entry = dir->buckets[i];
+        while (entry) {
+            tmpfs_dirent_t* next = entry->hash_next;
+            entry->hash_next = buckets[entry->hash & (count - 1)];
+            buckets[entry->hash & (count - 1)] = entry;
+            entry = next;
+        }
+    }
+    if (dir->buckets) kfree((virt_addr_t)dir->buckets);
+    dir->buckets = buckets;
+    dir->bucket_count = count;
+    return true;
+}
+
+/**
+ * @brief Makes room for one more entry at the end of the entry array.
+ *
+ * When at least half of the array are holes it is compacted instead of grown,
+ * which moves the readdir position of the entries behind the holes.
+ */
+static bool tmpfs_dir_grow_entries(tmpfs_node_t* dir) {
+    if (dir->entry_end < dir->entry_capacity) return true;
+
+    if (dir->entry_count <= dir->entry_capacity / 2 && dir->entry_capacity > 0) {
+        uint32_t used = 0;
+        for (uint32_t i = 0; i < dir->entry_end; i++) {
+            if (!dir->entries[i]) continue;
+            dir->entries[used] = dir->entries[i];
+            dir->entries[used]->slot = used;
+            used++;
+        }
+        dir->entry_end = used;
+        return true;
+    }
+
+    uint32_t capacity = dir->entry_capacity ? dir->entry_capacity * 2 : TMPFS_DIR_MIN_BUCKETS;
+    tmpfs_dirent_t** entries = (tmpfs_dirent_t**)krealloc((virt_addr_t)dir->entries, capacity * sizeof(tmpfs_dirent_t*));
+    if (!entries) return false;
+    dir->entries = entries;
+    dir->entry_capacity = capacity;
+    return true;
+}
+
+static uint8_t tmpfs_dir_add(tmpfs_node_t* dir, const char* name, tmpfs_node_t* node) {
+    if (dir->entry_count >= dir->bucket_count && !tmpfs_dir_grow_buckets(dir)) return 1;
+    if (!tmpfs_dir_grow_entries(dir)) return 1;
+
+    size_t len = strlen(name);
+    tmpfs_dirent_t* entry = (tmpfs_dirent_t*)kmalloc(sizeof(tmpfs_dirent_t) + len + 1);
+    if (!entry) return 1;
+    memcpy(entry->name, name, len + 1);
+    entry->node = node;
+    entry->hash = tmpfs_name_hash(name);
+    entry->slot = dir->entry_end;
+    entry->hash_next = dir->buckets[entry->hash & (dir->bucket_count - 1)];
+    dir->buckets[entry->hash & (dir->bucket_count - 1)] = entry;
+    dir->entries[dir->entry_end++] = entry;
+    dir->entry_count++;
+    node->dirent = entry;
+    return 0;
+}
+
+static void tmpfs_dir_remove(tmpfs_node_t* dir, tmpfs_dirent_t* entry) {
+    tmpfs_dirent_t** link = &dir->buckets[entry->hash & (dir->bucket_count - 1)];
+    while (*link != entry) link = &(*link)->hash_next;
+    *link = entry->hash_next;
+
+    dir->entries[entry->slot] = NULL;
+    while (dir->entry_end > 0 && !dir->entries[dir->entry_end - 1]) dir->entry_end--;
+    dir->entry_count--;
+    entry->node->dirent = NULL;
+    kfree((virt_addr_t)entry);
+}
+
+static tmpfs_node_t* tmpfs_node_alloc(tmpfs_volume_t* vol, uint8_t type) {
+    tmpfs_node_t* node = (tmpfs_node_t*)kzalloc(sizeof(tmpfs_node_t));
+    if (!node) return NULL;
+    node->ino = vol->next_ino++;
+    node->type = type;
+    if (type == VFS_TYPE_DIR) vol->dir_count++;
+    else vol->file_count++;
+    return node;
+}
+
+/**
+ * @brief Frees a node with its pages and, for a directory, everything below it.
+ */
+static void tmpfs_node_free(tmpfs_volume_t* vol, tmpfs_node_t* node) {
+    if (node->type == VFS_TYPE_DIR) {
+        for (uint32_t i = 0; i < node->entry_end; i++) {
+            tmpfs_dirent_t* entry = node->entries[i];
+            if (!entry) continue;
+            tmpfs_node_free(vol, entry->node);
+            kfree((virt_addr_t)entry);
+        }
+        if (node->entries) kfree((virt_addr_t)node->entries);
+        if (node->buckets) kfree((virt_addr_t)node->buckets);
+        vol->dir_count--;
+    } else {
+        tmpfs_free_pages(vol, node, 0);
+        vol->file_count--;
+    }
+    kfree((virt_addr_t)node);
+}
+
+static void tmpfs_vfs_fill(tmpfs_node_t* node, vfs_vnode_t* out) {
+    out->ino = node->ino;
+    out->type = node->type;
+    out->size = node->size;
+    out->private = node;
+}
+
+static uint8_t tmpfs_vfs_lookup(vfs_vnode_t* dir, const char* name, vfs_vnode_t* out) {
+    tmpfs_dirent_t* entry = tmpfs_dir_find((tmpfs_node_t*)dir->private, name);
+    if (!entry) return 1;
+    tmpfs_vfs_fill(entry->node, out);
+    return 0;
+}
+
+static uint8_t tmpfs_vfs_create(vfs_vnode_t* dir, const char* name, uint8_t type, vfs_vnode_t* out) {
+    tmpfs_volume_t* vol = (tmpfs_volume_t*)dir->mount->private;
+    tmpfs_node_t* parent = (tmpfs_node_t*)dir->private;
+    if (name[0] == '\0' || strlen(name) > VFS_MAX_NAME || tmpfs_dir_find(parent, name)) return 1;
+
+    tmpfs_node_t* node = tmpfs_node_alloc(vol, type);
+    if (!node) return 1;
+    if (tmpfs_dir_add(parent, name, node) != 0) {
+        tmpfs_node_free(vol, node);
+        return 1;
+    }
+    tmpfs_vfs_fill(node, out);
+    return 0;
+}
+
+/**
+ * @brief Removes a name, the node itself goes with its vnode in tmpfs_vfs_release().
+ */
+static uint8_t tmpfs_vfs_remove(vfs_vnode_t* dir, vfs_vnode_t* vnode) {
+    tmpfs_node_t* node = (tmpfs_node_t*)vnode->private;
+    if (!node->dirent || (node->type == VFS_TYPE_DIR && node->entry_count > 0)) return 1;
+
+    tmpfs_dir_remove((tmpfs_node_t*)dir->private, node->dirent);
+    node->unlinked = true;
+    return 0;
+}
+
+static uint8_t tmpfs_vfs_readdir(vfs_vnode_t* dir, uint32_t* cursor, vfs_dirent_t* out) {
+    tmpfs_node_t* node = (tmpfs_node_t*)dir->private;
+    while (*cursor < node->entry_end) {
+        tmpfs_dirent_t* entry = node->entries[(*cursor)++];
+        if (!entry) continue;
+        strcpy(out->name, entry->name);
+        out->type = entry->node->type;
+        out->size = entry->node->size;
+        return 0;
+    }
+    return 1;
+}
+
+static int32_t tmpfs_vfs_read(vfs_vnode_t* vnode, uint64_t offset, void* buffer, uint32_t length) {
+    tmpfs_volume_t* vol = (tmpfs_volume_t*)vnode->mount->private;
+    tmpfs_node_t* node = (tmpfs_node_t*)vnode->private;
+    if (offset >= node->size) return 0;
+    if (length > node->size - offset) length = (uint32_t)(node->size - offset);
+    if (length > INT32_MAX) length = INT32_MAX;
+
+    uint8_t* out = (uint8_t*)buffer;
+    uint32_t done = 0;
+    while (done < length) {
+        uint64_t pos = offset + done;
+        uint32_t page_offset = (uint32_t)pos & (TMPFS_PAGE_SIZE - 1);
+        uint32_t bytes = TMPFS_PAGE_SIZE - page_offset;
+        if (bytes > length - done) bytes = length - done;
+
+        phys_addr_t phys = tmpfs_radix_lookup(node, (uint32_t)(pos >> TMPFS_PAGE_SHIFT));
+        if (phys) {
+            uint8_t* page = tmpfs_map(phys);
+            if (!page) return done > 0 ? (int32_t)done : -1;
+            memcpy(out + done, page + page_offset, bytes);
+            tmpfs_unmap();
+        } else {
+            memset(out + done, 0, bytes);
+        }
+        done += bytes;
+    }
+    vol->bytes_read += done;
+    return (int32_t)done;
+}
+
+static int32_t tmpfs_vfs_write(vfs_vnode_t* vnode, uint64_t offset, const void* buffer, uint32_t length) {
+    tmpfs_volume_t* vol = (tmpfs_volume_t*)vnode->mount->private;
+    tmpfs_node_t* node = (tmpfs_node_t*)vnode->private;
+    if (offset >= TMPFS_MAX_FILE_SIZE) return -1;
+    if (length > TMPFS_MAX_FILE_SIZE - offset) length = (uint32_t)(TMPFS_MAX_FILE_SIZE - offset);
+    if (length > INT32_MAX) length = INT32_MAX;
+
+    const uint8_t* in = (const uint8_t*)buffer;
+    uint32_t done = 0;
+    while (done < length) {
+        uint64_t pos = offset + done;
+        uint32_t index = (uint32_t)(pos >> TMPFS_PAGE_SHIFT);
+        uint32_t page_offset = (uint32_t)pos & (TMPFS_PAGE_SIZE - 1);
+        uint32_t bytes = TMPFS_PAGE_SIZE - page_offset;
+        if (bytes > length - done) bytes = length - done;
+
+        phys_addr_t phys = tmpfs_radix_lookup(node, index);
+        if (!phys) {
+            if (vol->used_pages >= vol->limit_pages) {
+                vol->full_errors++;
+                break;
+            }
+            tmpfs_radix_node_t* leaf = tmpfs_radix_leaf(vol, node, index);
+            if (!leaf) break;
+
+            // a page that is written whole needs no zeroing
+            phys = bytes == TMPFS_PAGE_SIZE ? pmm_alloc_page() : pmm_zalloc_page();
+            if (!phys) break;
+            leaf->slots[index & (TMPFS_RADIX_SLOTS - 1)] = (uintptr_t)phys;
+            leaf->count++;
+            node->page_count++;
+            vol->used_pages++;
+        }
+
+        uint8_t* page = tmpfs_map(phys);
+        if (!page) break;
+        memcpy(page + page_offset, in + done, bytes);
+        tmpfs_unmap();
+        done += bytes;
+    }
+
+    if (offset + done > node->size) node->size = offset + done;
+    vnode->size = node->size;
+    vol->bytes_written += done;
+    if (done == 0 && length > 0) return -1;
+    return (int32_t)done;
+}
+
+/**
+ * @brief Frees the pages past a smaller size and zeroes the rest of the last page, a larger size leaves a hole.
+ */
+static uint8_t tmpfs_vfs_truncate(vfs_vnode_t* vnode, uint64_t size) {
+    tmpfs_volume_t* vol = (tmpfs_volume_t*)vnode->mount->private;
+    tmpfs_node_t* node = (tmpfs_node_t*)vnode->private;
+    if (size > TMPFS_MAX_FILE_SIZE) return 1;
+
+    if (size < node->size) {
+        tmpfs_free_pages(vol, node, (uint32_t)((size + TMPFS_PAGE_SIZE - 1) >> TMPFS_PAGE_SHIFT));
+
+        // bytes past the end must read as zeros when the file grows again
+        uint32_t keep = (uint32_t)size & (TMPFS_PAGE_SIZE - 1);
+        phys_addr_t phys = keep ? tmpfs_radix_lookup(node, (uint32_t)(size >> TMPFS_PAGE_SHIFT)) : 0;
+        uint8_t* page = phys ? tmpfs_map(phys) : NULL;
+        if (page) {
+            memset(page + keep, 0, TMPFS_PAGE_SIZE - keep);
+            tmpfs_unmap();
+        }
+    }
+    node->size = size;
+    vnode->size = size;
+    return 0;
+}
+
+static void tmpfs_vfs_release(vfs_vnode_t* vnode) {
+    tmpfs_node_t* node = (tmpfs_node_t*)vnode->private;
+    if (node && node->unlinked) tmpfs_node_free((tmpfs_volume_t*)vnode->mount->private, node);
+}
+
+static uint8_t tmpfs_vfs_mount(vfs_mount_t* mount, disk_t* disk, vfs_vnode_t* root) {
+    (void)disk;
+    tmpfs_volume_t* vol = (tmpfs_volume_t*)kzalloc(sizeof(tmpfs_volume_t));
+    if (!vol) return 1;
+    vol->limit_pages = pending_limit_kb / (TMPFS_PAGE_SIZE / 1024);
+    vol->next_ino = 1;
+
+    vol->root = tmpfs_node_alloc(vol, VFS_TYPE_DIR);
+    if (!vol->root) {
+        kfree((virt_addr_t)vol);
+        return 1;
+    }
+    tmpfs_vfs_fill(vol->root, root);
+    mount->private = vol;
+    return 0;
+}
+
+static void tmpfs_vfs_unmount(vfs_mount_t* mount) {
+    tmpfs_volume_t* vol = (tmpfs_volume_t*)mount->private;
+    tmpfs_node_free(vol, vol->root);
+    kfree((virt_addr_t)vol);
+}
+
+static void tmpfs_vfs_dump(vfs_mount_t* mount) {
+    tmpfs_volume_t* vol = (tmpfs_volume_t*)mount->private;
+    char buf[128];
+
+    uint32_t page_kb = TMPFS_PAGE_SIZE / 1024;
+    snprintf(buf, sizeof(buf), "  Used:      %u KB of %u KB (%u pages), %llu writes cut short by the limit\n",
+             vol->used_pages * page_kb, vol->limit_pages * page_kb, vol->used_pages, vol->full_errors);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+    snprintf(buf, sizeof(buf), "  Nodes:     %u files, %u directories, %u radix nodes (%u KB)\n",
+             vol->file_count, vol->dir_count, vol->radix_nodes, (uint32_t)(vol->radix_nodes * sizeof(tmpfs_radix_node_t)) / 1024);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+    snprintf(buf, sizeof(buf), "  Traffic:   %llu KB read, %llu KB written\n", vol->bytes_read >> 10, vol->bytes_written >> 10);
+    for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+}
+
+static const vfs_ops_t tmpfs_vfs_ops = {
+    .lookup = tmpfs_vfs_lookup,
+    .create = tmpfs_vfs_create,
+    .remove = tmpfs_vfs_remove,
+    .readdir = tmpfs_vfs_readdir,
+    .read = tmpfs_vfs_read,
+    .write = tmpfs_vfs_write,
+    .truncate = tmpfs_vfs_truncate,
+    .bmap = NULL,
+    .sync = NULL,
+    .release = tmpfs_vfs_release
+};
+
+static const vfs_fs_type_t tmpfs_fs_type = {
+    .name = "tmpfs",
+    .flags = VFS_FS_NO_PAGE_CACHE,
+    .mount = tmpfs_vfs_mount,
+    .unmount = tmpfs_vfs_unmount,
+    .dump = tmpfs_vfs_dump,
+    .ops = &tmpfs_vfs_ops
+};
+
+/**
+ * @brief Mounts an empty tmpfs.
+ * @param limit_kb Most file data it may hold.
+ * @return 0 on success, 1 on failure.
+ */
+uint8_t tmpfs_mount(const char* path, uint32_t limit_kb) {
+    pending_limit_kb = limit_kb;
+    uint8_t res = vfs_mount(path, "tmpfs", NULL);
+    pending_limit_kb = TMPFS_DEFAULT_KB;
+    return res;
+}
+
+/**
+ * @brief Registers tmpfs with the VFS and mounts one at /tmp.
+ *
+ * tmpfs=<KB> sets its size, 0 leaves /tmp unmounted.
+ */
+void tmpfs_init(void) {
+    vfs_register_fs(&tmpfs_fs_type);
+
+    uint32_t limit_kb = TMPFS_DEFAULT_KB;
+    const char* value = kernel_cmdline_get("tmpfs=");
+    if (value) limit_kb = (uint32_t)str_to_u64_legacy(value);
+    if (limit_kb > 0) tmpfs_mount("/tmp", limit_kb);
+}
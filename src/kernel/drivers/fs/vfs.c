@@ -1,4 +1,948 @@
 /**
  * @file vfs.c
+ * @brief Virtual file system with mount points, vnode cache and dentry cache
  * @author friedrichOsDev
- */
\ No newline at end of file
+ *
+ * Paths are normalized lexically and mapped to the mount with the longest
+ * matching prefix, then walked one component at a time. Every step first
+ * consults the dentry cache, which remembers both names that exist (holding a
+ * reference on their vnode) and names that do not, so repeated walks to hot
+ * files and repeated misses never reach the filesystem.
+ *
+ * File data is read through the page cache (pcache.c), which vfs_mmap() maps
+ * directly. Writes go to the filesystem and are copied into cached pages.
+ */
+
+#include <vfs.h>
+#include <pcache.h>
+#include <aio.h>
+#include <memory.h>
+#include <string.h>
+#include <serial.h>
+#include <console.h>
+#include <print.h>
+#include <convert.h>
+#include <kernel.h>
+#include <timer.h>
+
+#define VFS_READDIR_MOUNTS 0x80000000 // readdir cursors from here on list mount points
+
+static const vfs_fs_type_t* fs_types[VFS_MAX_FS_TYPES];
+static uint32_t fs_type_count = 0;
+static vfs_mount_t* mounts[VFS_MAX_MOUNTS];
+
+static vfs_dentry_t* dentry_table[VFS_DCACHE_BUCKETS];
+static vfs_dentry_t* dentry_lru_head = NULL; // most recently used
+static vfs_dentry_t* dentry_lru_tail = NULL; // least recently used
+static uint32_t dentry_count = 0;
+static uint32_t dentry_negative_count = 0;
+static uint32_t dentry_limit = VFS_DCACHE_DEFAULT;
+
+static vfs_vnode_t* vnode_table[VFS_VCACHE_BUCKETS];
+static vfs_vnode_t* vnode_lru_head = NULL; // most recently released unused vnode
+static vfs_vnode_t* vnode_lru_tail = NULL;
+static uint32_t vnode_count = 0;
+static uint32_t vnode_unused_count = 0;
+static uint32_t vnode_limit = VFS_VCACHE_DEFAULT;
+
+static vfs_stats_t stats;
+
+static volatile bool sync_pending = false;
+static bool modified = false; // something may have changed since the last vfs_sync()
+
+// stands in for directories that only exist as ancestors of mount points, such as "/" before a root is mounted
+static vfs_vnode_t virtual_dir = { .type = VFS_TYPE_DIR, .refs = 1 };
+
+static inline bool vfs_case_insensitive(vfs_mount_t* mount) {
+    return mount->type->flags & VFS_FS_CASE_INSENSITIVE;
+}
+
+static inline char vfs_fold(vfs_mount_t* mount, char c) {
+    return (vfs_case_insensitive(mount) && c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+}
+
+static uint32_t vfs_name_hash(vfs_mount_t* mount, uint64_t parent_ino, const char* name) {
+    uint32_t hash = 2166136261u;
+    for (const char* p = name; *p; p++) {
+        hash ^= (uint8_t)vfs_fold(mount, *p);
+        hash *= 16777619u;
+    }
+    return hash ^ (((uint32_t)parent_ino ^ (uint32_t)(parent_ino >> 32) ^ ((uint32_t)(uintptr_t)mount >> 4)) * 2654435761u);
+}
+
+static bool vfs_name_equal(vfs_mount_t* mount, const char* a, const char* b) {
+    while (*a && *b) {
+        if (vfs_fold(mount, *a) != vfs_fold(mount, *b)) return false;
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static inline uint32_t vfs_vnode_bucket(vfs_mount_t* mount, uint64_t ino) {
+    uint32_t key = (uint32_t)ino ^ (uint32_t)(ino >> 32) ^ ((uint32_t)(uintptr_t)mount >> 4);
+    return (key * 2654435761u) % VFS_VCACHE_BUCKETS;
+}
+
+static void vfs_vnode_lru_unlink(vfs_vnode_t* node) {
+    if (node->lru_prev) node->lru_prev->lru_next = node->lru_next;
+    else vnode_lru_head = node->lru_next;
+    if (node->lru_next) node->lru_next->lru_prev = node->lru_prev;
+    else vnode_lru_tail = node->lru_prev;
+    node->lru_prev = NULL;
+    node->lru_next = NULL;
+    vnode_unused_count--;
+}
+
+static void vfs_vnode_lru_push_front(vfs_vnode_t* node) {
+    node->lru_prev = NULL;
+    node->lru_next = vnode_lru_head;
+    if (vnode_lru_head) vnode_lru_head->lru_prev = node;
+    vnode_lru_head = node;
+    if (!vnode_lru_tail) vnode_lru_tail = node;
+    vnode_unused_count++;
+}
+
+static void vfs_vnode_unhash(vfs_vnode_t* node) {
+    vfs_vnode_t** link = &vnode_table[vfs_vnode_bucket(node->mount, node->ino)];
+    while (*link) {
+        if (*link == node) {
+            *link = node->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    node->hash_next = NULL;
+}
+
+/**
+ * @brief Frees an unreferenced vnode together with its filesystem data.
+ */
+static void vfs_vnode_destroy(vfs_vnode_t* node) {
+    if (node->refs == 0 && (node->lru_prev || vnode_lru_head == node)) vfs_vnode_lru_unlink(node);
+    if (!(node->flags & VFS_VNODE_UNLINKED)) vfs_vnode_unhash(node);
+    pcache_drop_vnode(node);
+    if (node->mount->type->ops->release) node->mount->type->ops->release(node);
+    kfree((virt_addr_t)node);
+    vnode_count--;
+}
+
+static void vfs_dentry_remove(vfs_dentry_t* dentry);
+
+/**
+ * @brief Evicts unused vnodes, and dentries pinning vnodes, until at most target vnodes remain.
+ */
+static void vfs_vnode_shrink(uint32_t target) {
+    while (vnode_count > target) {
+        if (vnode_lru_tail) {
+            vfs_vnode_destroy(vnode_lru_tail);
+            stats.vcache_evictions++;
+        } else if (dentry_lru_tail) {
+            vfs_dentry_remove(dentry_lru_tail);
+            stats.dcache_evictions++;
+        } else {
+            break; // everything left is open or a mount root
+        }
+    }
+}
+
+/**
+ * @brief Returns a cached vnode with an added reference.
+ */
+static vfs_vnode_t* vfs_vnode_find(vfs_mount_t* mount, uint64_t ino) {
+    vfs_vnode_t* node = vnode_table[vfs_vnode_bucket(mount, ino)];
+    while (node) {
+        if (node->mount == mount && node->ino == ino) {
+            if (node->refs++ == 0) vfs_vnode_lru_unlink(node);
+            stats.vcache_hits++;
+            return node;
+        }
+        node = node->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns the cached vnode for a node filled in by lookup or create,
+ * or caches it. The filled in node is released if it was already cached.
+ */
+static vfs_vnode_t* vfs_vnode_instantiate(vfs_mount_t* mount, vfs_vnode_t* filled) {
+    const vfs_ops_t* ops = mount->type->ops;
+    filled->mount = mount;
+
+    vfs_vnode_t* node = vfs_vnode_find(mount, filled->ino);
+    if (node) {
+        if (ops->release) ops->release(filled);
+        return node;
+    }
+
+    stats.vcache_misses++;
+    if (vnode_limit > 0) vfs_vnode_shrink(vnode_limit - 1);
+
+    node = (vfs_vnode_t*)kzalloc(sizeof(vfs_vnode_t));
+    if (!node) {
+        if (ops->release) ops->release(filled);
+        return NULL;
+    }
+    node->mount = mount;
+    node->ino = filled->ino;
+    node->type = filled->type;
+    node->size = filled->size;
+    node->private = filled->private;
+    node->refs = 1;
+
+    uint32_t bucket = vfs_vnode_bucket(mount, node->ino);
+    node->hash_next = vnode_table[bucket];
+    vnode_table[bucket] = node;
+    vnode_count++;
+    return node;
+}
+
+static void vfs_vnode_put(vfs_vnode_t* node) {
+    if (!node->mount) return; // virtual directories are never freed
+
+    if (--node->refs > 0) return;
+    if (node->flags & VFS_VNODE_UNLINKED) {
+        vfs_vnode_destroy(node);
+        return;
+    }
+    vfs_vnode_lru_push_front(node);
+    if (vnode_count > vnode_limit) vfs_vnode_shrink(vnode_limit);
+}
+
+static void vfs_dentry_lru_unlink(vfs_dentry_t* dentry) {
+    if (dentry->lru_prev) dentry->lru_prev->lru_next = dentry->lru_next;
+    else dentry_lru_head = dentry->lru_next;
+    if (dentry->lru_next) dentry->lru_next->lru_prev = dentry->lru_prev;
+    else dentry_lru_tail = dentry->lru_prev;
+    dentry->lru_prev = NULL;
+    dentry->lru_next = NULL;
+}
+
+static void vfs_dentry_lru_push_front(vfs_dentry_t* dentry) {
+    dentry->lru_prev = NULL;
+    dentry->lru_next = dentry_lru_head;
+    if (dentry_lru_head) dentry_lru_head->lru_prev = dentry;
+    dentry_lru_head = dentry;
+    if (!dentry_lru_tail) dentry_lru_tail = dentry;
+}
+
+static void vfs_dentry_remove(vfs_dentry_t* dentry) {
+    vfs_dentry_t** link = &dentry_table[dentry->hash % VFS_DCACHE_BUCKETS];
+    while (*link) {
+        if (*link == dentry) {
+            *link = dentry->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    vfs_dentry_lru_unlink(dentry);
+
+    if (dentry->vnode) vfs_vnode_put(dentry->vnode);
+    else dentry_negative_count--;
+    kfree((virt_addr_t)dentry);
+    dentry_count--;
+}
+
+static vfs_dentry_t* vfs_dentry_find(vfs_mount_t* mount, uint64_t parent_ino, const char* name, uint32_t hash) {
+    vfs_dentry_t* dentry = dentry_table[hash % VFS_DCACHE_BUCKETS];
+    while (dentry) {
+        if (dentry->hash == hash && dentry->mount == mount && dentry->parent_ino == parent_ino && vfs_name_equal(mount, dentry->name, name)) {
+            return dentry;
+        }
+        dentry = dentry->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Caches a name, taking a reference on node, or a negative entry if node is NULL.
+ */
+static void vfs_dentry_add(vfs_mount_t* mount, uint64_t parent_ino, const char* name, uint32_t hash, vfs_vnode_t* node) {
+    if (dentry_limit == 0) return;
+    while (dentry_count >= dentry_limit && dentry_lru_tail) {
+        vfs_dentry_remove(dentry_lru_tail);
+        stats.dcache_evictions++;
+    }
+
+    size_t len = strlen(name);
+    vfs_dentry_t* dentry = (vfs_dentry_t*)kmalloc(sizeof(vfs_dentry_t) + len + 1);
+    if (!dentry) return;
+    dentry->mount = mount;
+    dentry->parent_ino = parent_ino;
+    dentry->hash = hash;
+    dentry->vnode = node;
+    memcpy(dentry->name, name, len + 1);
+
+    if (node) node->refs++;
+    else dentry_negative_count++;
+
+    uint32_t bucket = hash % VFS_DCACHE_BUCKETS;
+    dentry->hash_next = dentry_table[bucket];
+    dentry_table[bucket] = dentry;
+    vfs_dentry_lru_push_front(dentry);
+    dentry_count++;
+}
+
+/**
+ * @brief Drops the dentries of a mount, optionally only those in one directory or naming one vnode.
+ */
+static void vfs_dentry_purge(vfs_mount_t* mount, bool match_parent, uint64_t parent_ino, vfs_vnode_t* node) {
+    vfs_dentry_t* dentry = dentry_lru_head;
+    while (dentry) {
+        vfs_dentry_t* next = dentry->lru_next;
+        bool match = dentry->mount == mount;
+        if (match && match_parent) match = dentry->parent_ino == parent_ino;
+        if (match && node) match = dentry->vnode == node;
+        if (match) vfs_dentry_remove(dentry);
+        dentry = next;
+    }
+}
+
+/**
+ * @brief Turns a path into an absolute path without ".", ".." and repeated slashes.
+ * @param out At least VFS_MAX_PATH bytes.
+ * @return 0 on success, 1 if the path is relative or too long.
+ */
+uint8_t vfs_normalize_path(const char* path, char* out) {
+    if (!path || path[0] != '/') return 1;
+
+    uint32_t len = 0;
+    const char* p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        if (!*p) break;
+
+        const char* start = p;
+        while (*p && *p != '/') p++;
+        uint32_t n = (uint32_t)(p - start);
+
+        if (n == 1 && start[0] == '.') continue;
+        if (n == 2 && start[0] == '.' && start[1] == '.') {
+            while (len > 0 && out[len - 1] != '/') len--;
+            if (len > 0) len--;
+            continue;
+        }
+        if (n > VFS_MAX_NAME || len + 1 + n >= VFS_MAX_PATH) return 1;
+
+        out[len++] = '/';
+        memcpy(out + len, start, n);
+        len += n;
+    }
+
+    if (len == 0) out[len++] = '/';
+    out[len] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Returns true if the mount point lies within the first len characters of a normalized path.
+ */
+static bool vfs_mount_covers(vfs_mount_t* mount, const char* path, uint32_t len) {
+    if (mount->path_len == 1) return true; // "/"
+    if (mount->path_len > len || memcmp(mount->path, path, mount->path_len) != 0) return false;
+    return mount->path_len == len || path[mount->path_len] == '/';
+}
+
+/**
+ * @brief Returns true if a mount point lies strictly below the first len characters of a normalized path.
+ */
+static bool vfs_mount_below(vfs_mount_t* mount, const char* path, uint32_t len) {
+    if (len == 1) return mount->path_len > 1;
+    return mount->path_len > len && memcmp(mount->path, path, len) == 0 && mount->path[len] == '/';
+}
+
+static vfs_mount_t* vfs_find_mount(const char* path, uint32_t len) {
+    vfs_mount_t* best = NULL;
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        vfs_mount_t* mount = mounts[i];
+        if (mount && vfs_mount_covers(mount, path, len) && (!best || mount->path_len > best->path_len)) best = mount;
+    }
+    return best;
+}
+
+/**
+ * @brief Resolves one name in a directory through the dentry cache.
+ * @return The child with an added reference, or NULL if it does not exist.
+ */
+static vfs_vnode_t* vfs_lookup_child(vfs_vnode_t* dir, const char* name) {
+    vfs_mount_t* mount = dir->mount;
+    if (!mount || dir->type != VFS_TYPE_DIR) return NULL;
+    stats.lookups++;
+
+    uint32_t hash = vfs_name_hash(mount, dir->ino, name);
+    vfs_dentry_t* dentry = vfs_dentry_find(mount, dir->ino, name, hash);
+    if (dentry) {
+        if (dentry_lru_head != dentry) {
+            vfs_dentry_lru_unlink(dentry);
+            vfs_dentry_lru_push_front(dentry);
+        }
+        if (!dentry->vnode) {
+            stats.dcache_negative_hits++;
+            return NULL;
+        }
+        stats.dcache_hits++;
+        if (dentry->vnode->refs++ == 0) vfs_vnode_lru_unlink(dentry->vnode);
+        return dentry->vnode;
+    }
+    stats.dcache_misses++;
+
+    vfs_vnode_t filled;
+    memset(&filled, 0, sizeof(filled));
+    vfs_vnode_t* node = NULL;
+    if (mount->type->ops->lookup(dir, name, &filled) == 0) {
+        node = vfs_vnode_instantiate(mount, &filled);
+        if (!node) return NULL;
+    }
+
+    vfs_dentry_add(mount, dir->ino, name, hash, node);
+    return node;
+}
+
+/**
+ * @brief Walks the part of a normalized path below a mount point.
+ */
+static vfs_vnode_t* vfs_walk_mount(vfs_mount_t* mount, const char* path, uint32_t len) {
+    vfs_vnode_t* node = mount->root;
+    node->refs++;
+
+    char name[VFS_MAX_NAME + 1];
+    const char* p = path + (mount->path_len == 1 ? 0 : mount->path_len);
+    const char* end = path + len;
+    while (p < end) {
+        while (p < end && *p == '/') p++;
+        if (p == end) break;
+
+        uint32_t n = 0;
+        while (p + n < end && p[n] != '/') n++;
+        memcpy(name, p, n);
+        name[n] = '\0';
+        p += n;
+
+        vfs_vnode_t* child = vfs_lookup_child(node, name);
+        vfs_vnode_put(node);
+        if (!child) return NULL;
+        node = child;
+    }
+    return node;
+}
+
+/**
+ * @brief Resolves the first len characters of a normalized path.
+ * @return The vnode with an added reference, or NULL if it does not exist.
+ */
+static vfs_vnode_t* vfs_walk(const char* path, uint32_t len) {
+    vfs_mount_t* mount = vfs_find_mount(path, len);
+    vfs_vnode_t* node = mount ? vfs_walk_mount(mount, path, len) : NULL;
+    if (node) return node;
+
+    // directories leading to a mount point exist even where no filesystem provides them
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (mounts[i] && vfs_mount_below(mounts[i], path, len)) return &virtual_dir;
+    }
+    return len == 1 ? &virtual_dir : NULL;
+}
+
+/**
+ * @brief Splits a normalized path into its parent and last name.
+ * @return Length of the parent path, 0 for "/" itself.
+ */
+static uint32_t vfs_split_path(const char* path, const char** name) {
+    uint32_t len = (uint32_t)strlen(path);
+    uint32_t slash = len;
+    while (slash > 0 && path[slash - 1] != '/') slash--;
+    *name = path + slash;
+    if (len <= 1) return 0;
+    return slash > 1 ? slash - 1 : 1;
+}
+
+static bool vfs_is_mount_point(const char* path) {
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (mounts[i] && strcmp(mounts[i]->path, path) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Creates a file or directory at a normalized path.
+ * @return The new vnode with a reference, or NULL on failure.
+ */
+static vfs_vnode_t* vfs_create_at(const char* path, uint8_t type) {
+    const char* name;
+    uint32_t parent_len = vfs_split_path(path, &name);
+    if (parent_len == 0 || vfs_is_mount_point(path)) return NULL;
+
+    vfs_vnode_t* dir = vfs_walk(path, parent_len);
+    if (!dir) return NULL;
+
+    vfs_mount_t* mount = dir->mount;
+    vfs_vnode_t* node = NULL;
+    modified = true;
+    if (mount && dir->type == VFS_TYPE_DIR && mount->type->ops->create) {
+        // the negative entry for the name goes away with the creation
+        uint32_t hash = vfs_name_hash(mount, dir->ino, name);
+        vfs_dentry_t* dentry = vfs_dentry_find(mount, dir->ino, name, hash);
+        bool exists = dentry && dentry->vnode;
+        if (dentry && !exists) vfs_dentry_remove(dentry);
+
+        vfs_vnode_t filled;
+        memset(&filled, 0, sizeof(filled));
+        if (!exists && mount->type->ops->create(dir, name, type, &filled) == 0) {
+            node = vfs_vnode_instantiate(mount, &filled);
+            if (node) vfs_dentry_add(mount, dir->ino, name, hash, node);
+        }
+    }
+
+    vfs_vnode_put(dir);
+    return node;
+}
+
+/**
+ * @brief Opens a file or directory.
+ * @param flags VFS_OPEN_CREATE creates a missing file, VFS_OPEN_TRUNCATE empties a file.
+ * @return The open file, or NULL on failure.
+ */
+vfs_file_t* vfs_open(const char* path, uint32_t flags) {
+    char normalized[VFS_MAX_PATH];
+    if (vfs_normalize_path(path, normalized) != 0) return NULL;
+
+    vfs_vnode_t* node = vfs_walk(normalized, (uint32_t)strlen(normalized));
+    if (!node && (flags & VFS_OPEN_CREATE)) node = vfs_create_at(normalized, VFS_TYPE_FILE);
+    if (!node) return NULL;
+
+    if ((flags & VFS_OPEN_TRUNCATE) && node->type == VFS_TYPE_FILE && node->size > 0) {
+        modified = true;
+        if (!node->mount->type->ops->truncate || node->mount->type->ops->truncate(node, 0) != 0) {
+            vfs_vnode_put(node);
+            return NULL;
+        }
+        pcache_truncate(node, 0);
+    }
+
+    vfs_file_t* file = (vfs_file_t*)kzalloc(sizeof(vfs_file_t));
+    if (!file) {
+        vfs_vnode_put(node);
+        return NULL;
+    }
+    file->vnode = node;
+    file->flags = flags;
+    strcpy(file->path, normalized);
+    node->open_count++;
+    return file;
+}
+
+/**
+ * @brief Reads up to length bytes at offset, through the page cache unless the filesystem opts out.
+ * @return The number of bytes read (0 at the end of the file), or -1 on error.
+ */
+int32_t vfs_read(vfs_file_t* file, uint64_t offset, void* buffer, uint32_t length) {
+    vfs_vnode_t* node = file->vnode;
+    if (node->type != VFS_TYPE_FILE || !node->mount->type->ops->read) return -1;
+    if (node->mount->type->flags & VFS_FS_NO_PAGE_CACHE) return node->mount->type->ops->read(node, offset, buffer, length);
+    return pcache_read(node, offset, buffer, length);
+}
+
+/**
+ * @brief Writes length bytes at offset, growing the file as needed.
+ * @return The number of bytes written, or -1 on error.
+ */
+int32_t vfs_write(vfs_file_t* file, uint64_t offset, const void* buffer, uint32_t length) {
+    vfs_vnode_t* node = file->vnode;
+    if (node->type != VFS_TYPE_FILE || !node->mount->type->ops->write) return -1;
+    modified = true;
+    int32_t written = node->mount->type->ops->write(node, offset, buffer, length);
+    if (written > 0) pcache_update(node, offset, buffer, (uint32_t)written);
+    return written;
+}
+
+uint8_t vfs_truncate(vfs_file_t* file, uint64_t size) {
+    vfs_vnode_t* node = file->vnode;
+    if (node->type != VFS_TYPE_FILE || !node->mount->type->ops->truncate) return 1;
+    modified = true;
+    uint8_t result = node->mount->type->ops->truncate(node, size);
+    if (result == 0) pcache_truncate(node, node->size);
+    return result;
+}
+
+/**
+ * @brief Returns the entry at or after *cursor of an open directory.
+ *
+ * After the entries of the filesystem, the mount points directly below the
+ * directory are listed.
+ * @param cursor Start with 0, advanced past the returned entry.
+ * @return 0 if an entry was returned, 1 at the end of the directory.
+ */
+uint8_t vfs_readdir(vfs_file_t* dir, uint32_t* cursor, vfs_dirent_t* out) {
+    vfs_vnode_t* node = dir->vnode;
+    if (node->type != VFS_TYPE_DIR) return 1;
+
+    if (*cursor < VFS_READDIR_MOUNTS) {
+        if (node->mount && node->mount->type->ops->readdir && node->mount->type->ops->readdir(node, cursor, out) == 0) return 0;
+        *cursor = VFS_READDIR_MOUNTS;
+    }
+
+    uint32_t len = (uint32_t)strlen(dir->path);
+    for (uint32_t i = *cursor - VFS_READDIR_MOUNTS; i < VFS_MAX_MOUNTS; i++) {
+        vfs_mount_t* mount = mounts[i];
+        if (!mount || !vfs_mount_below(mount, dir->path, len)) continue;
+
+        // list the next component once, even if several mounts lie below it
+        const char* name = mount->path + (len == 1 ? 1 : len + 1);
+        uint32_t n = 0;
+        while (name[n] && name[n] != '/') n++;
+
+        bool seen = false;
+        for (uint32_t j = 0; j < i && !seen; j++) {
+            vfs_mount_t* other = mounts[j];
+            if (!other || !vfs_mount_below(other, dir->path, len)) continue;
+            const char* other_name = other->path + (len == 1 ? 1 : len + 1);
+            seen = strncmp(other_name, name, n) == 0 && (other_name[n] == '\0' || other_name[n] == '/');
+        }
+        if (seen) continue;
+
+        memcpy(out->name, name, n);
+        out->name[n] = '\0';
+        out->type = VFS_TYPE_DIR;
+        out->size = 0;
+        *cursor = VFS_READDIR_MOUNTS + i + 1;
+        return 0;
+    }
+
+    *cursor = VFS_READDIR_MOUNTS + VFS_MAX_MOUNTS;
+    return 1;
+}
+
+void vfs_close(vfs_file_t* file) {
+    if (!file) return;
+    file->vnode->open_count--;
+    vfs_vnode_put(file->vnode);
+    kfree((virt_addr_t)file);
+}
+
+/**
+ * @brief Maps part of a file read only, sharing the pages of the page cache.
+ *
+ * Pages are read on their first touch, which must happen with interrupts
+ * enabled. The mapping counts as an open file until vfs_munmap(), so the file
+ * stays on its mount and cannot be removed, and it outlives the file it was
+ * made from. Later writes to the file show up in the mapping.
+ * @param offset Start in the file, a multiple of the page size and below the file size.
+ * @return The address of offset, or NULL on failure.
+ */
+void* vfs_mmap(vfs_file_t* file, uint64_t offset, uint32_t length) {
+    vfs_vnode_t* node = file->vnode;
+    if (node->type != VFS_TYPE_FILE || !node->mount->type->ops->read) return NULL;
+
+    virt_addr_t addr = pcache_map(node, offset, length);
+    if (!addr) return NULL;
+    node->refs++;
+    node->open_count++;
+    return (void*)addr;
+}
+
+void vfs_munmap(void* addr) {
+    vfs_vnode_t* node = pcache_unmap((virt_addr_t)addr);
+    if (!node) {
+        serial_printf("VFS: Error: %x is not a mapping\n", (uint32_t)addr);
+        return;
+    }
+    node->open_count--;
+    vfs_vnode_put(node);
+}
+
+uint8_t vfs_stat(const char* path, vfs_stat_t* out) {
+    char normalized[VFS_MAX_PATH];
+    if (vfs_normalize_path(path, normalized) != 0) return 1;
+
+    vfs_vnode_t* node = vfs_walk(normalized, (uint32_t)strlen(normalized));
+    if (!node) return 1;
+    out->ino = node->ino;
+    out->type = node->type;
+    out->size = node->size;
+    vfs_vnode_put(node);
+    return 0;
+}
+
+uint8_t vfs_mkdir(const char* path) {
+    char normalized[VFS_MAX_PATH];
+    if (vfs_normalize_path(path, normalized) != 0) return 1;
+
+    vfs_vnode_t* node = vfs_create_at(normalized, VFS_TYPE_DIR);
+    if (!node) return 1;
+    vfs_vnode_put(node);
+    return 0;
+}
+
+/**
+ * @brief Removes a file or an empty directory.
+ * @return 0 on success, 1 if it does not exist, is open, is a mount point or is a non-empty directory.
+ */
+uint8_t vfs_unlink(const char* path) {
+    char normalized[VFS_MAX_PATH];
+    if (vfs_normalize_path(path, normalized) != 0) return 1;
+
+    const char* name;
+    uint32_t parent_len = vfs_split_path(normalized, &name);
+    if (parent_len == 0 || vfs_is_mount_point(normalized)) return 1;
+
+    vfs_vnode_t* dir = vfs_walk(normalized, parent_len);
+    if (!dir) return 1;
+    vfs_vnode_t* node = vfs_lookup_child(dir, name);
+    if (!node) {
+        vfs_vnode_put(dir);
+        return 1;
+    }
+
+    vfs_mount_t* mount = dir->mount;
+    uint8_t res = 1;
+    modified = true;
+    if (node->open_count > 0) {
+        serial_printf("VFS: Cannot remove %s, it is open\n", normalized);
+    } else if (mount->type->ops->remove && mount->type->ops->remove(dir, node) == 0) {
+        // forget every name of the node and, for a directory, everything cached below it
+        vfs_dentry_purge(mount, false, 0, node);
+        if (node->type == VFS_TYPE_DIR) vfs_dentry_purge(mount, true, node->ino, NULL);
+        vfs_vnode_unhash(node);
+        node->flags |= VFS_VNODE_UNLINKED;
+        vfs_dentry_add(mount, dir->ino, name, vfs_name_hash(mount, dir->ino, name), NULL);
+        res = 0;
+    }
+
+    vfs_vnode_put(node);
+    vfs_vnode_put(dir);
+    return res;
+}
+
+/**
+ * @brief Writes the metadata of every mounted filesystem back.
+ *
+ * For FAT32 this includes the data of delayed allocations, the cached FAT
+ * and the FSInfo sector.
+ */
+uint8_t vfs_sync(void) {
+    modified = false;
+    uint8_t res = 0;
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        vfs_mount_t* mount = mounts[i];
+        if (mount && mount->type->ops->sync && mount->type->ops->sync(mount) != 0) res = 1;
+    }
+    return res;
+}
+
+static void vfs_sync_event(void) {
+    sync_pending = true;
+}
+
+/**
+ * @brief Periodic sync, called from the kernel main loop.
+ *
+ * Runs once per VFS_SYNC_INTERVAL_MS if anything was changed, so the
+ * filesystem metadata, which the block cache does not know about, never falls
+ * far behind the directory entries and data the block cache writes back.
+ */
+void vfs_sync_task(void) {
+    if (!sync_pending) return;
+    sync_pending = false;
+    if (modified) vfs_sync();
+}
+
+uint8_t vfs_register_fs(const vfs_fs_type_t* type) {
+    if (fs_type_count >= VFS_MAX_FS_TYPES) return 1;
+    fs_types[fs_type_count++] = type;
+    return 0;
+}
+
+/**
+ * @brief Mounts the filesystem on a disk at a path.
+ * @param disk May be NULL for filesystems without a backing disk.
+ * @return 0 on success, 1 if the path is taken or the disk holds no such filesystem.
+ */
+uint8_t vfs_mount(const char* path, const char* fs_name, disk_t* disk) {
+    char normalized[VFS_MAX_PATH];
+    if (vfs_normalize_path(path, normalized) != 0 || vfs_is_mount_point(normalized)) return 1;
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (disk && mounts[i] && mounts[i]->disk == disk) return 1; // two mounts would keep separate metadata caches
+    }
+
+    const vfs_fs_type_t* type = NULL;
+    for (uint32_t i = 0; i < fs_type_count; i++) {
+        if (strcmp(fs_types[i]->name, fs_name) == 0) type = fs_types[i];
+    }
+    if (!type) return 1;
+
+    uint32_t slot = 0;
+    while (slot < VFS_MAX_MOUNTS && mounts[slot]) slot++;
+    if (slot == VFS_MAX_MOUNTS) {
+        serial_printf("VFS: Error: Maximum number of mounts reached\n");
+        return 1;
+    }
+
+    vfs_mount_t* mount = (vfs_mount_t*)kzalloc(sizeof(vfs_mount_t));
+    if (!mount) return 1;
+    strcpy(mount->path, normalized);
+    mount->path_len = (uint32_t)strlen(normalized);
+    mount->type = type;
+    mount->disk = disk;
+
+    vfs_vnode_t root;
+    memset(&root, 0, sizeof(root));
+    root.mount = mount;
+    if (type->mount(mount, disk, &root) != 0) {
+        kfree((virt_addr_t)mount);
+        return 1;
+    }
+    mount->root = vfs_vnode_instantiate(mount, &root);
+    if (!mount->root) {
+        if (type->unmount) type->unmount(mount);
+        kfree((virt_addr_t)mount);
+        return 1;
+    }
+
+    mounts[slot] = mount;
+    serial_printf("VFS: Mounted %s %s at %s\n", type->name, disk ? disk->name : "(none)", normalized);
+    return 0;
+}
+
+/**
+ * @brief Unmounts the filesystem mounted at a path.
+ * @return 0 on success, 1 if nothing is mounted there or files on it are open.
+ */
+uint8_t vfs_umount(const char* path) {
+    char normalized[VFS_MAX_PATH];
+    if (vfs_normalize_path(path, normalized) != 0) return 1;
+
+    uint32_t slot = 0;
+    while (slot < VFS_MAX_MOUNTS && !(mounts[slot] && strcmp(mounts[slot]->path, normalized) == 0)) slot++;
+    if (slot == VFS_MAX_MOUNTS) return 1;
+    vfs_mount_t* mount = mounts[slot];
+
+    // after the dentries are gone only open files and running walks hold vnodes
+    vfs_dentry_purge(mount, false, 0, NULL);
+    for (uint32_t i = 0; i < VFS_VCACHE_BUCKETS; i++) {
+        for (vfs_vnode_t* node = vnode_table[i]; node; node = node->hash_next) {
+            if (node->mount == mount && node->refs > (node == mount->root ? 1u : 0u)) {
+                serial_printf("VFS: Cannot unmount %s, files are open\n", normalized);
+                return 1;
+            }
+        }
+    }
+
+    if (mount->type->ops->sync) mount->type->ops->sync(mount);
+
+    for (uint32_t i = 0; i < VFS_VCACHE_BUCKETS; i++) {
+        vfs_vnode_t* node = vnode_table[i];
+        while (node) {
+            vfs_vnode_t* next = node->hash_next;
+            if (node->mount == mount && node != mount->root) vfs_vnode_destroy(node);
+            node = next;
+        }
+    }
+    mount->root->refs = 0;
+    vfs_vnode_destroy(mount->root);
+
+    if (mount->type->unmount) mount->type->unmount(mount);
+    mounts[slot] = NULL;
+    kfree((virt_addr_t)mount);
+    serial_printf("VFS: Unmounted %s\n", normalized);
+    return 0;
+}
+
+vfs_mount_t* vfs_get_mount(uint32_t index) {
+    return index < VFS_MAX_MOUNTS ? mounts[index] : NULL;
+}
+
+/**
+ * @brief Sets how many dentries and vnodes are cached, shrinking the caches right away.
+ */
+void vfs_set_cache_limits(uint32_t dentries, uint32_t vnodes) {
+    dentry_limit = dentries;
+    vnode_limit = vnodes;
+    while (dentry_count > dentry_limit && dentry_lru_tail) {
+        vfs_dentry_remove(dentry_lru_tail);
+        stats.dcache_evictions++;
+    }
+    vfs_vnode_shrink(vnode_limit);
+}
+
+/**
+ * @brief Empties the dentry cache and frees every unused vnode and unmapped cached page.
+ */
+void vfs_drop_caches(void) {
+    while (dentry_lru_tail) vfs_dentry_remove(dentry_lru_tail);
+    while (vnode_lru_tail) vfs_vnode_destroy(vnode_lru_tail);
+    pcache_drop_all();
+}
+
+vfs_stats_t* vfs_get_stats(void) {
+    return &stats;
+}
+
+static uint32_t vfs_permille(uint64_t part, uint64_t total) {
+    if (total == 0) return 0;
+    while (total >> 22) {
+        part >>= 1;
+        total >>= 1;
+    }
+    if (total == 0) return 0;
+    return (uint32_t)part * 1000 / (uint32_t)total;
+}
+
+void vfs_dump_info(void) {
+    char buf[160];
+    console_puts(U"Mounts:\n");
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        vfs_mount_t* mount = mounts[i];
+        if (!mount) continue;
+        snprintf(buf, sizeof(buf), "[Mount %u] %s: %s on %s\n", i, mount->path, mount->type->name, mount->disk ? mount->disk->name : "(none)");
+        for (int j = 0; buf[j]; j++) console_putc((uint32_t)buf[j]);
+        if (mount->type->dump) mount->type->dump(mount);
+    }
+
+    uint64_t walks = stats.dcache_hits + stats.dcache_negative_hits + stats.dcache_misses;
+    uint32_t dcache_rate = vfs_permille(stats.dcache_hits + stats.dcache_negative_hits, walks);
+    uint32_t vcache_rate = vfs_permille(stats.vcache_hits, stats.vcache_hits + stats.vcache_misses);
+
+    console_puts(U"Dentry Cache:\n");
+    snprintf(buf, sizeof(buf), "  Entries:        %u of %u (%u negative)\n", dentry_count, dentry_limit, dentry_negative_count);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Hits / Misses:  %llu + %llu negative / %llu (hit rate %u.%u%%)\n",
+             stats.dcache_hits, stats.dcache_negative_hits, stats.dcache_misses, dcache_rate / 10, dcache_rate % 10);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Evictions:      %llu\n", stats.dcache_evictions);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+
+    console_puts(U"Vnode Cache:\n");
+    snprintf(buf, sizeof(buf), "  Vnodes:         %u of %u (%u unused)\n", vnode_count, vnode_limit, vnode_unused_count);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Hits / Misses:  %llu / %llu (hit rate %u.%u%%)\n", stats.vcache_hits, stats.vcache_misses, vcache_rate / 10, vcache_rate % 10);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Evictions:      %llu\n", stats.vcache_evictions);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+
+    pcache_dump_info();
+    aio_dump_info();
+}
+
+/**
+ * @brief Applies the dcache=<n> and vcache=<n> boot options and sets up the page cache.
+ */
+void vfs_init(void) {
+    const char* value = kernel_cmdline_get("dcache=");
+    if (value) dentry_limit = (uint32_t)str_to_u64_legacy(value);
+    value = kernel_cmdline_get("vcache=");
+    if (value) vnode_limit = (uint32_t)str_to_u64_legacy(value);
+
+    serial_printf("VFS: Caching up to %u dentries and %u vnodes\n", dentry_limit, vnode_limit);
+    pcache_init();
+
+    // the timer only flags the work, the sync itself runs from the kernel loop
+    event_t sync_event = {
+        .event_id = 0,
+        .handler = vfs_sync_event,
+        .interval = (VFS_SYNC_INTERVAL_MS * TIMER_FREQUENCY) / 1000,
+        .target_tick = timer_get_ticks() + (VFS_SYNC_INTERVAL_MS * TIMER_FREQUENCY) / 1000,
+        .repeat = true,
+        .active = true
+    };
+    timer_add_event(sync_event);
+}
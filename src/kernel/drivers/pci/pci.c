@@ -9,6 +9,9 @@
 #include <kernel.h>
 #include <heap.h>
 #include <ahci.h>
+#include <ata_dma.h>
+#include <nvme.h>
+#include <virtio_blk.h>
 #include <rtx3050.h>
 
 uint32_t pci_config_read_dword(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
@@ -48,6 +51,36 @@ pci_driver_t ahci_driver = {
     .init = ahci_init_device
 };
 
+pci_driver_t nvme_driver = {
+    .vendor_id = 0,
+    .class_code = 0x01, // Mass Storage
+    .subclass = 0x08, // Non-Volatile Memory Controller
+    .prog_if = 0x02, // NVM Express
+    .name = "NVMe Controller",
+    .init = nvme_init_device
+};
+
+pci_driver_t virtio_blk_driver = {
+    .vendor_id = 0x1AF4,
+    .device_id = 0x1001, // legacy/transitional block device
+    .name = "virtio Block Device",
+    .init = virtio_blk_init_device
+};
+
+pci_driver_t piix3_ide_driver = {
+    .vendor_id = 0x8086,
+    .device_id = 0x7010,
+    .name = "Intel PIIX3 IDE Controller",
+    .init = ata_dma_init_device
+};
+
+pci_driver_t piix4_ide_driver = {
+    .vendor_id = 0x8086,
+    .device_id = 0x7111,
+    .name = "Intel PIIX4 IDE Controller",
+    .init = ata_dma_init_device
+};
+
 pci_driver_t rtx3050 = {
     .vendor_id = 0x10DE,
     .device_id = 0x2584,
@@ -57,6 +90,10 @@ pci_driver_t rtx3050 = {
 
 void pci_init() {
     pci_register_driver(&ahci_driver);
+    pci_register_driver(&nvme_driver);
+    pci_register_driver(&virtio_blk_driver);
+    pci_register_driver(&piix3_ide_driver);
+    pci_register_driver(&piix4_ide_driver);
     pci_register_driver(&rtx3050);
     init_state = INIT_PCI;
 }
@@ -271,6 +271,9 @@ void ahci_identify(ahci_disk_t* disk) {
 
     disk->base.total_sectors = sectors;
 
+    // word 84 bit 6 / word 87 bit 6: WRITE DMA FUA EXT supported / enabled
+    disk->fua_supported = (identify_buf[84] & (1 << 6)) && (identify_buf[87] & (1 << 6));
+
     char model[41];
     int char_idx = 0;
     for (int i = 27; i <= 46; i++) {
@@ -285,6 +288,7 @@ void ahci_identify(ahci_disk_t* disk) {
 
     disk->base.read = ahci_read_sectors;   
     disk->base.write = ahci_write_sectors; 
+    disk->base.flush = ahci_flush;
 
     storage_register_disk(&disk->base);
     serial_printf("AHCI: Disk '%s' registered in storage\n", model);
@@ -365,7 +369,7 @@ uint8_t ahci_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buff
     return 0;
 }
 
-uint8_t ahci_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer) {
+uint8_t ahci_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
     ahci_disk_t* disk = (ahci_disk_t*)self;
     HBA_port_t* port = disk->hba_port;
 
@@ -396,7 +400,8 @@ uint8_t ahci_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const voi
     fis_reg_h2d_t* cmdfis = (fis_reg_h2d_t*)(&cmdtbl->cfis);
     cmdfis->fis_type = FIS_TYPE_REG_H2D;
     cmdfis->c = 1; 
-    cmdfis->command = ATA_CMD_WRITE_DMA_EX;
+    bool fua = (flags & STORAGE_WRITE_FUA) && disk->fua_supported;
+    cmdfis->command = fua ? ATA_CMD_WRITE_DMA_FUA_EX : ATA_CMD_WRITE_DMA_EX;
 
     cmdfis->lba0 = (uint8_t)lba;
     cmdfis->lba1 = (uint8_t)(lba >> 8);
@@ -437,5 +442,60 @@ uint8_t ahci_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const voi
         return 1;
     }
 
+    if ((flags & STORAGE_WRITE_FUA) && !fua) return ahci_flush(self);
+
+    return 0;
+}
+
+uint8_t ahci_flush(disk_t* self) {
+    ahci_disk_t* disk = (ahci_disk_t*)self;
+    HBA_port_t* port = disk->hba_port;
+
+    port->is = (uint32_t)-1;
+
+    int slot = ahci_find_cmdslot(port);
+    if (slot == -1) {
+        serial_printf("AHCI: No free command slots on port %d\n", disk->port_num);
+        return 1;
+    }
+
+    // non-data command, no PRDT entries
+    HBA_cmd_header_t* cmdheader = &cmd_headers[disk->port_num][slot];
+    cmdheader->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
+    cmdheader->w = 0;
+    cmdheader->prdtl = 0;
+
+    HBA_cmd_tbl_t* cmdtbl = &cmd_tables[disk->port_num][slot];
+    memset(cmdtbl, 0, sizeof(HBA_cmd_tbl_t));
+
+    fis_reg_h2d_t* cmdfis = (fis_reg_h2d_t*)(&cmdtbl->cfis);
+    cmdfis->fis_type = FIS_TYPE_REG_H2D;
+    cmdfis->c = 1;
+    cmdfis->command = ATA_CMD_FLUSH_CACHE_EX;
+    cmdfis->device = 1 << 6;
+
+    uint32_t spin = 0;
+    while ((port->tfd & (AHCI_DEV_BUSY | AHCI_DEV_DRQ)) && spin < 1000000) {
+        spin++;
+    }
+    if (spin == 1000000) {
+        serial_printf("AHCI: Port %d is hung before issuing flush!\n", disk->port_num);
+        return 1;
+    }
+
+    port->ci = (1 << slot);
+
+    while (1) {
+        if ((port->ci & (1 << slot)) == 0) {
+            break;
+        }
+
+        if (port->is & HBA_PxIS_TFES) {
+            serial_printf("AHCI: Flush error on port %d!\n", disk->port_num);
+            return 1;
+        }
+    }
+
+    cmdheader->prdtl = 1;
     return 0;
 }
\ No newline at end of file
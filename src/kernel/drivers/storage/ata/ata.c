@@ -4,31 +4,56 @@
  */
 
 #include <ata.h>
+#include <ata_dma.h>
 #include <io.h>
 #include <memory.h>
 #include <string.h>
 #include <serial.h>
+#include <handler.h>
+#include <cpu.h>
 
-static void ata_delay() {
-    for(int i = 0; i < 4; i++) inb(ATA_STATUS);
+static ata_channel_t channels[ATA_CHANNEL_COUNT] = {
+    { .io_base = ATA_PRIMARY_IO, .ctrl_base = ATA_PRIMARY_CTRL, .irq = ATA_PRIMARY_IRQ, .index = 0 },
+    { .io_base = ATA_SECONDARY_IO, .ctrl_base = ATA_SECONDARY_CTRL, .irq = ATA_SECONDARY_IRQ, .index = 1 }
+};
+
+static void ata_start(ata_channel_t* channel);
+
+static uint8_t ata_status(ata_channel_t* channel) {
+    return inb(channel->io_base + ATA_REG_STATUS);
+}
+
+// reads the alternate status register, which does not acknowledge the interrupt
+static void ata_delay(ata_channel_t* channel) {
+    for(int i = 0; i < 4; i++) inb(channel->ctrl_base);
 }
 
-static uint8_t ata_wait_ready() {
-    while (inb(ATA_STATUS) & ATA_SR_BSY);
-    uint8_t status = inb(ATA_STATUS);
+static uint8_t ata_wait_ready(ata_channel_t* channel) {
+    while (ata_status(channel) & ATA_SR_BSY);
+    uint8_t status = ata_status(channel);
     if (status & ATA_SR_ERR) return 0;
     return (status & ATA_SR_DRQ);
 }
 
-void ata_soft_reset() {
-    outb(0x3F6, 0x04); // Software Reset Bit setzen
-    ata_delay();
-    outb(0x3F6, 0x00); // Zurück auf Normalbetrieb
-    ata_delay();
+static uint8_t ata_wait_idle(ata_channel_t* channel) {
+    uint32_t timeout = 10000000;
+    while ((ata_status(channel) & ATA_SR_BSY) && timeout) timeout--;
+    if (timeout == 0) return 1;
+
+    uint8_t status = ata_status(channel);
+    if (status & (ATA_SR_ERR | ATA_SR_DF)) return 1;
+    return 0;
+}
+
+static void ata_soft_reset(ata_channel_t* channel) {
+    outb(channel->ctrl_base, ATA_CTRL_SRST); // Software Reset Bit setzen
+    ata_delay(channel);
+    outb(channel->ctrl_base, 0x00); // Zurück auf Normalbetrieb, Interrupts an
+    ata_delay(channel);
 
     uint32_t timeout = 1000000;
     while (timeout > 0) {
-        uint8_t status = inb(ATA_STATUS);
+        uint8_t status = ata_status(channel);
         
         if (!(status & ATA_SR_BSY)) {
             break; 
@@ -37,132 +62,417 @@ void ata_soft_reset() {
     }
 
     if (timeout == 0) {
-        serial_printf("ATA: Soft reset timeout (BSY stuck)!\n");
+        serial_printf("ATA: Soft reset timeout on channel %d (BSY stuck)!\n", channel->index);
     } else {
-        serial_printf("ATA: Reset successful, status: %x\n", inb(ATA_STATUS));
+        serial_printf("ATA: Reset successful on channel %d, status: %x\n", channel->index, ata_status(channel));
     }
 }
 
+static void ata_channel_irq(ata_channel_t* channel);
+
+static void ata_primary_irq(struct registers* regs) {
+    (void)regs;
+    ata_channel_irq(&channels[0]);
+}
+
+static void ata_secondary_irq(struct registers* regs) {
+    (void)regs;
+    ata_channel_irq(&channels[1]);
+}
+
 void ata_init() {
-    serial_printf("ATA: Checking for controller...\n");
-    
-    uint8_t status = inb(ATA_STATUS);
-    if (status == 0xFF) {
-        serial_printf("ATA: No controller found (Floating Bus). Skipping.\n");
-        return;
+    for (uint8_t i = 0; i < ATA_CHANNEL_COUNT; i++) {
+        ata_channel_t* channel = &channels[i];
+        serial_printf("ATA: Checking for controller on channel %d...\n", i);
+
+        uint8_t status = ata_status(channel);
+        if (status == 0xFF) {
+            serial_printf("ATA: No controller found on channel %d (Floating Bus). Skipping.\n", i);
+            continue;
+        }
+
+        channel->bm_base = ata_dma_base(i);
+        channel->state = ATA_STATE_IDLE;
+
+        serial_printf("ATA: Controller found, resetting...\n");
+        ata_soft_reset(channel);
+        serial_printf("ATA: Soft reset complete\n");
+        ata_identify(channel, 0xA0); // Master
+        serial_printf("ATA: Master identified\n");
+        ata_identify(channel, 0xB0); // Slave
+        serial_printf("ATA: Slave identified\n");
+
+        // identification is polled, requests complete from the IRQ
+        irq_install_handler(channel->irq, (irq_handler_t)(i == 0 ? ata_primary_irq : ata_secondary_irq));
     }
+}
+
+static uint8_t ata_drive_head(ata_disk_t* disk) {
+    return (disk->drive_id == 0xA0) ? 0xE0 : 0xF0;
+}
+
+/**
+ * @brief Tells whether the data port of the channel takes 32-bit accesses.
+ *
+ * Reads IDENTIFY once more with doubleword accesses and compares it to the
+ * copy read with word accesses. Only called for the known PIIX controllers,
+ * whose bus master registers ata_dma_available() reports.
+ */
+static bool ata_probe_pio32(ata_channel_t* channel, uint8_t drive, const uint16_t* identify) {
+    uint16_t io = channel->io_base;
+
+    outb(io + ATA_REG_DRIVE_SELECT, drive);
+    ata_delay(channel);
+    outb(io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay(channel);
+    if (!ata_wait_ready(channel)) return false;
+
+    uint16_t data[256];
+    insl(io + ATA_REG_DATA, data, 128);
+
+    // a port that splits doublewords may leave words behind, which must not stay in the FIFO
+    for (uint32_t i = 0; i < 256 && (ata_status(channel) & ATA_SR_DRQ); i++) inw(io + ATA_REG_DATA);
 
-    serial_printf("ATA: Controller found, resetting...\n");
-    ata_soft_reset();
-    serial_printf("ATA: Soft reset complete\n");
-    ata_identify(0xA0); // Master
-    serial_printf("ATA: Master identified\n");
-    ata_identify(0xB0); // Slave
-    serial_printf("ATA: Slave identified\n");
+    return memcmp(data, identify, sizeof(data)) == 0;
 }
 
-void ata_identify(uint8_t drive) {
-    outb(ATA_DRIVE_SELECT, drive); // 0xA0 = Master
-    ata_delay();
+void ata_identify(ata_channel_t* channel, uint8_t drive) {
+    uint16_t io = channel->io_base;
 
-    if (inb(ATA_STATUS) == 0) {
-        serial_printf("ATA: No drive on port %x\n", drive);
+    outb(io + ATA_REG_DRIVE_SELECT, drive); // 0xA0 = Master
+    ata_delay(channel);
+
+    if (ata_status(channel) == 0) {
+        serial_printf("ATA: No drive on channel %d port %x\n", channel->index, drive);
         return;
     }
 
-    outb(ATA_SECTOR_COUNT, 0);
-    outb(ATA_LBA_LOW, 0);
-    outb(ATA_LBA_MID, 0);
-    outb(ATA_LBA_HIGH, 0);
+    outb(io + ATA_REG_SECTOR_COUNT, 0);
+    outb(io + ATA_REG_LBA_LOW, 0);
+    outb(io + ATA_REG_LBA_MID, 0);
+    outb(io + ATA_REG_LBA_HIGH, 0);
     
-    outb(ATA_COMMAND, ATA_CMD_IDENTIFY);
-    ata_delay();
+    outb(io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay(channel);
 
-    uint8_t status = inb(ATA_STATUS);
+    uint8_t status = ata_status(channel);
     if (status == 0) return;
 
-    if (!ata_wait_ready()) {
-        serial_printf("ATA: Drive %x did not respond to IDENTIFY\n", drive);
+    if (!ata_wait_ready(channel)) {
+        serial_printf("ATA: Drive %x on channel %d did not respond to IDENTIFY\n", drive, channel->index);
         return;
     }
 
     uint16_t data[256];
-    insw(ATA_DATA, data, 256);
-
-    uint32_t sectors = *((uint32_t*)&data[60]);
+    insw(io + ATA_REG_DATA, data, 256);
 
-    ata_disk_t* ata_disk = (ata_disk_t*)kmalloc(sizeof(ata_disk_t));
+    ata_disk_t* ata_disk = (ata_disk_t*)kzalloc(sizeof(ata_disk_t));
     disk_t* new_disk = &ata_disk->base;
+    ata_disk->channel = channel;
     ata_disk->drive_id = drive;
-    strncpy(new_disk->name, (drive == 0xA0) ? "hda" : "hdb", 4);
+
+    // word 83 bit 10: 48-bit address feature set, size in words 100-103 instead of 60-61
+    ata_disk->lba48 = (data[83] & (1 << 10)) != 0;
+    uint64_t sectors = ata_disk->lba48 ? *((uint64_t*)&data[100]) : *((uint32_t*)&data[60]);
+
+    // word 49 bit 8: DMA supported
+    ata_disk->dma = channel->bm_base && (data[49] & (1 << 8));
+
+    // word 48 is obsolete, so 32-bit PIO is only tried on the PIIX and verified there
+    ata_disk->pio32 = ata_dma_available() && ata_probe_pio32(channel, drive, data);
+
+    // word 47 bits 0-7: maximum sectors per DRQ block for READ/WRITE MULTIPLE
+    uint8_t max_multiple = (uint8_t)(data[47] & 0xFF);
+    if (max_multiple > 1) {
+        outb(io + ATA_REG_DRIVE_SELECT, ata_drive_head(ata_disk));
+        outb(io + ATA_REG_SECTOR_COUNT, max_multiple);
+        outb(io + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+        ata_delay(channel);
+        if (ata_wait_idle(channel) == 0) ata_disk->multiple = max_multiple;
+    }
+
+    new_disk->name[0] = 'h';
+    new_disk->name[1] = 'd';
+    new_disk->name[2] = (char)('a' + channel->index * 2 + (drive == 0xA0 ? 0 : 1));
+    new_disk->name[3] = '\0';
     new_disk->total_sectors = sectors;
     new_disk->sector_size = 512;
     new_disk->type = TYPE_ATA;
     new_disk->read = ata_read_sectors;
     new_disk->write = ata_write_sectors; 
+    new_disk->flush = ata_flush;
+    new_disk->submit = ata_submit;
 
     storage_register_disk(new_disk);
-    serial_printf("ATA: Registered disk %s with %u sectors\n", new_disk->name, new_disk->total_sectors);
+    serial_printf("ATA: Registered disk %s with %llu sectors (%s, LBA%d, multiple %d, %d-bit PIO)\n", new_disk->name, new_disk->total_sectors,
+                  ata_disk->dma ? "DMA" : "PIO", ata_disk->lba48 ? 48 : 28, ata_disk->multiple, ata_disk->pio32 ? 32 : 16);
 }
 
-uint8_t ata_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buffer) {
-    uint16_t* ptr = (uint16_t*)buffer;
-    ata_disk_t* ata_disk = (ata_disk_t*)self;
-    uint8_t drive_head = (ata_disk->drive_id == 0xA0) ? 0xE0 : 0xF0;
+static bool ata_use_lba48(ata_disk_t* disk, uint64_t lba, uint32_t count) {
+    return disk->lba48 && (count > ATA_MAX_SECTORS_28 || lba + count > ATA_LBA28_MAX);
+}
 
-    for (uint32_t i = 0; i < count; i++) {
-        uint32_t current_lba = (uint32_t)lba + i;
+static void ata_setup_lba(ata_disk_t* disk, uint64_t lba, uint32_t count, bool lba48) {
+    ata_channel_t* channel = disk->channel;
+    uint16_t io = channel->io_base;
+    uint8_t drive_head = ata_drive_head(disk);
+
+    if (lba48) {
+        outb(io + ATA_REG_DRIVE_SELECT, drive_head);
+        ata_delay(channel);
+        // high bytes first, the registers are two-deep FIFOs
+        outb(io + ATA_REG_SECTOR_COUNT, (uint8_t)(count >> 8)); // 65536 wraps to 0
+        outb(io + ATA_REG_LBA_LOW,  (uint8_t)(lba >> 24));
+        outb(io + ATA_REG_LBA_MID,  (uint8_t)(lba >> 32));
+        outb(io + ATA_REG_LBA_HIGH, (uint8_t)(lba >> 40));
+    } else {
+        outb(io + ATA_REG_DRIVE_SELECT, drive_head | ((lba >> 24) & 0x0F));
+        ata_delay(channel);
+    }
 
-        outb(ATA_DRIVE_SELECT, drive_head | ((current_lba >> 24) & 0x0F));
-        
-        outb(ATA_SECTOR_COUNT, 1); 
-        outb(ATA_LBA_LOW,  (uint8_t)(current_lba));
-        outb(ATA_LBA_MID,  (uint8_t)(current_lba >> 8));
-        outb(ATA_LBA_HIGH, (uint8_t)(current_lba >> 16));
+    outb(io + ATA_REG_SECTOR_COUNT, (uint8_t)count); // 256 wraps to 0
+    outb(io + ATA_REG_LBA_LOW,  (uint8_t)(lba));
+    outb(io + ATA_REG_LBA_MID,  (uint8_t)(lba >> 8));
+    outb(io + ATA_REG_LBA_HIGH, (uint8_t)(lba >> 16));
+}
 
-        outb(ATA_COMMAND, ATA_CMD_READ_PIO);
+// moves the next DRQ block of the current PIO command
+static void ata_pio_block(ata_channel_t* channel) {
+    storage_request_t* req = channel->queue_head;
+    ata_disk_t* disk = (ata_disk_t*)req->disk;
+    uint16_t data = channel->io_base + ATA_REG_DATA;
 
-        ata_delay();
-        if (!ata_wait_ready()) {
-            serial_printf("ATA: Error reading sector %u from disk %s\n", (uint32_t)lba + i, self->name);
-            return 1;
+    uint32_t block = disk->multiple ? disk->multiple : 1;
+    uint32_t left = channel->cmd_sectors - channel->cmd_done;
+    uint32_t m = left < block ? left : block;
+    uint8_t* ptr = (uint8_t*)req->buffer + (channel->done_sectors + channel->cmd_done) * 512;
+
+    if (req->op == STORAGE_OP_WRITE) {
+        if (disk->pio32) outsl(data, ptr, m * 128);
+        else outsw(data, ptr, m * 256);
+    } else {
+        if (disk->pio32) insl(data, ptr, m * 128);
+        else insw(data, ptr, m * 256);
+    }
+    channel->cmd_done += m;
+}
+
+static uint8_t ata_issue_flush(ata_channel_t* channel, ata_disk_t* disk) {
+    outb(channel->io_base + ATA_REG_DRIVE_SELECT, ata_drive_head(disk));
+    ata_delay(channel);
+    channel->state = ATA_STATE_FLUSH;
+    outb(channel->io_base + ATA_REG_COMMAND, disk->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+    return 0;
+}
+
+// issues the next command for the request at the head of the queue
+static uint8_t ata_issue(ata_channel_t* channel) {
+    storage_request_t* req = channel->queue_head;
+    ata_disk_t* disk = (ata_disk_t*)req->disk;
+    uint16_t io = channel->io_base;
+    bool write = req->op == STORAGE_OP_WRITE;
+
+    uint64_t lba = req->lba + channel->done_sectors;
+    uint32_t remaining = req->count - channel->done_sectors;
+    uint8_t* buffer = (uint8_t*)req->buffer + channel->done_sectors * 512;
+
+    channel->cmd_done = 0;
+
+    if (disk->dma) {
+        uint32_t n = remaining > ATA_DMA_MAX_SECTORS ? ATA_DMA_MAX_SECTORS : remaining;
+        if (ata_dma_prepare(channel, buffer, n, write) == 0) {
+            bool ext = ata_use_lba48(disk, lba, n);
+            ata_setup_lba(disk, lba, n, ext);
+            channel->cmd_sectors = n;
+            channel->state = ATA_STATE_DMA;
+            if (ext) outb(io + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+            else outb(io + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+            ata_dma_start(channel, write);
+            return 0;
         }
+        // unaligned or too fragmented for the PRD table, this command goes through PIO
+    }
 
-        insw(ATA_DATA, ptr + (i * 256), 256);
+    uint32_t max_count = disk->lba48 ? ATA_MAX_SECTORS_48 : ATA_MAX_SECTORS_28;
+    uint32_t n = remaining > max_count ? max_count : remaining;
+    bool ext = ata_use_lba48(disk, lba, n);
+
+    ata_setup_lba(disk, lba, n, ext);
+    channel->cmd_sectors = n;
+    channel->state = ATA_STATE_PIO;
+    if (write) {
+        if (disk->multiple) outb(io + ATA_REG_COMMAND, ext ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE);
+        else outb(io + ATA_REG_COMMAND, ext ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO);
+
+        // the first block is sent without an interrupt, the rest after one each
+        ata_delay(channel);
+        if (!ata_wait_ready(channel)) {
+            channel->state = ATA_STATE_IDLE;
+            return 1;
+        }
+        ata_pio_block(channel);
+    } else {
+        if (disk->multiple) outb(io + ATA_REG_COMMAND, ext ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE);
+        else outb(io + ATA_REG_COMMAND, ext ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO);
     }
 
     return 0;
 }
 
-uint8_t ata_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer) {
-    uint16_t* ptr = (uint16_t*)buffer;
-    ata_disk_t* ata_disk = (ata_disk_t*)self;
-    uint8_t drive_head = (ata_disk->drive_id == 0xA0) ? 0xE0 : 0xF0;
+static void ata_finish(ata_channel_t* channel, uint8_t status) {
+    storage_request_t* req = channel->queue_head;
 
-    for (uint32_t i = 0; i < count; i++) {
-        uint32_t current_lba = (uint32_t)lba + i;
+    channel->queue_head = req->next;
+    if (!channel->queue_head) channel->queue_tail = NULL;
+    channel->state = ATA_STATE_IDLE;
 
-        outb(ATA_DRIVE_SELECT, drive_head | ((current_lba >> 24) & 0x0F));
-        outb(ATA_SECTOR_COUNT, 1);
-        outb(ATA_LBA_LOW,  (uint8_t)(current_lba));
-        outb(ATA_LBA_MID,  (uint8_t)(current_lba >> 8));
-        outb(ATA_LBA_HIGH, (uint8_t)(current_lba >> 16));
+    if (status != 0) {
+        serial_printf("ATA: Error %s disk %s at LBA %llu (status %x)\n", req->op == STORAGE_OP_READ ? "reading from" : "writing to",
+                      req->disk->name, req->lba + channel->done_sectors, ata_status(channel));
+    }
 
-        outb(ATA_COMMAND, ATA_CMD_WRITE_PIO);
+    storage_complete(req, status);
+    ata_start(channel);
+}
 
-        ata_delay();
-        if (!ata_wait_ready()) {
-            serial_printf("ATA: Error writing sector %u to disk %s\n", (uint32_t)lba + i, self->name);
-            return 1; 
+static void ata_start(ata_channel_t* channel) {
+    while (channel->queue_head && channel->state == ATA_STATE_IDLE) {
+        storage_request_t* req = channel->queue_head;
+        channel->done_sectors = 0;
+
+        uint8_t res;
+        if (req->op == STORAGE_OP_FLUSH) {
+            res = ata_issue_flush(channel, (ata_disk_t*)req->disk);
+        } else if (req->count == 0) {
+            ata_finish(channel, 0);
+            return;
+        } else {
+            res = ata_issue(channel);
         }
 
-        outsw(ATA_DATA, ptr + (i * 256), 256);
+        if (res != 0) {
+            ata_finish(channel, 1);
+            return;
+        }
+    }
+}
 
+// the current command moved all of its sectors
+static void ata_command_done(ata_channel_t* channel) {
+    storage_request_t* req = channel->queue_head;
+
+    channel->done_sectors += channel->cmd_sectors;
+    channel->state = ATA_STATE_IDLE;
+
+    if (channel->done_sectors < req->count) {
+        if (ata_issue(channel) != 0) ata_finish(channel, 1);
+        return;
     }
-    
-    outb(ATA_COMMAND, ATA_CMD_CACHE_FLUSH);
-    ata_delay();
-    ata_wait_ready();
+
+    // PIO and DMA have no FUA variant, a cache flush gives the same guarantee
+    if (req->op == STORAGE_OP_WRITE && (req->flags & STORAGE_WRITE_FUA)) {
+        ata_issue_flush(channel, (ata_disk_t*)req->disk);
+        return;
+    }
+
+    ata_finish(channel, 0);
+}
+
+static void ata_channel_irq(ata_channel_t* channel) {
+    uint8_t status;
+
+    switch (channel->state) {
+        case ATA_STATE_IDLE:
+            ata_status(channel); // acknowledge
+            return;
+
+        case ATA_STATE_DMA: {
+            if (!(inb(channel->bm_base + ATA_BM_STATUS) & ATA_BM_SR_IRQ)) return;
+            uint8_t bm_status = ata_dma_stop(channel);
+            status = ata_status(channel);
+            if ((bm_status & ATA_BM_SR_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+                ata_disk_t* disk = (ata_disk_t*)channel->queue_head->disk;
+                serial_printf("ATA: DMA error on disk %s (bm status %x, status %x), falling back to PIO\n", disk->base.name, bm_status, status);
+                disk->dma = false;
+                channel->state = ATA_STATE_IDLE;
+                if (ata_issue(channel) != 0) ata_finish(channel, 1);
+                return;
+            }
+            ata_command_done(channel);
+            return;
+        }
+
+        case ATA_STATE_PIO: {
+            status = ata_status(channel);
+            if (status & ATA_SR_BSY) return;
+            if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+                ata_finish(channel, 1);
+                return;
+            }
+
+            bool more = channel->cmd_done < channel->cmd_sectors;
+            if (more) {
+                if (!(status & ATA_SR_DRQ)) {
+                    ata_finish(channel, 1);
+                    return;
+                }
+                ata_pio_block(channel);
+            }
+
+            // reads are complete with their last block, writes get one more interrupt after it
+            if (channel->queue_head->op == STORAGE_OP_READ ? channel->cmd_done == channel->cmd_sectors : !more) {
+                ata_command_done(channel);
+            }
+            return;
+        }
+
+        case ATA_STATE_FLUSH:
+            status = ata_status(channel);
+            if (status & ATA_SR_BSY) return;
+            ata_finish(channel, (status & (ATA_SR_ERR | ATA_SR_DF)) ? 1 : 0);
+            return;
+    }
+}
+
+uint8_t ata_submit(disk_t* self, storage_request_t* req) {
+    ata_channel_t* channel = ((ata_disk_t*)self)->channel;
+
+    req->disk = self;
+    req->next = NULL;
+
+    uint32_t irq_flags = cpu_irq_save();
+    if (channel->queue_tail) channel->queue_tail->next = req;
+    else channel->queue_head = req;
+    channel->queue_tail = req;
+
+    if (channel->state == ATA_STATE_IDLE) ata_start(channel);
+    cpu_irq_restore(irq_flags);
 
     return 0;
-}
\ No newline at end of file
+}
+
+static uint8_t ata_request(disk_t* self, storage_op_t op, uint64_t lba, uint32_t count, void* buffer, uint32_t flags) {
+    storage_request_t req = {
+        .disk = self,
+        .op = op,
+        .lba = lba,
+        .count = count,
+        .buffer = buffer,
+        .flags = flags
+    };
+
+    ata_submit(self, &req);
+    return storage_wait(&req);
+}
+
+uint8_t ata_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buffer) {
+    return ata_request(self, STORAGE_OP_READ, lba, count, buffer, 0);
+}
+
+uint8_t ata_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
+    return ata_request(self, STORAGE_OP_WRITE, lba, count, (void*)buffer, flags);
+}
+
+uint8_t ata_flush(disk_t* self) {
+    return ata_request(self, STORAGE_OP_FLUSH, 0, 0, NULL, 0);
+}
@@ -0,0 +1,113 @@
+/**
+ * @file ata_dma.c
+ * @author friedrichOsDev
+ */
+
+#include <ata_dma.h>
+#include <io.h>
+#include <memory.h>
+#include <serial.h>
+
+static uint16_t bm_base = 0;
+static ata_prd_t prd_tables[ATA_CHANNEL_COUNT][ATA_DMA_MAX_PRDS] __attribute__((aligned(1024)));
+
+void ata_dma_init_device(pci_device_t* dev) {
+    pci_bar_t bar4 = pci_get_bar(dev->bus, dev->device, dev->function, 4);
+
+    if (bar4.base_address == 0 || bar4.type != PCI_BAR_IO) {
+        serial_printf("ATA DMA: Invalid BAR4, staying on PIO\n");
+        return;
+    }
+
+    // Enable I/O space decoding and bus mastering
+    uint32_t command = pci_config_read_dword(dev->bus, dev->device, dev->function, PCI_COMMAND);
+    command |= (1 << 0) | (1 << 2);
+    pci_config_write_dword(dev->bus, dev->device, dev->function, PCI_COMMAND, command);
+
+    bm_base = (uint16_t)bar4.base_address;
+    for (uint8_t i = 0; i < ATA_CHANNEL_COUNT; i++) {
+        uint16_t base = ata_dma_base(i);
+        outb(base + ATA_BM_COMMAND, 0);
+        outb(base + ATA_BM_STATUS, ATA_BM_SR_IRQ | ATA_BM_SR_ERR);
+    }
+    serial_printf("ATA DMA: Bus master IDE at I/O %x\n", bm_base);
+}
+
+bool ata_dma_available() {
+    return bm_base != 0;
+}
+
+uint16_t ata_dma_base(uint8_t channel) {
+    if (!bm_base) return 0;
+    return bm_base + channel * ATA_BM_CHANNEL_STRIDE;
+}
+
+static int ata_dma_build_prdt(ata_prd_t* prd_table, void* buffer, uint32_t size) {
+    uint32_t virt = (uint32_t)buffer;
+    int n = -1;
+
+    while (size > 0) {
+        uint32_t chunk = VMM_PAGE_SIZE - (virt & (VMM_PAGE_SIZE - 1));
+        if (chunk > size) chunk = size;
+
+        uint32_t phys = vmm_virtual_to_physical(vmm_get_page_directory(), virt);
+        if (phys == 0) return -1;
+
+        // Extend the previous region if it is physically contiguous and stays in the same 64 KB window
+        if (n >= 0) {
+            uint32_t prev_len = prd_table[n].byte_count;
+            uint32_t prev_end = prd_table[n].phys_addr + prev_len;
+            if (prev_end == phys && (prd_table[n].phys_addr >> 16) == ((phys + chunk - 1) >> 16) && prev_len + chunk < 0x10000) {
+                prd_table[n].byte_count = (uint16_t)(prev_len + chunk);
+                virt += chunk;
+                size -= chunk;
+                continue;
+            }
+        }
+
+        if (++n >= ATA_DMA_MAX_PRDS) return -1;
+        prd_table[n].phys_addr = phys;
+        prd_table[n].byte_count = (uint16_t)chunk;
+        prd_table[n].flags = 0;
+
+        virt += chunk;
+        size -= chunk;
+    }
+
+    if (n < 0) return -1;
+    prd_table[n].flags = ATA_PRD_EOT;
+    return n + 1;
+}
+
+/**
+ * @brief Loads the PRD table for a transfer; the ATA command is issued by the caller.
+ * @return 0 on success, 1 if the buffer cannot be described (unaligned or too fragmented).
+ */
+uint8_t ata_dma_prepare(ata_channel_t* channel, void* buffer, uint32_t count, bool write) {
+    ata_prd_t* prd_table = prd_tables[channel->index];
+
+    // PRD regions must start on a word boundary
+    if (!channel->bm_base || ((uint32_t)buffer & 1) || count > ATA_DMA_MAX_SECTORS) return 1;
+    if (ata_dma_build_prdt(prd_table, buffer, count * 512) < 0) return 1;
+
+    outb(channel->bm_base + ATA_BM_COMMAND, 0);
+    outl(channel->bm_base + ATA_BM_PRDT, vmm_virtual_to_physical(vmm_get_page_directory(), (uint32_t)prd_table));
+    outb(channel->bm_base + ATA_BM_STATUS, ATA_BM_SR_IRQ | ATA_BM_SR_ERR);
+    outb(channel->bm_base + ATA_BM_COMMAND, write ? 0 : ATA_BM_CMD_READ);
+    return 0;
+}
+
+void ata_dma_start(ata_channel_t* channel, bool write) {
+    outb(channel->bm_base + ATA_BM_COMMAND, (write ? 0 : ATA_BM_CMD_READ) | ATA_BM_CMD_START);
+}
+
+/**
+ * @brief Stops the bus master engine and acknowledges its status.
+ * @return The bus master status before it was cleared.
+ */
+uint8_t ata_dma_stop(ata_channel_t* channel) {
+    outb(channel->bm_base + ATA_BM_COMMAND, 0);
+    uint8_t status = inb(channel->bm_base + ATA_BM_STATUS);
+    outb(channel->bm_base + ATA_BM_STATUS, ATA_BM_SR_IRQ | ATA_BM_SR_ERR);
+    return status;
+}
@@ -0,0 +1,487 @@
+/**
+ * @file bcache.c
+ * @brief Block buffer cache in front of the storage HAL
+ * @author friedrichOsDev
+ */
+
+#include <bcache.h>
+#include <memory.h>
+#include <string.h>
+#include <serial.h>
+#include <console.h>
+#include <print.h>
+#include <timer.h>
+
+static bcache_block_t* blocks = NULL;
+static uint8_t* block_data = NULL;
+static uint32_t block_count = 0;
+
+static bcache_block_t** hash_table = NULL;
+static uint32_t hash_bits = 0;
+
+static bcache_block_t* lru_head = NULL; // most recently used
+static bcache_block_t* lru_tail = NULL; // least recently used
+
+static bcache_stats_t stats;
+
+static bool writeback_enabled = BCACHE_WRITEBACK_DEFAULT;
+static volatile bool writeback_pending = false;
+static uint32_t dirty_count = 0;
+
+// bounce buffers, kept in .bss so they are physically contiguous for DMA
+static uint8_t readahead_buffer[BCACHE_READAHEAD_MAX * BCACHE_BLOCK_SIZE] __attribute__((aligned(4096)));
+static uint8_t writeback_buffer[BCACHE_MAX_RUN * BCACHE_BLOCK_SIZE] __attribute__((aligned(4096)));
+
+static inline uint32_t bcache_hash(disk_t* disk, uint64_t lba) {
+    uint32_t key = (uint32_t)lba ^ (uint32_t)(lba >> 32) ^ ((uint32_t)(uintptr_t)disk >> 4);
+    return (key * 2654435761u) >> (32 - hash_bits);
+}
+
+static void bcache_lru_unlink(bcache_block_t* block) {
+    if (block->lru_prev) block->lru_prev->lru_next = block->lru_next;
+    else lru_head = block->lru_next;
+    if (block->lru_next) block->lru_next->lru_prev = block->lru_prev;
+    else lru_tail = block->lru_prev;
+    block->lru_prev = NULL;
+    block->lru_next = NULL;
+}
+
+static void bcache_lru_push_front(bcache_block_t* block) {
+    block->lru_prev = NULL;
+    block->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = block;
+    lru_head = block;
+    if (!lru_tail) lru_tail = block;
+}
+
+static void bcache_lru_touch(bcache_block_t* block) {
+    if (lru_head == block) return;
+    bcache_lru_unlink(block);
+    bcache_lru_push_front(block);
+}
+
+static void bcache_hash_remove(bcache_block_t* block) {
+    bcache_block_t** link = &hash_table[bcache_hash(block->disk, block->lba)];
+    while (*link) {
+        if (*link == block) {
+            *link = block->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    block->hash_next = NULL;
+}
+
+static bcache_block_t* bcache_lookup(disk_t* disk, uint64_t lba) {
+    bcache_block_t* block = hash_table[bcache_hash(disk, lba)];
+    while (block) {
+        if (block->disk == disk && block->lba == lba) return block;
+        block = block->hash_next;
+    }
+    return NULL;
+}
+
+static void bcache_mark_clean(bcache_block_t* block) {
+    if (!(block->flags & BCACHE_BLOCK_DIRTY)) return;
+    block->flags &= ~BCACHE_BLOCK_DIRTY;
+    dirty_count--;
+}
+
+static void bcache_mark_dirty(bcache_block_t* block) {
+    if (block->flags & BCACHE_BLOCK_DIRTY) return;
+    block->flags |= BCACHE_BLOCK_DIRTY;
+    block->dirty_tick = timer_get_ticks();
+    dirty_count++;
+}
+
+/**
+ * @brief Writes back a dirty block together with all dirty neighbours on the
+ * same disk as one device request.
+ */
+static uint8_t bcache_writeback_run(bcache_block_t* block) {
+    disk_t* disk = block->disk;
+    uint64_t start = block->lba;
+
+    while (start > 0 && block->lba - start + 1 < BCACHE_MAX_RUN) {
+        bcache_block_t* prev = bcache_lookup(disk, start - 1);
+        if (!prev || !(prev->flags & BCACHE_BLOCK_DIRTY)) break;
+        start--;
+    }
+
+    uint32_t run = 0;
+    while (run < BCACHE_MAX_RUN) {
+        bcache_block_t* next = bcache_lookup(disk, start + run);
+        if (!next || !(next->flags & BCACHE_BLOCK_DIRTY)) break;
+        memcpy(writeback_buffer + (run * BCACHE_BLOCK_SIZE), next->data, BCACHE_BLOCK_SIZE);
+        run++;
+    }
+
+    uint8_t res = disk->write(disk, start, run, writeback_buffer, 0);
+    if (res != 0) {
+        serial_printf("BCache: Error: Writeback of %u sectors at LBA %llu on %s failed\n", run, start, disk->name);
+        stats.write_errors++;
+        return res;
+    }
+
+    for (uint32_t i = 0; i < run; i++) {
+        bcache_mark_clean(bcache_lookup(disk, start + i));
+    }
+    stats.writeback_blocks += run;
+    stats.writeback_writes++;
+    return 0;
+}
+
+/**
+ * @brief Writes back dirty blocks until at most target remain.
+ * @param disk Only consider blocks of this disk, or all disks if NULL.
+ * @param target Number of dirty blocks that may remain.
+ * @param expired_only Only write back blocks older than BCACHE_DIRTY_EXPIRE_MS.
+ */
+static uint8_t bcache_writeback(disk_t* disk, uint32_t target, bool expired_only) {
+    uint32_t now = timer_get_ticks();
+    uint32_t expire_ticks = (BCACHE_DIRTY_EXPIRE_MS * TIMER_FREQUENCY) / 1000;
+    uint8_t res = 0;
+
+    for (uint32_t i = 0; i < block_count && dirty_count > target; i++) {
+        bcache_block_t* block = &blocks[i];
+        if (!(block->flags & BCACHE_BLOCK_DIRTY)) continue;
+        if (disk && block->disk != disk) continue;
+        if (expired_only && now - block->dirty_tick < expire_ticks) continue;
+
+        uint8_t err = bcache_writeback_run(block);
+        if (err != 0) res = err;
+    }
+    return res;
+}
+
+/**
+ * @brief Takes the least recently used block, drops its old identity and
+ * rehashes it for (disk, lba). The block is returned at the LRU head.
+ *
+ * A dirty block whose writeback fails stays dirty and the least recently
+ * used clean block is taken instead.
+ * @return The block, or NULL if every block is dirty and cannot be written back.
+ */
+static bcache_block_t* bcache_alloc(disk_t* disk, uint64_t lba) {
+    bcache_block_t* block = lru_tail;
+
+    if ((block->flags & BCACHE_BLOCK_DIRTY) && bcache_writeback_run(block) != 0) {
+        // move it away from the tail so the next allocation does not retry it right away
+        bcache_lru_touch(block);
+        block = lru_tail;
+        while (block && (block->flags & BCACHE_BLOCK_DIRTY)) block = block->lru_prev;
+        if (!block) {
+            serial_printf("BCache: Error: No clean block left to replace\n");
+            return NULL;
+        }
+    }
+
+    if (block->flags & BCACHE_BLOCK_VALID) {
+        bcache_hash_remove(block);
+        stats.evictions++;
+    }
+
+    block->disk = disk;
+    block->lba = lba;
+    block->flags = BCACHE_BLOCK_VALID;
+
+    uint32_t bucket = bcache_hash(disk, lba);
+    block->hash_next = hash_table[bucket];
+    hash_table[bucket] = block;
+
+    bcache_lru_touch(block);
+    return block;
+}
+
+static bcache_block_t* bcache_insert(disk_t* disk, uint64_t lba, const uint8_t* data, uint32_t flags) {
+    bcache_block_t* block = bcache_lookup(disk, lba);
+    if (!block) block = bcache_alloc(disk, lba);
+    else bcache_lru_touch(block);
+    if (!block) return NULL;
+
+    memcpy(block->data, data, BCACHE_BLOCK_SIZE);
+    block->flags = (block->flags & BCACHE_BLOCK_DIRTY) | BCACHE_BLOCK_VALID | flags;
+    return block;
+}
+
+static void bcache_writeback_event(void) {
+    writeback_pending = true;
+}
+
+static void bcache_readahead(disk_t* disk, uint64_t lba, uint32_t window) {
+    if (lba >= disk->total_sectors) return;
+    if (lba + window > disk->total_sectors) window = (uint32_t)(disk->total_sectors - lba);
+
+    // skip the part of the window that is already cached
+    while (window > 0 && bcache_lookup(disk, lba)) {
+        lba++;
+        window--;
+    }
+    if (window == 0) return;
+
+    if (disk->read(disk, lba, window, readahead_buffer) != 0) {
+        serial_printf("BCache: Read-ahead of %u sectors at LBA %llu on %s failed\n", window, lba, disk->name);
+        return;
+    }
+
+    for (uint32_t i = 0; i < window; i++) {
+        if (bcache_lookup(disk, lba + i)) continue;
+        bcache_insert(disk, lba + i, readahead_buffer + (i * BCACHE_BLOCK_SIZE), BCACHE_BLOCK_READAHEAD);
+    }
+    stats.readahead_blocks += window;
+}
+
+void bcache_init(void) {
+    uint64_t budget = pmm_get_free_memory() / BCACHE_MEMORY_DIVISOR;
+    uint64_t wanted = budget / BCACHE_BLOCK_SIZE;
+
+    if (wanted < BCACHE_MIN_BLOCKS) wanted = BCACHE_MIN_BLOCKS;
+    if (wanted > BCACHE_MAX_BLOCKS) wanted = BCACHE_MAX_BLOCKS;
+    block_count = (uint32_t)wanted;
+
+    hash_bits = 1;
+    while ((1u << hash_bits) < block_count) hash_bits++;
+
+    blocks = (bcache_block_t*)kzalloc(sizeof(bcache_block_t) * block_count);
+    block_data = (uint8_t*)kmalloc(BCACHE_BLOCK_SIZE * block_count);
+    hash_table = (bcache_block_t**)kzalloc(sizeof(bcache_block_t*) << hash_bits);
+
+    if (!blocks || !block_data || !hash_table) {
+        serial_printf("BCache: Error: Failed to allocate %u cache blocks, caching disabled\n", block_count);
+        kfree((virt_addr_t)blocks);
+        kfree((virt_addr_t)block_data);
+        kfree((virt_addr_t)hash_table);
+        blocks = NULL;
+        block_count = 0;
+        return;
+    }
+
+    lru_head = NULL;
+    lru_tail = NULL;
+    for (uint32_t i = 0; i < block_count; i++) {
+        blocks[i].data = block_data + (i * BCACHE_BLOCK_SIZE);
+        bcache_lru_push_front(&blocks[i]);
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    dirty_count = 0;
+
+    // the timer only flags the work, the writeback itself runs from the kernel loop
+    event_t writeback_event = {
+        .event_id = 0,
+        .handler = bcache_writeback_event,
+        .interval = (BCACHE_WRITEBACK_INTERVAL_MS * TIMER_FREQUENCY) / 1000,
+        .target_tick = timer_get_ticks() + (BCACHE_WRITEBACK_INTERVAL_MS * TIMER_FREQUENCY) / 1000,
+        .repeat = true,
+        .active = true
+    };
+    timer_add_event(writeback_event);
+
+    serial_printf("BCache: %u blocks (%u KB), %u hash buckets, %s\n", block_count, (block_count * BCACHE_BLOCK_SIZE) / 1024, 1u << hash_bits, writeback_enabled ? "write-back" : "write-through");
+}
+
+bool bcache_is_cacheable(disk_t* disk) {
+    if (block_count == 0) return false;
+    if (disk->flags & DISK_FLAG_NOCACHE) return false;
+    return disk->sector_size == BCACHE_BLOCK_SIZE;
+}
+
+uint8_t bcache_read(disk_t* disk, uint64_t lba, uint32_t count, void* buffer) {
+    if (!bcache_is_cacheable(disk)) return disk->read(disk, lba, count, buffer);
+
+    uint8_t* out = (uint8_t*)buffer;
+    disk_cache_state_t* state = &disk->cache;
+
+    // sequential stream detection: double the window while the reader keeps going, reset on a seek
+    if (lba == state->next_lba && lba != 0) {
+        if (state->readahead_window == 0) state->readahead_window = BCACHE_READAHEAD_MIN;
+        else if (state->readahead_window < BCACHE_READAHEAD_MAX) state->readahead_window *= 2;
+    } else {
+        state->readahead_window = 0;
+    }
+    state->next_lba = lba + count;
+
+    uint32_t i = 0;
+    while (i < count) {
+        bcache_block_t* block = bcache_lookup(disk, lba + i);
+        if (block) {
+            memcpy(out + (i * BCACHE_BLOCK_SIZE), block->data, BCACHE_BLOCK_SIZE);
+            if (block->flags & BCACHE_BLOCK_READAHEAD) {
+                block->flags &= ~BCACHE_BLOCK_READAHEAD;
+                stats.readahead_hits++;
+            }
+            bcache_lru_touch(block);
+            stats.hits++;
+            state->hits++;
+            i++;
+            continue;
+        }
+
+        // collect the run of missing sectors and fetch it with a single request
+        uint32_t run = 1;
+        while (i + run < count && run < BCACHE_MAX_RUN && !bcache_lookup(disk, lba + i + run)) run++;
+
+        uint8_t res = disk->read(disk, lba + i, run, out + (i * BCACHE_BLOCK_SIZE));
+        if (res != 0) return res;
+
+        for (uint32_t j = 0; j < run; j++) {
+            bcache_insert(disk, lba + i + j, out + ((i + j) * BCACHE_BLOCK_SIZE), 0);
+        }
+        stats.misses += run;
+        state->misses += run;
+        i += run;
+    }
+
+    if (state->readahead_window && !bcache_lookup(disk, lba + count)) {
+        bcache_readahead(disk, lba + count, state->readahead_window);
+    }
+
+    return 0;
+}
+
+uint8_t bcache_write(disk_t* disk, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
+    if (!bcache_is_cacheable(disk)) return disk->write(disk, lba, count, buffer, flags);
+
+    const uint8_t* in = (const uint8_t*)buffer;
+    uint32_t i = 0;
+
+    // FUA writes go straight to the device, everything else may be delayed
+    if (writeback_enabled && !(flags & STORAGE_WRITE_FUA)) {
+        // keep the data in the cache, the writeback task coalesces it later
+        for (; i < count; i++) {
+            bcache_block_t* block = bcache_insert(disk, lba + i, in + (i * BCACHE_BLOCK_SIZE), 0);
+            if (!block) break; // no clean block to take, the rest is written through
+            bcache_mark_dirty(block);
+        }
+
+        // the cached data of this write is safe either way; failed runs are
+        // counted in stats.write_errors, stay dirty and are reported by bcache_sync()
+        if (dirty_count > (block_count * BCACHE_DIRTY_RATIO) / 100) {
+            bcache_writeback(NULL, (block_count * BCACHE_DIRTY_BACKGROUND_RATIO) / 100, false);
+        }
+        if (i == count) return 0;
+    }
+
+    uint8_t res = disk->write(disk, lba + i, count - i, in + (i * BCACHE_BLOCK_SIZE), flags);
+    if (res != 0) return res;
+
+    // write-through: refresh blocks that are already cached
+    for (; i < count; i++) {
+        bcache_block_t* block = bcache_lookup(disk, lba + i);
+        if (!block) continue;
+        memcpy(block->data, in + (i * BCACHE_BLOCK_SIZE), BCACHE_BLOCK_SIZE);
+        block->flags &= ~BCACHE_BLOCK_READAHEAD;
+        bcache_mark_clean(block);
+        bcache_lru_touch(block);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Tells whether a cached block of the range is newer than the disk.
+ *
+ * Requests that bypass the cache with storage_submit() must not read such
+ * a range.
+ */
+bool bcache_range_dirty(disk_t* disk, uint64_t lba, uint32_t count) {
+    if (dirty_count == 0 || !bcache_is_cacheable(disk)) return false;
+    for (uint32_t i = 0; i < count; i++) {
+        bcache_block_t* block = bcache_lookup(disk, lba + i);
+        if (block && (block->flags & BCACHE_BLOCK_DIRTY)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Writes all dirty blocks of a disk (or of every disk if NULL) back.
+ * @return 0 on success, the first driver error otherwise.
+ */
+uint8_t bcache_sync(disk_t* disk) {
+    if (dirty_count == 0) return 0;
+    return bcache_writeback(disk, 0, false);
+}
+
+/**
+ * @brief Periodic writeback, called from the kernel main loop.
+ *
+ * Runs once per BCACHE_WRITEBACK_INTERVAL_MS and writes back blocks that
+ * have been dirty for longer than BCACHE_DIRTY_EXPIRE_MS.
+ */
+void bcache_writeback_task(void) {
+    if (!writeback_pending) return;
+    writeback_pending = false;
+
+    if (dirty_count == 0) return;
+    bcache_writeback(NULL, 0, true);
+}
+
+void bcache_set_writeback(bool enabled) {
+    if (!enabled && writeback_enabled) bcache_sync(NULL);
+    writeback_enabled = enabled;
+    serial_printf("BCache: Switched to %s mode\n", enabled ? "write-back" : "write-through");
+}
+
+bool bcache_get_writeback(void) {
+    return writeback_enabled;
+}
+
+void bcache_invalidate_disk(disk_t* disk) {
+    bcache_sync(disk);
+
+    for (uint32_t i = 0; i < block_count; i++) {
+        bcache_block_t* block = &blocks[i];
+        if (!(block->flags & BCACHE_BLOCK_VALID) || block->disk != disk) continue;
+
+        bcache_hash_remove(block);
+        bcache_mark_clean(block);
+        block->flags = 0;
+        block->disk = NULL;
+
+        // invalid blocks are reused first
+        bcache_lru_unlink(block);
+        block->lru_prev = lru_tail;
+        if (lru_tail) lru_tail->lru_next = block;
+        lru_tail = block;
+        if (!lru_head) lru_head = block;
+    }
+    disk->cache.next_lba = 0;
+    disk->cache.readahead_window = 0;
+}
+
+bcache_stats_t* bcache_get_stats(void) {
+    return &stats;
+}
+
+/**
+ * @brief Returns part/total in tenths of a percent without 64-bit division.
+ */
+static uint32_t bcache_permille(uint64_t part, uint64_t total) {
+    if (total == 0) return 0;
+    while (total >> 22) {
+        part >>= 1;
+        total >>= 1;
+    }
+    if (total == 0) return 0;
+    return ((uint32_t)part * 1000) / (uint32_t)total;
+}
+
+void bcache_dump_info(void) {
+    char buf[128];
+    uint32_t hit_rate = bcache_permille(stats.hits, stats.hits + stats.misses);
+    uint32_t ra_rate = bcache_permille(stats.readahead_hits, stats.readahead_blocks);
+
+    console_puts(U"Block Cache:\n");
+    snprintf(buf, sizeof(buf), "  Size:           %u blocks (%u KB)\n", block_count, (block_count * BCACHE_BLOCK_SIZE) / 1024);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Hits / Misses:  %llu / %llu (hit rate %u.%u%%)\n", stats.hits, stats.misses, hit_rate / 10, hit_rate % 10);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Read-ahead:     %llu blocks, %llu used (%u.%u%%)\n", stats.readahead_blocks, stats.readahead_hits, ra_rate / 10, ra_rate % 10);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Evictions:      %llu\n", stats.evictions);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Write mode:     %s, %u dirty blocks\n", writeback_enabled ? "write-back" : "write-through", dirty_count);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Writeback:      %llu blocks in %llu writes, %llu errors\n", stats.writeback_blocks, stats.writeback_writes, stats.write_errors);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+}
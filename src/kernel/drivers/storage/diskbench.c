@@ -0,0 +1,298 @@
+/**
+ * @file diskbench.c
+ * @brief In-kernel storage benchmark
+ * @author friedrichOsDev
+ *
+ * Drives a disk through storage_submit() with a fixed number of requests in
+ * flight, bypassing the block cache, and measures every request against the
+ * TSC clock. Each test prints a human readable line to the console and a
+ * machine readable "DISKBENCH key=value ..." line to the serial port.
+ */
+
+#include <diskbench.h>
+#include <bcache.h>
+#include <partman.h>
+#include <timer.h>
+#include <console.h>
+#include <serial.h>
+#include <print.h>
+#include <memory.h>
+#include <swap.h>
+#include <string.h>
+#include <convert.h>
+#include <cpu.h>
+
+typedef struct {
+    storage_request_t req;
+    uint64_t start_ns;
+    volatile uint64_t end_ns;
+    bool busy;
+} diskbench_slot_t;
+
+typedef struct {
+    uint32_t completed;
+    uint32_t errors;
+    uint64_t elapsed_ns;
+    uint32_t lat_min;
+    uint32_t lat_avg;
+    uint32_t lat_p99;
+    uint32_t lat_max;
+} diskbench_result_t;
+
+// kernel image memory is physically contiguous, which drivers with a single DMA segment rely on
+static uint8_t bench_buffer[DISKBENCH_BUFFER_SIZE] __attribute__((aligned(4096)));
+static diskbench_slot_t slots[DISKBENCH_MAX_QD];
+static const uint32_t sweep_depths[] = { 1, 4, 16, 32 };
+static uint32_t rng_state;
+
+/**
+ * @brief xorshift32, seeded the same way for every test so runs are comparable.
+ */
+static uint32_t diskbench_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void diskbench_complete(storage_request_t* req) {
+    diskbench_slot_t* slot = (diskbench_slot_t*)req->private;
+    slot->end_ns = timer_get_ns();
+}
+
+/**
+ * @brief Shell sort with Knuth's gap sequence, good enough for a few thousand samples.
+ */
+static void diskbench_sort(uint32_t* values, uint32_t count) {
+    uint32_t gap = 1;
+    while (gap < count / 3) gap = gap * 3 + 1;
+
+    for (; gap > 0; gap /= 3) {
+        for (uint32_t i = gap; i < count; i++) {
+            uint32_t value = values[i];
+            uint32_t j = i;
+            while (j >= gap && values[j - gap] > value) {
+                values[j] = values[j - gap];
+                j -= gap;
+            }
+            values[j] = value;
+        }
+    }
+}
+
+static void diskbench_print(const char* str) {
+    for (int i = 0; str[i]; i++) console_putc((uint32_t)str[i]);
+}
+
+/**
+ * @brief Runs one test and fills in the result.
+ * @param latencies Room for config->ops samples.
+ */
+static void diskbench_test(disk_t* disk, const diskbench_config_t* config, storage_op_t op, bool random, uint32_t depth, uint32_t* latencies, diskbench_result_t* result) {
+    uint32_t block_sectors = config->block_size / disk->sector_size;
+    uint64_t block_count = config->span;
+    div64_32(&block_count, block_sectors);
+    uint32_t blocks = block_count > UINT32_MAX ? UINT32_MAX : (uint32_t)block_count;
+    uint32_t buffer_slots = DISKBENCH_BUFFER_SIZE / config->block_size;
+
+    uint32_t total = config->ops;
+    uint32_t submitted = 0;
+    uint32_t in_flight = 0;
+    uint32_t next_block = 0;
+
+    memset(result, 0, sizeof(diskbench_result_t));
+    memset(slots, 0, sizeof(slots));
+    rng_state = 0x2545F491;
+
+    uint64_t start = timer_get_ns();
+    while (result->completed < total) {
+        // fill every free slot, only the last request of the batch notifies the device
+        uint32_t batch = depth - in_flight;
+        if (batch > total - submitted) batch = total - submitted;
+
+        for (uint32_t i = 0; i < depth && batch > 0; i++) {
+            if (slots[i].busy) continue;
+            batch--;
+
+            uint32_t block = random ? diskbench_random() % blocks : next_block++ % blocks;
+            storage_request_t* req = &slots[i].req;
+            memset(req, 0, sizeof(storage_request_t));
+            req->op = op;
+            req->lba = config->start_lba + (uint64_t)block * block_sectors;
+            req->count = block_sectors;
+            req->buffer = bench_buffer + (i % buffer_slots) * config->block_size;
+            req->flags = batch > 0 ? STORAGE_REQ_MORE : 0;
+            req->complete = diskbench_complete;
+            req->private = &slots[i];
+
+            slots[i].busy = true;
+            slots[i].start_ns = timer_get_ns();
+            if (storage_submit(disk, req) != 0) {
+                // stop issuing and let the requests already in flight drain, the device may not have seen them yet
+                slots[i].busy = false;
+                storage_kick(disk);
+                result->errors++;
+                total = submitted;
+                break;
+            }
+            submitted++;
+            in_flight++;
+        }
+
+        if (in_flight == 0) break;
+
+        // same check-then-halt pattern as storage_wait(), for any of the slots
+        uint32_t irq_flags = cpu_irq_save();
+        bool any_done = false;
+        for (uint32_t i = 0; i < depth; i++) {
+            if (slots[i].busy && slots[i].req.done) {
+                any_done = true;
+                break;
+            }
+        }
+        if (!any_done) {
+            cpu_sti_hlt();
+            continue;
+        }
+        cpu_irq_restore(irq_flags);
+
+        for (uint32_t i = 0; i < depth; i++) {
+            if (!slots[i].busy || !slots[i].req.done) continue;
+
+            uint64_t latency = slots[i].end_ns - slots[i].start_ns;
+            latencies[result->completed++] = latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency;
+            if (slots[i].req.status != 0) result->errors++;
+            slots[i].busy = false;
+            in_flight--;
+        }
+    }
+    result->elapsed_ns = timer_get_ns() - start;
+
+    uint32_t n = result->completed;
+    if (n == 0) return;
+
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) sum += latencies[i];
+    div64_32(&sum, n);
+
+    diskbench_sort(latencies, n);
+    result->lat_min = latencies[0];
+    result->lat_avg = (uint32_t)sum;
+    result->lat_p99 = latencies[((n - 1) * 99) / 100];
+    result->lat_max = latencies[n - 1];
+}
+
+/**
+ * @brief Prints a test result to the console and the summary line to serial.
+ */
+static void diskbench_report(disk_t* disk, const diskbench_config_t* config, storage_op_t op, bool random, uint32_t depth, const diskbench_result_t* result) {
+    uint64_t elapsed_us = result->elapsed_ns;
+    div64_32(&elapsed_us, 1000);
+    if (elapsed_us == 0) elapsed_us = 1;
+    uint32_t divisor = elapsed_us > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed_us;
+
+    uint64_t bytes = (uint64_t)result->completed * config->block_size;
+
+    // MB/s with two decimals, scaled in steps that cannot overflow
+    uint64_t rate = (((bytes * 100) >> 10) * 1000000) >> 10;
+    div64_32(&rate, divisor);
+    uint64_t iops = (uint64_t)result->completed * 1000000;
+    div64_32(&iops, divisor);
+    uint64_t rate_whole = rate;
+    uint32_t rate_frac = div64_32(&rate_whole, 100);
+
+    const char* op_name = op == STORAGE_OP_READ ? "read" : "write";
+    const char* pattern = random ? "rand" : "seq";
+
+    char buf[160];
+    snprintf(buf, sizeof(buf), "%-4s %-5s qd %-2u %5llu.%02u MB/s %7llu IOPS  lat us min %u.%u avg %u.%u p99 %u.%u max %u.%u%s\n",
+        pattern, op_name, depth, rate_whole, rate_frac, iops,
+        result->lat_min / 1000, (result->lat_min % 1000) / 100,
+        result->lat_avg / 1000, (result->lat_avg % 1000) / 100,
+        result->lat_p99 / 1000, (result->lat_p99 % 1000) / 100,
+        result->lat_max / 1000, (result->lat_max % 1000) / 100,
+        result->errors ? "  ERRORS" : "");
+    diskbench_print(buf);
+
+    serial_printf("DISKBENCH disk=%s op=%s pattern=%s bs=%u qd=%u ops=%u bytes=%llu usec=%llu mbps_x100=%llu iops=%llu lat_min_ns=%u lat_avg_ns=%u lat_p99_ns=%u lat_max_ns=%u errors=%u\n",
+        disk->name, op_name, pattern, config->block_size, depth, result->completed, bytes, elapsed_us, rate, iops,
+        result->lat_min, result->lat_avg, result->lat_p99, result->lat_max, result->errors);
+}
+
+/**
+ * @brief Fills in a read-only run over the last DISKBENCH_DEFAULT_SPAN bytes of the disk.
+ */
+void diskbench_default_config(disk_t* disk, diskbench_config_t* config) {
+    memset(config, 0, sizeof(diskbench_config_t));
+
+    uint64_t span = DISKBENCH_DEFAULT_SPAN / disk->sector_size;
+    if (span > disk->total_sectors) span = disk->total_sectors;
+    config->start_lba = disk->total_sectors - span;
+    config->span = span;
+    config->block_size = disk->sector_size > DISKBENCH_DEFAULT_BLOCK ? disk->sector_size : DISKBENCH_DEFAULT_BLOCK;
+    config->queue_depth = 0;
+    config->ops = DISKBENCH_DEFAULT_OPS;
+    config->patterns = DISKBENCH_SEQ | DISKBENCH_RAND;
+    config->write = false;
+}
+
+/**
+ * @brief Runs the configured tests on a disk.
+ * @warning With config->write set the scratch range is overwritten.
+ * @return 0 on success, 1 for an invalid configuration, 2 if memory ran out.
+ */
+uint8_t diskbench_run(disk_t* disk, const diskbench_config_t* config) {
+    if (!disk || !config || disk->sector_size == 0) return 1;
+
+    if (config->block_size == 0 || config->block_size % disk->sector_size != 0 || config->block_size > DISKBENCH_MAX_BLOCK) {
+        serial_printf("Diskbench: Error: Block size %u is not a multiple of %u up to %u bytes\n", config->block_size, disk->sector_size, DISKBENCH_MAX_BLOCK);
+        return 1;
+    }
+    if (config->span < config->block_size / disk->sector_size || config->start_lba + config->span > disk->total_sectors) {
+        serial_printf("Diskbench: Error: Scratch range LBA %llu + %llu does not fit the disk\n", config->start_lba, config->span);
+        return 1;
+    }
+    if (config->ops == 0 || config->ops > DISKBENCH_MAX_OPS || config->queue_depth > DISKBENCH_MAX_QD || config->patterns == 0) {
+        serial_printf("Diskbench: Error: Invalid request count, queue depth or pattern\n");
+        return 1;
+    }
+
+    // up to 4 MB of samples, only touched from this loop with interrupts on, so it may be paged out
+    uint32_t* latencies = (uint32_t*)swap_alloc_anon(config->ops * sizeof(uint32_t));
+    if (!latencies) return 2;
+
+    const uint32_t* depths = config->queue_depth ? &config->queue_depth : sweep_depths;
+    uint32_t depth_count = config->queue_depth ? 1 : sizeof(sweep_depths) / sizeof(sweep_depths[0]);
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "diskbench %s: LBA %llu-%llu, %u bytes x %u requests per test\n",
+        disk->name, config->start_lba, config->start_lba + config->span - 1, config->block_size, config->ops);
+    diskbench_print(buf);
+
+    if (config->write) {
+        // the tests write around the cache, so nothing cached may be written over them or read back afterwards;
+        // the cache keys partitions by their parent disk
+        bcache_sync(partman_resolve(disk, NULL));
+        memset(bench_buffer, 0xA5, sizeof(bench_buffer));
+    }
+
+    for (uint32_t p = 0; p < 2; p++) {
+        bool random = p == 1;
+        if (!(config->patterns & (random ? DISKBENCH_RAND : DISKBENCH_SEQ))) continue;
+
+        for (uint32_t o = 0; o < (config->write ? 2u : 1u); o++) {
+            storage_op_t op = o == 0 ? STORAGE_OP_READ : STORAGE_OP_WRITE;
+
+            for (uint32_t d = 0; d < depth_count; d++) {
+                diskbench_result_t result;
+                diskbench_test(disk, config, op, random, depths[d], latencies, &result);
+                diskbench_report(disk, config, op, random, depths[d], &result);
+            }
+        }
+    }
+
+    if (config->write) bcache_invalidate_disk(partman_resolve(disk, NULL));
+
+    swap_free_anon((virt_addr_t)latencies);
+    return 0;
+}
@@ -0,0 +1,203 @@
+/**
+ * @file iostat.c
+ * @brief Per-disk I/O statistics
+ * @author friedrichOsDev
+ *
+ * The storage HAL counts every request at storage_read/storage_write/storage_flush
+ * and at storage_submit/storage_complete. Requests a disk issues to another disk
+ * (partitions, md members) are counted on both.
+ */
+
+#include <iostat.h>
+#include <timer.h>
+#include <console.h>
+#include <print.h>
+#include <memory.h>
+#include <string.h>
+#include <convert.h>
+#include <cpu.h>
+
+/**
+ * @brief Marks a request as in flight.
+ * @return The start timestamp to hand to iostat_done().
+ */
+uint64_t iostat_start(disk_t* disk) {
+    uint64_t now = timer_get_ns();
+
+    uint32_t irq_flags = cpu_irq_save();
+    if (disk->stats.in_flight++ == 0) disk->stats.busy_since = now;
+    cpu_irq_restore(irq_flags);
+
+    return now;
+}
+
+/**
+ * @brief Accounts a finished request, may be called from interrupt context.
+ */
+void iostat_done(disk_t* disk, storage_op_t op, uint32_t sectors, uint64_t start_ns, uint8_t status) {
+    uint64_t now = timer_get_ns();
+    uint64_t latency = now - start_ns;
+
+    // log2 of the latency in microseconds
+    uint64_t latency_us = latency;
+    div64_32(&latency_us, 1000);
+    uint32_t bucket = 0;
+    while (bucket < STORAGE_LATENCY_BUCKETS - 1 && (latency_us >> (bucket + 1)) != 0) bucket++;
+
+    uint32_t irq_flags = cpu_irq_save();
+    disk_stats_t* stats = &disk->stats;
+    if (--stats->in_flight == 0) stats->busy_ns += now - stats->busy_since;
+
+    switch (op) {
+        case STORAGE_OP_READ:
+            stats->reads++;
+            stats->read_sectors += sectors;
+            stats->read_ns += latency;
+            break;
+        case STORAGE_OP_WRITE:
+            stats->writes++;
+            stats->write_sectors += sectors;
+            stats->write_ns += latency;
+            break;
+        case STORAGE_OP_FLUSH:
+            stats->flushes++;
+            break;
+    }
+    if (status != 0) stats->errors++;
+    stats->latency_hist[bucket]++;
+    cpu_irq_restore(irq_flags);
+}
+
+/**
+ * @brief Copies the statistics of a disk, with busy_ns including the current busy period.
+ */
+void iostat_snapshot(disk_t* disk, disk_stats_t* out) {
+    uint32_t irq_flags = cpu_irq_save();
+    uint64_t now = timer_get_ns();
+    *out = disk->stats;
+    cpu_irq_restore(irq_flags);
+
+    if (out->in_flight > 0) out->busy_ns += now - out->busy_since;
+}
+
+/**
+ * @brief Returns value * 1000000 / elapsed_us, i.e. a per-second rate.
+ */
+static uint64_t iostat_rate(uint64_t value, uint32_t elapsed_us) {
+    value *= 1000000;
+    div64_32(&value, elapsed_us);
+    return value;
+}
+
+/**
+ * @brief Returns the mean latency in ns.
+ */
+static uint32_t iostat_await(uint64_t total_ns, uint64_t count) {
+    if (count == 0) return 0;
+    div64_32(&total_ns, count > UINT32_MAX ? UINT32_MAX : (uint32_t)count);
+    return total_ns > UINT32_MAX ? UINT32_MAX : (uint32_t)total_ns;
+}
+
+static void iostat_print_row(disk_t* disk, const disk_stats_t* prev, const disk_stats_t* cur, uint32_t elapsed_us) {
+    uint64_t reads = cur->reads - prev->reads;
+    uint64_t writes = cur->writes - prev->writes;
+    uint64_t read_kb = ((cur->read_sectors - prev->read_sectors) * disk->sector_size) >> 10;
+    uint64_t write_kb = ((cur->write_sectors - prev->write_sectors) * disk->sector_size) >> 10;
+    uint32_t r_await = iostat_await(cur->read_ns - prev->read_ns, reads);
+    uint32_t w_await = iostat_await(cur->write_ns - prev->write_ns, writes);
+
+    // busy ns per elapsed us is the utilization in per mille
+    uint64_t util = cur->busy_ns - prev->busy_ns;
+    div64_32(&util, elapsed_us);
+    if (util > 1000) util = 1000;
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%-10s %7llu %7llu %9llu %9llu %6u.%u %6u.%u %5u %4u.%u%%\n",
+        disk->name, iostat_rate(reads, elapsed_us), iostat_rate(writes, elapsed_us),
+        iostat_rate(read_kb, elapsed_us), iostat_rate(write_kb, elapsed_us),
+        r_await / 1000, (r_await % 1000) / 100, w_await / 1000, (w_await % 1000) / 100,
+        cur->in_flight, (uint32_t)util / 10, (uint32_t)util % 10);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+}
+
+/**
+ * @brief Prints the per-disk activity of count intervals.
+ * @note Blocks the caller for count * interval_ms.
+ */
+void iostat_report(uint32_t interval_ms, uint32_t count) {
+    uint8_t disk_count = storage_get_disk_count();
+    if (disk_count == 0 || interval_ms == 0) return;
+
+    disk_stats_t* prev = (disk_stats_t*)kmalloc(disk_count * sizeof(disk_stats_t));
+    disk_stats_t* cur = (disk_stats_t*)kmalloc(disk_count * sizeof(disk_stats_t));
+    if (!prev || !cur) {
+        console_puts(U"Error: Memory allocation failed.\n");
+        if (prev) kfree((virt_addr_t)prev);
+        if (cur) kfree((virt_addr_t)cur);
+        return;
+    }
+
+    for (uint8_t i = 0; i < disk_count; i++) iostat_snapshot(storage_get_disk(i), &prev[i]);
+    uint64_t last = timer_get_ns();
+
+    for (uint32_t n = 0; n < count; n++) {
+        sleep_ms(interval_ms);
+
+        for (uint8_t i = 0; i < disk_count; i++) iostat_snapshot(storage_get_disk(i), &cur[i]);
+        uint64_t now = timer_get_ns();
+        uint64_t elapsed_us = now - last;
+        div64_32(&elapsed_us, 1000);
+        if (elapsed_us == 0) elapsed_us = 1;
+        last = now;
+
+        console_puts(U"Device         r/s     w/s     rKB/s     wKB/s r_await w_await queue  util\n");
+        for (uint8_t i = 0; i < disk_count; i++) {
+            iostat_print_row(storage_get_disk(i), &prev[i], &cur[i], elapsed_us > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed_us);
+        }
+        console_putc(U'\n');
+
+        memcpy(prev, cur, disk_count * sizeof(disk_stats_t));
+    }
+
+    kfree((virt_addr_t)prev);
+    kfree((virt_addr_t)cur);
+}
+
+/**
+ * @brief Prints the totals and the latency histogram of a disk since boot.
+ */
+void iostat_dump_histogram(disk_t* disk) {
+    disk_stats_t stats;
+    iostat_snapshot(disk, &stats);
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s: %llu reads (%llu sectors), %llu writes (%llu sectors), %llu flushes, %llu errors\n",
+        disk->name, stats.reads, stats.read_sectors, stats.writes, stats.write_sectors, stats.flushes, stats.errors);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+
+    uint32_t max = 0;
+    for (uint32_t b = 0; b < STORAGE_LATENCY_BUCKETS; b++) {
+        if (stats.latency_hist[b] > max) max = stats.latency_hist[b];
+    }
+    if (max == 0) return;
+
+    console_puts(U"Latency (us)         Count\n");
+    for (uint32_t b = 0; b < STORAGE_LATENCY_BUCKETS; b++) {
+        if (stats.latency_hist[b] == 0) continue;
+
+        char bar[41];
+        uint32_t scale = (max + 39) / 40;
+        uint32_t len = (stats.latency_hist[b] + scale - 1) / scale;
+        memset(bar, '#', len);
+        bar[len] = '\0';
+
+        if (b == 0) {
+            snprintf(buf, sizeof(buf), "%8s - %-8u %8u %s\n", "0", 2u, stats.latency_hist[b], bar);
+        } else if (b == STORAGE_LATENCY_BUCKETS - 1) {
+            snprintf(buf, sizeof(buf), "%8u - %-8s %8u %s\n", 1u << b, "", stats.latency_hist[b], bar);
+        } else {
+            snprintf(buf, sizeof(buf), "%8u - %-8u %8u %s\n", 1u << b, 1u << (b + 1), stats.latency_hist[b], bar);
+        }
+        for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    }
+}
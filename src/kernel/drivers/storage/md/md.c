@@ -0,0 +1,294 @@
+/**
+ * @file md.c
+ * @brief Software RAID (multiple device) disks
+ * @author friedrichOsDev
+ *
+ * An md disk splits every request into member requests and submits them all
+ * before waiting, so members with a submit callback work in parallel. The md
+ * request completes when the last member request has.
+ */
+
+#include <md.h>
+#include <memory.h>
+#include <string.h>
+#include <serial.h>
+#include <print.h>
+#include <convert.h>
+#include <cpu.h>
+
+typedef struct {
+    uint8_t member;
+    uint64_t lba;
+    uint32_t count;
+    uint8_t* buffer;
+} md_segment_t;
+
+static uint8_t device_count = 0;
+
+static md_child_t children[MD_MAX_CHILDREN];
+static md_child_t* free_children = NULL;
+static uint32_t free_child_count = 0;
+static bool children_ready = false;
+
+static void md_init_children(void) {
+    for (uint32_t i = 0; i < MD_MAX_CHILDREN; i++) {
+        children[i].next_free = free_children;
+        free_children = &children[i];
+    }
+    free_child_count = MD_MAX_CHILDREN;
+    children_ready = true;
+}
+
+/**
+ * @brief Takes count member requests from the pool, sleeping until enough are free.
+ */
+static void md_alloc_children(md_child_t** out, uint32_t count) {
+    while (1) {
+        uint32_t irq_flags = cpu_irq_save();
+        if (free_child_count >= count) {
+            for (uint32_t i = 0; i < count; i++) {
+                out[i] = free_children;
+                free_children = free_children->next_free;
+            }
+            free_child_count -= count;
+            cpu_irq_restore(irq_flags);
+            return;
+        }
+        cpu_sti_hlt();
+    }
+}
+
+static void md_free_child(md_child_t* child) {
+    uint32_t irq_flags = cpu_irq_save();
+    child->next_free = free_children;
+    free_children = child;
+    free_child_count++;
+    cpu_irq_restore(irq_flags);
+}
+
+/**
+ * @brief Drops one reference of an md request and completes it with the last one.
+ */
+static void md_put(storage_request_t* req) {
+    uint32_t irq_flags = cpu_irq_save();
+    bool last = --req->pending == 0;
+    cpu_irq_restore(irq_flags);
+
+    if (last) storage_complete(req, req->status);
+}
+
+static void md_child_complete(storage_request_t* req) {
+    md_child_t* child = (md_child_t*)req->private;
+    storage_request_t* parent = child->parent;
+
+    // the md request reports the first error of its members
+    if (req->status != 0 && parent->status == 0) parent->status = req->status;
+
+    md_free_child(child);
+    md_put(parent);
+}
+
+/**
+ * @brief Submits a batch of member requests.
+ *
+ * Only the last request of a batch to each member is submitted without
+ * STORAGE_REQ_MORE, so every member is notified once per batch.
+ */
+static void md_issue(md_device_t* md, storage_request_t* parent, md_segment_t* segments, uint32_t count) {
+    md_child_t* batch[MD_BATCH];
+    md_alloc_children(batch, count);
+
+    uint32_t irq_flags = cpu_irq_save();
+    parent->pending += count;
+    cpu_irq_restore(irq_flags);
+
+    for (uint32_t i = 0; i < count; i++) {
+        md_child_t* child = batch[i];
+        storage_request_t* req = &child->req;
+        memset(req, 0, sizeof(storage_request_t));
+        child->parent = parent;
+
+        req->op = parent->op;
+        req->lba = segments[i].lba;
+        req->count = segments[i].count;
+        req->buffer = segments[i].buffer;
+        req->flags = parent->flags & ~STORAGE_REQ_MORE;
+        req->complete = md_child_complete;
+        req->private = child;
+
+        for (uint32_t j = i + 1; j < count; j++) {
+            if (segments[j].member == segments[i].member) {
+                req->flags |= STORAGE_REQ_MORE;
+                break;
+            }
+        }
+
+        uint8_t res = storage_submit(md->members[segments[i].member], req);
+        if (res != 0) {
+            // rejected before it reached the member, so it never completes on its own,
+            // and the member requests queued before it with STORAGE_REQ_MORE need the notification it would have sent
+            storage_kick(md->members[segments[i].member]);
+            req->status = res;
+            md_child_complete(req);
+        }
+    }
+}
+
+uint8_t md_submit(disk_t* self, storage_request_t* req) {
+    md_device_t* md = (md_device_t*)self;
+
+    req->disk = self;
+    req->next = NULL;
+    req->issued = 0;
+    req->status = 0;
+    req->pending = 1; // held while the member requests are issued, so none can complete the md request early
+
+    md_segment_t segments[MD_BATCH];
+    uint32_t count = 0;
+
+    if (req->op == STORAGE_OP_FLUSH || (md->level == MD_RAID1 && req->op == STORAGE_OP_WRITE)) {
+        // every member gets the whole request
+        for (uint8_t m = 0; m < md->member_count; m++) {
+            segments[count++] = (md_segment_t){ .member = m, .lba = req->lba, .count = req->count, .buffer = req->buffer };
+        }
+        md_issue(md, req, segments, count);
+        md_put(req);
+        return 0;
+    }
+
+    uint64_t lba = req->lba;
+    uint32_t remaining = req->count;
+    uint8_t* buffer = (uint8_t*)req->buffer;
+
+    while (remaining > 0) {
+        uint32_t in_chunk = (uint32_t)lba & (md->chunk_sectors - 1);
+        uint32_t length = md->chunk_sectors - in_chunk;
+        if (length > remaining) length = remaining;
+
+        // chunk n lives on member n % members, as stripe n / members of it
+        uint64_t stripe = lba >> md->chunk_shift;
+        uint8_t member = (uint8_t)div64_32(&stripe, md->member_count);
+
+        segments[count++] = (md_segment_t){
+            .member = member,
+            .lba = md->level == MD_RAID0 ? (stripe << md->chunk_shift) + in_chunk : lba,
+            .count = length,
+            .buffer = buffer
+        };
+        if (count == MD_BATCH) {
+            md_issue(md, req, segments, count);
+            count = 0;
+        }
+
+        lba += length;
+        remaining -= length;
+        buffer += length * self->sector_size;
+    }
+    if (count > 0) md_issue(md, req, segments, count);
+
+    md_put(req);
+    return 0;
+}
+
+static uint8_t md_request(disk_t* self, storage_op_t op, uint64_t lba, uint32_t count, void* buffer, uint32_t flags) {
+    storage_request_t req = {
+        .disk = self,
+        .op = op,
+        .lba = lba,
+        .count = count,
+        .buffer = buffer,
+        .flags = flags & ~STORAGE_REQ_MORE
+    };
+
+    uint8_t res = md_submit(self, &req);
+    if (res != 0) return res;
+    return storage_wait(&req);
+}
+
+uint8_t md_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buffer) {
+    return md_request(self, STORAGE_OP_READ, lba, count, buffer, 0);
+}
+
+uint8_t md_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
+    return md_request(self, STORAGE_OP_WRITE, lba, count, (void*)buffer, flags);
+}
+
+uint8_t md_flush(disk_t* self) {
+    return md_request(self, STORAGE_OP_FLUSH, 0, 0, NULL, 0);
+}
+
+/**
+ * @brief Creates and registers an md disk over the given members.
+ * @param chunk_sectors Striping unit, a power of two.
+ * @return The new disk, or NULL if the members cannot be combined.
+ * @note The members must not be used directly while they belong to an md disk.
+ */
+disk_t* md_create(md_level_t level, uint32_t chunk_sectors, disk_t** members, uint8_t member_count) {
+    if (device_count >= MD_MAX_DEVICES) {
+        serial_printf("MD: Error: Maximum number of md disks reached\n");
+        return NULL;
+    }
+    if (member_count < 2 || member_count > MD_MAX_MEMBERS) {
+        serial_printf("MD: Error: An md disk needs 2 to %u members\n", MD_MAX_MEMBERS);
+        return NULL;
+    }
+    if (chunk_sectors == 0 || (chunk_sectors & (chunk_sectors - 1))) {
+        serial_printf("MD: Error: Chunk size of %u sectors is not a power of two\n", chunk_sectors);
+        return NULL;
+    }
+
+    uint64_t member_sectors = UINT64_MAX;
+    bool writable = true;
+    for (uint8_t i = 0; i < member_count; i++) {
+        if (!members[i] || !members[i]->read) return NULL;
+        for (uint8_t j = 0; j < i; j++) {
+            if (members[j] == members[i]) {
+                serial_printf("MD: Error: Disk %s is given twice\n", members[i]->name);
+                return NULL;
+            }
+        }
+        if (members[i]->sector_size != members[0]->sector_size) {
+            serial_printf("MD: Error: Members have different sector sizes\n");
+            return NULL;
+        }
+        if (members[i]->total_sectors < member_sectors) member_sectors = members[i]->total_sectors;
+        if (!members[i]->write) writable = false;
+    }
+
+    uint8_t chunk_shift = 0;
+    while ((1u << chunk_shift) < chunk_sectors) chunk_shift++;
+
+    // only whole chunks of the smallest member are used
+    member_sectors = (member_sectors >> chunk_shift) << chunk_shift;
+    if (member_sectors == 0) {
+        serial_printf("MD: Error: Members are smaller than one chunk\n");
+        return NULL;
+    }
+
+    if (!children_ready) md_init_children();
+
+    md_device_t* md = (md_device_t*)kzalloc(sizeof(md_device_t));
+    if (!md) return NULL;
+
+    md->level = level;
+    md->member_count = member_count;
+    md->chunk_sectors = chunk_sectors;
+    md->chunk_shift = chunk_shift;
+    for (uint8_t i = 0; i < member_count; i++) md->members[i] = members[i];
+
+    snprintf(md->base.name, sizeof(md->base.name), "md%u", device_count);
+    md->base.total_sectors = level == MD_RAID0 ? member_sectors * member_count : member_sectors;
+    md->base.sector_size = members[0]->sector_size;
+    md->base.type = TYPE_MD;
+    md->base.read = md_read_sectors;
+    md->base.write = writable ? md_write_sectors : NULL;
+    md->base.flush = md_flush;
+    md->base.submit = md_submit;
+
+    device_count++;
+    storage_register_disk(&md->base);
+
+    serial_printf("MD: Registered %s as RAID-%u over %u disks, %u sector chunks, %llu sectors\n",
+                  md->base.name, level == MD_RAID0 ? 0 : 1, member_count, chunk_sectors, md->base.total_sectors);
+    return &md->base;
+}
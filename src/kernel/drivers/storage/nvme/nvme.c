@@ -0,0 +1,543 @@
+/**
+ * @file nvme.c
+ * @author friedrichOsDev
+ */
+
+#include <nvme.h>
+#include <serial.h>
+#include <memory.h>
+#include <handler.h>
+#include <string.h>
+#include <print.h>
+#include <cpu.h>
+#include <timer.h>
+
+static nvme_controller_t controllers[NVME_MAX_CONTROLLERS];
+static uint8_t controller_count = 0;
+
+static nvme_sqe_t admin_sq[NVME_MAX_CONTROLLERS][NVME_ADMIN_QUEUE_SIZE] __attribute__((aligned(4096)));
+static nvme_cqe_t admin_cq[NVME_MAX_CONTROLLERS][NVME_ADMIN_QUEUE_SIZE] __attribute__((aligned(4096)));
+static nvme_sqe_t io_sq[NVME_MAX_CONTROLLERS][NVME_IO_QUEUE_SIZE] __attribute__((aligned(4096)));
+static nvme_cqe_t io_cq[NVME_MAX_CONTROLLERS][NVME_IO_QUEUE_SIZE] __attribute__((aligned(4096)));
+static uint64_t prp_lists[NVME_MAX_CONTROLLERS][NVME_IO_QUEUE_SIZE][NVME_PRP_LIST_ENTRIES] __attribute__((aligned(4096)));
+static uint8_t identify_buffer[4096] __attribute__((aligned(4096)));
+
+static uint32_t nvme_read32(nvme_controller_t* ctrl, uint32_t reg) {
+    return *(volatile uint32_t*)(ctrl->regs + reg);
+}
+
+static void nvme_write32(nvme_controller_t* ctrl, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(ctrl->regs + reg) = value;
+}
+
+static uint64_t nvme_read64(nvme_controller_t* ctrl, uint32_t reg) {
+    uint64_t low = nvme_read32(ctrl, reg);
+    uint64_t high = nvme_read32(ctrl, reg + 4);
+    return low | (high << 32);
+}
+
+static void nvme_write64(nvme_controller_t* ctrl, uint32_t reg, uint64_t value) {
+    nvme_write32(ctrl, reg, (uint32_t)value);
+    nvme_write32(ctrl, reg + 4, (uint32_t)(value >> 32));
+}
+
+static uint64_t nvme_phys(const void* ptr) {
+    return vmm_virtual_to_physical(vmm_get_page_directory(), (virt_addr_t)ptr);
+}
+
+static void nvme_queue_init(nvme_controller_t* ctrl, nvme_queue_t* q, uint16_t qid, nvme_sqe_t* sq, nvme_cqe_t* cq, uint16_t size, uint32_t dstrd) {
+    uint32_t stride = 4 << dstrd;
+
+    memset(sq, 0, size * sizeof(nvme_sqe_t));
+    memset(cq, 0, size * sizeof(nvme_cqe_t));
+
+    q->sq = sq;
+    q->cq = cq;
+    q->qid = qid;
+    q->size = size;
+    q->sq_tail = 0;
+    q->sq_head = 0;
+    q->sq_unannounced = 0;
+    q->cq_head = 0;
+    q->phase = 1;
+    q->sq_doorbell = (volatile uint32_t*)(ctrl->regs + NVME_REG_DOORBELL + (2 * qid) * stride);
+    q->cq_doorbell = (volatile uint32_t*)(ctrl->regs + NVME_REG_DOORBELL + (2 * qid + 1) * stride);
+}
+
+static bool nvme_wait_ready(nvme_controller_t* ctrl, bool ready) {
+    uint32_t spin = 0;
+    while (spin < 100000000) {
+        uint32_t csts = nvme_read32(ctrl, NVME_REG_CSTS);
+        if (csts & NVME_CSTS_CFS) return false;
+        if (((csts & NVME_CSTS_RDY) != 0) == ready) return true;
+        spin++;
+    }
+    return false;
+}
+
+/**
+ * @brief Runs one admin command and polls for its completion.
+ * @return The status field of the completion (0 = success), 0xFFFF on timeout.
+ */
+static uint16_t nvme_admin_command(nvme_controller_t* ctrl, nvme_sqe_t* cmd) {
+    nvme_queue_t* q = &ctrl->admin;
+
+    // admin commands run one at a time, so the slot index is a unique identifier
+    cmd->cid = q->sq_tail;
+    memcpy(&q->sq[q->sq_tail], cmd, sizeof(nvme_sqe_t));
+    if (++q->sq_tail == q->size) q->sq_tail = 0;
+    *q->sq_doorbell = q->sq_tail;
+
+    uint32_t spin = 0;
+    while ((q->cq[q->cq_head].status & 1) != q->phase) {
+        if (++spin == 100000000) {
+            serial_printf("NVMe: Admin command %x timed out on controller %d\n", cmd->opcode, ctrl->index);
+            return 0xFFFF;
+        }
+    }
+
+    uint16_t status = q->cq[q->cq_head].status >> 1;
+    if (++q->cq_head == q->size) {
+        q->cq_head = 0;
+        q->phase ^= 1;
+    }
+    *q->cq_doorbell = q->cq_head;
+
+    return status;
+}
+
+static uint16_t nvme_identify(nvme_controller_t* ctrl, uint32_t cns, uint32_t nsid) {
+    nvme_sqe_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_IDENTIFY;
+    cmd.nsid = nsid;
+    cmd.prp1 = nvme_phys(identify_buffer);
+    cmd.cdw10 = cns;
+    return nvme_admin_command(ctrl, &cmd);
+}
+
+static bool nvme_create_io_queues(nvme_controller_t* ctrl, uint16_t size, uint32_t dstrd) {
+    nvme_queue_t* q = &ctrl->io;
+    nvme_sqe_t cmd;
+
+    nvme_queue_init(ctrl, q, 1, io_sq[ctrl->index], io_cq[ctrl->index], size, dstrd);
+
+    // one I/O queue pair
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10 = NVME_FEATURE_NUM_QUEUES;
+    cmd.cdw11 = 0;
+    if (nvme_admin_command(ctrl, &cmd) != 0) {
+        serial_printf("NVMe: Set Features (number of queues) failed\n");
+        return false;
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_CREATE_CQ;
+    cmd.prp1 = nvme_phys((const void*)q->cq);
+    cmd.cdw10 = ((uint32_t)(size - 1) << 16) | q->qid;
+    cmd.cdw11 = (1 << 1) | (1 << 0); // interrupts enabled, physically contiguous
+    if (nvme_admin_command(ctrl, &cmd) != 0) {
+        serial_printf("NVMe: Create I/O completion queue failed\n");
+        return false;
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_CREATE_SQ;
+    cmd.prp1 = nvme_phys(q->sq);
+    cmd.cdw10 = ((uint32_t)(size - 1) << 16) | q->qid;
+    cmd.cdw11 = ((uint32_t)q->qid << 16) | (1 << 0); // completes to the CQ with the same id, physically contiguous
+    if (nvme_admin_command(ctrl, &cmd) != 0) {
+        serial_printf("NVMe: Create I/O submission queue failed\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void nvme_register_namespace(nvme_controller_t* ctrl, uint32_t nsid) {
+    if (nvme_identify(ctrl, NVME_IDENTIFY_NAMESPACE, nsid) != 0) return;
+
+    uint64_t nsze = *(uint64_t*)&identify_buffer[0];
+    if (nsze == 0) return; // inactive namespace
+
+    uint8_t flbas = identify_buffer[26] & 0x0F;
+    uint32_t lbaf = *(uint32_t*)&identify_buffer[128 + flbas * 4];
+    uint8_t lbads = (uint8_t)((lbaf >> 16) & 0xFF);
+    if (lbads != 9) {
+        serial_printf("NVMe: Namespace %u uses %u byte blocks, only 512 is supported. Skipping.\n", nsid, 1 << lbads);
+        return;
+    }
+
+    nvme_ns_t* ns = (nvme_ns_t*)kzalloc(sizeof(nvme_ns_t));
+    if (!ns) {
+        serial_printf("NVMe: Error: Out of memory for namespace %u. Skipping.\n", nsid);
+        return;
+    }
+    ns->ctrl = ctrl;
+    ns->nsid = nsid;
+    snprintf(ns->base.name, sizeof(ns->base.name), "nvme%un%u", ctrl->index, nsid);
+    ns->base.total_sectors = nsze;
+    ns->base.sector_size = 512;
+    ns->base.type = TYPE_NVME;
+    ns->base.read = nvme_read_sectors;
+    ns->base.write = nvme_write_sectors;
+    ns->base.flush = ctrl->volatile_cache ? nvme_flush : NULL;
+    ns->base.submit = nvme_submit;
+    ns->base.kick = nvme_kick;
+
+    storage_register_disk(&ns->base);
+    serial_printf("NVMe: Registered disk %s with %llu sectors\n", ns->base.name, ns->base.total_sectors);
+}
+
+static void nvme_process_completions(nvme_controller_t* ctrl);
+static void nvme_dispatch(nvme_controller_t* ctrl);
+static void nvme_ring(nvme_controller_t* ctrl);
+
+// the phase bit tells each controller whether it has new completions, so a shared line is fine
+static void nvme_interrupt_handler(struct registers* regs) {
+    (void)regs;
+    for (uint8_t i = 0; i < controller_count; i++) {
+        nvme_process_completions(&controllers[i]);
+    }
+}
+
+static void nvme_poll_event(void) {
+    nvme_interrupt_handler(NULL);
+}
+
+void nvme_init_device(pci_device_t* dev) {
+    serial_printf("Initializing NVMe device at bus %d, device %d, function %d\n", dev->bus, dev->device, dev->function);
+
+    if (controller_count >= NVME_MAX_CONTROLLERS) {
+        serial_printf("NVMe: Too many controllers, ignoring this one\n");
+        return;
+    }
+
+    pci_bar_t bar0 = pci_get_bar(dev->bus, dev->device, dev->function, 0);
+    if (bar0.base_address == 0 || bar0.type != PCI_BAR_MEM) {
+        serial_printf("NVMe: Invalid BAR0\n");
+        return;
+    }
+
+    // Enable memory space decoding and bus mastering
+    uint32_t command = pci_config_read_dword(dev->bus, dev->device, dev->function, PCI_COMMAND);
+    command |= (1 << 1) | (1 << 2);
+    pci_config_write_dword(dev->bus, dev->device, dev->function, PCI_COMMAND, command);
+
+    nvme_controller_t* ctrl = &controllers[controller_count];
+    memset(ctrl, 0, sizeof(nvme_controller_t));
+    ctrl->index = controller_count;
+    ctrl->regs = (volatile uint8_t*)io_map_permanent(bar0.base_address, bar0.size);
+    if (!ctrl->regs) {
+        serial_printf("NVMe: Failed to map BAR0\n");
+        return;
+    }
+
+    uint64_t cap = nvme_read64(ctrl, NVME_REG_CAP);
+    uint32_t mqes = (uint32_t)(cap & 0xFFFF) + 1;
+    uint32_t dstrd = (uint32_t)(cap >> 32) & 0xF;
+    uint32_t mpsmin = (uint32_t)(cap >> 48) & 0xF;
+    if (mpsmin != 0) {
+        serial_printf("NVMe: Controller does not support 4 KB pages\n");
+        return;
+    }
+
+    // Reset the controller and set up the admin queues
+    nvme_write32(ctrl, NVME_REG_CC, nvme_read32(ctrl, NVME_REG_CC) & ~NVME_CC_EN);
+    if (!nvme_wait_ready(ctrl, false)) {
+        serial_printf("NVMe: Controller did not stop\n");
+        return;
+    }
+
+    nvme_queue_init(ctrl, &ctrl->admin, 0, admin_sq[ctrl->index], admin_cq[ctrl->index], NVME_ADMIN_QUEUE_SIZE, dstrd);
+    nvme_write32(ctrl, NVME_REG_AQA, ((NVME_ADMIN_QUEUE_SIZE - 1) << 16) | (NVME_ADMIN_QUEUE_SIZE - 1));
+    nvme_write64(ctrl, NVME_REG_ASQ, nvme_phys(ctrl->admin.sq));
+    nvme_write64(ctrl, NVME_REG_ACQ, nvme_phys((const void*)ctrl->admin.cq));
+    nvme_write32(ctrl, NVME_REG_INTMS, 0xFFFFFFFF); // admin commands are polled during init
+
+    nvme_write32(ctrl, NVME_REG_CC, NVME_CC_EN | NVME_CC_IOSQES | NVME_CC_IOCQES);
+    if (!nvme_wait_ready(ctrl, true)) {
+        serial_printf("NVMe: Controller did not become ready\n");
+        return;
+    }
+    serial_printf("NVMe: Controller %d enabled, version %x\n", ctrl->index, nvme_read32(ctrl, NVME_REG_VS));
+
+    if (nvme_identify(ctrl, NVME_IDENTIFY_CONTROLLER, 0) != 0) {
+        serial_printf("NVMe: Identify controller failed\n");
+        return;
+    }
+
+    memcpy(ctrl->model, &identify_buffer[24], 40);
+    ctrl->model[40] = '\0';
+    for (int i = 39; i >= 0 && ctrl->model[i] == ' '; i--) ctrl->model[i] = '\0';
+
+    // MDTS is a power of two in units of the minimum page size, 0 means no limit
+    uint8_t mdts = identify_buffer[77];
+    ctrl->max_sectors = NVME_PRP_LIST_ENTRIES * (NVME_PAGE_SIZE / 512);
+    if (mdts != 0 && mdts < 16 && ((1u << mdts) * (NVME_PAGE_SIZE / 512)) < ctrl->max_sectors) {
+        ctrl->max_sectors = (1u << mdts) * (NVME_PAGE_SIZE / 512);
+    }
+
+    uint32_t nn = *(uint32_t*)&identify_buffer[516];
+    ctrl->volatile_cache = (identify_buffer[525] & (1 << 0)) != 0;
+    serial_printf("NVMe: Model: %s, namespaces: %u, max transfer: %u sectors\n", ctrl->model, nn, ctrl->max_sectors);
+
+    uint16_t io_size = mqes < NVME_IO_QUEUE_SIZE ? (uint16_t)mqes : NVME_IO_QUEUE_SIZE;
+    if (!nvme_create_io_queues(ctrl, io_size, dstrd)) return;
+
+    controller_count++;
+
+    if (nn > NVME_MAX_NAMESPACES) nn = NVME_MAX_NAMESPACES;
+    for (uint32_t nsid = 1; nsid <= nn; nsid++) {
+        nvme_register_namespace(ctrl, nsid);
+    }
+
+    uint32_t intr_reg = pci_config_read_dword(dev->bus, dev->device, dev->function, PCI_INTERRUPT_LINE);
+    ctrl->irq = (uint8_t)(intr_reg & 0xFF);
+    if (irq_install_handler(ctrl->irq, (irq_handler_t)nvme_interrupt_handler) != 0) {
+        // without a handler on the line completions are picked up on every timer tick
+        event_t poll_event = {
+            .event_id = 0,
+            .handler = nvme_poll_event,
+            .interval = 1,
+            .target_tick = timer_get_ticks() + 1,
+            .repeat = true,
+            .active = true
+        };
+        timer_add_event(poll_event);
+        serial_printf("NVMe: IRQ %d not available, polling controller %d\n", ctrl->irq, ctrl->index);
+        return;
+    }
+    nvme_write32(ctrl, NVME_REG_INTMC, 0xFFFFFFFF);
+    serial_printf("NVMe: IRQ handler installed for IRQ %d\n", ctrl->irq);
+}
+
+static uint32_t nvme_request_units(storage_request_t* req) {
+    // a flush is one command without sectors
+    return req->op == STORAGE_OP_FLUSH ? 1 : req->count;
+}
+
+static int nvme_alloc_cid(nvme_controller_t* ctrl) {
+    for (uint16_t i = 0; i < ctrl->io.size; i++) {
+        if (!(ctrl->cid_used[i / 32] & (1u << (i % 32)))) {
+            ctrl->cid_used[i / 32] |= (1u << (i % 32));
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void nvme_free_cid(nvme_controller_t* ctrl, uint16_t cid) {
+    ctrl->cid_used[cid / 32] &= ~(1u << (cid % 32));
+    ctrl->cmd_req[cid] = NULL;
+}
+
+/**
+ * @brief Describes a buffer with PRP1/PRP2, using the command's PRP list when
+ * it spans more than two pages.
+ */
+static uint8_t nvme_build_prps(nvme_controller_t* ctrl, uint16_t cid, void* buffer, uint32_t bytes, nvme_sqe_t* cmd) {
+    uint32_t virt = (uint32_t)buffer;
+    uint32_t first = NVME_PAGE_SIZE - (virt & (NVME_PAGE_SIZE - 1));
+
+    cmd->prp1 = nvme_phys(buffer);
+    if (cmd->prp1 == 0) return 1;
+    if (bytes <= first) return 0;
+
+    virt += first;
+    bytes -= first;
+
+    if (bytes <= NVME_PAGE_SIZE) {
+        cmd->prp2 = nvme_phys((void*)virt);
+        return cmd->prp2 == 0;
+    }
+
+    uint64_t* list = prp_lists[ctrl->index][cid];
+    uint32_t n = 0;
+    while (bytes > 0) {
+        if (n == NVME_PRP_LIST_ENTRIES) return 1;
+        list[n] = nvme_phys((void*)virt);
+        if (list[n] == 0) return 1;
+        n++;
+        virt += NVME_PAGE_SIZE;
+        bytes = bytes > NVME_PAGE_SIZE ? bytes - NVME_PAGE_SIZE : 0;
+    }
+    cmd->prp2 = nvme_phys(list);
+    return 0;
+}
+
+static void nvme_ring(nvme_controller_t* ctrl) {
+    if (ctrl->io.sq_unannounced == 0) return;
+    *ctrl->io.sq_doorbell = ctrl->io.sq_tail;
+    ctrl->io.sq_unannounced = 0;
+}
+
+/**
+ * @brief Moves waiting requests into the submission queue while there is room.
+ * Large requests are split into several commands. The doorbell is left to the caller.
+ */
+static void nvme_dispatch(nvme_controller_t* ctrl) {
+    nvme_queue_t* q = &ctrl->io;
+
+    while (ctrl->wait_head) {
+        storage_request_t* req = ctrl->wait_head;
+        nvme_ns_t* ns = (nvme_ns_t*)req->disk;
+
+        uint16_t next_tail = q->sq_tail + 1 == q->size ? 0 : q->sq_tail + 1;
+        if (next_tail == q->sq_head) return; // submission queue full
+
+        int cid = nvme_alloc_cid(ctrl);
+        if (cid < 0) return;
+
+        nvme_sqe_t* cmd = &q->sq[q->sq_tail];
+        memset(cmd, 0, sizeof(nvme_sqe_t));
+        cmd->cid = (uint16_t)cid;
+        cmd->nsid = ns->nsid;
+
+        uint32_t n = 1;
+        if (req->op == STORAGE_OP_FLUSH) {
+            cmd->opcode = NVME_CMD_FLUSH;
+        } else {
+            uint64_t lba = req->lba + req->issued;
+            uint8_t* buffer = (uint8_t*)req->buffer + req->issued * 512;
+            n = req->count - req->issued;
+            if (n > ctrl->max_sectors) n = ctrl->max_sectors;
+
+            if (nvme_build_prps(ctrl, (uint16_t)cid, buffer, n * 512, cmd) != 0) {
+                serial_printf("NVMe: Cannot map buffer %x for disk %s\n", (uint32_t)buffer, req->disk->name);
+                nvme_free_cid(ctrl, (uint16_t)cid);
+                ctrl->wait_head = req->next;
+                if (!ctrl->wait_head) ctrl->wait_tail = NULL;
+                req->issued = req->count;
+                req->status = 1;
+                if (req->pending == 0) storage_complete(req, req->status);
+                continue;
+            }
+
+            cmd->opcode = req->op == STORAGE_OP_WRITE ? NVME_CMD_WRITE : NVME_CMD_READ;
+            cmd->cdw10 = (uint32_t)lba;
+            cmd->cdw11 = (uint32_t)(lba >> 32);
+            cmd->cdw12 = (n - 1) | ((req->op == STORAGE_OP_WRITE && (req->flags & STORAGE_WRITE_FUA)) ? NVME_RW_FUA : 0);
+        }
+
+        ctrl->cmd_req[cid] = req;
+        req->issued += n;
+        req->pending++;
+
+        q->sq_tail = next_tail;
+        q->sq_unannounced++;
+
+        if (req->issued >= nvme_request_units(req)) {
+            ctrl->wait_head = req->next;
+            if (!ctrl->wait_head) ctrl->wait_tail = NULL;
+        }
+    }
+}
+
+static void nvme_process_completions(nvme_controller_t* ctrl) {
+    nvme_queue_t* q = &ctrl->io;
+    bool progress = false;
+
+    while ((q->cq[q->cq_head].status & 1) == q->phase) {
+        volatile nvme_cqe_t* cqe = &q->cq[q->cq_head];
+        uint16_t cid = cqe->cid;
+        uint16_t status = cqe->status >> 1;
+        q->sq_head = cqe->sq_head;
+
+        if (++q->cq_head == q->size) {
+            q->cq_head = 0;
+            q->phase ^= 1;
+        }
+        progress = true;
+
+        if (cid >= q->size || !ctrl->cmd_req[cid]) continue;
+
+        storage_request_t* req = ctrl->cmd_req[cid];
+        nvme_free_cid(ctrl, cid);
+
+        if (status != 0) {
+            serial_printf("NVMe: Command failed on disk %s with status %x\n", req->disk->name, status);
+            req->status = 1;
+        }
+
+        req->pending--;
+        if (req->pending == 0 && req->issued >= nvme_request_units(req)) {
+            storage_complete(req, req->status);
+        }
+    }
+
+    if (!progress) return;
+
+    // one doorbell write for the whole batch of completions
+    *q->cq_doorbell = q->cq_head;
+
+    nvme_dispatch(ctrl);
+    nvme_ring(ctrl);
+}
+
+uint8_t nvme_submit(disk_t* self, storage_request_t* req) {
+    nvme_ns_t* ns = (nvme_ns_t*)self;
+    nvme_controller_t* ctrl = ns->ctrl;
+
+    req->disk = self;
+    req->next = NULL;
+    req->issued = 0;
+    req->pending = 0;
+
+    if ((req->op != STORAGE_OP_FLUSH && req->count == 0) || (req->op == STORAGE_OP_FLUSH && !ctrl->volatile_cache)) {
+        storage_complete(req, 0);
+        return 0;
+    }
+
+    // PRP entries must be dword aligned
+    if (req->op != STORAGE_OP_FLUSH && ((uint32_t)req->buffer & 3)) {
+        serial_printf("NVMe: Unaligned buffer %x for disk %s\n", (uint32_t)req->buffer, self->name);
+        return 1;
+    }
+
+    uint32_t irq_flags = cpu_irq_save();
+    if (ctrl->wait_tail) ctrl->wait_tail->next = req;
+    else ctrl->wait_head = req;
+    ctrl->wait_tail = req;
+
+    nvme_dispatch(ctrl);
+    if (!(req->flags & STORAGE_REQ_MORE)) nvme_ring(ctrl);
+    cpu_irq_restore(irq_flags);
+
+    return 0;
+}
+
+void nvme_kick(disk_t* self) {
+    nvme_controller_t* ctrl = ((nvme_ns_t*)self)->ctrl;
+    uint32_t irq_flags = cpu_irq_save();
+    nvme_ring(ctrl);
+    cpu_irq_restore(irq_flags);
+}
+
+static uint8_t nvme_request(disk_t* self, storage_op_t op, uint64_t lba, uint32_t count, void* buffer, uint32_t flags) {
+    storage_request_t req = {
+        .disk = self,
+        .op = op,
+        .lba = lba,
+        .count = count,
+        .buffer = buffer,
+        .flags = flags & ~STORAGE_REQ_MORE
+    };
+
+    uint8_t res = nvme_submit(self, &req);
+    if (res != 0) return res;
+    return storage_wait(&req);
+}
+
+uint8_t nvme_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buffer) {
+    return nvme_request(self, STORAGE_OP_READ, lba, count, buffer, 0);
+}
+
+uint8_t nvme_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
+    return nvme_request(self, STORAGE_OP_WRITE, lba, count, (void*)buffer, flags);
+}
+
+uint8_t nvme_flush(disk_t* self) {
+    return nvme_request(self, STORAGE_OP_FLUSH, 0, 0, NULL, 0);
+}
@@ -0,0 +1,176 @@
+/**
+ * @file ramdisk.c
+ * @brief Memory backed block devices
+ * @author friedrichOsDev
+ *
+ * A RAM disk is either created empty at a requested size, backed by freshly
+ * allocated pages, or exposes a boot module loaded by the bootloader. Both are
+ * mapped contiguously into the RAM disk window, so reads and writes are plain
+ * memcpys.
+ */
+
+#include <ramdisk.h>
+#include <memory.h>
+#include <string.h>
+#include <serial.h>
+#include <print.h>
+#include <convert.h>
+
+static uint8_t ramdisk_count = 0;
+static virt_addr_t next_ramdisk_vaddr = VMM_RAMDISK_BASE;
+
+static uint8_t ramdisk_read(disk_t* self, uint64_t lba, uint32_t count, void* buffer) {
+    ramdisk_t* rd = (ramdisk_t*)self;
+    if (lba + count > self->total_sectors) return 1;
+
+    memcpy(buffer, rd->data + (uint32_t)lba * RAMDISK_SECTOR_SIZE, count * RAMDISK_SECTOR_SIZE);
+    return 0;
+}
+
+static uint8_t ramdisk_write(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
+    (void)flags; // memory is as stable as it gets, FUA is a no-op
+    ramdisk_t* rd = (ramdisk_t*)self;
+    if (lba + count > self->total_sectors) return 1;
+
+    memcpy(rd->data + (uint32_t)lba * RAMDISK_SECTOR_SIZE, buffer, count * RAMDISK_SECTOR_SIZE);
+    return 0;
+}
+
+/**
+ * @brief Reserves virtual address space in the RAM disk window.
+ * @return The start of the range, or 0 if the window is exhausted.
+ */
+static virt_addr_t ramdisk_reserve(uint32_t pages) {
+    if (pages > (VMM_RAMDISK_END + 1 - next_ramdisk_vaddr) / VMM_PAGE_SIZE) {
+        serial_printf("Ramdisk: Error: Out of virtual memory space for %u pages\n", pages);
+        return 0;
+    }
+    virt_addr_t vaddr = next_ramdisk_vaddr;
+    next_ramdisk_vaddr += pages * VMM_PAGE_SIZE;
+    return vaddr;
+}
+
+static disk_t* ramdisk_register(uint8_t* data, uint32_t size, bool from_module) {
+    ramdisk_t* rd = (ramdisk_t*)kzalloc(sizeof(ramdisk_t));
+    if (!rd) return NULL;
+
+    rd->data = data;
+    rd->size = size;
+    rd->from_module = from_module;
+
+    snprintf(rd->base.name, sizeof(rd->base.name), "ram%u", ramdisk_count);
+    rd->base.total_sectors = size / RAMDISK_SECTOR_SIZE;
+    rd->base.sector_size = RAMDISK_SECTOR_SIZE;
+    rd->base.type = TYPE_RAM;
+    rd->base.read = ramdisk_read;
+    rd->base.write = ramdisk_write;
+
+    ramdisk_count++;
+    storage_register_disk(&rd->base);
+    serial_printf("Ramdisk: Registered disk %s with %u KB%s\n", rd->base.name, size / 1024, from_module ? " from boot module" : "");
+    return &rd->base;
+}
+
+/**
+ * @brief Creates an empty, zeroed RAM disk.
+ * @param size Size in bytes, rounded up to whole sectors.
+ * @return The new disk, or NULL if memory or address space ran out.
+ */
+disk_t* ramdisk_create(uint32_t size) {
+    if (size == 0 || ramdisk_count >= RAMDISK_MAX_DISKS) return NULL;
+
+    size = (size + RAMDISK_SECTOR_SIZE - 1) & ~(RAMDISK_SECTOR_SIZE - 1);
+    uint32_t pages = (size + VMM_PAGE_SIZE - 1) / VMM_PAGE_SIZE;
+
+    virt_addr_t base = ramdisk_reserve(pages);
+    if (!base) return NULL;
+
+    // the disk only has to be virtually contiguous, so the pages are allocated one by one
+    for (uint32_t i = 0; i < pages; i++) {
+        phys_addr_t phys = pmm_alloc_page();
+        if (!phys) {
+            serial_printf("Ramdisk: Error: Out of physical memory after %u of %u pages\n", i, pages);
+            for (uint32_t j = 0; j < i; j++) {
+                virt_addr_t vaddr = base + j * VMM_PAGE_SIZE;
+                pmm_free_page(vmm_virtual_to_physical(vmm_get_page_directory(), vaddr));
+                vmm_unmap_page(vmm_get_page_directory(), vaddr);
+            }
+            if (next_ramdisk_vaddr == base + pages * VMM_PAGE_SIZE) next_ramdisk_vaddr = base;
+            return NULL;
+        }
+        vmm_map_page(vmm_get_page_directory(), base + i * VMM_PAGE_SIZE, phys, VMM_PAGE_PRESENT | VMM_PAGE_READ_WRITE);
+    }
+    memset((void*)base, 0, pages * VMM_PAGE_SIZE);
+
+    return ramdisk_register((uint8_t*)base, size, false);
+}
+
+/**
+ * @brief Maps a whole boot module into the RAM disk window.
+ *
+ * The module stays where the bootloader put it, its pages are kept locked by the PMM.
+ * @param writable false maps it read only.
+ * @return The address of its first byte, or NULL if the window is exhausted.
+ */
+uint8_t* ramdisk_map_module(const boot_module_t* module, bool writable) {
+    uint32_t offset = module->phys_start & (VMM_PAGE_SIZE - 1);
+    uint32_t pages = (offset + (module->phys_end - module->phys_start) + VMM_PAGE_SIZE - 1) / VMM_PAGE_SIZE;
+
+    virt_addr_t base = ramdisk_reserve(pages);
+    if (!base) return NULL;
+
+    uint32_t flags = VMM_PAGE_PRESENT | (writable ? VMM_PAGE_READ_WRITE : 0);
+    vmm_map_pages(vmm_get_page_directory(), base, module->phys_start - offset, flags, pages);
+    return (uint8_t*)(base + offset);
+}
+
+/**
+ * @brief Exposes a boot module as a RAM disk.
+ *
+ * A trailing partial sector is not part of the disk.
+ */
+disk_t* ramdisk_create_from_module(const boot_module_t* module) {
+    if (!module || ramdisk_count >= RAMDISK_MAX_DISKS) return NULL;
+
+    uint32_t size = (module->phys_end - module->phys_start) & ~(RAMDISK_SECTOR_SIZE - 1);
+    if (size == 0) {
+        serial_printf("Ramdisk: Error: Boot module '%s' is smaller than a sector\n", module->cmdline);
+        return NULL;
+    }
+    if (size != module->phys_end - module->phys_start) {
+        serial_printf("Ramdisk: Warning: Boot module '%s' is not a multiple of %u bytes, the tail is ignored\n", module->cmdline, RAMDISK_SECTOR_SIZE);
+    }
+
+    uint8_t* data = ramdisk_map_module(module, true);
+    if (!data) return NULL;
+    return ramdisk_register(data, size, true);
+}
+
+/**
+ * @brief Returns the size requested with "ramdisk=<MB>" on the kernel command line, 0 if none.
+ */
+static uint32_t ramdisk_cmdline_size(void) {
+    const char* value = kernel_cmdline_get("ramdisk=");
+    if (!value) return 0;
+
+    uint64_t mb = str_to_u64_legacy(value);
+    if (mb > (VMM_RAMDISK_END + 1 - VMM_RAMDISK_BASE) / (1024 * 1024)) {
+        serial_printf("Ramdisk: Error: ramdisk=%llu exceeds the RAM disk window\n", mb);
+        return 0;
+    }
+    return (uint32_t)mb * 1024 * 1024;
+}
+
+/**
+ * @brief Registers a RAM disk for every disk image module and the one requested on the command line.
+ *
+ * Archive modules are mounted by initramfs.c instead.
+ */
+void ramdisk_init(void) {
+    for (uint32_t i = 0; i < kernel_modules.count; i++) {
+        if (kernel_modules.entries[i].kind == BOOT_MODULE_IMAGE) ramdisk_create_from_module(&kernel_modules.entries[i]);
+    }
+
+    uint32_t size = ramdisk_cmdline_size();
+    if (size) ramdisk_create(size);
+}
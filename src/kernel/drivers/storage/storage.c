@@ -9,6 +9,10 @@
 #include <kernel.h>
 #include <console.h>
 #include <print.h>
+#include <bcache.h>
+#include <string.h>
+#include <cpu.h>
+#include <iostat.h>
 
 static disk_t* disks[MAX_DISKS];
 uint8_t disk_count = 0;
@@ -17,6 +21,7 @@ void storage_init() {
     for (uint8_t i = 0; i < MAX_DISKS; i++) {
         disks[i] = NULL;
     }
+    bcache_init();
     init_state = INIT_STORAGE;
 }
 
@@ -27,10 +32,19 @@ disk_t* storage_get_disk(uint8_t index) {
     return disks[index];
 }
 
-void storage_register_disk(disk_t* disk) {
-    if (disk_count < MAX_DISKS) {
-        disks[disk_count++] = disk;
+/**
+ * @brief Adds a disk to the disk table.
+ * @return 0 on success, 1 if the table is full.
+ */
+uint8_t storage_register_disk(disk_t* disk) {
+    if (disk_count >= MAX_DISKS) {
+        serial_printf("Storage: Error: Cannot register disk %s, all %u slots are taken\n", disk->name, MAX_DISKS);
+        return 1;
     }
+    memset(&disk->cache, 0, sizeof(disk->cache));
+    memset(&disk->stats, 0, sizeof(disk->stats));
+    disks[disk_count++] = disk;
+    return 0;
 }
 
 uint8_t storage_get_disk_count() {
@@ -45,10 +59,17 @@ uint8_t storage_read(disk_t* disk, uint64_t lba, uint32_t count, void* buffer) {
         return 2; 
     }
     
-    return disk->read(disk, lba, count, buffer);
+    uint64_t start = iostat_start(disk);
+    uint8_t res = bcache_read(disk, lba, count, buffer);
+    iostat_done(disk, STORAGE_OP_READ, count, start, res);
+    return res;
 }
 
 uint8_t storage_write(disk_t* disk, uint64_t lba, uint32_t count, const void* buffer) {
+    return storage_write_flags(disk, lba, count, buffer, 0);
+}
+
+uint8_t storage_write_flags(disk_t* disk, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
     if (!disk || !disk->write) {
         serial_printf("Storage: Error: No disk or write function provided.\n");
         return 1;
@@ -59,7 +80,147 @@ uint8_t storage_write(disk_t* disk, uint64_t lba, uint32_t count, const void* bu
         return 2; 
     }
     
-    return disk->write(disk, lba, count, buffer);
+    uint64_t start = iostat_start(disk);
+    uint8_t res = bcache_write(disk, lba, count, buffer, flags);
+    iostat_done(disk, STORAGE_OP_WRITE, count, start, res);
+    return res;
+}
+
+/**
+ * @brief Write barrier for one disk: writes back its cached blocks and
+ * commits the device write cache.
+ */
+uint8_t storage_flush(disk_t* disk) {
+    if (!disk) return 1;
+
+    uint8_t res = bcache_sync(disk);
+    if (res != 0) return res;
+
+    if (!disk->flush) return 0;
+
+    uint64_t start = iostat_start(disk);
+    res = disk->flush(disk);
+    iostat_done(disk, STORAGE_OP_FLUSH, 0, start, res);
+    return res;
+}
+
+uint8_t storage_sync() {
+    uint8_t res = 0;
+    for (uint8_t i = 0; i < disk_count; i++) {
+        uint8_t err = storage_flush(disks[i]);
+        if (err != 0) {
+            serial_printf("Storage: Error: Sync of disk %s failed with error %u\n", disks[i]->name, err);
+            res = err;
+        }
+    }
+    return res;
+}
+
+/**
+ * @brief Queues a request on the device, bypassing the block cache.
+ *
+ * Requests on disks without a submit callback are carried out synchronously
+ * before this returns. The caller must not access the same blocks through the
+ * cache while the request is in flight.
+ * @return 0 if the request was accepted; its result is reported through req->status.
+ */
+uint8_t storage_submit(disk_t* disk, storage_request_t* req) {
+    if (!disk || !req) return 1;
+
+    req->disk = disk;
+    req->done = false;
+    req->status = 0;
+    req->next = NULL;
+
+    if (req->op != STORAGE_OP_FLUSH && req->lba + req->count > disk->total_sectors) {
+        serial_printf("Storage: Error: Out of bounds request at LBA %llu\n", req->lba);
+        return 2;
+    }
+
+    req->start_ns = iostat_start(disk);
+    req->accounted = true;
+
+    if (disk->submit) {
+        uint8_t res = disk->submit(disk, req);
+        if (res != 0 && req->accounted) {
+            req->accounted = false;
+            iostat_done(disk, req->op, 0, req->start_ns, res);
+        }
+        return res;
+    }
+
+    uint8_t res = 0;
+    switch (req->op) {
+        case STORAGE_OP_READ:
+            res = disk->read ? disk->read(disk, req->lba, req->count, req->buffer) : 1;
+            break;
+        case STORAGE_OP_WRITE:
+            res = disk->write ? disk->write(disk, req->lba, req->count, req->buffer, req->flags) : 1;
+            break;
+        case STORAGE_OP_FLUSH:
+            res = disk->flush ? disk->flush(disk) : 0;
+            break;
+    }
+    storage_complete(req, res);
+    return 0;
+}
+
+/**
+ * @brief Notifies the device of requests submitted with STORAGE_REQ_MORE.
+ *
+ * A batch normally ends with a request without the flag. Submitters whose
+ * batch ends early, because a later storage_submit() failed, must call this
+ * so the requests already queued do not wait forever.
+ */
+void storage_kick(disk_t* disk) {
+    if (disk && disk->kick) disk->kick(disk);
+}
+
+/**
+ * @brief Sleeps until the request is done.
+ * @note Must be called with interrupts enabled.
+ * @return The status of the request.
+ */
+uint8_t storage_wait(storage_request_t* req) {
+    while (1) {
+        // checking and halting with interrupts off means the completion cannot slip in between
+        uint32_t irq_flags = cpu_irq_save();
+        if (req->done) {
+            cpu_irq_restore(irq_flags);
+            break;
+        }
+        cpu_sti_hlt();
+    }
+    return req->status;
+}
+
+/**
+ * @brief Called by drivers when a request has finished.
+ */
+void storage_complete(storage_request_t* req, uint8_t status) {
+    // requests drivers build for themselves never went through storage_submit()
+    if (req->accounted) {
+        req->accounted = false;
+        iostat_done(req->disk, req->op, req->op == STORAGE_OP_FLUSH ? 0 : req->count, req->start_ns, status);
+    }
+
+    req->status = status;
+    req->done = true;
+    if (req->complete) req->complete(req);
+}
+
+static const char* storage_type_name(disk_type_t type) {
+    switch (type) {
+        case TYPE_ATA: return "ATA";
+        case TYPE_AHCI: return "AHCI";
+        case TYPE_NVME: return "NVMe";
+        case TYPE_VIRTIO: return "virtio";
+        case TYPE_RAM: return "RAM";
+        case TYPE_MD: return "md";
+        case TYPE_PARTITION: return "Partition";
+        case TYPE_ZRAM: return "zram";
+        default: return "Unknown";
+    }
 }
 
 void storage_dump_disk(disk_t* disk) {
@@ -71,7 +232,7 @@ void storage_dump_disk(disk_t* disk) {
     char buf[128];
     snprintf(buf, sizeof(buf), "  Name:           %s\n", disk->name);
     for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
-    snprintf(buf, sizeof(buf), "  Type:           %s\n", disk->type == TYPE_ATA ? "ATA" : (disk->type == TYPE_AHCI ? "AHCI" : "Unknown"));
+    snprintf(buf, sizeof(buf), "  Type:           %s\n", storage_type_name(disk->type));
     for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
     snprintf(buf, sizeof(buf), "  Total Sectors:  %llu\n", disk->total_sectors);
     for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
@@ -79,8 +240,16 @@ void storage_dump_disk(disk_t* disk) {
     for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
     snprintf(buf, sizeof(buf), "  Capacity:       %llu MB\n", (disk->total_sectors * disk->sector_size) / (1024 * 1024));
     for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
-    snprintf(buf, sizeof(buf), "  Capabilities:   %s%s\n", disk->read ? "READ " : "", disk->write ? "WRITE" : "");
+    snprintf(buf, sizeof(buf), "  Capabilities:   %s%s%s%s\n", disk->read ? "READ " : "", disk->write ? "WRITE " : "", disk->flush ? "FLUSH " : "", disk->submit ? "ASYNC" : "");
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    if (bcache_is_cacheable(disk)) {
+        snprintf(buf, sizeof(buf), "  Cache:          %llu hits, %llu misses, read-ahead %u sectors\n", disk->cache.hits, disk->cache.misses, disk->cache.readahead_window);
+    } else {
+        snprintf(buf, sizeof(buf), "  Cache:          bypassed\n");
+    }
     for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+
+    if (disk->dump) disk->dump(disk);
 }
 
 void storage_dump_info() {
@@ -95,4 +264,6 @@ void storage_dump_info() {
         storage_dump_disk(disks[i]);
         console_putc(U'\n');
     }
+
+    bcache_dump_info();
 }
\ No newline at end of file
@@ -0,0 +1,416 @@
+/**
+ * @file virtio_blk.c
+ * @author friedrichOsDev
+ */
+
+#include <virtio_blk.h>
+#include <io.h>
+#include <serial.h>
+#include <memory.h>
+#include <handler.h>
+#include <string.h>
+#include <print.h>
+#include <cpu.h>
+#include <timer.h>
+
+static virtio_blk_t* devices[VIRTIO_BLK_MAX_DEVICES];
+static uint8_t device_count = 0;
+
+static uint8_t vq_memory[VIRTIO_BLK_MAX_DEVICES][VIRTIO_VQ_MAX_BYTES] __attribute__((aligned(4096)));
+static virtq_desc_t indirect_tables[VIRTIO_BLK_MAX_DEVICES][VIRTIO_BLK_MAX_SLOTS][VIRTIO_BLK_INDIRECT_ENTRIES] __attribute__((aligned(1024)));
+static virtio_blk_req_hdr_t headers[VIRTIO_BLK_MAX_DEVICES][VIRTIO_BLK_MAX_SLOTS] __attribute__((aligned(16)));
+static uint8_t statuses[VIRTIO_BLK_MAX_DEVICES][VIRTIO_BLK_MAX_SLOTS];
+
+// orders the ring updates against the device's view, including store-load
+static inline void virtio_mb() {
+    __asm__ __volatile__ ("lock; addl $0, (%%esp)" ::: "memory");
+}
+
+static uint64_t virtio_phys(const void* ptr) {
+    return vmm_virtual_to_physical(vmm_get_page_directory(), (virt_addr_t)ptr);
+}
+
+static volatile uint16_t* virtio_used_event(virtio_blk_t* dev) {
+    return &dev->avail->ring[dev->queue_size];
+}
+
+static volatile uint16_t* virtio_avail_event(virtio_blk_t* dev) {
+    return (volatile uint16_t*)&dev->used->ring[dev->queue_size];
+}
+
+static void virtio_blk_process_used(virtio_blk_t* dev);
+static void virtio_blk_dispatch(virtio_blk_t* dev);
+static void virtio_blk_kick(virtio_blk_t* dev);
+
+static void virtio_blk_interrupt_handler(struct registers* regs) {
+    (void)regs;
+    for (uint8_t i = 0; i < device_count; i++) {
+        // reading the ISR status acknowledges the interrupt
+        if (inb(devices[i]->io_base + VIRTIO_REG_ISR_STATUS) & 1) {
+            virtio_blk_process_used(devices[i]);
+        }
+    }
+}
+
+// used when the IRQ line has no free handler slot, the ring tells whether there is anything new
+static void virtio_blk_poll_event(void) {
+    for (uint8_t i = 0; i < device_count; i++) {
+        inb(devices[i]->io_base + VIRTIO_REG_ISR_STATUS);
+        virtio_blk_process_used(devices[i]);
+    }
+}
+
+void virtio_blk_init_device(pci_device_t* dev) {
+    serial_printf("Initializing virtio-blk device at bus %d, device %d, function %d\n", dev->bus, dev->device, dev->function);
+
+    if (device_count >= VIRTIO_BLK_MAX_DEVICES) {
+        serial_printf("virtio-blk: Too many devices, ignoring this one\n");
+        return;
+    }
+
+    pci_bar_t bar0 = pci_get_bar(dev->bus, dev->device, dev->function, 0);
+    if (bar0.base_address == 0 || bar0.type != PCI_BAR_IO) {
+        serial_printf("virtio-blk: Invalid BAR0, only the legacy interface is supported\n");
+        return;
+    }
+
+    // Enable I/O space decoding and bus mastering
+    uint32_t command = pci_config_read_dword(dev->bus, dev->device, dev->function, PCI_COMMAND);
+    command |= (1 << 0) | (1 << 2);
+    pci_config_write_dword(dev->bus, dev->device, dev->function, PCI_COMMAND, command);
+
+    uint16_t io = (uint16_t)bar0.base_address;
+
+    outb(io + VIRTIO_REG_DEVICE_STATUS, 0); // reset
+    outb(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    uint32_t features = inl(io + VIRTIO_REG_DEVICE_FEATURES);
+    if (!(features & VIRTIO_RING_F_INDIRECT_DESC)) {
+        serial_printf("virtio-blk: Device lacks indirect descriptors\n");
+        outb(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return;
+    }
+    features &= VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_RING_F_EVENT_IDX | VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_RO;
+    outl(io + VIRTIO_REG_GUEST_FEATURES, features);
+
+    outw(io + VIRTIO_REG_QUEUE_SELECT, 0);
+    uint16_t queue_size = inw(io + VIRTIO_REG_QUEUE_SIZE);
+    if (queue_size == 0 || queue_size > VIRTIO_MAX_QUEUE_SIZE || (queue_size & (queue_size - 1))) {
+        serial_printf("virtio-blk: Unsupported queue size %u\n", queue_size);
+        outb(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return;
+    }
+
+    uint8_t index = device_count;
+    virtio_blk_t* blk = (virtio_blk_t*)kzalloc(sizeof(virtio_blk_t));
+    blk->io_base = io;
+    blk->index = index;
+    blk->event_idx = (features & VIRTIO_RING_F_EVENT_IDX) != 0;
+    blk->flush = (features & VIRTIO_BLK_F_FLUSH) != 0;
+    blk->queue_size = queue_size;
+    blk->slots = queue_size < VIRTIO_BLK_MAX_SLOTS ? queue_size : VIRTIO_BLK_MAX_SLOTS;
+
+    // legacy layout: descriptors, avail ring, then the used ring on the next page
+    uint8_t* mem = vq_memory[index];
+    memset(mem, 0, VIRTIO_VQ_MAX_BYTES);
+    uint32_t used_offset = (16 * queue_size + 6 + 2 * queue_size + 4095) & ~4095u;
+    blk->desc = (volatile virtq_desc_t*)mem;
+    blk->avail = (volatile virtq_avail_t*)(mem + 16 * queue_size);
+    blk->used = (volatile virtq_used_t*)(mem + used_offset);
+    outl(io + VIRTIO_REG_QUEUE_PFN, (uint32_t)(virtio_phys(mem) >> 12));
+
+    uint64_t capacity = inl(io + VIRTIO_REG_DEVICE_CONFIG) | ((uint64_t)inl(io + VIRTIO_REG_DEVICE_CONFIG + 4) << 32);
+
+    snprintf(blk->base.name, sizeof(blk->base.name), "vd%c", 'a' + index);
+    blk->base.total_sectors = capacity;
+    blk->base.sector_size = 512;
+    blk->base.type = TYPE_VIRTIO;
+    blk->base.read = virtio_blk_read_sectors;
+    blk->base.write = (features & VIRTIO_BLK_F_RO) ? NULL : virtio_blk_write_sectors;
+    blk->base.flush = blk->flush ? virtio_blk_flush : NULL;
+    blk->base.submit = virtio_blk_submit;
+    blk->base.kick = virtio_blk_kick_disk;
+
+    devices[device_count++] = blk;
+
+    uint32_t intr_reg = pci_config_read_dword(dev->bus, dev->device, dev->function, PCI_INTERRUPT_LINE);
+    blk->irq = (uint8_t)(intr_reg & 0xFF);
+    if (irq_install_handler(blk->irq, (irq_handler_t)virtio_blk_interrupt_handler) != 0) {
+        // the PCI interrupt disable bit keeps the unhandled line quiet, completions are picked up on every timer tick
+        pci_config_write_dword(dev->bus, dev->device, dev->function, PCI_COMMAND, command | (1 << 10));
+        event_t poll_event = {
+            .event_id = 0,
+            .handler = virtio_blk_poll_event,
+            .interval = 1,
+            .target_tick = timer_get_ticks() + 1,
+            .repeat = true,
+            .active = true
+        };
+        timer_add_event(poll_event);
+        serial_printf("virtio-blk: IRQ %d not available, polling %s\n", blk->irq, blk->base.name);
+    }
+
+    outb(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    storage_register_disk(&blk->base);
+    serial_printf("virtio-blk: Registered disk %s with %llu sectors (queue %u%s%s)\n", blk->base.name, capacity, queue_size,
+                  blk->event_idx ? ", event idx" : "", blk->flush ? ", flush" : "");
+}
+
+static bool virtio_blk_needs_flush(virtio_blk_t* dev, storage_request_t* req) {
+    return req->op == STORAGE_OP_WRITE && (req->flags & STORAGE_WRITE_FUA) && dev->flush;
+}
+
+// sectors of a request, a FUA write is followed by one flush command and a flush request is one command
+static uint32_t virtio_blk_request_units(virtio_blk_t* dev, storage_request_t* req) {
+    if (req->op == STORAGE_OP_FLUSH) return 1;
+    return req->count + (virtio_blk_needs_flush(dev, req) ? 1 : 0);
+}
+
+static int virtio_blk_alloc_slot(virtio_blk_t* dev) {
+    for (uint16_t i = 0; i < dev->slots; i++) {
+        if (!(dev->slot_used & (1u << i))) {
+            dev->slot_used |= (1u << i);
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Fills the indirect table of a slot: header, data segments, status.
+ * @return Number of descriptors used, 0 if the buffer does not fit.
+ */
+static uint32_t virtio_blk_build_table(virtio_blk_t* dev, uint16_t slot, uint32_t type, uint64_t sector, void* buffer, uint32_t bytes) {
+    virtq_desc_t* table = indirect_tables[dev->index][slot];
+    virtio_blk_req_hdr_t* hdr = &headers[dev->index][slot];
+    uint8_t* status = &statuses[dev->index][slot];
+    uint16_t data_flags = type == VIRTIO_BLK_T_IN ? VIRTQ_DESC_F_WRITE : 0;
+    uint32_t n = 0;
+
+    hdr->type = type;
+    hdr->reserved = 0;
+    hdr->sector = sector;
+    *status = 0xFF;
+
+    table[n].addr = virtio_phys(hdr);
+    table[n].len = sizeof(virtio_blk_req_hdr_t);
+    table[n].flags = VIRTQ_DESC_F_NEXT;
+    table[n].next = (uint16_t)(n + 1);
+    n++;
+
+    // one segment per physically contiguous run of pages
+    uint32_t virt = (uint32_t)buffer;
+    while (bytes > 0) {
+        uint32_t chunk = VMM_PAGE_SIZE - (virt & (VMM_PAGE_SIZE - 1));
+        if (chunk > bytes) chunk = bytes;
+
+        uint64_t phys = virtio_phys((void*)virt);
+        if (phys == 0) return 0;
+
+        if (n > 1 && table[n - 1].addr + table[n - 1].len == phys) {
+            table[n - 1].len += chunk;
+        } else {
+            if (n >= VIRTIO_BLK_INDIRECT_ENTRIES - 1) return 0;
+            table[n].addr = phys;
+            table[n].len = chunk;
+            table[n].flags = VIRTQ_DESC_F_NEXT | data_flags;
+            table[n].next = (uint16_t)(n + 1);
+            n++;
+        }
+
+        virt += chunk;
+        bytes -= chunk;
+    }
+
+    table[n].addr = virtio_phys(status);
+    table[n].len = 1;
+    table[n].flags = VIRTQ_DESC_F_WRITE;
+    table[n].next = 0;
+    n++;
+
+    return n;
+}
+
+static void virtio_blk_pop_wait(virtio_blk_t* dev) {
+    dev->wait_head = dev->wait_head->next;
+    if (!dev->wait_head) dev->wait_tail = NULL;
+}
+
+/**
+ * @brief Moves waiting requests into the avail ring while slots are free.
+ * The device is not notified here, see virtio_blk_kick().
+ */
+static void virtio_blk_dispatch(virtio_blk_t* dev) {
+    while (dev->wait_head) {
+        storage_request_t* req = dev->wait_head;
+
+        int slot = virtio_blk_alloc_slot(dev);
+        if (slot < 0) return;
+
+        uint32_t n = 1;
+        uint32_t descs;
+        if (req->op == STORAGE_OP_FLUSH || req->issued == req->count) {
+            descs = virtio_blk_build_table(dev, (uint16_t)slot, VIRTIO_BLK_T_FLUSH, 0, NULL, 0);
+        } else {
+            n = req->count - req->issued;
+            if (n > VIRTIO_BLK_MAX_SECTORS) n = VIRTIO_BLK_MAX_SECTORS;
+            uint8_t* buffer = (uint8_t*)req->buffer + req->issued * 512;
+            uint32_t type = req->op == STORAGE_OP_WRITE ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+            descs = virtio_blk_build_table(dev, (uint16_t)slot, type, req->lba + req->issued, buffer, n * 512);
+        }
+
+        if (descs == 0) {
+            serial_printf("virtio-blk: Cannot map buffer %x for disk %s\n", (uint32_t)req->buffer, dev->base.name);
+            dev->slot_used &= ~(1u << slot);
+            virtio_blk_pop_wait(dev);
+            req->issued = virtio_blk_request_units(dev, req);
+            req->status = 1;
+            if (req->pending == 0) storage_complete(req, req->status);
+            continue;
+        }
+
+        dev->slot_req[slot] = req;
+        req->issued += n;
+        req->pending++;
+
+        // the ring descriptor of a slot always points at the slot's indirect table
+        dev->desc[slot].addr = virtio_phys(indirect_tables[dev->index][slot]);
+        dev->desc[slot].len = descs * sizeof(virtq_desc_t);
+        dev->desc[slot].flags = VIRTQ_DESC_F_INDIRECT;
+        dev->desc[slot].next = 0;
+
+        dev->avail->ring[dev->avail_idx & (dev->queue_size - 1)] = (uint16_t)slot;
+        dev->avail_idx++;
+
+        // the flush after a FUA write waits until all data commands are done
+        if (req->issued >= req->count || req->op == STORAGE_OP_FLUSH) virtio_blk_pop_wait(dev);
+    }
+}
+
+/**
+ * @brief Publishes new avail entries and notifies the device if it asked for it.
+ */
+static void virtio_blk_kick(virtio_blk_t* dev) {
+    uint16_t old_idx = dev->kicked_idx;
+    uint16_t new_idx = dev->avail_idx;
+    if (old_idx == new_idx) return;
+
+    virtio_mb();
+    dev->avail->idx = new_idx;
+    dev->kicked_idx = new_idx;
+    virtio_mb();
+
+    bool notify;
+    if (dev->event_idx) {
+        uint16_t event = *virtio_avail_event(dev);
+        notify = (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+    } else {
+        notify = !(dev->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+
+    if (notify) outw(dev->io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+}
+
+static void virtio_blk_process_used(virtio_blk_t* dev) {
+    while (1) {
+        while (dev->last_used != dev->used->idx) {
+            virtio_mb();
+            volatile virtq_used_elem_t* elem = &dev->used->ring[dev->last_used & (dev->queue_size - 1)];
+            uint32_t slot = elem->id;
+            dev->last_used++;
+
+            if (slot >= dev->slots || !dev->slot_req[slot]) continue;
+
+            storage_request_t* req = dev->slot_req[slot];
+            dev->slot_req[slot] = NULL;
+            dev->slot_used &= ~(1u << slot);
+
+            if (statuses[dev->index][slot] != VIRTIO_BLK_S_OK) {
+                serial_printf("virtio-blk: Request failed on disk %s with status %u\n", dev->base.name, statuses[dev->index][slot]);
+                req->status = 1;
+            }
+
+            req->pending--;
+            if (req->pending != 0) continue;
+
+            if (req->issued < virtio_blk_request_units(dev, req) && req->status == 0) {
+                // all data of a FUA write is done, queue its flush in front
+                req->next = dev->wait_head;
+                dev->wait_head = req;
+                if (!dev->wait_tail) dev->wait_tail = req;
+            } else {
+                storage_complete(req, req->status);
+            }
+        }
+
+        if (!dev->event_idx) break;
+
+        // ask for an interrupt at the next completion, then catch any that raced with it
+        *virtio_used_event(dev) = dev->last_used;
+        virtio_mb();
+        if (dev->last_used == dev->used->idx) break;
+    }
+
+    virtio_blk_dispatch(dev);
+    virtio_blk_kick(dev);
+}
+
+uint8_t virtio_blk_submit(disk_t* self, storage_request_t* req) {
+    virtio_blk_t* dev = (virtio_blk_t*)self;
+
+    req->disk = self;
+    req->next = NULL;
+    req->issued = 0;
+    req->pending = 0;
+
+    if ((req->op != STORAGE_OP_FLUSH && req->count == 0) || (req->op == STORAGE_OP_FLUSH && !dev->flush)) {
+        storage_complete(req, 0);
+        return 0;
+    }
+
+    uint32_t irq_flags = cpu_irq_save();
+    if (dev->wait_tail) dev->wait_tail->next = req;
+    else dev->wait_head = req;
+    dev->wait_tail = req;
+
+    virtio_blk_dispatch(dev);
+    if (!(req->flags & STORAGE_REQ_MORE)) virtio_blk_kick(dev);
+    cpu_irq_restore(irq_flags);
+
+    return 0;
+}
+
+void virtio_blk_kick_disk(disk_t* self) {
+    uint32_t irq_flags = cpu_irq_save();
+    virtio_blk_kick((virtio_blk_t*)self);
+    cpu_irq_restore(irq_flags);
+}
+
+static uint8_t virtio_blk_request(disk_t* self, storage_op_t op, uint64_t lba, uint32_t count, void* buffer, uint32_t flags) {
+    storage_request_t req = {
+        .disk = self,
+        .op = op,
+        .lba = lba,
+        .count = count,
+        .buffer = buffer,
+        .flags = flags & ~STORAGE_REQ_MORE
+    };
+
+    uint8_t res = virtio_blk_submit(self, &req);
+    if (res != 0) return res;
+    return storage_wait(&req);
+}
+
+uint8_t virtio_blk_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buffer) {
+    return virtio_blk_request(self, STORAGE_OP_READ, lba, count, buffer, 0);
+}
+
+uint8_t virtio_blk_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
+    return virtio_blk_request(self, STORAGE_OP_WRITE, lba, count, (void*)buffer, flags);
+}
+
+uint8_t virtio_blk_flush(disk_t* self) {
+    return virtio_blk_request(self, STORAGE_OP_FLUSH, 0, 0, NULL, 0);
+}
@@ -0,0 +1,234 @@
+/**
+ * @file zram.c
+ * @brief Compressed RAM disks
+ * @author friedrichOsDev
+ *
+ * A zram disk keeps every 4 KB page LZ4-compressed in its own heap object.
+ * Pages made of one repeated word (zeroed pages, mostly) take no memory at
+ * all, and pages that barely compress are stored raw so reading them back
+ * costs a memcpy. Memory is only used for pages that were written, so a zram
+ * disk can be far larger than the memory it ends up taking.
+ */
+
+#include <zram.h>
+#include <lz4.h>
+#include <memory.h>
+#include <string.h>
+#include <serial.h>
+#include <console.h>
+#include <print.h>
+#include <convert.h>
+#include <kernel.h>
+
+static uint8_t zram_count = 0;
+
+// shared by all zram disks, their callbacks never run concurrently
+static uint8_t page_buffer[ZRAM_PAGE_SIZE] __attribute__((aligned(4)));
+static uint8_t compress_buffer[ZRAM_PAGE_SIZE];
+
+/**
+ * @brief Checks whether a page consists of a single repeated word.
+ */
+static bool zram_page_same_filled(const uint8_t* page, uint32_t* fill) {
+    const uint32_t* words = (const uint32_t*)page;
+    for (uint32_t i = 1; i < ZRAM_PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != words[0]) return false;
+    }
+    *fill = words[0];
+    return true;
+}
+
+static void zram_free_page(zram_t* zram, uint32_t index) {
+    zram_entry_t* entry = &zram->table[index];
+
+    if (entry->flags & ZRAM_FLAG_SAME) {
+        zram->same_pages--;
+    } else if (entry->data) {
+        kfree((virt_addr_t)entry->data);
+        zram->stored_pages--;
+        zram->compressed_bytes -= entry->size;
+        if (entry->flags & ZRAM_FLAG_HUGE) zram->huge_pages--;
+    }
+    memset(entry, 0, sizeof(zram_entry_t));
+}
+
+static uint8_t zram_load_page(zram_t* zram, uint32_t index, uint8_t* page) {
+    zram_entry_t* entry = &zram->table[index];
+
+    if (entry->flags & ZRAM_FLAG_SAME) {
+        memset32(page, entry->fill, ZRAM_PAGE_SIZE / sizeof(uint32_t));
+    } else if (!entry->data) {
+        memset32(page, 0, ZRAM_PAGE_SIZE / sizeof(uint32_t));
+    } else if (entry->flags & ZRAM_FLAG_HUGE) {
+        memcpy(page, entry->data, ZRAM_PAGE_SIZE);
+    } else if (lz4_decompress(entry->data, entry->size, page, ZRAM_PAGE_SIZE) != ZRAM_PAGE_SIZE) {
+        serial_printf("ZRAM: Error: Page %u of %s is corrupted\n", index, zram->base.name);
+        return 1;
+    }
+    return 0;
+}
+
+static uint8_t zram_store_page(zram_t* zram, uint32_t index, const uint8_t* page) {
+    uint32_t fill;
+    if (zram_page_same_filled(page, &fill)) {
+        zram_free_page(zram, index);
+        zram->table[index].fill = fill;
+        zram->table[index].flags = ZRAM_FLAG_SAME;
+        zram->same_pages++;
+        return 0;
+    }
+
+    uint32_t size = lz4_compress(page, ZRAM_PAGE_SIZE, compress_buffer, ZRAM_HUGE_THRESHOLD);
+    bool huge = size == 0;
+    if (huge) size = ZRAM_PAGE_SIZE;
+
+    // allocated before the old copy is dropped, so a failed write leaves the page intact
+    uint8_t* data = (uint8_t*)kmalloc(size);
+    if (!data) {
+        serial_printf("ZRAM: Error: Out of memory storing page %u of %s\n", index, zram->base.name);
+        return 1;
+    }
+    memcpy(data, huge ? page : compress_buffer, size);
+
+    zram_free_page(zram, index);
+    zram_entry_t* entry = &zram->table[index];
+    entry->data = data;
+    entry->size = (uint16_t)size;
+    entry->flags = huge ? ZRAM_FLAG_HUGE : 0;
+    zram->stored_pages++;
+    zram->compressed_bytes += size;
+    if (huge) zram->huge_pages++;
+    return 0;
+}
+
+static uint8_t zram_read(disk_t* self, uint64_t lba, uint32_t count, void* buffer) {
+    zram_t* zram = (zram_t*)self;
+    if (lba + count > self->total_sectors) return 1;
+
+    uint8_t* out = (uint8_t*)buffer;
+    uint32_t sector = (uint32_t)lba;
+    while (count > 0) {
+        uint32_t index = sector / ZRAM_SECTORS_PER_PAGE;
+        uint32_t offset = sector % ZRAM_SECTORS_PER_PAGE;
+        uint32_t length = ZRAM_SECTORS_PER_PAGE - offset;
+        if (length > count) length = count;
+
+        if (length == ZRAM_SECTORS_PER_PAGE) {
+            if (zram_load_page(zram, index, out) != 0) return 1;
+        } else {
+            if (zram_load_page(zram, index, page_buffer) != 0) return 1;
+            memcpy(out, page_buffer + offset * ZRAM_SECTOR_SIZE, length * ZRAM_SECTOR_SIZE);
+        }
+
+        out += length * ZRAM_SECTOR_SIZE;
+        sector += length;
+        count -= length;
+    }
+    return 0;
+}
+
+static uint8_t zram_write(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
+    (void)flags; // there is no volatile cache, FUA is a no-op
+    zram_t* zram = (zram_t*)self;
+    if (lba + count > self->total_sectors) return 1;
+
+    const uint8_t* in = (const uint8_t*)buffer;
+    uint32_t sector = (uint32_t)lba;
+    while (count > 0) {
+        uint32_t index = sector / ZRAM_SECTORS_PER_PAGE;
+        uint32_t offset = sector % ZRAM_SECTORS_PER_PAGE;
+        uint32_t length = ZRAM_SECTORS_PER_PAGE - offset;
+        if (length > count) length = count;
+
+        if (length == ZRAM_SECTORS_PER_PAGE) {
+            if (zram_store_page(zram, index, in) != 0) return 1;
+        } else {
+            // partial pages are read, modified and compressed again
+            if (zram_load_page(zram, index, page_buffer) != 0) return 1;
+            memcpy(page_buffer + offset * ZRAM_SECTOR_SIZE, in, length * ZRAM_SECTOR_SIZE);
+            if (zram_store_page(zram, index, page_buffer) != 0) return 1;
+        }
+
+        in += length * ZRAM_SECTOR_SIZE;
+        sector += length;
+        count -= length;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints the compression statistics, called by storage_dump_disk().
+ */
+static void zram_dump(disk_t* self) {
+    zram_t* zram = (zram_t*)self;
+
+    // the heap puts a header in front of every object
+    uint32_t mem_used = zram->compressed_bytes + zram->stored_pages * sizeof(heap_block_t) + zram->page_count * sizeof(zram_entry_t);
+    uint32_t data_kb = (zram->stored_pages + zram->same_pages) * (ZRAM_PAGE_SIZE / 1024);
+
+    uint64_t ratio = (uint64_t)data_kb * 1024 * 100;
+    div64_32(&ratio, mem_used ? mem_used : 1);
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "  Pages:          %u stored, %u same-filled, %u incompressible\n", zram->stored_pages, zram->same_pages, zram->huge_pages);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Memory Used:    %u KB for %u KB of data (%u KB compressed)\n", mem_used / 1024, data_kb, zram->compressed_bytes / 1024);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "  Ratio:          %u.%02u\n", (uint32_t)ratio / 100, (uint32_t)ratio % 100);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+}
+
+/**
+ * @brief Creates an empty zram disk.
+ * @param size Size in bytes, rounded up to whole pages.
+ * @return The new disk, or NULL if the page table could not be allocated.
+ * @note Memory is allocated as pages are written, a full disk can still fail writes.
+ */
+disk_t* zram_create(uint32_t size) {
+    if (size == 0 || zram_count >= ZRAM_MAX_DISKS) return NULL;
+    if (size / (1024 * 1024) > ZRAM_MAX_SIZE_MB) {
+        serial_printf("ZRAM: Error: %u MB exceeds the maximum of %u MB\n", size / (1024 * 1024), ZRAM_MAX_SIZE_MB);
+        return NULL;
+    }
+
+    uint32_t page_count = (size + ZRAM_PAGE_SIZE - 1) / ZRAM_PAGE_SIZE;
+
+    zram_t* zram = (zram_t*)kzalloc(sizeof(zram_t));
+    if (!zram) return NULL;
+    zram->table = (zram_entry_t*)kzalloc(page_count * sizeof(zram_entry_t));
+    if (!zram->table) {
+        serial_printf("ZRAM: Error: Out of memory for the table of %u pages\n", page_count);
+        kfree((virt_addr_t)zram);
+        return NULL;
+    }
+    zram->page_count = page_count;
+
+    snprintf(zram->base.name, sizeof(zram->base.name), "zram%u", zram_count);
+    zram->base.total_sectors = (uint64_t)page_count * ZRAM_SECTORS_PER_PAGE;
+    zram->base.sector_size = ZRAM_SECTOR_SIZE;
+    zram->base.type = TYPE_ZRAM;
+    zram->base.flags = DISK_FLAG_NOCACHE; // caching would keep a second, uncompressed copy
+    zram->base.read = zram_read;
+    zram->base.write = zram_write;
+    zram->base.dump = zram_dump;
+
+    zram_count++;
+    storage_register_disk(&zram->base);
+    serial_printf("ZRAM: Registered disk %s with %u KB\n", zram->base.name, page_count * (ZRAM_PAGE_SIZE / 1024));
+    return &zram->base;
+}
+
+/**
+ * @brief Registers the zram disk requested with "zram=<MB>" on the kernel command line.
+ */
+void zram_init(void) {
+    const char* value = kernel_cmdline_get("zram=");
+    if (!value) return;
+
+    uint64_t mb = str_to_u64_legacy(value);
+    if (mb == 0 || mb > ZRAM_MAX_SIZE_MB) {
+        serial_printf("ZRAM: Error: Invalid size zram=%llu\n", mb);
+        return;
+    }
+    zram_create((uint32_t)mb * 1024 * 1024);
+}
@@ -11,11 +11,13 @@
 #include <kernel.h>
 #include <interrupts.h>
 #include <cpu.h>
+#include <convert.h>
 
 static volatile uint32_t ticks = 0;
 static event_t events[TIMER_MAX_EVENTS];
 static uint32_t event_count = 0;
 static uint32_t next_id = 0;
+static uint32_t tsc_per_us = 0; // 0 until timer_calibrate_tsc() ran
 
 /**
  * @brief Small delay for I/O operations to ensure hardware synchronization.
@@ -49,6 +51,25 @@ void timer_callback(struct registers *regs) {
     ticks++;
 }
 
+/**
+ * @brief Measures the TSC frequency against the PIT.
+ * @note Interrupts must be enabled, the tick counter is used as the reference.
+ */
+static void timer_calibrate_tsc(void) {
+    // start on a tick edge so the whole measurement covers full ticks
+    uint32_t start_tick = ticks;
+    while (ticks == start_tick) cpu_hlt();
+    start_tick = ticks;
+    uint64_t start_tsc = cpu_rdtsc();
+
+    while (ticks - start_tick < TIMER_TSC_CALIBRATION_TICKS) cpu_hlt();
+    uint64_t cycles = cpu_rdtsc() - start_tsc;
+
+    div64_32(&cycles, (TIMER_TSC_CALIBRATION_TICKS * 1000000) / TIMER_FREQUENCY);
+    tsc_per_us = (uint32_t)cycles;
+    serial_printf("Timer: TSC runs at %u MHz\n", tsc_per_us);
+}
+
 /**
  * @brief Initializes the PIT to the frequency defined by TIMER_FREQUENCY.
  * 
@@ -65,6 +86,7 @@ void timer_init(void) {
 
     serial_printf("Timer: install IRQ handler\n");
     irq_install_handler(0, timer_callback);
+    timer_calibrate_tsc();
     init_state = INIT_TIMER;
 }
 
@@ -138,3 +160,18 @@ void sleep_ms(uint32_t ms) {
     else target_ticks = (uint32_t)overflow_check;
     while (ticks < target_ticks) cpu_hlt();
 }
+
+/**
+ * @brief Returns a high-resolution timestamp in nanoseconds since boot.
+ *
+ * Reads the TSC, falls back to the PIT tick counter if the TSC could not be
+ * calibrated.
+ */
+uint64_t timer_get_ns(void) {
+    if (!tsc_per_us) return (uint64_t)ticks * (1000000000 / TIMER_FREQUENCY);
+
+    uint64_t ns = cpu_rdtsc() * 1000;
+    div64_32(&ns, tsc_per_us);
+    return ns;
+}
+
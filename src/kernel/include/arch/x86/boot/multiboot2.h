@@ -11,6 +11,7 @@
 #define MULTIBOOT_TAG_TYPE_END 0
 #define MULTIBOOT_TAG_TYPE_CMDLINE 1
 #define MULTIBOOT_TAG_TYPE_BOOT_LOADER 2
+#define MULTIBOOT_TAG_TYPE_MODULE 3
 #define MULTIBOOT_TAG_TYPE_MMAP 6
 #define MULTIBOOT_TAG_TYPE_ACPI_OLD 14
 #define MULTIBOOT_TAG_TYPE_ACPI_NEW 15
@@ -47,6 +48,17 @@ typedef struct {
     char string[];
 } __attribute__((packed)) multiboot_tag_boot_loader_t;
 
+/**
+ * @brief Tag describing a boot module loaded by the bootloader.
+ */
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint32_t mod_start; /**< Physical start address. */
+    uint32_t mod_end;   /**< Physical end address (exclusive). */
+    char string[];      /**< Module command line. */
+} __attribute__((packed)) multiboot_tag_module_t;
+
 /**
  * @brief A single entry in the Multiboot2 memory map.
  */
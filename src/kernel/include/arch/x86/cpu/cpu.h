@@ -5,5 +5,15 @@
 
 #pragma once 
 
+#include <stdint.h>
+
+#define CPU_EFLAGS_IF (1 << 9) /**< Interrupts enabled. */
+
 extern void cpu_hlt();
-extern void cpu_pause();
\ No newline at end of file
+extern void cpu_pause();
+extern void cpu_sti_hlt();
+extern uint32_t cpu_irq_save();
+extern void cpu_irq_restore(uint32_t flags);
+extern uint64_t cpu_rdtsc();
+extern void cpu_sti();
+extern uint32_t cpu_read_cr2();
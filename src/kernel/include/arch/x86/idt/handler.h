@@ -7,6 +7,8 @@
 
 #include <stdint.h>
 
+#define IRQ_MAX_SHARED 4 /**< Handlers that can share one IRQ line. */
+
 /**
  * @brief Structure representing the CPU registers pushed onto the stack during an interrupt.
  */
@@ -22,7 +24,7 @@ typedef void (*isr_handler_t)(struct registers *regs);
 /** @brief Alias for isr_handler_t used for IRQs. */
 typedef isr_handler_t irq_handler_t;
 
-void irq_install_handler(int irq, irq_handler_t handler);
+uint8_t irq_install_handler(int irq, irq_handler_t handler);
 void isr_install_handler(int isr, isr_handler_t handler);
 void irq_handler(struct registers *regs);
 void isr_handler(struct registers *regs);
\ No newline at end of file
@@ -19,6 +19,12 @@ extern uint8_t _kernel_end_phys[];
 #define KERNEL_END_PHYS ((uintptr_t)_kernel_end_phys)
 
 #define MMAP_MAX_ENTRIES 128
+#define BOOT_MODULES_MAX 8
+#define BOOT_IDENTITY_MAP_END 0x00400000 // the boot page table identity maps the first 4 MB
+
+#define BOOT_MODULE_IMAGE 0 /**< A disk image, exposed as a RAM disk. */
+#define BOOT_MODULE_CPIO  1 /**< A cpio archive in the newc format, mounted by initramfs.c. */
+#define BOOT_MODULE_TAR   2 /**< A ustar archive, mounted by initramfs.c. */
 
 /**
  * @brief Structure containing basic framebuffer information.
@@ -59,6 +65,24 @@ typedef struct {
     mmap_entry_t entries[MMAP_MAX_ENTRIES];
 } mmap_t;
 
+/**
+ * @brief A module the bootloader loaded into physical memory.
+ */
+typedef struct {
+    uint32_t phys_start;
+    uint32_t phys_end;   /**< Exclusive. */
+    uint8_t kind;        /**< BOOT_MODULE_*, see multiboot_module_kind(). */
+    char cmdline[64];
+} boot_module_t;
+
+/**
+ * @brief Boot modules handed over by the bootloader.
+ */
+typedef struct {
+    uint32_t count;
+    boot_module_t entries[BOOT_MODULES_MAX];
+} boot_modules_t;
+
 /**
  * 
  */
@@ -86,7 +110,10 @@ typedef enum {
 
 extern init_state_t init_state;
 extern mmap_t kernel_mmap;
+extern boot_modules_t kernel_modules;
 extern fb_info_t kernel_fb_info;
 extern multiboot_info_t* kernel_multiboot_info;
 extern char kernel_cmdline[256];
 extern char kernel_bootloader_name[64];
+
+const char* kernel_cmdline_get(const char* key);
@@ -0,0 +1,100 @@
+/**
+ * @file aio.h
+ * @brief Asynchronous file I/O with submission and completion rings
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vfs.h>
+
+#define AIO_MAX_ENTRIES 256
+#define AIO_REQUEST_SECTORS 128    // largest device request built for one piece of a read
+
+#define AIO_OP_READ  0
+#define AIO_OP_WRITE 1
+
+struct aio_cqe;
+
+typedef void (*aio_callback_t)(const struct aio_cqe* cqe);
+
+/**
+ * @brief A submission queue entry, filled in by the caller.
+ * @note The file and the buffer must stay valid until the operation is reaped.
+ */
+typedef struct {
+    uint8_t op;                  /**< AIO_OP_READ or AIO_OP_WRITE. */
+    vfs_file_t* file;
+    uint64_t offset;
+    void* buffer;
+    uint32_t length;
+    aio_callback_t callback;     /**< Run by aio_reap(), may be NULL. */
+    void* user_data;             /**< Handed back in the completion. */
+} aio_sqe_t;
+
+/**
+ * @brief A completion queue entry.
+ */
+typedef struct aio_cqe {
+    void* user_data;
+    int32_t result;              /**< Bytes transferred, -1 on error. */
+} aio_cqe_t;
+
+struct aio_ring;
+
+/**
+ * @brief An operation taken from the submission queue, until it is reaped.
+ */
+typedef struct aio_op {
+    struct aio_ring* ring;
+    bool busy;
+    bool failed;
+    int32_t result;                  /**< Reported on success. */
+    aio_callback_t callback;
+    void* user_data;
+    storage_request_t* requests;     /**< Device requests of the read, NULL if it was done right away. */
+    uint32_t request_count;
+    volatile uint32_t pending;       /**< Device requests still in flight. */
+    struct aio_op* batch_next;       /**< Operations whose requests are submitted together. */
+} aio_op_t;
+
+/**
+ * @brief A pair of rings, a small io_uring.
+ *
+ * The caller fills entries of the submission queue with aio_get_sqe() and
+ * hands them over with aio_submit(). Finished operations appear in the
+ * completion queue in the order they finish. Both queues hold entries
+ * slots, indexes run freely and are masked.
+ */
+typedef struct aio_ring {
+    uint32_t entries;                /**< A power of two. */
+    aio_sqe_t* sq;
+    uint32_t sq_head;                /**< Next entry aio_submit() takes. */
+    uint32_t sq_tail;                /**< Next entry aio_get_sqe() hands out. */
+    aio_op_t* ops;
+    aio_op_t** cq;
+    uint32_t cq_head;                /**< Next completion aio_reap() takes. */
+    volatile uint32_t cq_tail;       /**< Advanced by completions, also from interrupt context. */
+    uint32_t outstanding;            /**< Submitted and not yet reaped, at most entries. */
+} aio_ring_t;
+
+typedef struct {
+    uint64_t ops;
+    uint64_t queued_ops;             /**< Reads that went to the device queue. */
+    uint64_t requests;               /**< Device requests issued for them. */
+    uint64_t sync_bytes;             /**< Bytes served right away: cached, in memory, written or unaligned. */
+    uint64_t queued_bytes;
+    uint64_t errors;
+} aio_stats_t;
+
+aio_ring_t* aio_create(uint32_t entries);
+void aio_destroy(aio_ring_t* ring);
+aio_sqe_t* aio_get_sqe(aio_ring_t* ring);
+uint32_t aio_submit(aio_ring_t* ring);
+uint32_t aio_reap(aio_ring_t* ring, aio_cqe_t* out, uint32_t max);
+void aio_wait(aio_ring_t* ring, uint32_t min_complete);
+
+aio_stats_t* aio_get_stats(void);
+void aio_dump_info(void);
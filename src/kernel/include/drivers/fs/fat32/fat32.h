@@ -1,4 +1,262 @@
 /**
  * @file fat32.h
  * @author friedrichOsDev
- */
\ No newline at end of file
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <storage.h>
+
+#define FAT32_MAX_VOLUMES 8
+#define FAT32_SECTOR_SIZE 512
+#define FAT32_FAT_CHUNK_SECTORS 8   // FAT sectors loaded and written back together
+#define FAT32_MAX_IO_SECTORS 128    // largest single data request
+#define FAT32_MAX_NAME 255
+#define FAT32_FILE_MIN_RUN 64       // free run a file is placed in when it needs new space, so it can keep growing in place
+#define FAT32_PAGE_SIZE 4096
+#define FAT32_DELAY_MAX_PAGES 64    // appended data held in memory per file before clusters are allocated for it
+#define FAT32_INDEX_BUCKETS 64      // directory indexes per volume hash table
+#define FAT32_INDEX_DEFAULT_KB 512  // memory for directory indexes, override with dirindex=<KB>, 0 disables them
+#define FAT32_INDEX_MAX_ENTRIES 65536 // the largest directory FAT32 allows
+
+#define FAT32_CLUSTER_MASK 0x0FFFFFFF
+#define FAT32_CLUSTER_FREE 0x00000000
+#define FAT32_CLUSTER_BAD  0x0FFFFFF7
+#define FAT32_CLUSTER_EOC  0x0FFFFFF8 /**< Values from here on end a chain. */
+#define FAT32_CLUSTER_LAST 0x0FFFFFFF /**< End of chain marker written by the driver. */
+
+#define FAT32_ATTR_READ_ONLY 0x01
+#define FAT32_ATTR_HIDDEN    0x02
+#define FAT32_ATTR_SYSTEM    0x04
+#define FAT32_ATTR_VOLUME_ID 0x08
+#define FAT32_ATTR_DIRECTORY 0x10
+#define FAT32_ATTR_ARCHIVE   0x20
+#define FAT32_ATTR_LFN       0x0F
+
+#define FAT32_DIRENT_END     0x00 /**< First name byte of the entry after the last used one. */
+#define FAT32_DIRENT_DELETED 0xE5
+
+#define FAT32_NTRES_LOWER_BASE 0x08 /**< The 8.3 base name is shown in lower case. */
+#define FAT32_NTRES_LOWER_EXT  0x10 /**< The 8.3 extension is shown in lower case. */
+
+#define FAT32_LFN_LAST 0x40 /**< Set in the order byte of the last (first stored) LFN entry. */
+#define FAT32_LFN_CHARS 13
+
+#define FAT32_FSINFO_LEAD_SIG   0x41615252
+#define FAT32_FSINFO_STRUCT_SIG 0x61417272
+#define FAT32_FSINFO_TRAIL_SIG  0xAA550000
+#define FAT32_FSINFO_UNKNOWN    0xFFFFFFFF
+
+#define FAT32_OPEN_CREATE   (1 << 0)
+#define FAT32_OPEN_TRUNCATE (1 << 1)
+
+typedef struct {
+    uint8_t  jump[3];
+    char     oem_name[8];
+    uint16_t bytes_per_sector;
+    uint8_t  sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t  fat_count;
+    uint16_t root_entry_count;
+    uint16_t total_sectors_16;
+    uint8_t  media;
+    uint16_t fat_size_16;
+    uint16_t sectors_per_track;
+    uint16_t head_count;
+    uint32_t hidden_sectors;
+    uint32_t total_sectors_32;
+    uint32_t fat_size_32;
+    uint16_t ext_flags;
+    uint16_t fs_version;
+    uint32_t root_cluster;
+    uint16_t fsinfo_sector;
+    uint16_t backup_boot_sector;
+    uint8_t  reserved[12];
+    uint8_t  drive_number;
+    uint8_t  reserved1;
+    uint8_t  boot_signature;
+    uint32_t volume_id;
+    char     volume_label[11];
+    char     fs_type[8];
+    uint8_t  boot_code[420];
+    uint16_t signature;
+} __attribute__((packed)) fat32_bpb_t;
+
+typedef struct {
+    uint32_t lead_signature;
+    uint8_t  reserved[480];
+    uint32_t struct_signature;
+    uint32_t free_count;
+    uint32_t next_free;
+    uint8_t  reserved2[12];
+    uint32_t trail_signature;
+} __attribute__((packed)) fat32_fsinfo_t;
+
+typedef struct {
+    char     name[11];
+    uint8_t  attr;
+    uint8_t  ntres;
+    uint8_t  create_time_tenth;
+    uint16_t create_time;
+    uint16_t create_date;
+    uint16_t access_date;
+    uint16_t first_cluster_high;
+    uint16_t write_time;
+    uint16_t write_date;
+    uint16_t first_cluster_low;
+    uint32_t file_size;
+} __attribute__((packed)) fat32_dirent_t;
+
+typedef struct {
+    uint8_t  order;
+    uint16_t name1[5];
+    uint8_t  attr;
+    uint8_t  type;
+    uint8_t  checksum;
+    uint16_t name2[6];
+    uint16_t first_cluster_low;
+    uint16_t name3[2];
+} __attribute__((packed)) fat32_lfn_entry_t;
+
+/**
+ * @brief A run of clusters that are contiguous both in the file and on the disk.
+ */
+typedef struct {
+    uint32_t file_cluster; /**< Index of the first cluster within the file. */
+    uint32_t disk_cluster; /**< Its cluster number on the volume. */
+    uint32_t length;       /**< Clusters in the run. */
+} fat32_extent_t;
+
+/**
+ * @brief FAT32_FAT_CHUNK_SECTORS sectors of the first FAT, loaded on first use.
+ */
+typedef struct {
+    uint32_t* entries;
+    bool dirty;
+} fat32_fat_chunk_t;
+
+struct fat32_file;
+struct fat32_volume;
+
+/**
+ * @brief A name in a directory index, found by open addressing on its hash.
+ */
+typedef struct {
+    uint32_t hash;
+    uint16_t entry_index;  /**< Index of the 8.3 entry. */
+    uint8_t lfn_count;     /**< Long name entries in front of it. */
+    uint8_t kind;
+} fat32_index_slot_t;
+
+/**
+ * @brief Hash index of one directory, mapping every name to the position of its entries.
+ *
+ * Each file is found both by the name it is shown with (long or 8.3, without
+ * case) and by its raw 8.3 name, so lookups and short name collision checks
+ * read at most the entries a hash matches.
+ */
+typedef struct fat32_dir_index {
+    struct fat32_volume* volume;
+    uint32_t dir_cluster;
+    fat32_index_slot_t* slots;
+    uint32_t capacity;             /**< Slots, a power of two. */
+    uint32_t used;
+    uint32_t tombstones;           /**< Slots of removed names, still part of probe chains. */
+    uint32_t end;                  /**< Index of the first entry after the last used one. */
+    uint32_t entry_capacity;       /**< Entries in the clusters of the directory. */
+    uint32_t holes;                /**< Deleted entries in front of end. */
+    struct fat32_dir_index* hash_next;
+    struct fat32_dir_index* lru_prev; /**< Towards the most recently used index. */
+    struct fat32_dir_index* lru_next;
+} fat32_dir_index_t;
+
+typedef struct fat32_volume {
+    disk_t* disk;
+    uint32_t sectors_per_cluster;
+    uint32_t cluster_size;     /**< Bytes per cluster, a power of two. */
+    uint8_t cluster_shift;
+    uint32_t fat_count;
+    uint32_t fat_sectors;      /**< Sectors per FAT. */
+    uint64_t fat_lba;
+    uint64_t data_lba;
+    uint32_t root_cluster;
+    uint32_t fsinfo_sector;    /**< 0 if the volume has none. */
+    uint32_t cluster_count;    /**< Data clusters, numbered 2 to cluster_count + 1. */
+    uint32_t free_count;       /**< Free clusters, counted at mount time. */
+    uint32_t next_free;        /**< FSInfo hint, the cluster after the last allocation. */
+    bool fsinfo_dirty;
+    uint32_t* used_bitmap;     /**< One bit per data cluster, set while it is allocated. */
+
+    fat32_fat_chunk_t* fat_cache;
+    uint32_t fat_chunk_count;
+    uint64_t fat_hits;
+    uint64_t fat_misses;
+
+    struct fat32_file* open_files; /**< Written back by fat32_sync(). */
+    uint64_t writebacks;           /**< Delayed ranges allocated and written. */
+    uint64_t delayed_writes;       /**< Writes that only reached the page cache. */
+
+    fat32_dir_index_t* index_table[FAT32_INDEX_BUCKETS];
+    uint64_t index_hits;
+    uint64_t index_builds;
+    uint64_t index_evictions;
+
+    uint8_t sector_buffer[FAT32_SECTOR_SIZE]; /**< Bounce buffer for partial sector transfers. */
+} fat32_volume_t;
+
+/**
+ * @brief A directory entry as found by a lookup or a directory listing.
+ */
+typedef struct {
+    char name[FAT32_MAX_NAME + 1];
+    uint8_t attr;
+    uint32_t first_cluster;  /**< 0 for an empty file. */
+    uint32_t size;
+    uint32_t dir_cluster;    /**< First cluster of the directory holding the entry, 0 for the root itself. */
+    uint32_t entry_index;    /**< Index of the 8.3 entry in that directory. */
+    uint8_t lfn_count;       /**< Long name entries in front of it. */
+} fat32_node_t;
+
+/**
+ * @brief An open file, with its cluster chain converted to extents.
+ *
+ * Data written past the allocated clusters stays in pages until writeback,
+ * page i holds the bytes from page_base + i * FAT32_PAGE_SIZE.
+ */
+typedef struct fat32_file {
+    fat32_volume_t* volume;
+    fat32_node_t node;       /**< size includes the delayed pages. */
+    fat32_extent_t* extents;
+    uint32_t extent_count;
+    uint32_t extent_capacity;
+    uint32_t cluster_count;  /**< Clusters allocated to the file. */
+    uint8_t* pages[FAT32_DELAY_MAX_PAGES];
+    uint32_t page_count;
+    uint32_t page_base;      /**< Cluster aligned offset of the first page, the allocated size when it was created. */
+    bool entry_dirty;        /**< Size or first cluster differ from the directory entry. */
+    struct fat32_file* next_open;
+} fat32_file_t;
+
+void fat32_init(void);
+fat32_volume_t* fat32_mount(disk_t* disk);
+void fat32_unmount(fat32_volume_t* vol);
+uint8_t fat32_sync(fat32_volume_t* vol);
+uint32_t fat32_get_volume_count(void);
+fat32_volume_t* fat32_get_volume(uint32_t index);
+
+void fat32_root_node(fat32_volume_t* vol, fat32_node_t* out);
+uint8_t fat32_find(fat32_volume_t* vol, const fat32_node_t* dir, const char* name, fat32_node_t* out);
+uint8_t fat32_lookup(fat32_volume_t* vol, const char* path, fat32_node_t* out);
+uint8_t fat32_readdir(fat32_volume_t* vol, const fat32_node_t* dir, uint32_t* cursor, fat32_node_t* out);
+uint8_t fat32_create(fat32_volume_t* vol, const fat32_node_t* dir, const char* name, uint8_t attr, fat32_node_t* out);
+uint8_t fat32_remove(fat32_volume_t* vol, const fat32_node_t* node);
+
+fat32_file_t* fat32_open_node(fat32_volume_t* vol, const fat32_node_t* node);
+fat32_file_t* fat32_open(fat32_volume_t* vol, const char* path, uint32_t flags);
+int32_t fat32_read(fat32_file_t* file, uint32_t offset, void* buffer, uint32_t length);
+int32_t fat32_write(fat32_file_t* file, uint32_t offset, const void* buffer, uint32_t length);
+uint8_t fat32_truncate(fat32_file_t* file, uint32_t size);
+uint8_t fat32_flush(fat32_file_t* file);
+void fat32_close(fat32_file_t* file);
@@ -0,0 +1,45 @@
+/**
+ * @file fsbench.h
+ * @brief In-kernel filesystem benchmark
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vfs.h>
+
+#define FSBENCH_MAX_FILES 100000
+#define FSBENCH_MAX_BLOCK (128 * 1024)      // largest sequential I/O size in bytes
+#define FSBENCH_MAX_QD 32
+#define FSBENCH_RANDOM_BLOCK 4096
+#define FSBENCH_DEFAULT_FILES 1000
+#define FSBENCH_DEFAULT_FILE_SIZE 1024
+#define FSBENCH_DEFAULT_LARGE_KB 4096       // fits the default page cache, so warm reads can hit
+#define FSBENCH_DEFAULT_BLOCK (64 * 1024)
+#define FSBENCH_DEFAULT_OPS 2048
+#define FSBENCH_DEFAULT_QD 16
+#define FSBENCH_DIR_NAME "fsbench.tmp"      // created below the benchmarked directory and removed again
+
+#define FSBENCH_META (1 << 0)  // create, stat, unlink
+#define FSBENCH_LIST (1 << 1)
+#define FSBENCH_SEQ  (1 << 2)
+#define FSBENCH_RAND (1 << 3)
+#define FSBENCH_ALL  (FSBENCH_META | FSBENCH_LIST | FSBENCH_SEQ | FSBENCH_RAND)
+
+/**
+ * @brief Parameters of a benchmark run.
+ */
+typedef struct {
+    uint32_t files;          /**< Small files for the metadata and listing tests. */
+    uint32_t file_size;      /**< Bytes written to each small file. */
+    uint32_t large_kb;       /**< Size of the file of the sequential and random tests. */
+    uint32_t block_size;     /**< Bytes per sequential read or write. */
+    uint32_t ops;            /**< Random 4 KB reads per test. */
+    uint32_t queue_depth;    /**< Random reads kept in flight through the async I/O rings. */
+    uint32_t tests;          /**< FSBENCH_* flags. */
+} fsbench_config_t;
+
+void fsbench_default_config(fsbench_config_t* config);
+uint8_t fsbench_run(const char* path, const fsbench_config_t* config);
@@ -0,0 +1,49 @@
+/**
+ * @file initramfs.h
+ * @brief Read-only filesystem on a cpio or tar archive loaded as a boot module
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vfs.h>
+#include <kernel.h>
+
+#define INITRAMFS_BUCKETS 256
+#define INITRAMFS_NONE 0xFFFFFFFF     // index of no node, ends hash chains
+
+#define CPIO_NEWC_HEADER_SIZE 110
+#define TAR_BLOCK_SIZE 512
+
+/**
+ * @brief A file or directory of the archive.
+ *
+ * Files point straight into the mapped module, nothing is copied.
+ */
+typedef struct {
+    char* name;
+    uint32_t parent;      /**< Index of the directory holding the node, the root is its own parent. */
+    uint32_t hash_next;   /**< Next node in the same hash bucket, INITRAMFS_NONE at the end. */
+    uint8_t type;
+    const uint8_t* data;
+    uint32_t size;
+} initramfs_node_t;
+
+typedef struct {
+    const boot_module_t* module;
+    const uint8_t* archive;          /**< The module, mapped read only. */
+    uint32_t archive_size;
+    initramfs_node_t* nodes;         /**< In archive order, node 0 is the root. */
+    uint32_t node_count;
+    uint32_t node_capacity;
+    uint32_t buckets[INITRAMFS_BUCKETS];
+    uint32_t file_count;
+    uint32_t dir_count;
+    uint32_t skipped;                /**< Links, devices and malformed entries left out. */
+    uint64_t bytes_read;
+} initramfs_volume_t;
+
+void initramfs_init(void);
+uint8_t initramfs_mount(const char* path, const boot_module_t* module);
@@ -7,21 +7,40 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <storage.h>
 
-#define MAX_PARTITIONS 16
+#define PARTMAN_MAX_CHILDREN 64  // requests forwarded to parent disks in flight over all partitions
 
-typedef struct {
-    uint8_t disk_index;
-    uint32_t start_lba;
-    uint32_t sector_count;
-    uint8_t partition_type;
-    char name[36];
-    bool used;
+/**
+ * @brief A partition, registered as a disk of its own.
+ *
+ * Requests to the partition disk are remapped to the parent disk and go
+ * through the parent's block cache, so both views stay coherent. Requests
+ * submitted with storage_submit() are forwarded to the parent's queue.
+ */
+typedef struct partition {
+    disk_t base;
+    disk_t* parent;
+    uint8_t disk_index;     /**< Index of the parent disk. */
+    uint64_t start_lba;     /**< First sector on the parent disk. */
+    uint64_t sector_count;
+    uint8_t partition_type; /**< MBR type byte, 0 for GPT partitions. */
+    char label[36];         /**< GPT partition name, empty for MBR partitions. */
+    struct partition* next;
 } partition_t;
 
+/**
+ * @brief A request to the parent disk, issued on behalf of a request to a partition.
+ */
+typedef struct partman_child {
+    storage_request_t req;
+    storage_request_t* parent;
+    struct partman_child* next_free;
+} partman_child_t;
+
 void partman_init();
 partition_t* partman_get_partition(uint32_t partition_id);
 uint32_t partman_get_partition_count();
-int32_t partman_register_partition(uint8_t disk_index, uint32_t start_lba, uint32_t sector_count, uint8_t type, const char* name);
-bool partman_read_partition(uint32_t partition_id, uint32_t relative_lba, uint32_t sector_count, uint8_t* buffer);
-void partman_dump_info();
\ No newline at end of file
+disk_t* partman_resolve(disk_t* disk, uint64_t* lba);
+int32_t partman_register_partition(uint8_t disk_index, uint64_t start_lba, uint64_t sector_count, uint8_t type, const char* label);
+void partman_dump_info();
@@ -0,0 +1,73 @@
+/**
+ * @file pcache.h
+ * @brief Page cache of file data and file mappings
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vmm.h>
+#include <vfs.h>
+
+#define PCACHE_PAGE_SIZE VMM_PAGE_SIZE
+#define PCACHE_MAX_PAGES ((VMM_PCACHE_END + 1 - VMM_PCACHE_BASE) / PCACHE_PAGE_SIZE)
+#define PCACHE_MMAP_PAGES ((VMM_MMAP_END + 1 - VMM_MMAP_BASE) / PCACHE_PAGE_SIZE)
+#define PCACHE_DEFAULT_PAGES 1024   // pages cached, override with pcache=<n>
+#define PCACHE_BUCKETS 1024
+#define PCACHE_READ_RUN 64          // missing pages read with one filesystem request
+#define PCACHE_MAX_MAPPINGS 32
+
+/**
+ * @brief One page of a file, mapped at its slot in the page cache window.
+ *
+ * Bytes past the end of the file are zero. Pages that are mapped by
+ * vfs_mmap() or being filled are referenced and kept off the LRU list.
+ */
+typedef struct pcache_page {
+    vfs_vnode_t* vnode;              /**< NULL while the slot is free. */
+    uint32_t index;                  /**< Page of the file, its offset divided by PCACHE_PAGE_SIZE. */
+    phys_addr_t phys;
+    uint32_t refs;
+    struct pcache_page* hash_next;   /**< Next free slot while the slot is free. */
+    struct pcache_page* lru_prev;    /**< Towards the most recently used page. */
+    struct pcache_page* lru_next;
+    struct pcache_page* file_prev;   /**< Other pages of the same vnode. */
+    struct pcache_page* file_next;
+} pcache_page_t;
+
+/**
+ * @brief A range of the mapping window showing consecutive pages of a file.
+ */
+typedef struct {
+    vfs_vnode_t* vnode;    /**< NULL for an unused entry. */
+    virt_addr_t base;
+    uint32_t first_page;   /**< Page of the file shown at base. */
+    uint32_t pages;
+} pcache_mapping_t;
+
+typedef struct {
+    uint64_t hits;         /**< Pages found in the cache. */
+    uint64_t misses;       /**< Pages read from the filesystem. */
+    uint64_t evictions;    /**< Pages dropped for the page limit. */
+    uint64_t reclaims;     /**< Pages given back to the PMM when it ran out. */
+    uint64_t faults;       /**< Pages mapped on first touch of a mapping. */
+} pcache_stats_t;
+
+void pcache_init(void);
+int32_t pcache_read(vfs_vnode_t* node, uint64_t offset, void* buffer, uint32_t length);
+bool pcache_contains(vfs_vnode_t* node, uint64_t offset, uint32_t length);
+void pcache_update(vfs_vnode_t* node, uint64_t offset, const void* buffer, uint32_t length);
+void pcache_truncate(vfs_vnode_t* node, uint64_t size);
+void pcache_drop_vnode(vfs_vnode_t* node);
+void pcache_drop_all(void);
+uint32_t pcache_reclaim(uint32_t count);
+void pcache_set_limit(uint32_t pages);
+
+virt_addr_t pcache_map(vfs_vnode_t* node, uint64_t offset, uint32_t length);
+vfs_vnode_t* pcache_unmap(virt_addr_t addr);
+bool pcache_fault(virt_addr_t addr);
+
+pcache_stats_t* pcache_get_stats(void);
+void pcache_dump_info(void);
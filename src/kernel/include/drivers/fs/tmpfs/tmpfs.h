@@ -0,0 +1,82 @@
+/**
+ * @file tmpfs.h
+ * @brief In-memory filesystem backed by physical pages
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vfs.h>
+
+#define TMPFS_PAGE_SIZE 4096
+#define TMPFS_RADIX_SHIFT 6                          // page index bits resolved per tree level
+#define TMPFS_RADIX_SLOTS (1 << TMPFS_RADIX_SHIFT)
+#define TMPFS_RADIX_MAX_HEIGHT 4                     // 64^4 pages, 64 GB, more than a 32 bit size can reach
+#define TMPFS_MAX_FILE_SIZE 0xFFFFFFFFULL
+#define TMPFS_DEFAULT_KB 16384                       // size of /tmp, override with tmpfs=<KB>, 0 mounts none
+#define TMPFS_WINDOW 13                              // zero window slots used to reach file pages
+#define TMPFS_WINDOW_COUNT 2                         // a fault on a mapping of a tmpfs file nests one copy in another
+#define TMPFS_DIR_MIN_BUCKETS 8
+
+/**
+ * @brief A node of the page tree of a file.
+ *
+ * Slots of the lowest level hold physical page addresses, the others child
+ * nodes. Empty slots are 0, holes in the file read as zeros.
+ */
+typedef struct tmpfs_radix_node {
+    uintptr_t slots[TMPFS_RADIX_SLOTS];
+    uint32_t count;  /**< Slots in use. */
+} tmpfs_radix_node_t;
+
+struct tmpfs_node;
+
+/**
+ * @brief A name in a directory, found through the hash of its directory.
+ */
+typedef struct tmpfs_dirent {
+    struct tmpfs_node* node;
+    uint32_t hash;
+    uint32_t slot;                  /**< Position in the entry array, the readdir cursor. */
+    struct tmpfs_dirent* hash_next;
+    char name[];
+} tmpfs_dirent_t;
+
+typedef struct tmpfs_node {
+    uint64_t ino;
+    uint8_t type;
+    bool unlinked;                  /**< Removed while its vnode lives, freed by the release callback. */
+    tmpfs_dirent_t* dirent;         /**< Its name, NULL for the root and once removed. */
+    uint64_t size;
+
+    // files
+    tmpfs_radix_node_t* root;
+    uint8_t height;                 /**< Tree levels, 0 while the file has no pages. */
+    uint32_t page_count;
+
+    // directories
+    tmpfs_dirent_t** entries;       /**< In creation order, with NULL holes left by removals. */
+    uint32_t entry_end;             /**< Slots of entries used so far. */
+    uint32_t entry_capacity;
+    uint32_t entry_count;           /**< Names in the directory. */
+    tmpfs_dirent_t** buckets;
+    uint32_t bucket_count;          /**< A power of two. */
+} tmpfs_node_t;
+
+typedef struct {
+    uint32_t limit_pages;           /**< Data pages the filesystem may hold. */
+    uint32_t used_pages;
+    uint32_t radix_nodes;
+    uint32_t file_count;
+    uint32_t dir_count;
+    uint64_t next_ino;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t full_errors;           /**< Writes cut short by the size limit. */
+    tmpfs_node_t* root;
+} tmpfs_volume_t;
+
+void tmpfs_init(void);
+uint8_t tmpfs_mount(const char* path, uint32_t limit_kb);
@@ -1,4 +1,172 @@
 /**
  * @file vfs.h
+ * @brief Virtual file system with mount points, vnode cache and dentry cache
  * @author friedrichOsDev
- */
\ No newline at end of file
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <storage.h>
+
+#define VFS_MAX_MOUNTS 16
+#define VFS_MAX_FS_TYPES 8
+#define VFS_MAX_PATH 256
+#define VFS_MAX_NAME 255
+
+#define VFS_DCACHE_DEFAULT 1024 // dentries kept, override with dcache=<n>
+#define VFS_VCACHE_DEFAULT 256  // vnodes kept, override with vcache=<n>
+#define VFS_DCACHE_BUCKETS 1024
+#define VFS_VCACHE_BUCKETS 256
+#define VFS_SYNC_INTERVAL_MS 5000 // how often changed filesystems are synced in the background
+
+#define VFS_TYPE_FILE 1
+#define VFS_TYPE_DIR  2
+
+#define VFS_OPEN_CREATE   (1 << 0)
+#define VFS_OPEN_TRUNCATE (1 << 1)
+
+#define VFS_FS_CASE_INSENSITIVE (1 << 0) /**< Names are compared and hashed without case. */
+#define VFS_FS_NO_PAGE_CACHE    (1 << 1) /**< File data is in memory already, vfs_read() goes straight to the filesystem. */
+
+#define VFS_VNODE_UNLINKED (1 << 0) /**< Removed from its directory, no longer in the vnode hash. */
+
+struct vfs_mount;
+struct pcache_page;
+
+/**
+ * @brief A cached file or directory.
+ *
+ * A vnode is referenced by the dentries that name it, by open files and by
+ * running path walks. Unreferenced vnodes stay cached on an LRU list until the
+ * vnode limit is reached.
+ */
+typedef struct vfs_vnode {
+    struct vfs_mount* mount;
+    uint64_t ino;                  /**< Filesystem-wide unique number, chosen by the filesystem. */
+    uint8_t type;
+    uint8_t flags;
+    uint64_t size;
+    uint32_t refs;
+    uint32_t open_count;
+    void* private;                 /**< Filesystem data, freed by its release callback. */
+    struct pcache_page* pages;     /**< Cached pages of the file, see pcache.c. */
+    struct vfs_vnode* hash_next;
+    struct vfs_vnode* lru_prev;    /**< Towards the most recently released vnode. */
+    struct vfs_vnode* lru_next;
+} vfs_vnode_t;
+
+/**
+ * @brief A cached name in a directory, negative if the name does not exist.
+ */
+typedef struct vfs_dentry {
+    struct vfs_mount* mount;
+    uint64_t parent_ino;
+    uint32_t hash;
+    vfs_vnode_t* vnode;            /**< Referenced child, NULL for a negative entry. */
+    struct vfs_dentry* hash_next;
+    struct vfs_dentry* lru_prev;   /**< Towards the most recently used dentry. */
+    struct vfs_dentry* lru_next;
+    char name[];
+} vfs_dentry_t;
+
+typedef struct {
+    char name[VFS_MAX_NAME + 1];
+    uint8_t type;
+    uint64_t size;
+} vfs_dirent_t;
+
+typedef struct {
+    uint64_t ino;
+    uint8_t type;
+    uint64_t size;
+} vfs_stat_t;
+
+/**
+ * @brief Filesystem callbacks, all return 0 or a byte count on success.
+ *
+ * lookup and create fill in ino, type, size and private of a vnode that is
+ * not yet cached. read and write update node->size themselves. bmap returns
+ * the sector holding a file offset and how many bytes from there on lie
+ * contiguously on the disk, it may be NULL and fails for data not on the
+ * disk yet.
+ */
+typedef struct {
+    uint8_t (*lookup)(vfs_vnode_t* dir, const char* name, vfs_vnode_t* out);
+    uint8_t (*create)(vfs_vnode_t* dir, const char* name, uint8_t type, vfs_vnode_t* out);
+    uint8_t (*remove)(vfs_vnode_t* dir, vfs_vnode_t* node);
+    uint8_t (*readdir)(vfs_vnode_t* dir, uint32_t* cursor, vfs_dirent_t* out);
+    int32_t (*read)(vfs_vnode_t* node, uint64_t offset, void* buffer, uint32_t length);
+    int32_t (*write)(vfs_vnode_t* node, uint64_t offset, const void* buffer, uint32_t length);
+    uint8_t (*truncate)(vfs_vnode_t* node, uint64_t size);
+    uint8_t (*bmap)(vfs_vnode_t* node, uint64_t offset, uint64_t* lba, uint32_t* length);
+    uint8_t (*sync)(struct vfs_mount* mount);
+    void (*release)(vfs_vnode_t* node);
+} vfs_ops_t;
+
+typedef struct {
+    const char* name;
+    uint32_t flags;
+    /** Sets up mount->private and fills in the root vnode, returns 0 on success. */
+    uint8_t (*mount)(struct vfs_mount* mount, disk_t* disk, vfs_vnode_t* root);
+    void (*unmount)(struct vfs_mount* mount);
+    void (*dump)(struct vfs_mount* mount);
+    const vfs_ops_t* ops;
+} vfs_fs_type_t;
+
+typedef struct vfs_mount {
+    char path[VFS_MAX_PATH];
+    uint32_t path_len;
+    const vfs_fs_type_t* type;
+    disk_t* disk;
+    void* private;
+    vfs_vnode_t* root;
+} vfs_mount_t;
+
+typedef struct {
+    vfs_vnode_t* vnode;
+    uint32_t flags;
+    char path[VFS_MAX_PATH];       /**< Normalized path, used to list mount points below directories. */
+} vfs_file_t;
+
+/**
+ * @brief Lookup and cache statistics.
+ */
+typedef struct {
+    uint64_t lookups;          /**< Path components resolved. */
+    uint64_t dcache_hits;
+    uint64_t dcache_negative_hits;
+    uint64_t dcache_misses;
+    uint64_t dcache_evictions;
+    uint64_t vcache_hits;
+    uint64_t vcache_misses;
+    uint64_t vcache_evictions;
+} vfs_stats_t;
+
+void vfs_init(void);
+uint8_t vfs_register_fs(const vfs_fs_type_t* type);
+uint8_t vfs_mount(const char* path, const char* fs_name, disk_t* disk);
+uint8_t vfs_umount(const char* path);
+vfs_mount_t* vfs_get_mount(uint32_t index);
+uint8_t vfs_normalize_path(const char* path, char* out);
+
+vfs_file_t* vfs_open(const char* path, uint32_t flags);
+int32_t vfs_read(vfs_file_t* file, uint64_t offset, void* buffer, uint32_t length);
+int32_t vfs_write(vfs_file_t* file, uint64_t offset, const void* buffer, uint32_t length);
+uint8_t vfs_truncate(vfs_file_t* file, uint64_t size);
+uint8_t vfs_readdir(vfs_file_t* dir, uint32_t* cursor, vfs_dirent_t* out);
+void vfs_close(vfs_file_t* file);
+void* vfs_mmap(vfs_file_t* file, uint64_t offset, uint32_t length);
+void vfs_munmap(void* addr);
+
+uint8_t vfs_stat(const char* path, vfs_stat_t* out);
+uint8_t vfs_mkdir(const char* path);
+uint8_t vfs_unlink(const char* path);
+uint8_t vfs_sync(void);
+void vfs_sync_task(void);
+
+void vfs_set_cache_limits(uint32_t dentries, uint32_t vnodes);
+void vfs_drop_caches(void);
+vfs_stats_t* vfs_get_stats(void);
+void vfs_dump_info(void);
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <storage.h>
 #include <pci.h>
 
@@ -26,6 +27,8 @@
 #define ATA_CMD_IDENTIFY 0xEC
 #define ATA_CMD_READ_DMA_EX 0x25
 #define ATA_CMD_WRITE_DMA_EX 0x35
+#define ATA_CMD_WRITE_DMA_FUA_EX 0x3D
+#define ATA_CMD_FLUSH_CACHE_EX 0xEA
 
 #define AHCI_DEV_BUSY 0x80
 #define AHCI_DEV_DRQ  0x08
@@ -367,6 +370,7 @@ typedef struct {
     disk_t base;
     volatile HBA_port_t* hba_port;
     uint8_t port_num;
+    bool fua_supported;
 } ahci_disk_t;
 
 void ahci_init_device(pci_device_t* dev);
@@ -376,4 +380,5 @@ void probe_port(HBA_mem_t* abar);
 void port_rebase(HBA_port_t* port, int port_no);
 void ahci_identify(ahci_disk_t* disk);
 uint8_t ahci_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buffer);
-uint8_t ahci_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer);
\ No newline at end of file
+uint8_t ahci_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags);
+uint8_t ahci_flush(disk_t* self);
\ No newline at end of file
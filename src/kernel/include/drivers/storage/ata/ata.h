@@ -6,23 +6,45 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <storage.h>
 
-#define ATA_DATA 0x1F0
-#define ATA_ERROR 0x1F1
-#define ATA_SECTOR_COUNT 0x1F2
-#define ATA_LBA_LOW 0x1F3
-#define ATA_LBA_MID 0x1F4
-#define ATA_LBA_HIGH 0x1F5
-#define ATA_DRIVE_SELECT 0x1F6
-#define ATA_COMMAND 0x1F7
-#define ATA_STATUS 0x1F7
+#define ATA_PRIMARY_IO 0x1F0
+#define ATA_PRIMARY_CTRL 0x3F6
+#define ATA_PRIMARY_IRQ 14
+#define ATA_SECONDARY_IO 0x170
+#define ATA_SECONDARY_CTRL 0x376
+#define ATA_SECONDARY_IRQ 15
+#define ATA_CHANNEL_COUNT 2
+
+// Task file register offsets from the channel I/O base
+#define ATA_REG_DATA 0x00
+#define ATA_REG_ERROR 0x01
+#define ATA_REG_SECTOR_COUNT 0x02
+#define ATA_REG_LBA_LOW 0x03
+#define ATA_REG_LBA_MID 0x04
+#define ATA_REG_LBA_HIGH 0x05
+#define ATA_REG_DRIVE_SELECT 0x06
+#define ATA_REG_COMMAND 0x07
+#define ATA_REG_STATUS 0x07
 
 #define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_READ_PIO_EXT 0x24
+#define ATA_CMD_READ_MULTIPLE 0xC4
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
 #define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_SET_MULTIPLE 0xC6
 #define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CMD_CACHE_FLUSH_EXT 0xEA
 #define ATA_CMD_IDENTIFY 0xEC
 
+#define ATA_LBA28_MAX 0x0FFFFFFF
+#define ATA_MAX_SECTORS_28 256    // sector count of 0 means 256
+#define ATA_MAX_SECTORS_48 65536  // sector count of 0 means 65536
+
 #define ATA_SR_BSY 0x80
 #define ATA_SR_DRDY 0x40
 #define ATA_SR_DF 0x20
@@ -32,12 +54,49 @@
 #define ATA_SR_IDX 0x02
 #define ATA_SR_ERR 0x01
 
+#define ATA_CTRL_SRST 0x04
+#define ATA_CTRL_NIEN 0x02
+
+typedef enum {
+    ATA_STATE_IDLE,
+    ATA_STATE_PIO,   // waiting for the next DRQ block or the end of a PIO command
+    ATA_STATE_DMA,   // waiting for the end of a DMA command
+    ATA_STATE_FLUSH  // waiting for a cache flush to finish
+} ata_state_t;
+
+/**
+ * @brief One IDE channel. Each channel runs one command at a time, so
+ * requests are queued here and started from the channel's IRQ.
+ */
+typedef struct {
+    uint16_t io_base;
+    uint16_t ctrl_base;
+    uint16_t bm_base;   // bus master registers, 0 if the channel has no DMA
+    uint8_t irq;
+    uint8_t index;
+
+    storage_request_t* queue_head; // the head request is the one in flight
+    storage_request_t* queue_tail;
+
+    volatile ata_state_t state;
+    uint32_t done_sectors;  // sectors of the head request finished by earlier commands
+    uint32_t cmd_sectors;   // sectors moved by the current command
+    uint32_t cmd_done;      // sectors of the current command already transferred
+} ata_channel_t;
+
 typedef struct {
     disk_t base;
-    uint8_t drive_id;
+    ata_channel_t* channel;
+    uint8_t drive_id;  // 0xA0 = master, 0xB0 = slave
+    bool dma;
+    bool lba48;
+    bool pio32;        // 32-bit data port transfers
+    uint16_t multiple; // sectors per DRQ block for READ/WRITE MULTIPLE, 0 if disabled
 } ata_disk_t;
 
 void ata_init();
-void ata_identify(uint8_t drive);
+void ata_identify(ata_channel_t* channel, uint8_t drive);
+uint8_t ata_submit(disk_t* self, storage_request_t* req);
 uint8_t ata_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buffer);
-uint8_t ata_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer);
\ No newline at end of file
+uint8_t ata_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags);
+uint8_t ata_flush(disk_t* self);
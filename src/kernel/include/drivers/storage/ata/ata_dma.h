@@ -0,0 +1,50 @@
+/**
+ * @file ata_dma.h
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pci.h>
+#include <ata.h>
+
+// Bus master IDE register offsets, relative to BAR4 (+8 for the secondary channel)
+#define ATA_BM_COMMAND 0x00
+#define ATA_BM_STATUS 0x02
+#define ATA_BM_PRDT 0x04
+#define ATA_BM_CHANNEL_STRIDE 0x08
+
+#define ATA_BM_CMD_START 0x01
+#define ATA_BM_CMD_READ 0x08 // bus master writes to memory
+
+#define ATA_BM_SR_ACTIVE 0x01
+#define ATA_BM_SR_ERR 0x02
+#define ATA_BM_SR_IRQ 0x04
+
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+
+#define ATA_DMA_MAX_SECTORS 256 // bounded by the PRD table size
+#define ATA_DMA_MAX_PRDS 64
+#define ATA_PRD_EOT 0x8000
+
+/**
+ * @brief Physical Region Descriptor, one contiguous chunk of a DMA transfer.
+ * @note A region may not cross a 64 KB boundary.
+ */
+typedef struct {
+    uint32_t phys_addr;
+    uint16_t byte_count; // 0 means 64 KB
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+void ata_dma_init_device(pci_device_t* dev);
+bool ata_dma_available();
+uint16_t ata_dma_base(uint8_t channel);
+uint8_t ata_dma_prepare(ata_channel_t* channel, void* buffer, uint32_t count, bool write);
+void ata_dma_start(ata_channel_t* channel, bool write);
+uint8_t ata_dma_stop(ata_channel_t* channel);
@@ -0,0 +1,70 @@
+/**
+ * @file bcache.h
+ * @brief Block buffer cache in front of the storage HAL
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <storage.h>
+
+#define BCACHE_BLOCK_SIZE 512
+#define BCACHE_MIN_BLOCKS 128
+#define BCACHE_MAX_BLOCKS 16384       // 8 MB of cached data
+#define BCACHE_MEMORY_DIVISOR 64      // use 1/64 of the free physical memory
+#define BCACHE_MAX_RUN 128            // largest single device request issued by the cache
+#define BCACHE_READAHEAD_MIN 8
+#define BCACHE_READAHEAD_MAX 128
+
+#define BCACHE_WRITEBACK_DEFAULT true
+#define BCACHE_WRITEBACK_INTERVAL_MS 1000 // how often the writeback task wakes up
+#define BCACHE_DIRTY_EXPIRE_MS 5000       // dirty blocks older than this are written back
+#define BCACHE_DIRTY_RATIO 20             // % of blocks dirty before writers flush synchronously
+#define BCACHE_DIRTY_BACKGROUND_RATIO 10  // % of blocks the synchronous flush brings it down to
+
+#define BCACHE_BLOCK_VALID     (1 << 0)
+#define BCACHE_BLOCK_READAHEAD (1 << 1) // prefetched and not yet used
+#define BCACHE_BLOCK_DIRTY     (1 << 2) // newer than the copy on the disk
+
+/**
+ * @brief A single cached sector.
+ */
+typedef struct bcache_block {
+    disk_t* disk;
+    uint64_t lba;
+    uint8_t* data;
+    uint32_t flags;
+    uint32_t dirty_tick;           /**< Timer tick at which the block became dirty. */
+    struct bcache_block* hash_next;
+    struct bcache_block* lru_prev; /**< Towards the most recently used block. */
+    struct bcache_block* lru_next; /**< Towards the least recently used block. */
+} bcache_block_t;
+
+/**
+ * @brief Global block cache statistics.
+ */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t readahead_blocks; /**< Blocks fetched by read-ahead. */
+    uint64_t readahead_hits;   /**< Prefetched blocks that were later read. */
+    uint64_t writeback_blocks; /**< Dirty blocks written to disk. */
+    uint64_t writeback_writes; /**< Device writes issued for them after coalescing. */
+    uint64_t write_errors;
+} bcache_stats_t;
+
+void bcache_init(void);
+bool bcache_is_cacheable(disk_t* disk);
+uint8_t bcache_read(disk_t* disk, uint64_t lba, uint32_t count, void* buffer);
+uint8_t bcache_write(disk_t* disk, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags);
+bool bcache_range_dirty(disk_t* disk, uint64_t lba, uint32_t count);
+uint8_t bcache_sync(disk_t* disk);
+void bcache_writeback_task(void);
+void bcache_set_writeback(bool enabled);
+bool bcache_get_writeback(void);
+void bcache_invalidate_disk(disk_t* disk);
+bcache_stats_t* bcache_get_stats(void);
+void bcache_dump_info(void);
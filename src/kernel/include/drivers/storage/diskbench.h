@@ -0,0 +1,38 @@
+/**
+ * @file diskbench.h
+ * @brief In-kernel storage benchmark
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <storage.h>
+
+#define DISKBENCH_MAX_QD 32
+#define DISKBENCH_MAX_BLOCK (128 * 1024)       // largest block size in bytes
+#define DISKBENCH_BUFFER_SIZE (256 * 1024)     // shared data buffer of all in-flight requests
+#define DISKBENCH_MAX_OPS 1000000
+#define DISKBENCH_DEFAULT_BLOCK 4096
+#define DISKBENCH_DEFAULT_OPS 1024
+#define DISKBENCH_DEFAULT_SPAN (64 * 1024 * 1024) // scratch range in bytes at the end of the disk
+
+#define DISKBENCH_SEQ  (1 << 0)
+#define DISKBENCH_RAND (1 << 1)
+
+/**
+ * @brief Parameters of a benchmark run.
+ */
+typedef struct {
+    uint64_t start_lba;     /**< First sector of the scratch range. */
+    uint64_t span;          /**< Size of the scratch range in sectors. */
+    uint32_t block_size;    /**< Bytes per request, a multiple of the sector size. */
+    uint32_t queue_depth;   /**< Requests kept in flight, 0 sweeps 1, 4, 16 and 32. */
+    uint32_t ops;           /**< Requests per test. */
+    uint32_t patterns;      /**< DISKBENCH_SEQ / DISKBENCH_RAND. */
+    bool write;             /**< Also run write tests, destroys the scratch range. */
+} diskbench_config_t;
+
+void diskbench_default_config(disk_t* disk, diskbench_config_t* config);
+uint8_t diskbench_run(disk_t* disk, const diskbench_config_t* config);
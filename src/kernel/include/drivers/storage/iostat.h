@@ -0,0 +1,19 @@
+/**
+ * @file iostat.h
+ * @brief Per-disk I/O statistics
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <storage.h>
+
+#define IOSTAT_DEFAULT_INTERVAL_MS 1000
+
+uint64_t iostat_start(disk_t* disk);
+void iostat_done(disk_t* disk, storage_op_t op, uint32_t sectors, uint64_t start_ns, uint8_t status);
+void iostat_snapshot(disk_t* disk, disk_stats_t* out);
+void iostat_report(uint32_t interval_ms, uint32_t count);
+void iostat_dump_histogram(disk_t* disk);
@@ -0,0 +1,48 @@
+/**
+ * @file md.h
+ * @brief Software RAID (multiple device) disks
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <storage.h>
+
+#define MD_MAX_DEVICES 4
+#define MD_MAX_MEMBERS 8
+#define MD_MAX_CHILDREN 128  // member requests in flight over all md devices
+#define MD_BATCH 32          // member requests issued together, at most MD_MAX_CHILDREN
+
+typedef enum {
+    MD_RAID0, /**< Striping, chunks are spread round-robin over the members. */
+    MD_RAID1  /**< Mirroring, writes go to all members, reads are striped over them. */
+} md_level_t;
+
+/**
+ * @brief A virtual disk combining several member disks.
+ */
+typedef struct {
+    disk_t base;
+    md_level_t level;
+    disk_t* members[MD_MAX_MEMBERS];
+    uint8_t member_count;
+    uint32_t chunk_sectors; /**< Power of two. */
+    uint8_t chunk_shift;
+} md_device_t;
+
+/**
+ * @brief A request to one member, issued on behalf of a request to the md disk.
+ */
+typedef struct md_child {
+    storage_request_t req;
+    storage_request_t* parent;
+    struct md_child* next_free;
+} md_child_t;
+
+disk_t* md_create(md_level_t level, uint32_t chunk_sectors, disk_t** members, uint8_t member_count);
+uint8_t md_submit(disk_t* self, storage_request_t* req);
+uint8_t md_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buffer);
+uint8_t md_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags);
+uint8_t md_flush(disk_t* self);
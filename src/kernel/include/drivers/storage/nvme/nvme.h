@@ -0,0 +1,133 @@
+/**
+ * @file nvme.h
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <storage.h>
+#include <pci.h>
+
+// Controller registers (offsets from BAR0)
+#define NVME_REG_CAP 0x00
+#define NVME_REG_VS 0x08
+#define NVME_REG_INTMS 0x0C
+#define NVME_REG_INTMC 0x10
+#define NVME_REG_CC 0x14
+#define NVME_REG_CSTS 0x1C
+#define NVME_REG_AQA 0x24
+#define NVME_REG_ASQ 0x28
+#define NVME_REG_ACQ 0x30
+#define NVME_REG_DOORBELL 0x1000
+
+#define NVME_CC_EN (1 << 0)
+#define NVME_CC_IOSQES (6 << 16) // 64 byte submission entries
+#define NVME_CC_IOCQES (4 << 20) // 16 byte completion entries
+#define NVME_CSTS_RDY (1 << 0)
+#define NVME_CSTS_CFS (1 << 1)
+
+// Admin opcodes
+#define NVME_ADMIN_CREATE_SQ 0x01
+#define NVME_ADMIN_CREATE_CQ 0x05
+#define NVME_ADMIN_IDENTIFY 0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+#define NVME_IDENTIFY_NAMESPACE 0x00
+#define NVME_IDENTIFY_CONTROLLER 0x01
+#define NVME_FEATURE_NUM_QUEUES 0x07
+
+// NVM opcodes
+#define NVME_CMD_FLUSH 0x00
+#define NVME_CMD_WRITE 0x01
+#define NVME_CMD_READ 0x02
+
+#define NVME_RW_FUA (1 << 30) // cdw12
+
+#define NVME_MAX_CONTROLLERS 4
+#define NVME_MAX_NAMESPACES 4   // per controller
+#define NVME_ADMIN_QUEUE_SIZE 32
+#define NVME_IO_QUEUE_SIZE 64
+#define NVME_PAGE_SIZE 4096
+#define NVME_PRP_LIST_ENTRIES 32 // limits a single command to 128 KB
+
+/**
+ * @brief Submission queue entry.
+ */
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t cid;
+    uint32_t nsid;
+    uint64_t reserved;
+    uint64_t mptr;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw10;
+    uint32_t cdw11;
+    uint32_t cdw12;
+    uint32_t cdw13;
+    uint32_t cdw14;
+    uint32_t cdw15;
+} __attribute__((packed)) nvme_sqe_t;
+
+/**
+ * @brief Completion queue entry.
+ */
+typedef struct {
+    uint32_t result;
+    uint32_t reserved;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status; // bit 0 is the phase tag
+} __attribute__((packed)) nvme_cqe_t;
+
+/**
+ * @brief A submission/completion queue pair.
+ */
+typedef struct {
+    nvme_sqe_t* sq;
+    volatile nvme_cqe_t* cq;
+    uint16_t qid;
+    uint16_t size;
+    uint16_t sq_tail;
+    uint16_t sq_head;        // last head reported by the controller
+    uint16_t sq_unannounced; // entries written since the doorbell was last rung
+    uint16_t cq_head;
+    uint8_t phase;
+    volatile uint32_t* sq_doorbell;
+    volatile uint32_t* cq_doorbell;
+} nvme_queue_t;
+
+typedef struct {
+    volatile uint8_t* regs;
+    uint8_t index;
+    uint8_t irq;
+    bool volatile_cache;    // controller has a volatile write cache that needs flushing
+    uint32_t max_sectors;   // largest transfer of a single command
+    char model[41];
+
+    nvme_queue_t admin;
+    nvme_queue_t io;
+
+    storage_request_t* cmd_req[NVME_IO_QUEUE_SIZE]; // owner of each command identifier
+    uint32_t cid_used[NVME_IO_QUEUE_SIZE / 32];
+
+    storage_request_t* wait_head; // requests not yet (completely) handed to the controller
+    storage_request_t* wait_tail;
+} nvme_controller_t;
+
+typedef struct {
+    disk_t base;
+    nvme_controller_t* ctrl;
+    uint32_t nsid;
+} nvme_ns_t;
+
+void nvme_init_device(pci_device_t* dev);
+uint8_t nvme_submit(disk_t* self, storage_request_t* req);
+void nvme_kick(disk_t* self);
+uint8_t nvme_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buffer);
+uint8_t nvme_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags);
+uint8_t nvme_flush(disk_t* self);
@@ -0,0 +1,30 @@
+/**
+ * @file ramdisk.h
+ * @brief Memory backed block devices
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <storage.h>
+#include <kernel.h>
+
+#define RAMDISK_MAX_DISKS 8
+#define RAMDISK_SECTOR_SIZE 512
+
+/**
+ * @brief A RAM disk, mapped contiguously in the RAM disk window.
+ */
+typedef struct {
+    disk_t base;
+    uint8_t* data;
+    uint32_t size;        /**< Size in bytes, a multiple of RAMDISK_SECTOR_SIZE. */
+    bool from_module;     /**< The memory belongs to a boot module. */
+} ramdisk_t;
+
+void ramdisk_init(void);
+disk_t* ramdisk_create(uint32_t size);
+disk_t* ramdisk_create_from_module(const boot_module_t* module);
+uint8_t* ramdisk_map_module(const boot_module_t* module, bool writable);
@@ -8,30 +8,119 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 #define MAX_DISKS 64
 
+#define DISK_FLAG_NOCACHE (1 << 0) /**< Bypass the block cache for this disk. */
+
+#define STORAGE_WRITE_FUA (1 << 0) /**< Forced unit access: the data is on stable media when the write returns. */
+#define STORAGE_REQ_MORE (1 << 1)  /**< More requests follow right away, the driver may delay notifying the device. The last request of a batch must not set it. */
+
 typedef enum {
     TYPE_UNKNOWN,
     TYPE_ATA,
-    TYPE_AHCI
+    TYPE_AHCI,
+    TYPE_NVME,
+    TYPE_VIRTIO,
+    TYPE_RAM,
+    TYPE_MD,
+    TYPE_PARTITION,
+    TYPE_ZRAM
 } disk_type_t;
 
+/**
+ * @brief Per-disk state kept by the block cache.
+ */
+typedef struct {
+    uint64_t next_lba;         /**< LBA a sequential reader is expected to ask for next. */
+    uint32_t readahead_window; /**< Current read-ahead window in sectors (0 = random access). */
+    uint64_t hits;
+    uint64_t misses;
+} disk_cache_state_t;
+
+#define STORAGE_LATENCY_BUCKETS 24 /**< Bucket i counts latencies of [2^i, 2^(i+1)) us, the first and last are open-ended. */
+
+/**
+ * @brief Per-disk I/O statistics, see iostat.c.
+ */
+typedef struct {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t flushes;
+    uint64_t read_sectors;
+    uint64_t write_sectors;
+    uint64_t read_ns;           /**< Sum of the read latencies. */
+    uint64_t write_ns;          /**< Sum of the write latencies. */
+    uint64_t errors;
+    uint64_t busy_ns;           /**< Time with at least one request in flight, up to busy_since. */
+    uint64_t busy_since;        /**< Start of the current busy period. */
+    uint32_t in_flight;
+    uint32_t latency_hist[STORAGE_LATENCY_BUCKETS];
+} disk_stats_t;
+
+typedef enum {
+    STORAGE_OP_READ,
+    STORAGE_OP_WRITE,
+    STORAGE_OP_FLUSH
+} storage_op_t;
+
+struct disk;
+
+/**
+ * @brief An asynchronous device request, see storage_submit().
+ * @note The request must stay valid until it is done.
+ */
+typedef struct storage_request {
+    struct disk* disk;
+    storage_op_t op;
+    uint64_t lba;
+    uint32_t count;
+    void* buffer;
+    uint32_t flags;                 /**< STORAGE_WRITE_* / STORAGE_REQ_* flags. */
+
+    volatile bool done;
+    volatile uint8_t status;        /**< 0 on success, valid once done is set. */
+    void (*complete)(struct storage_request* req); /**< Called from interrupt context when done, may be NULL. */
+    void* private;                  /**< Owned by the submitter. */
+
+    struct storage_request* next;   /**< Driver queue link. */
+    uint32_t issued;                /**< Driver bookkeeping: sectors handed to the device so far. */
+    uint32_t pending;               /**< Driver bookkeeping: device commands still outstanding. */
+    uint64_t start_ns;              /**< Set by storage_submit() for the I/O statistics. */
+    bool accounted;                 /**< Counted in the disk statistics when it completes. */
+} storage_request_t;
+
 typedef struct disk {
     char name[32];
     uint64_t total_sectors;
     uint32_t sector_size;
     disk_type_t type;
+    uint32_t flags;
 
     uint8_t (*read)(struct disk* self, uint64_t lba, uint32_t count, void* buffer);
-    uint8_t (*write)(struct disk* self, uint64_t lba, uint32_t count, const void* buffer);
+    uint8_t (*write)(struct disk* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags);
+    uint8_t (*flush)(struct disk* self); /**< Commits the volatile write cache of the device, may be NULL. */
+    uint8_t (*submit)(struct disk* self, storage_request_t* req); /**< Queues a request without waiting, may be NULL. */
+    void (*kick)(struct disk* self); /**< Notifies the device of requests queued with STORAGE_REQ_MORE, may be NULL. */
+    void (*dump)(struct disk* self); /**< Prints driver specific details for storage_dump_disk(), may be NULL. */
+
+    disk_cache_state_t cache;
+    disk_stats_t stats;
 } disk_t;
 
 void storage_init();
 disk_t* storage_get_disk(uint8_t index);
-void storage_register_disk(disk_t* disk);
+uint8_t storage_register_disk(disk_t* disk);
 uint8_t storage_get_disk_count();
 uint8_t storage_read(disk_t* disk, uint64_t lba, uint32_t count, void* buffer);
 uint8_t storage_write(disk_t* disk, uint64_t lba, uint32_t count, const void* buffer);
+uint8_t storage_write_flags(disk_t* disk, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags);
+uint8_t storage_flush(disk_t* disk);
+uint8_t storage_sync();
+uint8_t storage_submit(disk_t* disk, storage_request_t* req);
+void storage_kick(disk_t* disk);
+uint8_t storage_wait(storage_request_t* req);
+void storage_complete(storage_request_t* req, uint8_t status);
 void storage_dump_disk(disk_t* disk);
 void storage_dump_info();
\ No newline at end of file
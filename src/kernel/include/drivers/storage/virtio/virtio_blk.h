@@ -0,0 +1,110 @@
+/**
+ * @file virtio_blk.h
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <storage.h>
+#include <pci.h>
+
+// Legacy virtio PCI registers (offsets from the I/O BAR0)
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES 0x04
+#define VIRTIO_REG_QUEUE_PFN 0x08
+#define VIRTIO_REG_QUEUE_SIZE 0x0C
+#define VIRTIO_REG_QUEUE_SELECT 0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10
+#define VIRTIO_REG_DEVICE_STATUS 0x12
+#define VIRTIO_REG_ISR_STATUS 0x13
+#define VIRTIO_REG_DEVICE_CONFIG 0x14 // without MSI-X
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+#define VIRTIO_BLK_F_RO (1 << 5)
+#define VIRTIO_BLK_F_FLUSH (1 << 9)
+#define VIRTIO_RING_F_INDIRECT_DESC (1 << 28)
+#define VIRTIO_RING_F_EVENT_IDX (1 << 29)
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_S_OK 0
+
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2 // device writes to the buffer
+#define VIRTQ_DESC_F_INDIRECT 4
+#define VIRTQ_USED_F_NO_NOTIFY 1
+
+#define VIRTIO_BLK_MAX_DEVICES 4
+#define VIRTIO_MAX_QUEUE_SIZE 256
+#define VIRTIO_VQ_MAX_BYTES 12288       // split virtqueue of VIRTIO_MAX_QUEUE_SIZE entries
+#define VIRTIO_BLK_MAX_SLOTS 32         // requests in flight, one ring descriptor each
+#define VIRTIO_BLK_INDIRECT_ENTRIES 64  // header + data segments + status
+#define VIRTIO_BLK_MAX_SECTORS 256      // per command
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[]; // followed by used_event
+} virtq_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} virtq_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem_t ring[]; // followed by avail_event
+} virtq_used_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed)) virtio_blk_req_hdr_t;
+
+typedef struct {
+    disk_t base;
+    uint16_t io_base;
+    uint8_t index;
+    uint8_t irq;
+    bool event_idx;
+    bool flush;
+
+    uint16_t queue_size;
+    volatile virtq_desc_t* desc;
+    volatile virtq_avail_t* avail;
+    volatile virtq_used_t* used;
+    uint16_t avail_idx;   // next avail index, published to the device on kick
+    uint16_t kicked_idx;  // avail index at the last kick
+    uint16_t last_used;
+
+    uint16_t slots;
+    uint32_t slot_used;
+    storage_request_t* slot_req[VIRTIO_BLK_MAX_SLOTS];
+
+    storage_request_t* wait_head; // requests not yet (completely) handed to the device
+    storage_request_t* wait_tail;
+} virtio_blk_t;
+
+void virtio_blk_init_device(pci_device_t* dev);
+uint8_t virtio_blk_submit(disk_t* self, storage_request_t* req);
+void virtio_blk_kick_disk(disk_t* self);
+uint8_t virtio_blk_read_sectors(disk_t* self, uint64_t lba, uint32_t count, void* buffer);
+uint8_t virtio_blk_write_sectors(disk_t* self, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags);
+uint8_t virtio_blk_flush(disk_t* self);
@@ -0,0 +1,49 @@
+/**
+ * @file zram.h
+ * @brief Compressed RAM disks
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <storage.h>
+
+#define ZRAM_MAX_DISKS 4
+#define ZRAM_SECTOR_SIZE 512
+#define ZRAM_PAGE_SIZE 4096
+#define ZRAM_SECTORS_PER_PAGE (ZRAM_PAGE_SIZE / ZRAM_SECTOR_SIZE)
+#define ZRAM_MAX_SIZE_MB 2048
+#define ZRAM_HUGE_THRESHOLD (ZRAM_PAGE_SIZE * 3 / 4) /**< Pages that compress worse than this are stored raw. */
+
+#define ZRAM_FLAG_SAME (1 << 0) /**< Every word of the page is fill, nothing is allocated. */
+#define ZRAM_FLAG_HUGE (1 << 1) /**< The page did not compress and is stored as is. */
+
+/**
+ * @brief The stored form of one page, an empty entry reads as zeros.
+ */
+typedef struct {
+    union {
+        uint8_t* data;  /**< LZ4 block, or the raw page if ZRAM_FLAG_HUGE. */
+        uint32_t fill;  /**< Repeated word if ZRAM_FLAG_SAME. */
+    };
+    uint16_t size;      /**< Bytes allocated for data. */
+    uint8_t flags;
+} zram_entry_t;
+
+/**
+ * @brief A compressed RAM disk.
+ */
+typedef struct {
+    disk_t base;
+    zram_entry_t* table;
+    uint32_t page_count;
+    uint32_t stored_pages;     /**< Pages with allocated data, including huge pages. */
+    uint32_t same_pages;
+    uint32_t huge_pages;
+    uint32_t compressed_bytes; /**< Sum of the data sizes. */
+} zram_t;
+
+void zram_init(void);
+disk_t* zram_create(uint32_t size);
@@ -11,6 +11,7 @@
 
 #define TIMER_FREQUENCY 60 /**< PIT frequency in Hz. */
 #define TIMER_MAX_EVENTS 64 /**< Maximum number of concurrent timer events. */
+#define TIMER_TSC_CALIBRATION_TICKS 6 /**< PIT ticks the TSC is measured against at boot (100 ms). */
 
 /**
  * @brief Structure representing a timed event.
@@ -30,3 +31,4 @@ uint32_t timer_add_event(event_t event);
 void timer_remove_event(uint32_t event_id);
 uint32_t timer_get_ticks(void);
 void sleep_ms(uint32_t ms);
+uint64_t timer_get_ns(void);
@@ -15,3 +15,4 @@ char* ustr_to_str(const uint32_t* ustr, char* buffer, size_t buffer_size);
 uint64_t str_to_u64(const uint32_t* str);
 uint64_t str_to_u64_legacy(const char* str);
 uint8_t bcd_to_dezimal(uint8_t bcd);
+uint32_t div64_32(uint64_t* dividend, uint32_t divisor);
@@ -15,3 +15,5 @@ void outl(uint16_t port, uint32_t value);
 uint32_t inl(uint16_t port);
 void outsw(uint16_t port, const void* buffer, uint32_t count);
 void insw(uint16_t port, void* buffer, uint32_t count);
+void outsl(uint16_t port, const void* buffer, uint32_t count);
+void insl(uint16_t port, void* buffer, uint32_t count);
@@ -0,0 +1,18 @@
+/**
+ * @file lz4.h
+ * @brief LZ4 block format compression
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define LZ4_MAX_INPUT 65536 // match offsets are tracked in 16 bits
+#define LZ4_HASH_LOG 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // the last 5 bytes are always literals
+#define LZ4_MFLIMIT 12      // no match may start in the last 12 bytes
+
+uint32_t lz4_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_capacity);
+int32_t lz4_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_capacity);
@@ -0,0 +1,49 @@
+/**
+ * @file swap.h
+ * @brief Pageable anonymous memory and swapping
+ * @author friedrichOsDev
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <vmm.h>
+#include <storage.h>
+
+#define SWAP_PAGE_SIZE VMM_PAGE_SIZE
+#define SWAP_ANON_PAGES ((VMM_ANON_END + 1 - VMM_ANON_BASE) / VMM_PAGE_SIZE)
+#define SWAP_MAX_SLOTS (1 << 20)     /**< Slot numbers are kept in bits 12-31 of a page table entry. */
+#define SWAP_RECLAIM_BATCH 32        /**< Pages freed per reclaim at least, so a run of allocations does not scan for every page. */
+#define SWAP_WINDOW_OUT 11           /**< Zero window slot used to write pages out. */
+#define SWAP_WINDOW_IN 12            /**< Zero window slot used to read pages in. */
+
+#define SWAP_ANON_RESERVED (1 << 0)  /**< The page belongs to an allocation. */
+#define SWAP_ANON_LAST (1 << 1)      /**< Last page of an allocation. */
+
+/**
+ * @brief State of one page of the anonymous memory window.
+ */
+typedef struct {
+    uint32_t slot;   /**< Swap slot holding a copy of the page, 0 if none. */
+    uint16_t pins;   /**< The page is kept resident while non-zero. */
+    uint8_t flags;
+} swap_anon_page_t;
+
+typedef struct {
+    uint64_t swap_outs;         /**< Pages written to the swap device. */
+    uint64_t swap_ins;          /**< Pages read back from the swap device. */
+    uint64_t clean_drops;       /**< Pages evicted without I/O, their slot was still up to date. */
+    uint64_t zero_fills;        /**< First touches of a page. */
+    uint64_t reclaim_failures;  /**< Reclaims that could not free a single page. */
+} swap_stats_t;
+
+void swap_init(void);
+uint8_t swap_on(disk_t* disk);
+virt_addr_t swap_alloc_anon(size_t size);
+void swap_free_anon(virt_addr_t addr);
+uint8_t swap_pin(virt_addr_t addr, size_t size);
+void swap_unpin(virt_addr_t addr, size_t size);
+uint32_t swap_reclaim(uint32_t count);
+void swap_dump_info(void);
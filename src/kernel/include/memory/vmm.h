@@ -25,6 +25,9 @@
 
 #define VMM_PAGE_MASK 0xFFFFF000
 
+#define VMM_PAGE_SWAPPED         0b1000000000 /**< Available to the OS: a not present page whose content is in a swap slot (bits 12-31). */
+#define VMM_PAGE_DIRTY           0b01000000
+#define VMM_PAGE_ACCESSED        0b00100000
 #define VMM_PAGE_CACHE_DISABLED  0b00010000
 #define VMM_PAGE_WRITE_THROUGH   0b00001000
 #define VMM_PAGE_USER_SUPERVISOR 0b00000100
@@ -42,7 +45,15 @@
 #define VMM_FRAMEBUFFER_END      0xEFFFFFFF
 #define VMM_MMIO_BASE            0xF0000000
 #define VMM_MMIO_END             (VMM_MMIO_BASE + 0x01FFFFFF) // 32MB for MMIO (including ACPI)
-#define VMM_RESERVED_BASE        (VMM_MMIO_END + 1)
+#define VMM_RAMDISK_BASE         (VMM_MMIO_END + 1)
+#define VMM_RAMDISK_END          (VMM_RAMDISK_BASE + 0x07FFFFFF) // 128MB for RAM disks
+#define VMM_ANON_BASE            (VMM_RAMDISK_END + 1)
+#define VMM_ANON_END             (VMM_ANON_BASE + 0x03FFFFFF) // 64MB of pageable anonymous memory, see swap.c
+#define VMM_PCACHE_BASE          (VMM_ANON_END + 1)
+#define VMM_PCACHE_END           (VMM_PCACHE_BASE + 0x00BFFFFF) // 12MB, every page of the file page cache, see pcache.c
+#define VMM_MMAP_BASE            (VMM_PCACHE_END + 1)
+#define VMM_MMAP_END             (VMM_MMAP_BASE + 0x007FFFFF) // 8MB of file mappings made by vfs_mmap()
+#define VMM_RESERVED_BASE        (VMM_MMAP_END + 1)
 #define VMM_RESERVED_END         VMM_ZERO_WINDOW - 1
 #define VMM_ZERO_WINDOW_BASE     VMM_ZERO_WINDOW
 #define VMM_RECURSIVE_BASE       VMM_TABLES_BASE
@@ -80,6 +91,7 @@ void vmm_map_page(page_directory_t* dir, virt_addr_t virtual_address, phys_addr_
 void vmm_unmap_page(page_directory_t* dir, virt_addr_t virtual_address);
 void vmm_map_pages(page_directory_t* dir, virt_addr_t virtual_start_address, phys_addr_t physical_start_address, uint32_t flags, uint32_t count);
 void vmm_unmap_pages(page_directory_t* dir, virt_addr_t virtual_start_address, uint32_t count);
+uint32_t* vmm_get_page_entry(virt_addr_t virtual_address, bool create);
 bool vmm_is_region_free(page_directory_t* dir, virt_addr_t start, uint32_t count);
 phys_addr_t vmm_virtual_to_physical(page_directory_t* dir, virt_addr_t virtual_address);
 page_directory_t* vmm_get_page_directory(void);
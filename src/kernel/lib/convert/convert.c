@@ -41,7 +41,7 @@ static void reverse_str_legacy(char* str, int length) {
  * @param divisor Die 32-Bit Basis (Divisor).
  * @return uint32_t Der Rest der Division.
  */
-static uint32_t div64_32(uint64_t* dividend, uint32_t divisor) {
+uint32_t div64_32(uint64_t* dividend, uint32_t divisor) {
     uint32_t high = (uint32_t)(*dividend >> 32);
     uint32_t low = (uint32_t)(*dividend & 0xFFFFFFFF);
     uint32_t rem;
@@ -96,3 +96,30 @@ void outsw(uint16_t port, const void* buffer, uint32_t count) {
 void insw(uint16_t port, void* buffer, uint32_t count) {
     __asm__ __volatile__ ("cld; rep insw" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
 }
+
+
+/**
+ * @brief Sends a buffer of 32-bit double words to an I/O port.
+ * 
+ * Uses the 'rep outsl' instruction to send multiple double words.
+ * 
+ * @param port The I/O port address.
+ * @param buffer Pointer to the source buffer.
+ * @param count Number of double words to send.
+ */
+void outsl(uint16_t port, const void* buffer, uint32_t count) {
+    __asm__ __volatile__ ("cld; rep outsl" : "+S"(buffer), "+c"(count) : "d"(port));
+}
+
+/**
+ * @brief Reads a buffer of 32-bit double words from an I/O port.
+ * 
+ * Uses the 'rep insl' instruction to read multiple double words.
+ * 
+ * @param port The I/O port address.
+ * @param buffer Pointer to the destination buffer.
+ * @param count Number of double words to read.
+ */
+void insl(uint16_t port, void* buffer, uint32_t count) {
+    __asm__ __volatile__ ("cld; rep insl" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
+}
\ No newline at end of file
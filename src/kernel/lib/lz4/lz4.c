@@ -0,0 +1,180 @@
+/**
+ * @file lz4.c
+ * @brief LZ4 block format compression
+ * @author friedrichOsDev
+ *
+ * A greedy single-pass compressor with a hash table of recent positions,
+ * and a bounds-checked decompressor. The output is a plain LZ4 block
+ * (no frame header), readable by any LZ4 implementation.
+ */
+
+#include <lz4.h>
+#include <string.h>
+
+static uint16_t hash_table[1 << LZ4_HASH_LOG];
+
+static inline uint32_t lz4_read32(const uint8_t* p) {
+    return *(const uint32_t*)p; // x86 handles unaligned loads
+}
+
+static inline uint32_t lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+/**
+ * @brief Writes the extra bytes of a literal or match length of 15 or more.
+ */
+static inline uint8_t* lz4_write_length(uint8_t* op, uint32_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+/**
+ * @brief Compresses a buffer of at most LZ4_MAX_INPUT bytes.
+ * @return The compressed size, or 0 if it does not fit into dst_capacity bytes.
+ */
+uint32_t lz4_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_capacity) {
+    if (src_len > LZ4_MAX_INPUT) return 0;
+
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_capacity;
+
+    if (src_len > LZ4_MFLIMIT) {
+        const uint8_t* mflimit = end - LZ4_MFLIMIT;
+        const uint8_t* matchlimit = end - LZ4_LAST_LITERALS;
+
+        memset32(hash_table, 0, sizeof(hash_table) / sizeof(uint32_t));
+        ip++;
+
+        while (ip < mflimit) {
+            uint32_t sequence = lz4_read32(ip);
+            uint32_t h = lz4_hash(sequence);
+            const uint8_t* ref = src + hash_table[h];
+            hash_table[h] = (uint16_t)(ip - src);
+
+            // empty slots point at src, the compare filters them out like any other collision
+            if (ip - ref > 65535 || lz4_read32(ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            const uint8_t* match_end = ip + LZ4_MIN_MATCH;
+            const uint8_t* ref_end = ref + LZ4_MIN_MATCH;
+            while (match_end < matchlimit && *match_end == *ref_end) {
+                match_end++;
+                ref_end++;
+            }
+
+            uint32_t literals = (uint32_t)(ip - anchor);
+            uint32_t match_length = (uint32_t)(match_end - ip) - LZ4_MIN_MATCH;
+            if (op + 1 + literals + literals / 255 + 1 + 2 + match_length / 255 + 1 > oend) return 0;
+
+            uint8_t* token = op++;
+            if (literals >= 15) {
+                *token = 15 << 4;
+                op = lz4_write_length(op, literals - 15);
+            } else {
+                *token = (uint8_t)(literals << 4);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+
+            if (match_length >= 15) {
+                *token |= 15;
+                op = lz4_write_length(op, match_length - 15);
+            } else {
+                *token |= (uint8_t)match_length;
+            }
+
+            ip = match_end;
+            anchor = ip;
+        }
+    }
+
+    uint32_t literals = (uint32_t)(end - anchor);
+    if (op + 1 + literals + literals / 255 + 1 > oend) return 0;
+
+    uint8_t* token = op++;
+    if (literals >= 15) {
+        *token = 15 << 4;
+        op = lz4_write_length(op, literals - 15);
+    } else {
+        *token = (uint8_t)(literals << 4);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    return (uint32_t)(op - dst);
+}
+
+/**
+ * @brief Decompresses an LZ4 block.
+ * @return The decompressed size, or -1 if the input is malformed or does not fit into dst_capacity bytes.
+ */
+int32_t lz4_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_capacity;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        uint32_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (uint32_t)(iend - ip) || literals > (uint32_t)(oend - op)) return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // the last sequence has no match
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return -1;
+        uint32_t offset = ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) return -1;
+
+        uint32_t match_length = token & 15;
+        if (match_length == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                match_length += b;
+            } while (b == 255);
+        }
+        match_length += LZ4_MIN_MATCH;
+        if (match_length > (uint32_t)(oend - op)) return -1;
+
+        // byte by byte, the match may overlap the bytes it produces
+        const uint8_t* match = op - offset;
+        for (uint32_t i = 0; i < match_length; i++) op[i] = match[i];
+        op += match_length;
+    }
+
+    return (int32_t)(op - dst);
+}
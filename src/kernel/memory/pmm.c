@@ -9,6 +9,8 @@
 #include <panic.h>
 #include <string.h>
 #include <vmm.h>
+#include <swap.h>
+#include <pcache.h>
 
 static pmm_state_t pmm_state;
 extern uint8_t boot_page_directory[];
@@ -61,6 +63,13 @@ void pmm_init(void) {
                 if (candidate < kernel_end) candidate = kernel_end;
             }
 
+            // Boot modules are still needed after the PMM is up (the bootloader loads them in ascending order)
+            for (uint32_t m = 0; m < kernel_modules.count; m++) {
+                phys_addr_t module_start = PMM_ALIGN_DOWN(kernel_modules.entries[m].phys_start);
+                phys_addr_t module_end = PMM_ALIGN_UP(kernel_modules.entries[m].phys_end);
+                if (candidate < module_end && (candidate + bitmap_size) > module_start) candidate = module_end;
+            }
+
             // Check if candidate still fits in the block
             if ((uint64_t)candidate + bitmap_size > block_end) continue;
 
@@ -87,8 +96,8 @@ void pmm_init(void) {
         }
     }
 
-    // lock kernel + boot page dir/table && bitmap && framebuffer && multiboot structure && (later acpi __TODO__)
-    serial_printf("PMM: Locking kernel, bitmap, framebuffer, and multiboot structure\n");
+    // lock kernel + boot page dir/table && bitmap && framebuffer && multiboot structure && boot modules && (later acpi __TODO__)
+    serial_printf("PMM: Locking kernel, bitmap, framebuffer, multiboot structure, and boot modules\n");
     phys_addr_t kernel_start_aligned = PMM_ALIGN_DOWN(KERNEL_START_PHYS);
     phys_addr_t kernel_end_aligned = PMM_ALIGN_UP(KERNEL_END_PHYS);
     pmm_lock_pages(kernel_start_aligned, (kernel_end_aligned - kernel_start_aligned) / PMM_PAGE_SIZE);
@@ -110,6 +119,12 @@ void pmm_init(void) {
     phys_addr_t multiboot_end_aligned = PMM_ALIGN_UP((phys_addr_t)kernel_multiboot_info + kernel_multiboot_info->total_size);
     pmm_lock_pages(multiboot_start_aligned, (multiboot_end_aligned - multiboot_start_aligned) / PMM_PAGE_SIZE);
 
+    for (uint32_t i = 0; i < kernel_modules.count; i++) {
+        phys_addr_t module_start_aligned = PMM_ALIGN_DOWN(kernel_modules.entries[i].phys_start);
+        phys_addr_t module_end_aligned = PMM_ALIGN_UP(kernel_modules.entries[i].phys_end);
+        pmm_lock_pages(module_start_aligned, (module_end_aligned - module_start_aligned) / PMM_PAGE_SIZE);
+    }
+
     pmm_lock_pages(0x00000000, 256);
 
     serial_printf("PMM: Initialized with max address %x, total pages: %d\n", max_addr, pmm_state.max_pages);
@@ -182,16 +197,10 @@ void pmm_zfree_page(phys_addr_t addr) {
 }
 
 /**
- * @brief Allocates a contiguous range of physical pages.
- * @param count The number of pages to allocate.
- * @return The physical address of the first page, or 0 on failure.
+ * @brief Searches the bitmap for a contiguous range of free pages and locks it.
+ * @return The physical address of the first page, or 0 if there is none.
  */
-phys_addr_t pmm_alloc_pages(size_t count) {
-    if (count == 0 || count > pmm_state.max_pages) {
-        serial_printf("PMM: Error: Invalid page count %d for allocation\n", count);
-        return 0;
-    }
-
+static phys_addr_t pmm_find_pages(size_t count) {
     uint32_t* bitmap32 = (uint32_t*)pmm_state.bitmap;
     uint32_t max_blocks = (pmm_state.max_pages / 8) / 4;
 
@@ -240,6 +249,25 @@ phys_addr_t pmm_alloc_pages(size_t count) {
     return 0;
 }
 
+/**
+ * @brief Allocates a contiguous range of physical pages.
+ *
+ * When no range is free, unused pages of the file page cache are freed, or
+ * else cold anonymous pages are swapped out, and the search is retried once.
+ * @param count The number of pages to allocate.
+ * @return The physical address of the first page, or 0 on failure.
+ */
+phys_addr_t pmm_alloc_pages(size_t count) {
+    if (count == 0 || count > pmm_state.max_pages) {
+        serial_printf("PMM: Error: Invalid page count %d for allocation\n", count);
+        return 0;
+    }
+
+    phys_addr_t addr = pmm_find_pages(count);
+    if (!addr && (pcache_reclaim(count) > 0 || swap_reclaim(count) > 0)) addr = pmm_find_pages(count);
+    return addr;
+}
+
 /**
  * @brief Frees a contiguous range of physical pages.
  * @param addr The physical address of the first page.
@@ -0,0 +1,460 @@
+/**
+ * @file swap.c
+ * @brief Pageable anonymous memory and swapping
+ * @author friedrichOsDev
+ *
+ * Memory from swap_alloc_anon() lives in its own window and is filled on the
+ * first touch by the page fault handler. When the PMM runs out it asks
+ * swap_reclaim() for pages: a clock sweep over the window skips pages whose
+ * accessed bit is set (clearing it for the next round) and evicts the rest to
+ * the swap device. An evicted page's table entry is left not present with
+ * VMM_PAGE_SWAPPED and its slot number, and the next touch reads it back.
+ * A page keeps its slot after swap-in, so evicting it again without having
+ * written to it needs no I/O.
+ *
+ * The kernel heap is not pageable, its block headers are walked on every
+ * kmalloc. Anonymous pages may only be touched with interrupts enabled,
+ * anything used from interrupt context or for DMA must be pinned.
+ */
+
+#include <swap.h>
+#include <memory.h>
+#include <string.h>
+#include <serial.h>
+#include <console.h>
+#include <print.h>
+#include <panic.h>
+#include <kernel.h>
+#include <cpu.h>
+#include <handler.h>
+#include <bcache.h>
+#include <pcache.h>
+#include <partman.h>
+
+static swap_anon_page_t* anon_pages = NULL;
+static uint32_t reserved_pages = 0;
+static uint32_t resident_pages = 0;
+static uint32_t clock_hand = 0;
+
+static disk_t* swap_disk = NULL;
+static uint32_t sectors_per_slot = 0;
+static uint32_t slot_count = 0;
+static uint32_t used_slots = 0;
+static uint32_t* slot_bitmap = NULL;
+static uint32_t slot_hint = 0;
+
+static bool reclaiming = false;
+static swap_stats_t stats;
+
+static inline virt_addr_t swap_anon_addr(uint32_t index) {
+    return VMM_ANON_BASE + index * SWAP_PAGE_SIZE;
+}
+
+/**
+ * @brief Allocates a swap slot.
+ * @return The slot number, or 0 if the swap device is full.
+ */
+static uint32_t swap_alloc_slot(void) {
+    uint32_t words = (slot_count + 31) / 32;
+    for (uint32_t i = 0; i < words; i++) {
+        uint32_t word = (slot_hint + i) % words;
+        if (slot_bitmap[word] == 0xFFFFFFFF) continue;
+
+        for (uint32_t bit = 0; bit < 32; bit++) {
+            uint32_t slot = word * 32 + bit;
+            if (slot >= slot_count) break;
+            if (!(slot_bitmap[word] & (1u << bit))) {
+                slot_bitmap[word] |= 1u << bit;
+                slot_hint = word;
+                used_slots++;
+                return slot;
+            }
+        }
+    }
+    return 0;
+}
+
+static void swap_free_slot(uint32_t slot) {
+    slot_bitmap[slot / 32] &= ~(1u << (slot % 32));
+    used_slots--;
+}
+
+/**
+ * @brief Transfers one page between a zero window slot and a swap slot.
+ *
+ * The request bypasses the block cache, which would only keep a second copy.
+ */
+static uint8_t swap_io(storage_op_t op, uint32_t slot, uint32_t window) {
+    storage_request_t req = {
+        .disk = swap_disk,
+        .op = op,
+        .lba = (uint64_t)slot * sectors_per_slot,
+        .count = sectors_per_slot,
+        .buffer = (void*)(VMM_ZERO_WINDOW + window * VMM_PAGE_SIZE),
+        .flags = 0
+    };
+
+    uint8_t res = storage_submit(swap_disk, &req);
+    if (res != 0) return res;
+    return storage_wait(&req);
+}
+
+/**
+ * @brief Writes a resident page to its swap slot and frees its frame.
+ * @return true if the page was evicted.
+ */
+static bool swap_evict(uint32_t index) {
+    virt_addr_t vaddr = swap_anon_addr(index);
+    swap_anon_page_t* page = &anon_pages[index];
+    uint32_t* pte = vmm_get_page_entry(vaddr, false);
+    uint32_t entry = *pte;
+    phys_addr_t phys = entry & VMM_PAGE_MASK;
+
+    if (page->slot && !(entry & VMM_PAGE_DIRTY)) {
+        // unchanged since it was read in, the slot still holds it
+        *pte = (page->slot << 12) | VMM_PAGE_SWAPPED;
+        flush_tlb(vaddr);
+        stats.clean_drops++;
+    } else {
+        uint32_t slot = page->slot ? page->slot : swap_alloc_slot();
+        if (!slot) return false;
+
+        // unmapped before the write, so the page cannot change while it is on its way out
+        *pte = (slot << 12) | VMM_PAGE_SWAPPED;
+        flush_tlb(vaddr);
+
+        vmm_prepare_zero_window(phys, SWAP_WINDOW_OUT);
+        if (swap_io(STORAGE_OP_WRITE, slot, SWAP_WINDOW_OUT) != 0) {
+            serial_printf("Swap: Error: Writing page %x to slot %u failed\n", vaddr, slot);
+            *pte = entry;
+            flush_tlb(vaddr);
+            if (!page->slot) swap_free_slot(slot);
+            return false;
+        }
+        page->slot = slot;
+        stats.swap_outs++;
+    }
+
+    pmm_free_page(phys);
+    resident_pages--;
+    return true;
+}
+
+/**
+ * @brief Makes an anonymous page resident, reading it from swap or zero filling it.
+ */
+static uint8_t swap_fault_in(uint32_t index) {
+    virt_addr_t vaddr = swap_anon_addr(index);
+
+    phys_addr_t phys = pmm_alloc_page();
+    if (!phys) {
+        serial_printf("Swap: Error: No memory to fault in page %x\n", vaddr);
+        return 1;
+    }
+
+    uint32_t* pte = vmm_get_page_entry(vaddr, true);
+    if (!pte) {
+        pmm_free_page(phys);
+        return 1;
+    }
+
+    vmm_prepare_zero_window(phys, SWAP_WINDOW_IN);
+    if (*pte & VMM_PAGE_SWAPPED) {
+        if (swap_io(STORAGE_OP_READ, *pte >> 12, SWAP_WINDOW_IN) != 0) {
+            serial_printf("Swap: Error: Reading page %x from slot %u failed\n", vaddr, *pte >> 12);
+            pmm_free_page(phys);
+            return 1;
+        }
+        stats.swap_ins++;
+    } else {
+        memset32((void*)(VMM_ZERO_WINDOW + SWAP_WINDOW_IN * VMM_PAGE_SIZE), 0, VMM_PAGE_SIZE / sizeof(uint32_t));
+        stats.zero_fills++;
+    }
+
+    *pte = phys | VMM_PAGE_PRESENT | VMM_PAGE_READ_WRITE;
+    flush_tlb(vaddr);
+    resident_pages++;
+    return 0;
+}
+
+static void swap_page_fault(struct registers* regs) {
+    virt_addr_t addr = cpu_read_cr2();
+
+    // error code bit 0 is clear for accesses to pages that are not present
+    if (!(regs->err_code & 1) && addr >= VMM_ANON_BASE && addr <= VMM_ANON_END) {
+        uint32_t index = (addr - VMM_ANON_BASE) / SWAP_PAGE_SIZE;
+        if (anon_pages[index].flags & SWAP_ANON_RESERVED) {
+            if (!(regs->eflags & CPU_EFLAGS_IF)) {
+                serial_printf("Swap: Error: Page %x touched with interrupts disabled (EIP %x), it must be pinned\n", addr, regs->eip);
+                kernel_panic("Unpinned anonymous page touched with interrupts disabled", addr);
+            }
+
+            // the faulting code ran with interrupts enabled, so can the I/O resolving the fault
+            cpu_sti();
+            if (swap_fault_in(index) == 0) return;
+            kernel_panic("Failed to fault in anonymous page", addr);
+        }
+    }
+
+    // file mappings of vfs_mmap() are filled the same way, by the page cache
+    if (!(regs->err_code & 1) && addr >= VMM_MMAP_BASE && addr <= VMM_MMAP_END) {
+        if (!(regs->eflags & CPU_EFLAGS_IF)) {
+            serial_printf("Swap: Error: Mapped file page %x touched with interrupts disabled (EIP %x)\n", addr, regs->eip);
+            kernel_panic("Mapped file page touched with interrupts disabled", addr);
+        }
+        cpu_sti();
+        if (pcache_fault(addr)) return;
+    }
+
+    serial_printf("Page fault at %x (EIP: %x, Error Code: %x)\n", addr, regs->eip, regs->err_code);
+    serial_printf("DS: %x, EDI: %x, ESI: %x, EBP: %x, ESP: %x, EBX: %x, EDX: %x, ECX: %x, EAX: %x\n",
+                  regs->ds, regs->edi, regs->esi, regs->ebp, regs->esp,
+                  regs->ebx, regs->edx, regs->ecx, regs->eax);
+    kernel_panic("Page fault", addr);
+}
+
+/**
+ * @brief Evicts cold anonymous pages.
+ *
+ * Called by the PMM when it is out of pages. Does nothing without a swap
+ * device, with interrupts disabled (the I/O needs them) and while a reclaim
+ * is already running (the swap device driver may allocate memory).
+ * @param count Pages wanted, at least SWAP_RECLAIM_BATCH are freed if possible.
+ * @return The number of pages freed.
+ */
+uint32_t swap_reclaim(uint32_t count) {
+    if (!swap_disk || reclaiming || resident_pages == 0) return 0;
+
+    uint32_t irq_flags = cpu_irq_save();
+    cpu_irq_restore(irq_flags);
+    if (!(irq_flags & CPU_EFLAGS_IF)) return 0;
+
+    reclaiming = true;
+    if (count < SWAP_RECLAIM_BATCH) count = SWAP_RECLAIM_BATCH;
+
+    // two rounds at most: the first may only clear accessed bits
+    uint32_t freed = 0;
+    for (uint32_t scanned = 0; scanned < 2 * SWAP_ANON_PAGES && freed < count; scanned++) {
+        uint32_t index = clock_hand;
+        clock_hand = (clock_hand + 1) % SWAP_ANON_PAGES;
+
+        swap_anon_page_t* page = &anon_pages[index];
+        if (!(page->flags & SWAP_ANON_RESERVED) || page->pins) continue;
+
+        virt_addr_t vaddr = swap_anon_addr(index);
+        uint32_t* pte = vmm_get_page_entry(vaddr, false);
+        if (!pte || !(*pte & VMM_PAGE_PRESENT)) continue;
+
+        if (*pte & VMM_PAGE_ACCESSED) {
+            *pte &= ~VMM_PAGE_ACCESSED;
+            flush_tlb(vaddr);
+            continue;
+        }
+
+        if (swap_evict(index)) freed++;
+    }
+
+    reclaiming = false;
+    if (freed == 0) stats.reclaim_failures++;
+    return freed;
+}
+
+/**
+ * @brief Reserves pageable memory, backed by frames only once it is touched.
+ * @param size Size in bytes, rounded up to whole pages.
+ * @return The page aligned start of the memory, or 0 if the window is full.
+ */
+virt_addr_t swap_alloc_anon(size_t size) {
+    if (!anon_pages || size == 0) return 0;
+
+    uint32_t pages = (size + SWAP_PAGE_SIZE - 1) / SWAP_PAGE_SIZE;
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < SWAP_ANON_PAGES; i++) {
+        if (anon_pages[i].flags & SWAP_ANON_RESERVED) {
+            run = 0;
+            continue;
+        }
+        if (++run < pages) continue;
+
+        uint32_t start = i + 1 - pages;
+        for (uint32_t j = start; j <= i; j++) anon_pages[j].flags = SWAP_ANON_RESERVED;
+        anon_pages[i].flags |= SWAP_ANON_LAST;
+        reserved_pages += pages;
+        return swap_anon_addr(start);
+    }
+
+    serial_printf("Swap: Error: No room for %u anonymous pages\n", pages);
+    return 0;
+}
+
+/**
+ * @brief Releases memory from swap_alloc_anon(), with its frames and swap slots.
+ */
+void swap_free_anon(virt_addr_t addr) {
+    if (!anon_pages || addr < VMM_ANON_BASE || addr > VMM_ANON_END || !VMM_IS_ADDR_ALIGNED(addr)) {
+        serial_printf("Swap: Error: Invalid free of anonymous memory at %x\n", addr);
+        return;
+    }
+
+    uint32_t index = (addr - VMM_ANON_BASE) / SWAP_PAGE_SIZE;
+    while (index < SWAP_ANON_PAGES && (anon_pages[index].flags & SWAP_ANON_RESERVED)) {
+        swap_anon_page_t* page = &anon_pages[index];
+        virt_addr_t vaddr = swap_anon_addr(index);
+
+        uint32_t* pte = vmm_get_page_entry(vaddr, false);
+        if (pte && (*pte & VMM_PAGE_PRESENT)) {
+            pmm_free_page(*pte & VMM_PAGE_MASK);
+            resident_pages--;
+        }
+        if (pte) {
+            *pte = 0; // the page table stays, it is reused by the next allocation
+            flush_tlb(vaddr);
+        }
+        if (page->slot) swap_free_slot(page->slot);
+
+        bool last = page->flags & SWAP_ANON_LAST;
+        memset(page, 0, sizeof(swap_anon_page_t));
+        reserved_pages--;
+        index++;
+        if (last) break;
+    }
+}
+
+static void swap_unpin_pages(uint32_t first, uint32_t count) {
+    for (uint32_t index = first; index < first + count; index++) {
+        if (anon_pages[index].pins > 0) anon_pages[index].pins--;
+    }
+}
+
+/**
+ * @brief Faults in a range of anonymous memory and keeps it resident until swap_unpin().
+ * @note Pins nest, every swap_pin() needs its own swap_unpin().
+ */
+uint8_t swap_pin(virt_addr_t addr, size_t size) {
+    if (!anon_pages || size == 0 || addr < VMM_ANON_BASE || addr + size - 1 > VMM_ANON_END) return 1;
+
+    uint32_t first = (addr - VMM_ANON_BASE) / SWAP_PAGE_SIZE;
+    uint32_t last = (addr + size - 1 - VMM_ANON_BASE) / SWAP_PAGE_SIZE;
+    for (uint32_t index = first; index <= last; index++) {
+        if (!(anon_pages[index].flags & SWAP_ANON_RESERVED)) {
+            swap_unpin_pages(first, index - first);
+            return 1;
+        }
+
+        // pinned first, so faulting in the next page cannot evict it
+        anon_pages[index].pins++;
+        uint32_t* pte = vmm_get_page_entry(swap_anon_addr(index), false);
+        if ((!pte || !(*pte & VMM_PAGE_PRESENT)) && swap_fault_in(index) != 0) {
+            swap_unpin_pages(first, index - first + 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void swap_unpin(virt_addr_t addr, size_t size) {
+    if (!anon_pages || size == 0 || addr < VMM_ANON_BASE || addr + size - 1 > VMM_ANON_END) return;
+
+    uint32_t first = (addr - VMM_ANON_BASE) / SWAP_PAGE_SIZE;
+    uint32_t last = (addr + size - 1 - VMM_ANON_BASE) / SWAP_PAGE_SIZE;
+    swap_unpin_pages(first, last - first + 1);
+}
+
+/**
+ * @brief Makes a disk the swap device.
+ *
+ * Its previous content is lost. The disk must not be used otherwise while it
+ * holds swap, and the swap device cannot be changed once set.
+ */
+uint8_t swap_on(disk_t* disk) {
+    if (!anon_pages) return 1;
+    if (swap_disk) {
+        serial_printf("Swap: Error: %s is already the swap device\n", swap_disk->name);
+        return 1;
+    }
+    if (!disk || !disk->read || !disk->write || disk->sector_size == 0 || SWAP_PAGE_SIZE % disk->sector_size != 0) {
+        serial_printf("Swap: Error: Disk cannot hold swap\n");
+        return 1;
+    }
+
+    uint32_t sectors = SWAP_PAGE_SIZE / disk->sector_size;
+    uint64_t slots = disk->total_sectors;
+    for (uint32_t s = sectors; s > 1; s >>= 1) slots >>= 1; // sectors divides a page, so it is a power of two
+    if (slots > SWAP_MAX_SLOTS) slots = SWAP_MAX_SLOTS;
+    if (slots < 2) {
+        serial_printf("Swap: Error: %s is too small for swap\n", disk->name);
+        return 1;
+    }
+
+    uint32_t* bitmap = (uint32_t*)kzalloc(((uint32_t)slots + 31) / 32 * sizeof(uint32_t));
+    if (!bitmap) return 1;
+
+    // swap I/O bypasses the cache, so nothing cached may be written back over it later;
+    // the cache keys partitions by their parent disk
+    bcache_invalidate_disk(partman_resolve(disk, NULL));
+
+    slot_bitmap = bitmap;
+    slot_bitmap[0] = 1; // slot 0 means "no slot"
+    slot_count = (uint32_t)slots;
+    used_slots = 1;
+    slot_hint = 0;
+    sectors_per_slot = sectors;
+    swap_disk = disk;
+
+    serial_printf("Swap: Using %s with %u slots (%u KB)\n", disk->name, slot_count - 1, (slot_count - 1) * (SWAP_PAGE_SIZE / 1024));
+    return 0;
+}
+
+/**
+ * @brief Sets up the anonymous memory window and the page fault handler, and
+ * enables swap on the disk named with "swap=<disk>" on the kernel command line.
+ */
+void swap_init(void) {
+    anon_pages = (swap_anon_page_t*)kzalloc(SWAP_ANON_PAGES * sizeof(swap_anon_page_t));
+    if (!anon_pages) {
+        serial_printf("Swap: Error: Out of memory for the anonymous page table\n");
+        return;
+    }
+    memset(&stats, 0, sizeof(stats));
+    isr_install_handler(14, swap_page_fault);
+
+    const char* value = kernel_cmdline_get("swap=");
+    if (!value) return;
+
+    char name[32];
+    size_t len = 0;
+    while (value[len] && value[len] != ' ' && len < sizeof(name) - 1) {
+        name[len] = value[len];
+        len++;
+    }
+    name[len] = '\0';
+
+    for (uint8_t i = 0; i < storage_get_disk_count(); i++) {
+        disk_t* disk = storage_get_disk(i);
+        if (strcmp(disk->name, name) == 0) {
+            swap_on(disk);
+            return;
+        }
+    }
+    serial_printf("Swap: Error: swap=%s names no disk\n", name);
+}
+
+void swap_dump_info(void) {
+    char buf[128];
+    if (swap_disk) {
+        snprintf(buf, sizeof(buf), "Swap device:      %s, %u of %u KB used\n", swap_disk->name,
+                 (used_slots - 1) * (SWAP_PAGE_SIZE / 1024), (slot_count - 1) * (SWAP_PAGE_SIZE / 1024));
+    } else {
+        snprintf(buf, sizeof(buf), "Swap device:      none\n");
+    }
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+
+    snprintf(buf, sizeof(buf), "Anonymous memory: %u KB reserved, %u KB resident\n",
+             reserved_pages * (SWAP_PAGE_SIZE / 1024), resident_pages * (SWAP_PAGE_SIZE / 1024));
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "Pages:            %llu out, %llu in, %llu dropped clean, %llu zero filled\n",
+             stats.swap_outs, stats.swap_ins, stats.clean_drops, stats.zero_fills);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+    snprintf(buf, sizeof(buf), "Failed reclaims:  %llu\n", stats.reclaim_failures);
+    for (int i = 0; buf[i]; i++) console_putc((uint32_t)buf[i]);
+}
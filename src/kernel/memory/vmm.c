@@ -301,6 +301,34 @@ void vmm_unmap_pages(page_directory_t* dir, virt_addr_t virtual_start_address, u
     if (reload_dir) reload_page_directory();
 }
 
+/**
+ * @brief Returns the page table entry of a virtual address in the current page directory.
+ *
+ * Unlike vmm_map_page()/vmm_unmap_page() this gives access to entries that are
+ * not present, and never frees a page table.
+ * @param virtual_address The virtual address.
+ * @param create Allocate the page table if there is none.
+ * @return Pointer to the entry, or NULL if there is no page table and it was not (or could not be) created.
+ */
+uint32_t* vmm_get_page_entry(virt_addr_t virtual_address, bool create) {
+    if (current_directory == NULL) {
+        serial_printf("VMM: Error: Page entries can only be accessed with paging set up\n");
+        return NULL;
+    }
+
+    uint32_t dir_index = VMM_GET_DIR_INDEX(virtual_address);
+    if (!(current_directory->entries[dir_index] & VMM_PAGE_PRESENT)) {
+        if (!create) return NULL;
+
+        phys_addr_t pt_phys = pmm_zalloc_page();
+        if (!pt_phys) return NULL;
+        current_directory->entries[dir_index] = pt_phys | VMM_PAGE_PRESENT | VMM_PAGE_READ_WRITE;
+        flush_tlb((virt_addr_t)VMM_GET_TABLE_ADDR(virtual_address));
+    }
+
+    return &VMM_GET_TABLE_ADDR(virtual_address)->entries[VMM_GET_TABLE_INDEX(virtual_address)];
+}
+
 /**
  * @brief Checks if a virtual memory region is currently unmapped.
  * @param dir The page directory to check.